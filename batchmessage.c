@@ -0,0 +1,493 @@
+// ---------------------------------------------------------------------------------------------
+// this program runs a whole list of writemessage and readmessage jobs in one process, on a
+// pool of threads, instead of starting one process per image.
+//
+// the jobs are read from a manifest file, one job per line, with the fields separated by tabs:
+//
+//     write    <inputimagepath>    <outputimagepath>    <payloadfile>    (optional)<passkey>
+//     read     <steganographyimage>    <outputfile>    (optional)<passkey>
+//
+// a write job stores the contents of the payload file in the output image (like writemessage
+// does with the typed in text) and a read job writes the message stored in the image to the
+// output file (like readmessage prints it). empty lines and lines starting with # are skipped.
+//
+// for every job one line of JSON is printed when the job finishes, for example:
+// {"line":3,"job":"write","input":"a.bmp","output":"b.bmp","code":0,"result":"Message successfully stored.","bytes":12,"seconds":0.000412}
+// code is the exit code writemessage or readmessage would have given for the same job.
+// ---------------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "helpers.h"
+#include "mappedio.h"
+#include "stego.h"
+#include "threadpool.h"
+
+// the fields a manifest line can have.
+#define MAXFIELDS 5
+
+// the two kinds of jobs.
+#define WRITEJOB 1
+#define READJOB 2
+
+// the biggest buffer a thread keeps between its jobs.
+#define MAXKEPTBUFFER (64 << 20)
+
+
+// a single line of the manifest.
+typedef struct
+{
+    int line;
+    int kind;
+    char* input;
+    char* output;
+    char* payload;
+    char* passkey;
+} Job;
+
+// a buffer that every thread keeps for the payloads it reads, so that
+// it is allocated once per thread and not once per job. one that grew
+// past MAXKEPTBUFFER for a big payload is freed after its job.
+typedef struct
+{
+    char* data;
+    size_t capacity;
+} PayloadBuffer;
+
+// everything the jobs share.
+typedef struct
+{
+    Job* jobs;
+    PayloadBuffer* buffers;
+    int failed;
+} Batch;
+
+
+// this function reads the whole file into the buffer (growing it if
+// needed) and puts a NUL character after it.
+// returns the number of bytes read or -1 if the file can't be read.
+static long readPayload(char* path, PayloadBuffer* buffer)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return -1;
+
+    size_t length = 0;
+    while (1)
+    {
+        // always keep space for the NUL character.
+        if (buffer->capacity - length < 2)
+        {
+            size_t capacity = buffer->capacity < 4096 ? 4096 : buffer->capacity * 2;
+            char* data = realloc(buffer->data, capacity);
+            if (data == NULL)
+            {
+                fclose(file);
+                return -1;
+            }
+            buffer->data = data;
+            buffer->capacity = capacity;
+        }
+
+        size_t bytesRead = fread(buffer->data + length, 1, buffer->capacity - length - 1, file);
+        if (bytesRead == 0)
+            break;
+        length += bytesRead;
+    }
+
+    fclose(file);
+    buffer->data[length] = '\0';
+    return length;
+}
+
+
+// this function makes sure the buffer has space for at least size
+// bytes. returns 1 on success and 0 if there is not enough memory.
+static int reserveBuffer(PayloadBuffer* buffer, size_t size)
+{
+    if (buffer->capacity >= size)
+        return 1;
+
+    char* data = realloc(buffer->data, size);
+    if (data == NULL)
+        return 0;
+
+    buffer->data = data;
+    buffer->capacity = size;
+    return 1;
+}
+
+
+// this function does what writemessage does, with the text read from
+// the payload file. returns the exit code of writemessage.
+static int runWriteJob(Job* job, PayloadBuffer* buffer, long* bytes, const char** result)
+{
+    FILE* inimage = fopen(job->input, "rb");
+    MappedFile image;
+    if (inimage == NULL || loadFile(inimage, &image) == 0)
+    {
+        if (inimage != NULL)
+            fclose(inimage);
+        *result = "Invalid input image path.";
+        return 1;
+    }
+
+    int code = 0;
+    long textlen = readPayload(job->payload, buffer);
+    stego_crypto crypto;
+    stego_options options = {1, STEGO_COLORCHANNELS, job->passkey != NULL ? &crypto : NULL, 0, NULL, 0, 0};
+    stego_layout layout;
+    FILE* outimage = NULL;
+
+    // the output image is only created once it is known that the
+    // message fits.
+    if (stego_type(image.data, image.size) == STEGO_UNSUPPORTED)
+    {
+        *result = "Unsupported file type.";
+        code = 3;
+    }
+    else if (textlen < 0)
+    {
+        *result = "Could not read payload file.";
+        code = 4;
+    }
+    else if (job->passkey != NULL && stego_encrypt((BYTE*) buffer->data, textlen, job->passkey, &crypto) != STEGO_OK)
+    {
+        *result = "Could not encrypt message.";
+        code = 5;
+    }
+    else if (stego_plan(image.data, image.size, textlen, &options, &layout) != STEGO_OK)
+    {
+        *result = "Could not store message.";
+        code = 5;
+    }
+    else if ((outimage = fopen(job->output, "w+")) == NULL)
+    {
+        *result = "Could not create output image.";
+        code = 2;
+    }
+    else
+    {
+        *bytes = textlen;
+        if (writeEmbeddedImage(&image, &layout, (BYTE*) buffer->data, textlen, outimage, 1) == 1)
+            *result = "Message successfully stored.";
+        else
+        {
+            *result = "Could not store message.";
+            code = 5;
+        }
+        fclose(outimage);
+    }
+
+    unmapFile(&image);
+    fclose(inimage);
+    return code;
+}
+
+
+// this function does what readmessage does, but writes the message to
+// the output file. the message is read into the buffer of the thread.
+// returns the exit code of readmessage.
+static int runReadJob(Job* job, PayloadBuffer* buffer, long* bytes, const char** result)
+{
+    FILE* image = fopen(job->input, "rb");
+    MappedFile map;
+    if (image == NULL || loadFile(image, &map) == 0)
+    {
+        if (image != NULL)
+            fclose(image);
+        *result = "Could not open image.";
+        return 1;
+    }
+
+    if (stego_type(map.data, map.size) == STEGO_UNSUPPORTED)
+    {
+        unmapFile(&map);
+        fclose(image);
+        *result = "Unsupported file type.";
+        return 2;
+    }
+
+    FILE* out = fopen(job->output, "wb");
+    if (out == NULL)
+    {
+        unmapFile(&map);
+        fclose(image);
+        *result = "Could not create output file.";
+        return 4;
+    }
+
+    int code = 0;
+    int textPrinted = 0;
+    // the fields of a header that could not be read are not trusted
+    // (its length could be anything).
+    stego_header header = {0};
+    if (stego_read_header(map.data, map.size, &header) != STEGO_OK)
+        header = (stego_header) {0};
+    size_t capacity = header.length;
+    size_t length = 0;
+    int status = STEGO_SMALLBUFFER;
+
+    // a shard is only a piece of a message, it is read with the other
+    // shards by readmessage --shards, and the records of a container
+    // are read one at a time by readmessage --record.
+    if (header.flags & (STEGO_SHARDED | STEGO_CONTAINER))
+        status = STEGO_NOMESSAGE;
+    else if (reserveBuffer(buffer, capacity + 1) == 1)
+        status = stego_extract(map.data, map.size, (BYTE*) buffer->data, capacity, &length);
+
+    // an encrypted message is only written if the passkey is right.
+    if (status == STEGO_OK && (header.flags & STEGO_ENCRYPTED))
+        status = job->passkey == NULL ? STEGO_BADKEY
+                                      : stego_decrypt((BYTE*) buffer->data, length, job->passkey, &header.crypto);
+    else if (status == STEGO_OK && job->passkey != NULL)
+        decryptOldMessage((BYTE*) buffer->data, length, job->passkey, header.version);
+
+    // an image without a header only holds a message of an older
+    // version if it looks like one.
+    if (status == STEGO_OK && header.version == 0
+        && !isOldMessage((BYTE*) buffer->data, length, stego_type(map.data, map.size) == STEGO_BMP))
+        status = STEGO_NOMESSAGE;
+
+    // a compressed message is decompressed into memory of its own (the
+    // buffer still has the compressed one).
+    BYTE* message = (BYTE*) buffer->data;
+    BYTE* decompressed = NULL;
+    if (status == STEGO_OK && (header.flags & STEGO_COMPRESSED))
+    {
+        size_t decompressedLength = 0;
+        status = stego_decompressed_length(message, length, &decompressedLength);
+        if (status == STEGO_OK && (decompressed = malloc(decompressedLength + 1)) == NULL)
+            status = STEGO_NOMEMORY;
+        if (status == STEGO_OK)
+            status = stego_decompress(message, length, decompressed, decompressedLength, &length);
+        message = decompressed;
+    }
+
+    if (status == STEGO_OK)
+    {
+        *bytes = fwrite(message, 1, length, out);
+        textPrinted = *bytes == (long) length && fflush(out) == 0;
+    }
+    free(decompressed);
+
+    if (textPrinted == 1)
+        *result = "Message read successfully.";
+    else
+    {
+        if (header.flags & STEGO_SHARDED)
+            *result = "The image holds a shard of a message, read all of them with readmessage --shards.";
+        else if (header.flags & STEGO_CONTAINER)
+            *result = "The image holds a container of records, read them with readmessage --record.";
+        else
+            *result = status == STEGO_BADKEY || status == STEGO_BADMESSAGE || status == STEGO_NOMESSAGE
+                          ? stego_error(status)
+                          : "Could not read message.";
+        code = 3;
+    }
+
+    unmapFile(&map);
+    fclose(image);
+    fclose(out);
+    return code;
+}
+
+
+// this function prints a string as a JSON string (in quotes, with the
+// special characters escaped) into line.
+static int printJSONString(char* line, size_t size, const char* string)
+{
+    size_t used = 0;
+
+    if (used + 1 < size)
+        line[used++] = '"';
+
+    for (const char* c = string; *c != '\0' && used + 7 < size; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            line[used++] = '\\';
+            line[used++] = *c;
+        }
+        else if ((unsigned char) *c < 0x20)
+            used += snprintf(line + used, size - used, "\\u%04x", *c);
+        else
+            line[used++] = *c;
+    }
+
+    if (used + 1 < size)
+        line[used++] = '"';
+
+    line[used] = '\0';
+    return used;
+}
+
+
+// this function runs one job and prints its result line.
+static void runJob(void* context, long task, int worker)
+{
+    Batch* batch = context;
+    Job* job = &batch->jobs[task];
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    long bytes = 0;
+    const char* result = NULL;
+    int code;
+    PayloadBuffer* buffer = &batch->buffers[worker];
+    if (job->kind == WRITEJOB)
+        code = runWriteJob(job, buffer, &bytes, &result);
+    else
+        code = runReadJob(job, buffer, &bytes, &result);
+
+    if (buffer->capacity > MAXKEPTBUFFER)
+    {
+        free(buffer->data);
+        *buffer = (PayloadBuffer) {NULL, 0};
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (code != 0)
+        __atomic_store_n(&batch->failed, 1, __ATOMIC_RELAXED);
+
+    // the whole line is built first and then printed with a single
+    // fwrite() so that lines from different threads don't mix.
+    char line[3 * FILENAME_MAX];
+    size_t used = snprintf(line, sizeof(line), "{\"line\":%d,\"job\":\"%s\",\"input\":",
+                           job->line, job->kind == WRITEJOB ? "write" : "read");
+    used += printJSONString(line + used, sizeof(line) - used, job->input);
+    used += snprintf(line + used, sizeof(line) - used, ",\"output\":");
+    used += printJSONString(line + used, sizeof(line) - used, job->output);
+    used += snprintf(line + used, sizeof(line) - used,
+                     ",\"code\":%d,\"result\":\"%s\",\"bytes\":%ld,\"seconds\":%.6f}\n",
+                     code, result, bytes, seconds);
+
+    fwrite(line, 1, used < sizeof(line) ? used : sizeof(line) - 1, stdout);
+}
+
+
+// this function splits the manifest into jobs. the fields point into
+// the manifest text (the tabs and new lines are replaced with NUL).
+// returns the number of jobs or -1 if a line is not a valid job.
+static long parseManifest(char* text, Job* jobs)
+{
+    long count = 0;
+    int lineNumber = 0;
+    char* line = text;
+
+    while (line != NULL && *line != '\0')
+    {
+        lineNumber++;
+        char* next = strchr(line, '\n');
+        if (next != NULL)
+            *next++ = '\0';
+
+        // remove the carriage return of windows line endings.
+        size_t length = strlen(line);
+        if (length > 0 && line[length - 1] == '\r')
+            line[length - 1] = '\0';
+
+        if (line[0] != '\0' && line[0] != '#')
+        {
+            char* fields[MAXFIELDS] = {NULL};
+            int fieldCount = 0;
+            for (char* field = line; field != NULL && fieldCount < MAXFIELDS; fieldCount++)
+            {
+                fields[fieldCount] = field;
+                field = strchr(field, '\t');
+                if (field != NULL)
+                    *field++ = '\0';
+            }
+
+            Job* job = &jobs[count++];
+            job->line = lineNumber;
+            job->input = fields[1];
+            job->output = fields[2];
+
+            if (strcmp(fields[0], "write") == 0 && (fieldCount == 4 || fieldCount == 5))
+            {
+                job->kind = WRITEJOB;
+                job->payload = fields[3];
+                job->passkey = fields[4];
+            }
+            else if (strcmp(fields[0], "read") == 0 && (fieldCount == 3 || fieldCount == 4))
+            {
+                job->kind = READJOB;
+                job->payload = NULL;
+                job->passkey = fields[3];
+            }
+            else
+            {
+                fprintf(stderr, "Invalid job on line %d of the manifest.\n", lineNumber);
+                return -1;
+            }
+        }
+
+        line = next;
+    }
+
+    return count;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2 && argc != 3)
+    {
+        printf("Incorrect usage.\nCorrect usage: ./batchmessage <manifest> (optional)<threads>\n");
+        return -1;
+    }
+
+    int threadCount = numberOfCores();
+    if (argc == 3)
+        threadCount = atoi(argv[2]);
+    if (threadCount < 1)
+    {
+        printf("The number of threads must be at least 1.\n");
+        return -1;
+    }
+
+    // read the whole manifest into memory.
+    PayloadBuffer text = {NULL, 0};
+    long textlen = readPayload(argv[1], &text);
+    if (textlen < 0)
+    {
+        printf("Could not read manifest: %s\n", argv[1]);
+        return 1;
+    }
+
+    // there are at most as many jobs as there are lines.
+    long maxJobs = 1;
+    for (long i = 0; i < textlen; i++)
+        maxJobs += text.data[i] == '\n';
+
+    Batch batch = {NULL, NULL, 0};
+    batch.jobs = malloc(sizeof(Job) * maxJobs);
+    batch.buffers = calloc(threadCount, sizeof(PayloadBuffer));
+    if (batch.jobs == NULL || batch.buffers == NULL)
+    {
+        printf("Something went wrong...\n");
+        return 4;
+    }
+
+    long jobCount = parseManifest(text.data, batch.jobs);
+    if (jobCount < 0)
+        return 2;
+
+    runTasks(jobCount, threadCount, runJob, &batch);
+
+    for (int i = 0; i < threadCount; i++)
+        free(batch.buffers[i].data);
+    free(batch.buffers);
+    free(batch.jobs);
+    free(text.data);
+
+    // exit with code 3 if any of the jobs failed.
+    return batch.failed == 0 ? 0 : 3;
+}
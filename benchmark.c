@@ -0,0 +1,275 @@
+// ---------------------------------------------------------------------------------------------
+// this program measures how fast libstego stores and reads messages, so that it can be seen
+// whether a change (a new kernel, a different way of copying the image) makes things faster
+// on a given machine. run it with "make bench".
+//
+// the covers are made up in memory with a fixed seed, so every run uses exactly the same
+// bytes: bmps of a few sizes, bit depths and row paddings, a png and a jpg (the png is a real
+// image with stored deflate blocks, the jpg only has the segments libstego looks at). for
+// every cover, bit depth and payload size that fits, the message is stored with stego_embed()
+// and read back with stego_extract(), in memory (no files are written), and stego_encrypt()
+// is timed on its own. the png is measured a second time (as "pngpixels") with the message
+// in its pixels, which has to uncompress and compress the whole image, and a real baseline
+// jpg (as "jpgcoefficients", with random blocks) with the message in its DCT coefficients,
+// which has to huffman decode and code again the whole scan.
+// the covers are made by covers.c.
+//
+// every measurement is printed as one line of JSON, for example:
+// {"cover":"bmp-1920x1080x24","type":"bmp","coverBytes":6220854,"op":"embed","depth":1,"payloadBytes":65536,"iterations":1321,"seconds":0.000151312,"MBps":433.1,"nsPerByte":2.31,"peakRSSKB":31524,"kernel":"avx2"}
+// seconds is the fastest of the iterations, and MBps and nsPerByte are worked out from it and
+// the number of payload bytes. peakRSSKB is the most memory the process has used so far.
+// ---------------------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chacha20.h"
+#include "covers.h"
+#include "helpers.h"
+#include "lsbkernels.h"
+#include "stego.h"
+
+// every measurement runs for at least this many seconds (unless -t
+// is given) and at least MINITERATIONS times.
+#define DEFAULTSECONDS 0.2
+#define MINITERATIONS 3
+
+// the seed all the covers and payloads are made from.
+#define SEED 0x5eed5eedULL
+
+
+// returns the current time in seconds.
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+
+// returns the most memory (in KB) the process has used so far.
+static long peakRSS(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+
+// the things that can be measured.
+#define EMBED 0
+#define EXTRACT 1
+#define ENCRYPT 2
+
+static const char* operationNames[] = {"embed", "extract", "encrypt"};
+
+
+// everything a single measurement needs.
+typedef struct
+{
+    const Cover* cover;
+    int operation;
+    int depth;
+    BYTE* payload;
+    size_t payloadBytes;
+    BYTE* image;
+    size_t imageSize;
+    BYTE* output;
+    int pixels;
+} Measurement;
+
+
+// this function does the operation once. returns 1 if it worked.
+static int runOnce(Measurement* m)
+{
+    stego_options options = {m->depth, STEGO_COLORCHANNELS, NULL, m->pixels, NULL, 0, 0};
+    size_t length;
+
+    if (m->operation == EMBED)
+        return stego_embed(m->cover->data, m->cover->size, m->payload, m->payloadBytes, &options, m->output,
+                           m->imageSize, &length) == STEGO_OK;
+    else if (m->operation == EXTRACT)
+        return stego_extract(m->image, m->imageSize, m->output, m->payloadBytes, &length) == STEGO_OK
+               && length == m->payloadBytes;
+    else
+    {
+        stego_crypto crypto;
+        return stego_encrypt(m->payload, m->payloadBytes, "benchmark", &crypto) == STEGO_OK;
+    }
+}
+
+
+// this function runs the operation until minSeconds have passed and
+// prints the JSON line for it. returns 1 if it worked.
+static int measure(Measurement* m, double minSeconds)
+{
+    if (runOnce(m) == 0)
+    {
+        fprintf(stderr, "%s of %zu bytes in %s failed.\n", operationNames[m->operation], m->payloadBytes,
+                m->cover != NULL ? m->cover->name : "memory");
+        return 0;
+    }
+
+    double best = 0, total = 0;
+    long iterations = 0;
+    while (total < minSeconds || iterations < MINITERATIONS)
+    {
+        double start = now();
+        runOnce(m);
+        double seconds = now() - start;
+
+        if (iterations == 0 || seconds < best)
+            best = seconds;
+        total += seconds;
+        iterations++;
+    }
+
+    if (m->cover != NULL)
+        printf("{\"cover\":\"%s\",\"type\":\"%.3s\",\"coverBytes\":%zu,", m->cover->name, m->cover->name,
+               m->cover->size);
+    else
+        printf("{\"cover\":null,\"type\":null,\"coverBytes\":0,");
+
+    printf("\"op\":\"%s\",\"depth\":%d,\"payloadBytes\":%zu,\"iterations\":%ld,\"seconds\":%.9f,"
+           "\"MBps\":%.1f,\"nsPerByte\":%.3f,\"peakRSSKB\":%ld,\"kernel\":\"%s\"}\n",
+           operationNames[m->operation], m->depth, m->payloadBytes, iterations, best,
+           m->payloadBytes / best / 1e6, best * 1e9 / m->payloadBytes, peakRSS(),
+           m->operation == ENCRYPT ? chachaKernelName() : lsbKernelName());
+    fflush(stdout);
+    return 1;
+}
+
+
+// this function measures storing and reading every payload size that
+// fits in the cover with the given bit depth (in the pixels of a png
+// or the coefficients of a jpg when pixels is 1).
+static int benchmarkCover(const Cover* cover, int depth, int pixels, BYTE* payload, const size_t* payloadSizes,
+                          int payloadCount, double minSeconds)
+{
+    int ok = 1;
+    stego_options options = {depth, STEGO_COLORCHANNELS, NULL, pixels, NULL, 0, 0};
+
+    for (int i = 0; i < payloadCount; i++)
+    {
+        size_t payloadBytes = payloadSizes[i];
+        if (payloadBytes > stego_capacity(cover->data, cover->size, cover->size, &options))
+            continue;
+
+        // an image with the message in it, to read it back from.
+        stego_layout layout;
+        if (stego_plan(cover->data, cover->size, payloadBytes, &options, &layout) != STEGO_OK)
+            continue;
+
+        // the size of a png or jpg with the message in its pixels is only
+        // known once it is made.
+        size_t imageSize = layout.outputSize;
+        if (layout.flags & STEGO_PIXELS)
+            stego_embed(cover->data, cover->size, payload, payloadBytes, &options, NULL, 0, &imageSize);
+
+        BYTE* image = malloc(imageSize);
+        BYTE* output = malloc(imageSize > payloadBytes ? imageSize : payloadBytes);
+        if (image == NULL || output == NULL
+            || stego_embed(cover->data, cover->size, payload, payloadBytes, &options, image, imageSize,
+                           &imageSize) != STEGO_OK)
+        {
+            free(image);
+            free(output);
+            return 0;
+        }
+
+        Measurement m = {cover, EMBED, depth, payload, payloadBytes, image, imageSize, output, pixels};
+        ok &= measure(&m, minSeconds);
+        m.operation = EXTRACT;
+        ok &= measure(&m, minSeconds);
+
+        free(image);
+        free(output);
+    }
+
+    return ok;
+}
+
+
+int main(int argc, char* argv[])
+{
+    // -t changes the least time every measurement runs for.
+    double minSeconds = DEFAULTSECONDS;
+    int option;
+    while ((option = getopt(argc, argv, "t:")) != -1)
+    {
+        if (option == 't' && atof(optarg) > 0)
+            minSeconds = atof(optarg);
+        else
+        {
+            fprintf(stderr, "Incorrect usage.\nCorrect usage: ./benchmark (optional)-t <seconds>\n");
+            return -1;
+        }
+    }
+
+    static const size_t payloadSizes[] = {1 << 10, 1 << 16, 1 << 20, 1 << 24};
+    static const int depths[] = {1, 2, 4};
+    int payloadCount = sizeof(payloadSizes) / sizeof(payloadSizes[0]);
+
+    size_t largestPayload = payloadSizes[payloadCount - 1];
+    BYTE* payload = malloc(largestPayload);
+    if (payload == NULL)
+    {
+        fprintf(stderr, "Not enough memory.\n");
+        return 1;
+    }
+    fillRandom(payload, largestPayload, SEED);
+
+    // the bmps: a small one with and without row padding, full hd with
+    // 8, 24 and 32 bits per pixel and a large one.
+    static const long bmps[][3] = {{640, 480, 24}, {641, 480, 24}, {1920, 1080, 8},
+                                   {1920, 1080, 24}, {1920, 1080, 32}, {4000, 3000, 24}};
+    int ok = 1;
+
+    for (size_t i = 0; i < sizeof(bmps) / sizeof(bmps[0]); i++)
+    {
+        Cover cover;
+        if (makeBMP(&cover, bmps[i][0], bmps[i][1], bmps[i][2], SEED + i) == 0)
+            return 1;
+
+        for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++)
+            ok &= benchmarkCover(&cover, depths[d], 0, payload, payloadSizes, payloadCount, minSeconds);
+        free(cover.data);
+    }
+
+    // a png and a jpg, where the message is appended.
+    Cover png, jpg, coefficientJPG;
+    if (makePNG(&png, 1920, 1080, SEED) == 0 || makeJPG(&jpg, 4 << 20, SEED) == 0
+        || makeBaselineJPG(&coefficientJPG, 1920, 1080, SEED) == 0)
+        return 1;
+
+    ok &= benchmarkCover(&png, 1, 0, payload, payloadSizes, payloadCount, minSeconds);
+    ok &= benchmarkCover(&jpg, 1, 0, payload, payloadSizes, payloadCount, minSeconds);
+
+    // the same png with the message in its pixels.
+    Cover pixelPNG = png;
+    snprintf(pixelPNG.name, sizeof(pixelPNG.name), "pngpixels-1920x1080");
+    for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++)
+        ok &= benchmarkCover(&pixelPNG, depths[d], 1, payload, payloadSizes, payloadCount, minSeconds);
+
+    // a baseline jpg with the message in its coefficients.
+    ok &= benchmarkCover(&coefficientJPG, 1, 1, payload, payloadSizes, payloadCount, minSeconds);
+    free(png.data);
+    free(jpg.data);
+    free(coefficientJPG.data);
+
+    // the encryption on its own (the key derivation is the same for
+    // every size, so small payloads show its cost).
+    for (int i = 0; i < payloadCount; i++)
+    {
+        Measurement m = {NULL, ENCRYPT, 0, payload, payloadSizes[i], NULL, 0, NULL, 0};
+        ok &= measure(&m, minSeconds);
+    }
+
+    free(payload);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,70 @@
+// this file has the function that reads the headers of a bmp image
+// (the 14 byte file header and the info header after it) to find out
+// where the pixel array is and how its rows are laid out.
+//
+// only the first few dozen bytes of the image are looked at.
+
+#include <stddef.h>
+
+#include "bmpinfo.h"
+#include "helpers.h"
+
+
+// reads a little endian number of the given number of bytes.
+static unsigned long readLittleEndian(const BYTE* bytes, int count)
+{
+    unsigned long number = 0;
+    for (int i = count - 1; i >= 0; i--)
+        number = number << 8 | bytes[i];
+
+    return number;
+}
+
+
+// this function reads the headers of the bmp image of the given size
+// (only the first size bytes of the image need to be there) into info.
+// returns 1 if the headers make sense and 0 if they don't (also for a
+// compressed pixel array, the compression is still filled in then).
+int readBMPInfo(const BYTE* image, size_t size, BMPInfo* info)
+{
+    info->compression = BMPRGB;
+    if (size < BITMAPHEADERSIZE + BMPCOREHEADERSIZE)
+        return 0;
+
+    info->pixelArrayOffset = readLittleEndian(&image[10], 4);
+    unsigned long infoHeaderSize = readLittleEndian(&image[14], 4);
+
+    // the old core header stores the sizes as 16-bit numbers.
+    if (infoHeaderSize == BMPCOREHEADERSIZE)
+    {
+        info->width = readLittleEndian(&image[18], 2);
+        info->height = readLittleEndian(&image[20], 2);
+        info->bitsPerPixel = readLittleEndian(&image[24], 2);
+    }
+    else if (infoHeaderSize >= BMPINFOHEADERSIZE && size >= BITMAPHEADERSIZE + BMPINFOHEADERSIZE)
+    {
+        info->width = (int) readLittleEndian(&image[18], 4);
+        info->height = (int) readLittleEndian(&image[22], 4);
+        info->bitsPerPixel = readLittleEndian(&image[28], 2);
+        info->compression = readLittleEndian(&image[30], 4);
+    }
+    else
+        return 0;
+
+    if (info->compression != BMPRGB && info->compression != BMPBITFIELDS)
+        return 0;
+
+    // a negative height means the rows are stored top to bottom.
+    info->topDown = info->height < 0;
+    if (info->topDown)
+        info->height = -info->height;
+
+    if (info->width <= 0 || info->height == 0 || info->bitsPerPixel == 0 || info->bitsPerPixel > 64)
+        return 0;
+
+    // pixels of less than 8 bits share bytes, count them as 1 byte.
+    info->bytesPerPixel = info->bitsPerPixel < BYTESIZE ? 1 : info->bitsPerPixel / BYTESIZE;
+    info->rowBytes = ((size_t) info->width * info->bitsPerPixel + BYTESIZE - 1) / BYTESIZE;
+    info->stride = ((size_t) info->width * info->bitsPerPixel + 31) / 32 * 4;
+    return 1;
+}
@@ -0,0 +1,47 @@
+// header file for the bmp header reader
+
+#ifndef BMPINFO_H_
+#define BMPINFO_H_
+
+#include <stddef.h>
+
+#include "helpers.h"
+
+// the info header comes right after the 14 byte file header. the
+// oldest one (BITMAPCOREHEADER) is 12 bytes, the one almost every
+// bmp has (BITMAPINFOHEADER) is 40 bytes and the newer ones are
+// longer but start with the same fields.
+#define BMPCOREHEADERSIZE 12
+#define BMPINFOHEADERSIZE 40
+
+// the compressions an info header can say its pixel array has. only
+// uncompressed pixels (BI_RGB, or BI_BITFIELDS which just says which
+// bits of a pixel are which color) are rows a message can be stored
+// in, the bytes of RLE8, RLE4, BI_JPEG and BI_PNG are not pixels.
+#define BMPRGB 0
+#define BMPBITFIELDS 3
+
+// what the headers of a bmp image say about its pixel array.
+//
+// the pixel array is a list of rows, every row is rowBytes bytes of
+// pixels followed by padding that makes it stride bytes long (a
+// multiple of 4). the rows are stored bottom to top unless topDown
+// is 1.
+typedef struct
+{
+    size_t pixelArrayOffset;
+    long width;
+    long height;
+    int topDown;
+    int compression;
+    int bitsPerPixel;
+    int bytesPerPixel;
+    size_t rowBytes;
+    size_t stride;
+} BMPInfo;
+
+
+// function declarations
+int readBMPInfo(const BYTE* image, size_t size, BMPInfo* info);
+
+#endif
@@ -0,0 +1,483 @@
+// this file has the ChaCha20 stream cipher and the Poly1305
+// authenticator (RFC 8439), which libstego uses to encrypt messages.
+//
+// ChaCha20 turns a key, a nonce and a block counter into 64 bytes of
+// keystream, which is xored with the data. the blocks don't depend on
+// each other, so like the LSB kernels there are three versions:
+//  - a portable scalar one that makes 1 block at a time.
+//  - an SSE2 one that makes 4 blocks at a time, one in each 32-bit
+//    lane of 16 registers.
+//  - an AVX2 one that makes 8 blocks at a time the same way.
+// the best version the cpu supports is picked once when the program
+// starts.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chacha20.h"
+#include "helpers.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVEX86KERNELS 1
+#include <immintrin.h>
+#endif
+
+
+static uint32_t load32(const BYTE* bytes)
+{
+    return (uint32_t) bytes[0] | (uint32_t) bytes[1] << 8 | (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+}
+
+
+static uint64_t load64(const BYTE* bytes)
+{
+    return (uint64_t) load32(bytes) | (uint64_t) load32(bytes + 4) << 32;
+}
+
+
+static void store64(BYTE* bytes, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+        bytes[i] = value >> (8 * i);
+}
+
+
+// scalar kernel, this works on any cpu.
+
+#define ROTATE(v, n) ((v) << (n) | (v) >> (32 - (n)))
+
+#define QUARTERROUND(x, a, b, c, d) \
+    x[a] += x[b]; x[d] = ROTATE(x[d] ^ x[a], 16); \
+    x[c] += x[d]; x[b] = ROTATE(x[b] ^ x[c], 12); \
+    x[a] += x[b]; x[d] = ROTATE(x[d] ^ x[a], 8); \
+    x[c] += x[d]; x[b] = ROTATE(x[b] ^ x[c], 7);
+
+// this function makes the 64 byte block of keystream for the state.
+static void makeBlock(const uint32_t* state, BYTE* block)
+{
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+
+    // 20 rounds: a column round and a diagonal round 10 times.
+    for (int i = 0; i < 10; i++)
+    {
+        QUARTERROUND(x, 0, 4, 8, 12)
+        QUARTERROUND(x, 1, 5, 9, 13)
+        QUARTERROUND(x, 2, 6, 10, 14)
+        QUARTERROUND(x, 3, 7, 11, 15)
+        QUARTERROUND(x, 0, 5, 10, 15)
+        QUARTERROUND(x, 1, 6, 11, 12)
+        QUARTERROUND(x, 2, 7, 8, 13)
+        QUARTERROUND(x, 3, 4, 9, 14)
+    }
+
+    for (int i = 0; i < 16; i++)
+    {
+        uint32_t word = x[i] + state[i];
+        block[4 * i] = word;
+        block[4 * i + 1] = word >> 8;
+        block[4 * i + 2] = word >> 16;
+        block[4 * i + 3] = word >> 24;
+    }
+}
+
+// the scalar kernel xors count whole blocks of data with the keystream
+// and moves the block counter (state[12]) past them.
+static void xorScalar(uint32_t* state, BYTE* data, size_t count)
+{
+    BYTE block[CHACHABLOCKSIZE];
+    for (size_t i = 0; i < count; i++)
+    {
+        makeBlock(state, block);
+        state[12]++;
+
+        for (int j = 0; j < CHACHABLOCKSIZE; j++)
+            data[j] ^= block[j];
+        data += CHACHABLOCKSIZE;
+    }
+}
+
+
+#ifdef HAVEX86KERNELS
+
+// SSE2 and AVX2 kernels.
+//
+// register x[i] has word i of the state of every block (the blocks
+// only differ in their counter, word 12), so every step of a round is
+// done for all the blocks at once. at the end the registers are
+// transposed, so that each one has 4 words of a single block, and
+// xored with the data.
+
+#define ROTATESSE2(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+
+#define QUARTERROUNDSSE2(x, a, b, c, d) \
+    x[a] = _mm_add_epi32(x[a], x[b]); x[d] = ROTATESSE2(_mm_xor_si128(x[d], x[a]), 16); \
+    x[c] = _mm_add_epi32(x[c], x[d]); x[b] = ROTATESSE2(_mm_xor_si128(x[b], x[c]), 12); \
+    x[a] = _mm_add_epi32(x[a], x[b]); x[d] = ROTATESSE2(_mm_xor_si128(x[d], x[a]), 8); \
+    x[c] = _mm_add_epi32(x[c], x[d]); x[b] = ROTATESSE2(_mm_xor_si128(x[b], x[c]), 7);
+
+__attribute__((target("sse2")))
+static void xorSSE2(uint32_t* state, BYTE* data, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i x[16], start[16];
+        for (int j = 0; j < 16; j++)
+            start[j] = _mm_set1_epi32(state[j]);
+        start[12] = _mm_add_epi32(start[12], _mm_set_epi32(3, 2, 1, 0));
+        memcpy(x, start, sizeof(x));
+
+        for (int round = 0; round < 10; round++)
+        {
+            QUARTERROUNDSSE2(x, 0, 4, 8, 12)
+            QUARTERROUNDSSE2(x, 1, 5, 9, 13)
+            QUARTERROUNDSSE2(x, 2, 6, 10, 14)
+            QUARTERROUNDSSE2(x, 3, 7, 11, 15)
+            QUARTERROUNDSSE2(x, 0, 5, 10, 15)
+            QUARTERROUNDSSE2(x, 1, 6, 11, 12)
+            QUARTERROUNDSSE2(x, 2, 7, 8, 13)
+            QUARTERROUNDSSE2(x, 3, 4, 9, 14)
+        }
+
+        // words 4g to 4g + 3 of block k go to bytes 64k + 16g.
+        for (int g = 0; g < 4; g++)
+        {
+            __m128i a = _mm_add_epi32(x[4 * g], start[4 * g]);
+            __m128i b = _mm_add_epi32(x[4 * g + 1], start[4 * g + 1]);
+            __m128i c = _mm_add_epi32(x[4 * g + 2], start[4 * g + 2]);
+            __m128i d = _mm_add_epi32(x[4 * g + 3], start[4 * g + 3]);
+
+            __m128i ab0 = _mm_unpacklo_epi32(a, b), ab1 = _mm_unpackhi_epi32(a, b);
+            __m128i cd0 = _mm_unpacklo_epi32(c, d), cd1 = _mm_unpackhi_epi32(c, d);
+            __m128i words[4] = {_mm_unpacklo_epi64(ab0, cd0), _mm_unpackhi_epi64(ab0, cd0),
+                                _mm_unpacklo_epi64(ab1, cd1), _mm_unpackhi_epi64(ab1, cd1)};
+
+            for (int k = 0; k < 4; k++)
+            {
+                __m128i* p = (__m128i*) (data + CHACHABLOCKSIZE * k + 16 * g);
+                _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), words[k]));
+            }
+        }
+
+        state[12] += 4;
+        data += 4 * CHACHABLOCKSIZE;
+    }
+
+    xorScalar(state, data, count - i);
+}
+
+
+// AVX2 can rotate by 16 and 8 bits with a byte shuffle, which is
+// faster than two shifts.
+#define ROTATEAVX2(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+#define QUARTERROUNDAVX2(x, a, b, c, d) \
+    x[a] = _mm256_add_epi32(x[a], x[b]); x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rotate16); \
+    x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = ROTATEAVX2(_mm256_xor_si256(x[b], x[c]), 12); \
+    x[a] = _mm256_add_epi32(x[a], x[b]); x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rotate8); \
+    x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = ROTATEAVX2(_mm256_xor_si256(x[b], x[c]), 7);
+
+__attribute__((target("avx2")))
+static void xorAVX2(uint32_t* state, BYTE* data, size_t count)
+{
+    const __m256i rotate16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                              2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rotate8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                             3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i x[16], start[16];
+        for (int j = 0; j < 16; j++)
+            start[j] = _mm256_set1_epi32(state[j]);
+        start[12] = _mm256_add_epi32(start[12], _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        memcpy(x, start, sizeof(x));
+
+        for (int round = 0; round < 10; round++)
+        {
+            QUARTERROUNDAVX2(x, 0, 4, 8, 12)
+            QUARTERROUNDAVX2(x, 1, 5, 9, 13)
+            QUARTERROUNDAVX2(x, 2, 6, 10, 14)
+            QUARTERROUNDAVX2(x, 3, 7, 11, 15)
+            QUARTERROUNDAVX2(x, 0, 5, 10, 15)
+            QUARTERROUNDAVX2(x, 1, 6, 11, 12)
+            QUARTERROUNDAVX2(x, 2, 7, 8, 13)
+            QUARTERROUNDAVX2(x, 3, 4, 9, 14)
+        }
+
+        // the unpacks work inside each 128-bit half, so words[k] of
+        // group g has 4 words of block k in its low half and of block
+        // k + 4 in its high half. the halves of two groups are then
+        // put together into 8 words of a single block.
+        __m256i words[4][4];
+        for (int g = 0; g < 4; g++)
+        {
+            __m256i a = _mm256_add_epi32(x[4 * g], start[4 * g]);
+            __m256i b = _mm256_add_epi32(x[4 * g + 1], start[4 * g + 1]);
+            __m256i c = _mm256_add_epi32(x[4 * g + 2], start[4 * g + 2]);
+            __m256i d = _mm256_add_epi32(x[4 * g + 3], start[4 * g + 3]);
+
+            __m256i ab0 = _mm256_unpacklo_epi32(a, b), ab1 = _mm256_unpackhi_epi32(a, b);
+            __m256i cd0 = _mm256_unpacklo_epi32(c, d), cd1 = _mm256_unpackhi_epi32(c, d);
+            words[g][0] = _mm256_unpacklo_epi64(ab0, cd0);
+            words[g][1] = _mm256_unpackhi_epi64(ab0, cd0);
+            words[g][2] = _mm256_unpacklo_epi64(ab1, cd1);
+            words[g][3] = _mm256_unpackhi_epi64(ab1, cd1);
+        }
+
+        for (int k = 0; k < 4; k++)
+        {
+            __m256i blocks[4] = {_mm256_permute2x128_si256(words[0][k], words[1][k], 0x20),
+                                 _mm256_permute2x128_si256(words[2][k], words[3][k], 0x20),
+                                 _mm256_permute2x128_si256(words[0][k], words[1][k], 0x31),
+                                 _mm256_permute2x128_si256(words[2][k], words[3][k], 0x31)};
+
+            __m256i* low = (__m256i*) (data + CHACHABLOCKSIZE * k);
+            __m256i* high = (__m256i*) (data + CHACHABLOCKSIZE * (k + 4));
+            _mm256_storeu_si256(low, _mm256_xor_si256(_mm256_loadu_si256(low), blocks[0]));
+            _mm256_storeu_si256(low + 1, _mm256_xor_si256(_mm256_loadu_si256(low + 1), blocks[1]));
+            _mm256_storeu_si256(high, _mm256_xor_si256(_mm256_loadu_si256(high), blocks[2]));
+            _mm256_storeu_si256(high + 1, _mm256_xor_si256(_mm256_loadu_si256(high + 1), blocks[3]));
+        }
+
+        state[12] += 8;
+        data += 8 * CHACHABLOCKSIZE;
+    }
+
+    xorScalar(state, data, count - i);
+}
+
+#endif
+
+
+// the kernel that is actually used, picked by selectChaChaKernel().
+static void (*xorKernel)(uint32_t*, BYTE*, size_t) = xorScalar;
+static const char* kernelName = "scalar";
+
+
+// this function runs once before main() and picks the fastest kernel
+// the cpu supports. STEGO_KERNEL forces a slower one, as it does for
+// the LSB kernels.
+__attribute__((constructor))
+static void selectChaChaKernel(void)
+{
+#ifdef HAVEX86KERNELS
+    const char* forced = getenv("STEGO_KERNEL");
+    int allowAVX2 = forced == NULL || strcmp(forced, "avx2") == 0;
+    int allowSSE2 = allowAVX2 || strcmp(forced, "sse2") == 0;
+
+    __builtin_cpu_init();
+    if (allowAVX2 && __builtin_cpu_supports("avx2"))
+    {
+        xorKernel = xorAVX2;
+        kernelName = "avx2";
+    }
+    else if (allowSSE2 && __builtin_cpu_supports("sse2"))
+    {
+        xorKernel = xorSSE2;
+        kernelName = "sse2";
+    }
+#endif
+}
+
+
+// this function encrypts (or decrypts, it is the same) length bytes of
+// data in place, xoring them with the keystream for the 32 byte key
+// and 12 byte nonce starting at block number counter.
+void chacha20Xor(const BYTE* key, const BYTE* nonce, uint32_t counter, BYTE* data, size_t length)
+{
+    // "expand 32-byte k", the key, the counter and the nonce.
+    uint32_t state[16] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+    for (int i = 0; i < 8; i++)
+        state[4 + i] = load32(key + 4 * i);
+    state[12] = counter;
+    for (int i = 0; i < 3; i++)
+        state[13 + i] = load32(nonce + 4 * i);
+
+    size_t blocks = length / CHACHABLOCKSIZE;
+    xorKernel(state, data, blocks);
+    data += blocks * CHACHABLOCKSIZE;
+    length -= blocks * CHACHABLOCKSIZE;
+
+    // the last bytes that don't fill a block.
+    if (length > 0)
+    {
+        BYTE block[CHACHABLOCKSIZE];
+        makeBlock(state, block);
+        for (size_t i = 0; i < length; i++)
+            data[i] ^= block[i];
+    }
+}
+
+
+// returns the name of the kernel that is used ("scalar", "sse2" or
+// "avx2").
+const char* chachaKernelName(void)
+{
+    return kernelName;
+}
+
+
+// Poly1305 works out a 16 byte tag of the data with a 32 byte one-time
+// key, by evaluating a polynomial modulo 2^130 - 5. the numbers are
+// kept in 3 limbs of 44, 44 and 42 bits so that their products fit in
+// 128 bits.
+
+#define MASK44 0xfffffffffffULL
+#define MASK42 0x3ffffffffffULL
+
+typedef unsigned __int128 uint128;
+
+
+// this function adds count 16 byte blocks to the polynomial. hibit is
+// the 2^128 bit that is added to every full block (the last, partial
+// block is padded with a 1 byte instead).
+static void polyBlocks(Poly1305* poly, const BYTE* data, size_t count, uint64_t hibit)
+{
+    uint64_t r0 = poly->r[0], r1 = poly->r[1], r2 = poly->r[2];
+    uint64_t h0 = poly->h[0], h1 = poly->h[1], h2 = poly->h[2];
+    uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+
+    for (size_t i = 0; i < count; i++, data += 16)
+    {
+        uint64_t t0 = load64(data), t1 = load64(data + 8);
+        h0 += t0 & MASK44;
+        h1 += (t0 >> 44 | t1 << 20) & MASK44;
+        h2 += (t1 >> 24 & MASK42) | hibit;
+
+        // h = h * r modulo 2^130 - 5.
+        uint128 d0 = (uint128) h0 * r0 + (uint128) h1 * s2 + (uint128) h2 * s1;
+        uint128 d1 = (uint128) h0 * r1 + (uint128) h1 * r0 + (uint128) h2 * s2;
+        uint128 d2 = (uint128) h0 * r2 + (uint128) h1 * r1 + (uint128) h2 * r0;
+
+        uint64_t carry = (uint64_t) (d0 >> 44);
+        h0 = (uint64_t) d0 & MASK44;
+        d1 += carry;
+        carry = (uint64_t) (d1 >> 44);
+        h1 = (uint64_t) d1 & MASK44;
+        d2 += carry;
+        carry = (uint64_t) (d2 >> 42);
+        h2 = (uint64_t) d2 & MASK42;
+        h0 += carry * 5;
+        carry = h0 >> 44;
+        h0 &= MASK44;
+        h1 += carry;
+    }
+
+    poly->h[0] = h0;
+    poly->h[1] = h1;
+    poly->h[2] = h2;
+}
+
+
+// this function starts a new tag with the 32 byte key.
+void poly1305Start(Poly1305* poly, const BYTE* key)
+{
+    uint64_t t0 = load64(key), t1 = load64(key + 8);
+
+    // some bits of r are always cleared ("clamped").
+    poly->r[0] = t0 & 0xffc0fffffffULL;
+    poly->r[1] = (t0 >> 44 | t1 << 20) & 0xfffffc0ffffULL;
+    poly->r[2] = t1 >> 24 & 0x00ffffffc0fULL;
+
+    poly->h[0] = poly->h[1] = poly->h[2] = 0;
+    poly->pad[0] = load64(key + 16);
+    poly->pad[1] = load64(key + 24);
+    poly->blockLength = 0;
+}
+
+
+// this function adds length bytes of data to the tag.
+void poly1305Add(Poly1305* poly, const BYTE* data, size_t length)
+{
+    if (poly->blockLength > 0)
+    {
+        size_t count = 16 - poly->blockLength;
+        if (count > length)
+            count = length;
+
+        memcpy(poly->block + poly->blockLength, data, count);
+        poly->blockLength += count;
+        data += count;
+        length -= count;
+
+        if (poly->blockLength < 16)
+            return;
+
+        polyBlocks(poly, poly->block, 1, 1ULL << 40);
+        poly->blockLength = 0;
+    }
+
+    size_t blocks = length / 16;
+    polyBlocks(poly, data, blocks, 1ULL << 40);
+    data += blocks * 16;
+    length -= blocks * 16;
+
+    memcpy(poly->block, data, length);
+    poly->blockLength = length;
+}
+
+
+// this function finishes the tag and stores its 16 bytes in tag.
+void poly1305Finish(Poly1305* poly, BYTE* tag)
+{
+    if (poly->blockLength > 0)
+    {
+        poly->block[poly->blockLength] = 1;
+        memset(poly->block + poly->blockLength + 1, 0, 15 - poly->blockLength);
+        polyBlocks(poly, poly->block, 1, 0);
+    }
+
+    // carry h all the way through.
+    uint64_t h0 = poly->h[0], h1 = poly->h[1], h2 = poly->h[2];
+    uint64_t carry = h1 >> 44;
+    h1 &= MASK44;
+    h2 += carry;
+    carry = h2 >> 42;
+    h2 &= MASK42;
+    h0 += carry * 5;
+    carry = h0 >> 44;
+    h0 &= MASK44;
+    h1 += carry;
+    carry = h1 >> 44;
+    h1 &= MASK44;
+    h2 += carry;
+    carry = h2 >> 42;
+    h2 &= MASK42;
+    h0 += carry * 5;
+    carry = h0 >> 44;
+    h0 &= MASK44;
+    h1 += carry;
+
+    // g = h - (2^130 - 5), which is used instead of h if it is not
+    // negative. picked with a mask so that it takes the same time.
+    uint64_t g0 = h0 + 5;
+    carry = g0 >> 44;
+    g0 &= MASK44;
+    uint64_t g1 = h1 + carry;
+    carry = g1 >> 44;
+    g1 &= MASK44;
+    uint64_t g2 = h2 + carry - (1ULL << 42);
+
+    uint64_t useG = (g2 >> 63) - 1;
+    h0 = (h0 & ~useG) | (g0 & useG);
+    h1 = (h1 & ~useG) | (g1 & useG);
+    h2 = (h2 & ~useG) | (g2 & useG);
+
+    // tag = (h + pad) modulo 2^128.
+    uint64_t t0 = poly->pad[0], t1 = poly->pad[1];
+    h0 += t0 & MASK44;
+    carry = h0 >> 44;
+    h0 &= MASK44;
+    h1 += ((t0 >> 44 | t1 << 20) & MASK44) + carry;
+    carry = h1 >> 44;
+    h1 &= MASK44;
+    h2 += (t1 >> 24 & MASK42) + carry;
+    h2 &= MASK42;
+
+    store64(tag, h0 | h1 << 44);
+    store64(tag + 8, h1 >> 20 | h2 << 24);
+}
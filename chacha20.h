@@ -0,0 +1,38 @@
+// header file for the ChaCha20 stream cipher and the Poly1305
+// authenticator
+
+#ifndef CHACHA20_H_
+#define CHACHA20_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "helpers.h"
+
+// sizes of a key, a nonce, a block of keystream and a tag.
+#define CHACHAKEYSIZE 32
+#define CHACHANONCESIZE 12
+#define CHACHABLOCKSIZE 64
+#define POLY1305TAGSIZE 16
+
+// the state of a Poly1305 tag that is being worked out, so that the
+// data can be given in pieces.
+typedef struct
+{
+    uint64_t r[3];
+    uint64_t h[3];
+    uint64_t pad[2];
+    BYTE block[16];
+    size_t blockLength;
+} Poly1305;
+
+
+// function declarations
+void chacha20Xor(const BYTE* key, const BYTE* nonce, uint32_t counter, BYTE* data, size_t length);
+const char* chachaKernelName(void);
+
+void poly1305Start(Poly1305* poly, const BYTE* key);
+void poly1305Add(Poly1305* poly, const BYTE* data, size_t length);
+void poly1305Finish(Poly1305* poly, BYTE* tag);
+
+#endif
@@ -0,0 +1,121 @@
+// this file is the encryption stage of libstego: it encrypts a message
+// with a passkey before it is stored and decrypts it after it is read
+// (see stego_encrypt() and stego_decrypt() in stego.h).
+//
+// the passkey is turned into a 32 byte key once per message with
+// PBKDF2-HMAC-SHA256 and a random salt, and the message is encrypted
+// with ChaCha20 and authenticated with Poly1305 as in RFC 8439. the
+// salt, the random nonce and the tag are stored in the header of the
+// message, so a wrong passkey or a changed message is noticed when the
+// message is decrypted.
+//
+// the key is only derived once, the rest costs a few cycles per byte
+// (see chacha20.c).
+
+#include <string.h>
+#include <sys/random.h>
+
+#include "chacha20.h"
+#include "cipher.h"
+#include "helpers.h"
+#include "sha256.h"
+#include "stego.h"
+
+// the most PBKDF2 iterations a header may ask for, so that a damaged
+// header can't keep the reader busy for hours.
+#define MAXITERATIONS 10000000
+
+
+// this function fills buffer with length random bytes.
+// returns 1 if it could and 0 if it couldn't.
+int randomBytes(BYTE* buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t count = getrandom(buffer, length, 0);
+        if (count <= 0)
+            return 0;
+
+        buffer += count;
+        length -= count;
+    }
+
+    return 1;
+}
+
+
+// this function derives the ChaCha20 key from the passkey and the
+// Poly1305 key for the nonce (the first 32 bytes of keystream block 0).
+static void deriveKeys(const char* passkey, const stego_crypto* crypto, BYTE* key, BYTE* polyKey)
+{
+    pbkdf2SHA256((const BYTE*) passkey, strlen(passkey), crypto->salt, STEGO_SALTSIZE, crypto->iterations, key,
+                 CHACHAKEYSIZE);
+
+    memset(polyKey, 0, CHACHAKEYSIZE);
+    chacha20Xor(key, crypto->nonce, 0, polyKey, CHACHAKEYSIZE);
+}
+
+
+// this function works out the tag of an encrypted message: Poly1305 of
+// the message padded to 16 bytes and then the lengths of the (empty)
+// additional data and of the message.
+static void tagOf(const BYTE* polyKey, const BYTE* message, size_t messageLength, BYTE* tag)
+{
+    static const BYTE zeros[16];
+    BYTE lengths[16] = {0};
+    for (int i = 0; i < 8; i++)
+        lengths[8 + i] = (uint64_t) messageLength >> (8 * i);
+
+    Poly1305 poly;
+    poly1305Start(&poly, polyKey);
+    poly1305Add(&poly, message, messageLength);
+    poly1305Add(&poly, zeros, (16 - messageLength % 16) % 16);
+    poly1305Add(&poly, lengths, sizeof(lengths));
+    poly1305Finish(&poly, tag);
+}
+
+
+// this function encrypts the message in place with the passkey and
+// fills in crypto (a new salt and nonce and the tag), which is then
+// given to stego_plan() in stego_options to be stored in the header.
+// returns STEGO_OK or STEGO_NORANDOM.
+int stego_encrypt(uint8_t* message, size_t messageLength, const char* passkey, stego_crypto* crypto)
+{
+    if (!randomBytes(crypto->salt, STEGO_SALTSIZE) || !randomBytes(crypto->nonce, STEGO_NONCESIZE))
+        return STEGO_NORANDOM;
+    crypto->iterations = STEGO_KDFITERATIONS;
+
+    BYTE key[CHACHAKEYSIZE], polyKey[CHACHAKEYSIZE];
+    deriveKeys(passkey, crypto, key, polyKey);
+
+    chacha20Xor(key, crypto->nonce, 1, message, messageLength);
+    tagOf(polyKey, message, messageLength, crypto->tag);
+    return STEGO_OK;
+}
+
+
+// this function checks the tag of a message that was encrypted with
+// stego_encrypt() (crypto is what its header says) and decrypts it in
+// place with the passkey. the message is left as it is if the tag
+// doesn't match.
+// returns STEGO_OK or STEGO_BADKEY.
+int stego_decrypt(uint8_t* message, size_t messageLength, const char* passkey, const stego_crypto* crypto)
+{
+    if (crypto->iterations == 0 || crypto->iterations > MAXITERATIONS)
+        return STEGO_BADKEY;
+
+    BYTE key[CHACHAKEYSIZE], polyKey[CHACHAKEYSIZE], tag[STEGO_TAGSIZE];
+    deriveKeys(passkey, crypto, key, polyKey);
+    tagOf(polyKey, message, messageLength, tag);
+
+    // compare every byte, so that the time taken doesn't tell how much
+    // of the tag was right.
+    BYTE difference = 0;
+    for (int i = 0; i < STEGO_TAGSIZE; i++)
+        difference |= tag[i] ^ crypto->tag[i];
+    if (difference != 0)
+        return STEGO_BADKEY;
+
+    chacha20Xor(key, crypto->nonce, 1, message, messageLength);
+    return STEGO_OK;
+}
@@ -0,0 +1,14 @@
+// header file for the encryption stage of libstego (the rest of it is
+// stego_encrypt() and stego_decrypt() in stego.h)
+
+#ifndef CIPHER_H_
+#define CIPHER_H_
+
+#include <stddef.h>
+
+#include "helpers.h"
+
+// function declarations
+int randomBytes(BYTE* buffer, size_t length);
+
+#endif
@@ -0,0 +1,179 @@
+// this file is the compression stage of libstego: it makes a message
+// smaller before it is stored and back to what it was after it is
+// read (see stego_compress() and stego_decompress() in stego.h).
+//
+// a compressed message is the length of the message and then the
+// message in blocks of COMPRESSIONBLOCKSIZE bytes (the last one can be
+// shorter), every block compressed on its own with LZ4 (see lz4.c).
+// fewer bytes of the cover are changed for a smaller message, and
+// reading them back and decompressing is faster than reading the whole
+// message. a block that doesn't get smaller is stored as it is, so
+// noisy data (or data that is compressed already) grows by a few bytes
+// at most.
+//
+// only the blocks are LZ4, the framing around them is libstego's own
+// (see STEGO_COMPRESSIONSIZE in stego.h): it is not the LZ4 frame
+// format (there is no magic number, frame descriptor or end mark), so
+// the lz4 tool can't read a compressed message as it is.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "helpers.h"
+#include "lz4.h"
+#include "stego.h"
+
+// the number of bytes of the message every block has (they all get
+// their own LZ4 compression, so a match never reaches into the block
+// in front of it).
+#define COMPRESSIONBLOCKSIZE (1 << 22)
+
+// the bit of the length of a block that says it is stored as it is.
+#define STOREDBLOCK 0x80000000u
+
+// the most a block of LZ4 grows when it is decompressed (a match of 255
+// bytes per byte), to tell a damaged length from a real one.
+#define MAXRATIO 256
+
+
+// returns the number of blocks a message of the given length is split
+// into.
+static uint64_t blockCountOf(uint64_t length)
+{
+    return (length + COMPRESSIONBLOCKSIZE - 1) / COMPRESSIONBLOCKSIZE;
+}
+
+
+// returns the number of bytes stego_compress() needs for a message of
+// the given length: every block can be stored as it is, and the block
+// that is being compressed can take a little more than that before it
+// is known that it doesn't get smaller.
+size_t stego_compress_bound(size_t messageLength)
+{
+    size_t blockLength = messageLength < COMPRESSIONBLOCKSIZE ? messageLength : COMPRESSIONBLOCKSIZE;
+    return STEGO_COMPRESSIONSIZE + blockCountOf(messageLength) * 4 + messageLength
+           + LZ4BOUND(blockLength) - blockLength;
+}
+
+
+// this function compresses a message of messageLength bytes into
+// compressed, which has space for capacity bytes (up to
+// stego_compress_bound() of them are needed). compressedLength is set
+// to the number of bytes of the compressed message, which is then
+// stored with STEGO_COMPRESSED in the header (stego_options.compressed)
+// if it is smaller than the message.
+// returns STEGO_OK or STEGO_SMALLBUFFER.
+int stego_compress(const uint8_t* message, size_t messageLength, uint8_t* compressed, size_t capacity,
+                   size_t* compressedLength)
+{
+    if (capacity < stego_compress_bound(messageLength))
+        return STEGO_SMALLBUFFER;
+
+    for (int i = 0; i < STEGO_COMPRESSIONSIZE; i++)
+        compressed[i] = (uint64_t) messageLength >> (8 * i);
+    size_t used = STEGO_COMPRESSIONSIZE;
+
+    // every block is compressed straight into the output, and stored
+    // over it if it doesn't get smaller.
+    LZ4Table table;
+    for (size_t offset = 0; offset < messageLength; offset += COMPRESSIONBLOCKSIZE)
+    {
+        size_t blockLength = messageLength - offset < COMPRESSIONBLOCKSIZE ? messageLength - offset
+                                                                             : COMPRESSIONBLOCKSIZE;
+        BYTE* block = compressed + used + 4;
+        size_t length = lz4Compress(&table, message + offset, blockLength, block);
+
+        uint32_t header = length;
+        if (length >= blockLength)
+        {
+            memcpy(block, message + offset, blockLength);
+            length = blockLength;
+            header = blockLength | STOREDBLOCK;
+        }
+
+        for (int i = 0; i < 4; i++)
+            compressed[used + i] = header >> (8 * i);
+        used += 4 + length;
+    }
+
+    *compressedLength = used;
+    return STEGO_OK;
+}
+
+
+// this function reads the length of a compressed message (the length
+// of the message it decompresses to) and checks that its blocks add up
+// to it, so that a damaged length is never trusted for how much memory
+// to allocate.
+// returns STEGO_OK or STEGO_BADMESSAGE.
+int stego_decompressed_length(const uint8_t* compressed, size_t compressedLength, size_t* messageLength)
+{
+    if (compressedLength < STEGO_COMPRESSIONSIZE)
+        return STEGO_BADMESSAGE;
+
+    uint64_t length = 0;
+    for (int i = 0; i < STEGO_COMPRESSIONSIZE; i++)
+        length |= (uint64_t) compressed[i] << (8 * i);
+
+    size_t used = STEGO_COMPRESSIONSIZE;
+    for (uint64_t left = length; left > 0;)
+    {
+        uint64_t blockLength = left < COMPRESSIONBLOCKSIZE ? left : COMPRESSIONBLOCKSIZE;
+        if (compressedLength - used < 4)
+            return STEGO_BADMESSAGE;
+
+        uint32_t header = 0;
+        for (int i = 0; i < 4; i++)
+            header |= (uint32_t) compressed[used + i] << (8 * i);
+        size_t stored = header & ~STOREDBLOCK;
+        if (compressedLength - used - 4 < stored
+            || ((header & STOREDBLOCK) ? stored != blockLength : blockLength > (uint64_t) stored * MAXRATIO))
+            return STEGO_BADMESSAGE;
+
+        used += 4 + stored;
+        left -= blockLength;
+    }
+
+    if (used != compressedLength || length > SIZE_MAX)
+        return STEGO_BADMESSAGE;
+
+    *messageLength = length;
+    return STEGO_OK;
+}
+
+
+// this function decompresses a message that was compressed with
+// stego_compress() into message, which has space for capacity bytes
+// (stego_decompressed_length() of them are needed). messageLength is
+// set to the number of bytes of the message.
+// returns STEGO_OK, STEGO_SMALLBUFFER or STEGO_BADMESSAGE.
+int stego_decompress(const uint8_t* compressed, size_t compressedLength, uint8_t* message, size_t capacity,
+                     size_t* messageLength)
+{
+    size_t length;
+    int result = stego_decompressed_length(compressed, compressedLength, &length);
+    if (result != STEGO_OK)
+        return result;
+    if (capacity < length)
+        return STEGO_SMALLBUFFER;
+
+    size_t used = STEGO_COMPRESSIONSIZE;
+    for (size_t offset = 0; offset < length; offset += COMPRESSIONBLOCKSIZE)
+    {
+        size_t blockLength = length - offset < COMPRESSIONBLOCKSIZE ? length - offset : COMPRESSIONBLOCKSIZE;
+        uint32_t header = 0;
+        for (int i = 0; i < 4; i++)
+            header |= (uint32_t) compressed[used + i] << (8 * i);
+        size_t stored = header & ~STOREDBLOCK;
+
+        if (header & STOREDBLOCK)
+            memcpy(message + offset, compressed + used + 4, blockLength);
+        else if (!lz4Decompress(compressed + used + 4, stored, message + offset, blockLength))
+            return STEGO_BADMESSAGE;
+
+        used += 4 + stored;
+    }
+
+    *messageLength = length;
+    return STEGO_OK;
+}
@@ -0,0 +1,241 @@
+// this file is the container stage of libstego: it lets a message be a
+// container of named records (see STEGO_CONTAINER and stego_toc in
+// stego.h) instead of a single anonymous message.
+//
+// the container starts with a table of contents that says where every
+// record is and what its CRC-32 is, so a record is read by reading the
+// table and then only the bytes of the record (see
+// stego_extract_range()), however many other records there are. a
+// record is added or replaced by rewriting its bytes and the table
+// (see stego_plan_update()), the other records are never touched: a
+// new or replaced record goes in the first space between the records
+// it fits in (the space a replaced record had is free again), or after
+// the last of them. so replacing records over and over doesn't make
+// the container grow, it only grows by what doesn't fit in the spaces.
+
+#include <string.h>
+
+#include "helpers.h"
+#include "stego.h"
+
+
+// returns the little endian number of the given number of bytes.
+static uint64_t readNumber(const BYTE* bytes, int count)
+{
+    uint64_t number = 0;
+    for (int i = 0; i < count; i++)
+        number |= (uint64_t) bytes[i] << (8 * i);
+    return number;
+}
+
+
+// this function writes a number as the given number of little endian
+// bytes.
+static void writeNumber(BYTE* bytes, uint64_t number, int count)
+{
+    for (int i = 0; i < count; i++)
+        bytes[i] = number >> (8 * i);
+}
+
+
+// this function fills in the table of contents of a container that
+// has no records yet.
+void stego_new_toc(stego_toc* toc)
+{
+    memset(toc, 0, sizeof(stego_toc));
+    toc->length = STEGO_TOCSIZE;
+}
+
+
+// this function reads the table of contents of a container from its
+// first STEGO_TOCSIZE bytes, and checks that it is not damaged and
+// that all the records are in the messageLength bytes of the
+// container.
+// returns STEGO_OK or STEGO_BADMESSAGE.
+int stego_parse_toc(const uint8_t* bytes, uint64_t messageLength, stego_toc* toc)
+{
+    if (readNumber(bytes, 4) != STEGO_RECORDSLOTS
+        || readNumber(bytes + 4, 4) != stego_checksum(bytes + 8, STEGO_TOCSIZE - 8))
+        return STEGO_BADMESSAGE;
+
+    toc->length = readNumber(bytes + 8, 8);
+    if (toc->length < STEGO_TOCSIZE || toc->length > messageLength)
+        return STEGO_BADMESSAGE;
+
+    for (int i = 0; i < STEGO_RECORDSLOTS; i++)
+    {
+        const BYTE* slot = bytes + 16 + i * STEGO_SLOTSIZE;
+        stego_record* record = &toc->records[i];
+        memcpy(record->name, slot, STEGO_NAMESIZE);
+        record->offset = readNumber(slot + STEGO_NAMESIZE, 8);
+        record->length = readNumber(slot + STEGO_NAMESIZE + 8, 8);
+        record->checksum = readNumber(slot + STEGO_NAMESIZE + 16, 4);
+
+        if (record->name[STEGO_NAMESIZE - 1] != '\0')
+            return STEGO_BADMESSAGE;
+        if (record->name[0] != '\0'
+            && (record->offset < STEGO_TOCSIZE || record->offset > toc->length
+                || record->length > toc->length - record->offset))
+            return STEGO_BADMESSAGE;
+    }
+
+    return STEGO_OK;
+}
+
+
+// this function writes the table of contents as the first
+// STEGO_TOCSIZE bytes of the container.
+void stego_write_toc(const stego_toc* toc, uint8_t* bytes)
+{
+    memset(bytes, 0, STEGO_TOCSIZE);
+    writeNumber(bytes, STEGO_RECORDSLOTS, 4);
+    writeNumber(bytes + 8, toc->length, 8);
+
+    for (int i = 0; i < STEGO_RECORDSLOTS; i++)
+    {
+        BYTE* slot = bytes + 16 + i * STEGO_SLOTSIZE;
+        const stego_record* record = &toc->records[i];
+        if (record->name[0] == '\0')
+            continue;
+
+        strncpy((char*) slot, record->name, STEGO_NAMESIZE - 1);
+        writeNumber(slot + STEGO_NAMESIZE, record->offset, 8);
+        writeNumber(slot + STEGO_NAMESIZE + 8, record->length, 8);
+        writeNumber(slot + STEGO_NAMESIZE + 16, record->checksum, 4);
+    }
+
+    writeNumber(bytes + 4, stego_checksum(bytes + 8, STEGO_TOCSIZE - 8), 4);
+}
+
+
+// this function reads the table of contents of the container stored
+// in the image (only its bytes are read).
+// returns STEGO_OK, STEGO_UNSUPPORTED, STEGO_NOMESSAGE, STEGO_NORECORDS
+// (the message is not a container), STEGO_BADMESSAGE or
+// STEGO_NOMEMORY.
+int stego_read_toc(const uint8_t* image, size_t size, stego_toc* toc)
+{
+    stego_header header;
+    int result = stego_read_header(image, size, &header);
+    if (result != STEGO_OK)
+        return result;
+    if (!(header.flags & STEGO_CONTAINER))
+        return STEGO_NORECORDS;
+    if (header.length < STEGO_TOCSIZE)
+        return STEGO_BADMESSAGE;
+
+    BYTE bytes[STEGO_TOCSIZE];
+    result = stego_extract_range(image, size, 0, bytes, STEGO_TOCSIZE);
+    if (result != STEGO_OK)
+        return result;
+
+    return stego_parse_toc(bytes, header.length, toc);
+}
+
+
+// returns the slot of the record with the given name, or -1 if there
+// is none.
+int stego_find_record(const stego_toc* toc, const char* name)
+{
+    for (int i = 0; i < STEGO_RECORDSLOTS; i++)
+    {
+        if (toc->records[i].name[0] != '\0' && strcmp(toc->records[i].name, name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+
+// returns 1 if none of the records but the one in the slot skip take
+// any of the length bytes starting at offset.
+static int isFree(const stego_toc* toc, int skip, uint64_t offset, uint64_t length)
+{
+    for (int i = 0; i < STEGO_RECORDSLOTS; i++)
+    {
+        const stego_record* record = &toc->records[i];
+        if (i != skip && record->name[0] != '\0' && record->length > 0
+            && offset < record->offset + record->length && record->offset < offset + length)
+            return 0;
+    }
+
+    return 1;
+}
+
+
+// this function finds where a record of length bytes goes: the first
+// space it fits in right after the table of contents or right after a
+// record (other than the one in the slot skip, which is being
+// replaced). the end of the last record always has space.
+static uint64_t findSpace(const stego_toc* toc, int skip, uint64_t length)
+{
+    uint64_t best = UINT64_MAX;
+    for (int i = -1; i < STEGO_RECORDSLOTS; i++)
+    {
+        if (i >= 0 && (i == skip || toc->records[i].name[0] == '\0'))
+            continue;
+
+        uint64_t offset = i < 0 ? STEGO_TOCSIZE : toc->records[i].offset + toc->records[i].length;
+        if (offset < best && isFree(toc, skip, offset, length))
+            best = offset;
+    }
+
+    return best;
+}
+
+
+// this function adds a record of length bytes with the given name to
+// the table of contents, or replaces the record with that name. index
+// is set to its slot, the record then goes at the offset the slot
+// says (the bytes are only needed for the checksum, they are stored by
+// the caller, see stego_plan_update()). the length of the container
+// grows if the record doesn't fit before its end (it never gets
+// shorter).
+// returns STEGO_OK, STEGO_BADOPTIONS (the name is empty or longer than
+// STEGO_NAMESIZE - 1 bytes) or STEGO_TOCFULL.
+int stego_put_record(stego_toc* toc, const char* name, const uint8_t* bytes, size_t length, int* index)
+{
+    size_t nameLength = strlen(name);
+    if (nameLength == 0 || nameLength >= STEGO_NAMESIZE)
+        return STEGO_BADOPTIONS;
+
+    int slot = stego_find_record(toc, name);
+    for (int i = 0; i < STEGO_RECORDSLOTS && slot < 0; i++)
+    {
+        if (toc->records[i].name[0] == '\0')
+            slot = i;
+    }
+    if (slot < 0)
+        return STEGO_TOCFULL;
+
+    stego_record* record = &toc->records[slot];
+    record->offset = findSpace(toc, slot, length);
+    if (record->offset + length > toc->length)
+        toc->length = record->offset + length;
+
+    memset(record->name, 0, STEGO_NAMESIZE);
+    memcpy(record->name, name, nameLength);
+    record->length = length;
+    record->checksum = stego_checksum(bytes, length);
+    *index = slot;
+    return STEGO_OK;
+}
+
+
+// this function reads the record in the given slot of the table of
+// contents of the container stored in the image into bytes (which has
+// space for its length), and checks it against its checksum.
+// returns STEGO_OK, STEGO_BADOPTIONS (no record in the slot),
+// STEGO_BADMESSAGE or any error of stego_extract_range().
+int stego_extract_record(const uint8_t* image, size_t size, const stego_toc* toc, int index, uint8_t* bytes)
+{
+    if (index < 0 || index >= STEGO_RECORDSLOTS || toc->records[index].name[0] == '\0')
+        return STEGO_BADOPTIONS;
+
+    const stego_record* record = &toc->records[index];
+    int result = stego_extract_range(image, size, record->offset, bytes, record->length);
+    if (result == STEGO_OK && stego_checksum(bytes, record->length) != record->checksum)
+        result = STEGO_BADMESSAGE;
+
+    return result;
+}
@@ -0,0 +1,367 @@
+// this file makes up the covers of the benchmark and of the self test
+// in memory: bmps, an rgb png and two kinds of jpg. every byte comes
+// from a seed, so the covers are the same on every machine and every
+// run.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "covers.h"
+
+
+// a small random number generator (xorshift64*), so that the bytes
+// are the same on every machine.
+static uint64_t nextRandom(uint64_t* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dULL;
+}
+
+
+// this function fills buffer with length random bytes.
+void fillRandom(BYTE* buffer, size_t length, uint64_t seed)
+{
+    uint64_t state = seed;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t value = nextRandom(&state);
+        memcpy(buffer + i, &value, 8);
+    }
+
+    uint64_t value = nextRandom(&state);
+    memcpy(buffer + i, &value, length - i);
+}
+
+
+static void put16(BYTE* bytes, unsigned value)
+{
+    bytes[0] = value;
+    bytes[1] = value >> 8;
+}
+
+static void put32(BYTE* bytes, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        bytes[i] = value >> (8 * i);
+}
+
+static void put32BigEndian(BYTE* bytes, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        bytes[i] = value >> (24 - 8 * i);
+}
+
+
+// this function makes a bmp with random pixels. rows are padded to a
+// multiple of 4 bytes with zeros. an 8-bit bmp gets a palette.
+int makeBMP(Cover* cover, long width, long height, int bitsPerPixel, uint64_t seed)
+{
+    size_t rowBytes = (width * bitsPerPixel + 7) / 8;
+    size_t stride = (rowBytes + 3) & ~(size_t) 3;
+    size_t paletteSize = bitsPerPixel <= 8 ? 4 << bitsPerPixel : 0;
+    size_t offset = BITMAPHEADERSIZE + 40 + paletteSize;
+
+    cover->size = offset + stride * height;
+    cover->data = calloc(cover->size, 1);
+    if (cover->data == NULL)
+        return 0;
+    snprintf(cover->name, sizeof(cover->name), "bmp-%ldx%ldx%d", width, height, bitsPerPixel);
+
+    BYTE* header = cover->data;
+    header[0] = 'B';
+    header[1] = 'M';
+    put32(header + 2, cover->size);
+    put32(header + 10, offset);
+    put32(header + 14, 40);
+    put32(header + 18, width);
+    put32(header + 22, height);
+    put16(header + 26, 1);
+    put16(header + 28, bitsPerPixel);
+    put32(header + 34, stride * height);
+    put32(header + 46, paletteSize / 4);
+
+    for (size_t i = 0; i < paletteSize / 4; i++)
+        memset(header + BITMAPHEADERSIZE + 40 + 4 * i, i * 255 / (paletteSize / 4 - 1), 3);
+
+    for (long row = 0; row < height; row++)
+        fillRandom(cover->data + offset + row * stride, rowBytes, seed + row);
+    return 1;
+}
+
+
+// the CRC-32 of a png chunk.
+static uint32_t crc32Of(const BYTE* data, size_t length)
+{
+    static uint32_t table[256];
+    if (table[1] == 0)
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+    }
+
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < length; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffff;
+}
+
+
+// this function writes a png chunk with the given data (which may
+// already be in place) at position and returns its length.
+static size_t writeChunk(BYTE* position, const char* type, const BYTE* data, size_t length)
+{
+    put32BigEndian(position, length);
+    memcpy(position + 4, type, 4);
+    if (data != position + 8)
+        memmove(position + 8, data, length);
+    put32BigEndian(position + 8 + length, crc32Of(position + 4, length + 4));
+    return length + 12;
+}
+
+
+// this function makes an 8-bit rgb png with random pixels. the image
+// data is zlib with stored (not compressed) deflate blocks.
+int makePNG(Cover* cover, long width, long height, uint64_t seed)
+{
+    size_t rowBytes = 1 + width * 3;
+    size_t raw = rowBytes * height;
+    size_t blocks = (raw + 65534) / 65535;
+    size_t zlibLength = 2 + raw + 5 * blocks + 4;
+
+    cover->size = 8 + 25 + 12 + zlibLength + 12;
+    cover->data = malloc(cover->size);
+    if (cover->data == NULL)
+        return 0;
+    snprintf(cover->name, sizeof(cover->name), "png-%ldx%ld", width, height);
+
+    BYTE* p = cover->data;
+    memcpy(p, "\x89PNG\r\n\x1a\n", 8);
+    p += 8;
+
+    BYTE ihdr[13] = {0};
+    put32BigEndian(ihdr, width);
+    put32BigEndian(ihdr + 4, height);
+    ihdr[8] = 8;
+    ihdr[9] = 2;
+    p += writeChunk(p, "IHDR", ihdr, sizeof(ihdr));
+
+    // the rows (filter type 0 and the pixels) go straight into the
+    // stored blocks.
+    BYTE* zlib = p + 8;
+    BYTE* z = zlib;
+    *z++ = 0x78;
+    *z++ = 0x01;
+
+    BYTE* rows = malloc(raw);
+    if (rows == NULL)
+    {
+        free(cover->data);
+        return 0;
+    }
+    for (long row = 0; row < height; row++)
+    {
+        rows[row * rowBytes] = 0;
+        fillRandom(rows + row * rowBytes + 1, rowBytes - 1, seed + row);
+    }
+
+    uint32_t a = 1, b = 0;
+    for (size_t done = 0; done < raw;)
+    {
+        size_t length = raw - done < 65535 ? raw - done : 65535;
+        *z++ = done + length == raw;
+        put16(z, length);
+        put16(z + 2, ~length);
+        memcpy(z + 4, rows + done, length);
+        z += 4 + length;
+
+        for (size_t i = 0; i < length; i++)
+        {
+            a = (a + rows[done + i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        done += length;
+    }
+    put32BigEndian(z, b << 16 | a);
+    free(rows);
+
+    p += writeChunk(p, "IDAT", zlib, zlibLength);
+    p += writeChunk(p, "IEND", NULL, 0);
+    return 1;
+}
+
+
+// this function makes a jpg of about the given size: the segments of
+// a baseline jpg (with random contents) and random entropy coded data
+// in which every 0xFF is followed by 0x00, as in a real jpg.
+int makeJPG(Cover* cover, size_t entropyBytes, uint64_t seed)
+{
+    static const size_t segmentLengths[] = {16, 67, 17, 31, 12};
+    static const BYTE markers[] = {0xE0, 0xDB, 0xC0, 0xC4, 0xDA};
+
+    cover->size = 2 + 2 + entropyBytes + 2;
+    for (int i = 0; i < 5; i++)
+        cover->size += 2 + segmentLengths[i];
+    cover->data = malloc(cover->size);
+    if (cover->data == NULL)
+        return 0;
+    snprintf(cover->name, sizeof(cover->name), "jpg-%zuk", entropyBytes / 1024);
+
+    BYTE* p = cover->data;
+    *p++ = 0xFF;
+    *p++ = 0xD8;
+    for (int i = 0; i < 5; i++)
+    {
+        *p++ = 0xFF;
+        *p++ = markers[i];
+        *p++ = segmentLengths[i] >> 8;
+        *p++ = segmentLengths[i];
+        fillRandom(p, segmentLengths[i] - 2, seed + i);
+        p += segmentLengths[i] - 2;
+    }
+
+    fillRandom(p, entropyBytes + 2, seed + 5);
+    for (size_t i = 0; i < entropyBytes + 1; i++)
+    {
+        if (p[i] == 0xFF)
+            p[++i] = 0x00;
+    }
+    if (p[entropyBytes + 1] == 0xFF)
+        p[entropyBytes + 1] = 0xFE;
+    p += entropyBytes + 2;
+
+    *p++ = 0xFF;
+    *p++ = 0xD9;
+    return 1;
+}
+
+
+// the bits of a baseline jpg that is being made, see makeBaselineJPG().
+typedef struct
+{
+    BYTE* position;
+    uint32_t bits;
+    int count;
+} BitWriter;
+
+
+// this function writes the lowest length bits of value, most
+// significant first, with a 0x00 after every 0xFF byte.
+static void putBits(BitWriter* writer, uint32_t value, int length)
+{
+    writer->bits = writer->bits << length | (value & ((1u << length) - 1));
+    writer->count += length;
+    while (writer->count >= 8)
+    {
+        writer->count -= 8;
+        BYTE byte = writer->bits >> writer->count;
+        *writer->position++ = byte;
+        if (byte == 0xFF)
+            *writer->position++ = 0x00;
+    }
+}
+
+
+// this function makes a baseline jpg of the given size with 3
+// components that are not subsampled and random blocks (up to 15
+// coefficients that are not 0 in each). it has a single dc and ac
+// huffman table with codes of the same length (4 and 8 bits), so that
+// the code of a symbol is its number.
+int makeBaselineJPG(Cover* cover, long width, long height, uint64_t seed)
+{
+    // the ac symbols: end of block, a run of 16 zeros and every run of
+    // 0 - 15 zeros with a coefficient of size 1 - 10 after it.
+    BYTE acSymbols[162];
+    acSymbols[0] = 0x00;
+    acSymbols[1] = 0xF0;
+    for (int i = 0; i < 160; i++)
+        acSymbols[i + 2] = (i / 10) << 4 | (i % 10 + 1);
+
+    // a block takes at most 31 bytes (62 with a 0x00 after every byte).
+    long blocks = 3 * ((width + 7) / 8) * ((height + 7) / 8);
+    cover->size = 1024 + blocks * 64;
+    cover->data = malloc(cover->size);
+    if (cover->data == NULL)
+        return 0;
+    snprintf(cover->name, sizeof(cover->name), "jpgcoefficients-%ldx%ld", width, height);
+
+    static const BYTE app0[] = {0xFF, 0xE0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+    BYTE* p = cover->data;
+    *p++ = 0xFF;
+    *p++ = 0xD8;
+    memcpy(p, app0, sizeof(app0));
+    p += sizeof(app0);
+
+    // the quantization table (the coefficients are made up, it is only
+    // there for the decoders that want one).
+    *p++ = 0xFF;
+    *p++ = 0xDB;
+    *p++ = 0;
+    *p++ = 67;
+    *p++ = 0;
+    for (int i = 0; i < 64; i++)
+        *p++ = 1 + i / 4;
+
+    // the frame: 8 bit samples, 3 components with a sampling of 1x1.
+    BYTE frame[] = {0xFF, 0xC0, 0, 17, 8, height >> 8, height, width >> 8, width, 3, 1, 0x11, 0, 2, 0x11, 0, 3, 0x11, 0};
+    memcpy(p, frame, sizeof(frame));
+    p += sizeof(frame);
+
+    // the dc table has 12 codes of 4 bits, the ac table 162 of 8 bits.
+    BYTE dc[] = {0xFF, 0xC4, 0, 31, 0x00, 0, 0, 0, 12, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    memcpy(p, dc, sizeof(dc));
+    p += sizeof(dc);
+    for (int i = 0; i < 12; i++)
+        *p++ = i;
+    BYTE ac[] = {0xFF, 0xC4, 0, 181, 0x10, 0, 0, 0, 0, 0, 0, 0, 162, 0, 0, 0, 0, 0, 0, 0, 0};
+    memcpy(p, ac, sizeof(ac));
+    p += sizeof(ac);
+    memcpy(p, acSymbols, sizeof(acSymbols));
+    p += sizeof(acSymbols);
+
+    BYTE scan[] = {0xFF, 0xDA, 0, 12, 3, 1, 0x00, 2, 0x00, 3, 0x00, 0, 63, 0};
+    memcpy(p, scan, sizeof(scan));
+    p += sizeof(scan);
+
+    BitWriter writer = {p, 0, 0};
+    uint64_t state = seed;
+    for (long block = 0; block < blocks; block++)
+    {
+        uint64_t random = nextRandom(&state);
+        int dcSize = random % 8;
+        putBits(&writer, dcSize, 4);
+        putBits(&writer, random >> 8, dcSize);
+
+        int coefficients = random >> 16 & 15;
+        int k = 1;
+        for (int i = 0; i < coefficients; i++)
+        {
+            random = nextRandom(&state);
+            int run = random % 4;
+            int size = 1 + (random >> 4) % 7;
+            if (k + run > 63)
+                break;
+            putBits(&writer, 2 + run * 10 + size - 1, 8);
+            putBits(&writer, random >> 16, size);
+            k += run + 1;
+        }
+        if (k <= 63)
+            putBits(&writer, 0, 8);
+    }
+    if (writer.count > 0)
+        putBits(&writer, 0xFF, 8 - writer.count);
+    p = writer.position;
+
+    *p++ = 0xFF;
+    *p++ = 0xD9;
+    cover->size = p - cover->data;
+    return 1;
+}
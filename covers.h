@@ -0,0 +1,32 @@
+// header file for the covers that the benchmark and the self test make
+// up in memory
+
+#ifndef COVERS_H_
+#define COVERS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "helpers.h"
+
+// a cover that is made up. data is allocated by the function that
+// makes it and freed by the caller.
+typedef struct
+{
+    char name[64];
+    BYTE* data;
+    size_t size;
+} Cover;
+
+
+// function declarations
+void fillRandom(BYTE* buffer, size_t length, uint64_t seed);
+
+// these return 1 if the cover was made and 0 if there is not enough
+// memory.
+int makeBMP(Cover* cover, long width, long height, int bitsPerPixel, uint64_t seed);
+int makePNG(Cover* cover, long width, long height, uint64_t seed);
+int makeJPG(Cover* cover, size_t entropyBytes, uint64_t seed);
+int makeBaselineJPG(Cover* cover, long width, long height, uint64_t seed);
+
+#endif
@@ -0,0 +1,645 @@
+// this file has the deflate compressor (RFC 1951) that libstego uses to
+// compress the pixels of a png again after the message was stored in
+// them, and the adler32 checksum of the zlib stream around it.
+//
+// the data is compressed in independent blocks so that many of them
+// can be compressed at the same time (like pigz does): every block can
+// still find matches in the 32 KB in front of it (its history), and
+// ends on a whole byte with an empty stored block, so the compressed
+// blocks can just be written one after the other. deflateFinish()
+// writes the empty last block that ends the stream.
+//
+// matches are found with a hash table of 3 byte sequences and a short
+// chain of the earlier positions with the same hash, and every 32768
+// symbols are written as a block with its own huffman codes (or as
+// stored blocks when that is smaller, for noisy data).
+
+#include <stdint.h>
+#include <string.h>
+
+#include "deflate.h"
+#include "helpers.h"
+
+// the most earlier positions that are tried for every match.
+#define MAXCHAIN 32
+
+// matches longer than this don't get their inner positions added to
+// the hash table.
+#define MAXINSERTLENGTH 64
+
+// the shortest and longest match.
+#define MINMATCH 3
+#define MAXMATCH 258
+
+// the number of literal/length codes, distance codes and code length
+// codes.
+#define LITERALCODES 286
+#define DISTANCECODES 30
+#define CODELENGTHCODES 19
+
+// the end of block code.
+#define ENDOFBLOCK 256
+
+// the longest huffman code and the longest code length code.
+#define MAXCODELENGTH 15
+#define MAXCODELENGTHCODELENGTH 7
+
+// the most bytes in a stored block.
+#define MAXSTOREDLENGTH 65535
+
+const uint16_t deflateLengthBase[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                        31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const BYTE deflateLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                     2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t deflateDistanceBase[30] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+                                          193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const BYTE deflateDistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                       6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// the order the lengths of the code length codes are written in.
+static const BYTE codeLengthOrder[CODELENGTHCODES] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+
+// the bits of the output are collected here and written a byte at a
+// time, the first bit in the least significant bit of the byte.
+typedef struct
+{
+    BYTE* out;
+    size_t position;
+    uint64_t bits;
+    int count;
+} BitWriter;
+
+
+// a huffman code: the length and the (bit reversed) code of every
+// symbol.
+typedef struct
+{
+    BYTE lengths[LITERALCODES];
+    uint16_t codes[LITERALCODES];
+} HuffmanCode;
+
+
+static void putBits(BitWriter* writer, uint32_t value, int count)
+{
+    writer->bits |= (uint64_t) value << writer->count;
+    writer->count += count;
+    while (writer->count >= BYTESIZE)
+    {
+        writer->out[writer->position++] = writer->bits;
+        writer->bits >>= BYTESIZE;
+        writer->count -= BYTESIZE;
+    }
+}
+
+
+// this function pads the output with 0 bits up to a whole byte.
+static void alignWriter(BitWriter* writer)
+{
+    if (writer->count > 0)
+        putBits(writer, 0, BYTESIZE - writer->count);
+}
+
+
+// returns the length code (257 - 285) of a match length.
+static int lengthCodeOf(int length)
+{
+    if (length == MAXMATCH)
+        return 285;
+
+    int rest = length - MINMATCH;
+    if (rest < 8)
+        return 257 + rest;
+
+    // after the first 8, the codes come in groups of 4 that double in
+    // size.
+    int bits = 31 - __builtin_clz(rest);
+    return 257 + 4 * (bits - 1) + (rest >> (bits - 2) & 3);
+}
+
+
+// returns the distance code (0 - 29) of a match distance.
+static int distanceCodeOf(int distance)
+{
+    if (distance <= 4)
+        return distance - 1;
+
+    // after the first 4, the codes come in pairs that double in size.
+    int bits = 31 - __builtin_clz(distance - 1);
+    return 2 * bits + ((distance - 1) >> (bits - 1) & 1);
+}
+
+
+// this function works out the lengths of the huffman codes for the
+// symbols with the given frequencies, none of them longer than limit.
+// every symbol with a frequency of 0 gets length 0 (no code).
+static void buildLengths(const uint32_t* frequencies, int count, int limit, BYTE* lengths)
+{
+    int symbols[LITERALCODES];
+    uint32_t weights[2 * LITERALCODES];
+    int parents[2 * LITERALCODES];
+    int depths[2 * LITERALCODES];
+    int lengthCounts[2 * LITERALCODES] = {0};
+
+    // the used symbols, sorted from the least to the most frequent.
+    int used = 0;
+    for (int symbol = 0; symbol < count; symbol++)
+    {
+        lengths[symbol] = 0;
+        if (frequencies[symbol] == 0)
+            continue;
+
+        int i = used++;
+        while (i > 0 && frequencies[symbols[i - 1]] > frequencies[symbol])
+        {
+            symbols[i] = symbols[i - 1];
+            i--;
+        }
+        symbols[i] = symbol;
+    }
+
+    if (used == 1)
+        lengths[symbols[0]] = 1;
+    if (used <= 1)
+        return;
+
+    // build the tree with two queues: the leaves in the order above
+    // and the inner nodes, which are made in order of their weight.
+    for (int i = 0; i < used; i++)
+        weights[i] = frequencies[symbols[i]];
+
+    int leaf = 0, node = used, next = used;
+    for (int i = 0; i < used - 1; i++)
+    {
+        int pair[2];
+        for (int j = 0; j < 2; j++)
+        {
+            if (leaf < used && (node == next || weights[leaf] <= weights[node]))
+                pair[j] = leaf++;
+            else
+                pair[j] = node++;
+        }
+
+        weights[next] = weights[pair[0]] + weights[pair[1]];
+        parents[pair[0]] = parents[pair[1]] = next;
+        next++;
+    }
+
+    // the depth of every node is one more than the depth of its
+    // parent, which always comes after it.
+    depths[next - 1] = 0;
+    int deepest = 0;
+    for (int i = next - 2; i >= 0; i--)
+    {
+        depths[i] = depths[parents[i]] + 1;
+        if (i < used)
+        {
+            lengthCounts[depths[i]]++;
+            if (depths[i] > deepest)
+                deepest = depths[i];
+        }
+    }
+
+    // codes that are too long are made shorter by moving pairs of them
+    // up next to a shorter code that is moved down (like the JPEG
+    // standard does, annex K.3).
+    for (int i = deepest; i > limit; i--)
+    {
+        while (lengthCounts[i] > 0)
+        {
+            int j = i - 2;
+            while (lengthCounts[j] == 0)
+                j--;
+
+            lengthCounts[i] -= 2;
+            lengthCounts[i - 1]++;
+            lengthCounts[j + 1] += 2;
+            lengthCounts[j]--;
+        }
+    }
+
+    // the least frequent symbols get the longest codes.
+    int symbol = 0;
+    for (int length = limit < deepest ? limit : deepest; length > 0; length--)
+    {
+        for (int i = 0; i < lengthCounts[length]; i++)
+            lengths[symbols[symbol++]] = length;
+    }
+}
+
+
+// this function works out the canonical codes (see RFC 1951) for the
+// code lengths, with their bits reversed so that they can be written
+// with putBits().
+static void buildCodes(HuffmanCode* code, int count)
+{
+    int lengthCounts[MAXCODELENGTH + 1] = {0};
+    for (int symbol = 0; symbol < count; symbol++)
+        lengthCounts[code->lengths[symbol]]++;
+    lengthCounts[0] = 0;
+
+    int nextCode[MAXCODELENGTH + 1];
+    int value = 0;
+    for (int length = 1; length <= MAXCODELENGTH; length++)
+    {
+        value = (value + lengthCounts[length - 1]) << 1;
+        nextCode[length] = value;
+    }
+
+    for (int symbol = 0; symbol < count; symbol++)
+    {
+        int length = code->lengths[symbol];
+        if (length == 0)
+            continue;
+
+        int bits = nextCode[length]++;
+        int reversed = 0;
+        for (int i = 0; i < length; i++)
+            reversed |= (bits >> i & 1) << (length - 1 - i);
+        code->codes[symbol] = reversed;
+    }
+}
+
+
+// this function makes sure at least 2 symbols are used, so that every
+// code is complete.
+static void useTwoSymbols(uint32_t* frequencies, int count)
+{
+    int used = 0;
+    for (int symbol = 0; symbol < count; symbol++)
+        used += frequencies[symbol] != 0;
+
+    for (int symbol = 0; used < 2; symbol++)
+    {
+        if (frequencies[symbol] == 0)
+        {
+            frequencies[symbol] = 1;
+            used++;
+        }
+    }
+}
+
+
+// this function writes the data as stored blocks.
+static void writeStored(BitWriter* writer, const BYTE* data, size_t length)
+{
+    while (length > 0)
+    {
+        size_t blockLength = length < MAXSTOREDLENGTH ? length : MAXSTOREDLENGTH;
+        putBits(writer, 0, 3);
+        alignWriter(writer);
+        putBits(writer, blockLength, 16);
+        putBits(writer, ~blockLength & 0xFFFF, 16);
+
+        memcpy(writer->out + writer->position, data, blockLength);
+        writer->position += blockLength;
+        data += blockLength;
+        length -= blockLength;
+    }
+}
+
+
+// the code length codes that the code lengths of a block are written
+// with: a code and the value of its extra bits.
+typedef struct
+{
+    BYTE code;
+    BYTE extra;
+} LengthRun;
+
+
+// this function adds a code length code to the list.
+static void addRun(LengthRun* runs, int* runCount, int code, int extra)
+{
+    runs[*runCount].code = code;
+    runs[*runCount].extra = extra;
+    (*runCount)++;
+}
+
+
+// this function writes the symbols as a block with its own huffman
+// codes, or the data they stand for as stored blocks if that is
+// smaller.
+static void writeBlock(BitWriter* writer, const DeflateSymbol* symbols, int symbolCount, const BYTE* data,
+                       size_t length)
+{
+    uint32_t literalFrequencies[LITERALCODES] = {0};
+    uint32_t distanceFrequencies[DISTANCECODES] = {0};
+    for (int i = 0; i < symbolCount; i++)
+    {
+        if (symbols[i].length == 0)
+            literalFrequencies[symbols[i].value]++;
+        else
+        {
+            literalFrequencies[lengthCodeOf(symbols[i].length)]++;
+            distanceFrequencies[distanceCodeOf(symbols[i].value)]++;
+        }
+    }
+    literalFrequencies[ENDOFBLOCK]++;
+    useTwoSymbols(literalFrequencies, LITERALCODES);
+    useTwoSymbols(distanceFrequencies, DISTANCECODES);
+
+    HuffmanCode literals, distances;
+    buildLengths(literalFrequencies, LITERALCODES, MAXCODELENGTH, literals.lengths);
+    buildLengths(distanceFrequencies, DISTANCECODES, MAXCODELENGTH, distances.lengths);
+
+    int literalCount = LITERALCODES;
+    while (literals.lengths[literalCount - 1] == 0)
+        literalCount--;
+    int distanceCount = DISTANCECODES;
+    while (distances.lengths[distanceCount - 1] == 0)
+        distanceCount--;
+
+    // the code lengths of both codes are written one after the other,
+    // with runs of the same length written as a single code length
+    // code (16 repeats the last length, 17 and 18 write zeros).
+    BYTE allLengths[LITERALCODES + DISTANCECODES];
+    memcpy(allLengths, literals.lengths, literalCount);
+    memcpy(allLengths + literalCount, distances.lengths, distanceCount);
+    int total = literalCount + distanceCount;
+
+    LengthRun runs[LITERALCODES + DISTANCECODES];
+    int runCount = 0;
+    uint32_t codeLengthFrequencies[CODELENGTHCODES] = {0};
+    for (int i = 0; i < total;)
+    {
+        int value = allLengths[i];
+        int run = 1;
+        while (i + run < total && allLengths[i + run] == value)
+            run++;
+        i += run;
+
+        if (value == 0)
+        {
+            while (run >= 11)
+            {
+                int repeat = run < 138 ? run : 138;
+                addRun(runs, &runCount, 18, repeat - 11);
+                run -= repeat;
+            }
+            if (run >= 3)
+            {
+                addRun(runs, &runCount, 17, run - 3);
+                run = 0;
+            }
+        }
+        else
+        {
+            addRun(runs, &runCount, value, 0);
+            run--;
+            while (run >= 3)
+            {
+                int repeat = run < 6 ? run : 6;
+                addRun(runs, &runCount, 16, repeat - 3);
+                run -= repeat;
+            }
+        }
+
+        while (run-- > 0)
+            addRun(runs, &runCount, value, 0);
+    }
+
+    for (int i = 0; i < runCount; i++)
+        codeLengthFrequencies[runs[i].code]++;
+
+    HuffmanCode codeLengths;
+    buildLengths(codeLengthFrequencies, CODELENGTHCODES, MAXCODELENGTHCODELENGTH, codeLengths.lengths);
+    int codeLengthCount = CODELENGTHCODES;
+    while (codeLengthCount > 4 && codeLengths.lengths[codeLengthOrder[codeLengthCount - 1]] == 0)
+        codeLengthCount--;
+
+    // work out the size of the block, to compare it with stored blocks.
+    static const BYTE runExtraBits[CODELENGTHCODES] = {[16] = 2, [17] = 3, [18] = 7};
+    size_t bits = 3 + 5 + 5 + 4 + 3 * codeLengthCount;
+    for (int i = 0; i < runCount; i++)
+        bits += codeLengths.lengths[runs[i].code] + runExtraBits[runs[i].code];
+    for (int symbol = 0; symbol < LITERALCODES; symbol++)
+    {
+        size_t extra = symbol > ENDOFBLOCK ? deflateLengthExtra[symbol - 257] : 0;
+        bits += (size_t) literalFrequencies[symbol] * (literals.lengths[symbol] + extra);
+    }
+    for (int symbol = 0; symbol < DISTANCECODES; symbol++)
+        bits += (size_t) distanceFrequencies[symbol] * (distances.lengths[symbol] + deflateDistanceExtra[symbol]);
+
+    size_t storedBits = (length / MAXSTOREDLENGTH + 1) * (3 + 7 + 32) + length * BYTESIZE;
+    if (storedBits <= bits)
+    {
+        writeStored(writer, data, length);
+        return;
+    }
+
+    buildCodes(&literals, LITERALCODES);
+    buildCodes(&distances, DISTANCECODES);
+    buildCodes(&codeLengths, CODELENGTHCODES);
+
+    // the block header: not the last block, type 2 (its own codes).
+    putBits(writer, 0, 1);
+    putBits(writer, 2, 2);
+    putBits(writer, literalCount - 257, 5);
+    putBits(writer, distanceCount - 1, 5);
+    putBits(writer, codeLengthCount - 4, 4);
+    for (int i = 0; i < codeLengthCount; i++)
+        putBits(writer, codeLengths.lengths[codeLengthOrder[i]], 3);
+    for (int i = 0; i < runCount; i++)
+    {
+        putBits(writer, codeLengths.codes[runs[i].code], codeLengths.lengths[runs[i].code]);
+        putBits(writer, runs[i].extra, runExtraBits[runs[i].code]);
+    }
+
+    for (int i = 0; i < symbolCount; i++)
+    {
+        if (symbols[i].length == 0)
+        {
+            putBits(writer, literals.codes[symbols[i].value], literals.lengths[symbols[i].value]);
+            continue;
+        }
+
+        int length = symbols[i].length, distance = symbols[i].value;
+        int lengthCode = lengthCodeOf(length), distanceCode = distanceCodeOf(distance);
+        putBits(writer, literals.codes[lengthCode], literals.lengths[lengthCode]);
+        putBits(writer, length - deflateLengthBase[lengthCode - 257], deflateLengthExtra[lengthCode - 257]);
+        putBits(writer, distances.codes[distanceCode], distances.lengths[distanceCode]);
+        putBits(writer, distance - deflateDistanceBase[distanceCode], deflateDistanceExtra[distanceCode]);
+    }
+    putBits(writer, literals.codes[ENDOFBLOCK], literals.lengths[ENDOFBLOCK]);
+}
+
+
+// returns the hash of the 3 bytes at data.
+static uint32_t hashOf(const BYTE* data)
+{
+    uint32_t value = (uint32_t) data[0] | (uint32_t) data[1] << 8 | (uint32_t) data[2] << 16;
+    return value * 2654435761u >> (32 - DEFLATEHASHBITS);
+}
+
+
+// this function adds the position to the hash table.
+static void insertPosition(DeflateWork* work, const BYTE* base, int32_t position)
+{
+    uint32_t hash = hashOf(base + position);
+    work->previous[position & (DEFLATEWINDOWSIZE - 1)] = work->head[hash];
+    work->head[hash] = position;
+}
+
+
+// this function finds the longest match for the bytes at position
+// (up to end) in the positions before it.
+// returns its length (0 if there is none) and stores its distance.
+static int findMatch(const DeflateWork* work, const BYTE* base, int32_t position, int32_t end, int* distance)
+{
+    int longest = end - position < MAXMATCH ? end - position : MAXMATCH;
+    int best = 0;
+    const BYTE* current = base + position;
+
+    int32_t candidate = work->head[hashOf(current)];
+    for (int chain = 0; chain < MAXCHAIN && candidate >= 0 && candidate < position; chain++)
+    {
+        if (position - candidate > DEFLATEWINDOWSIZE)
+            break;
+
+        const BYTE* earlier = base + candidate;
+        if (earlier[best] == current[best])
+        {
+            int length = 0;
+            while (length < longest && earlier[length] == current[length])
+                length++;
+
+            if (length > best)
+            {
+                best = length;
+                *distance = position - candidate;
+                if (length == longest)
+                    break;
+            }
+        }
+
+        candidate = work->previous[candidate & (DEFLATEWINDOWSIZE - 1)];
+    }
+
+    return best >= MINMATCH ? best : 0;
+}
+
+
+// this function compresses length bytes of data into out, which must
+// have space for DEFLATEBOUND(length) bytes. the history bytes in front
+// of data (at most DEFLATEWINDOWSIZE) are not written but matches can
+// point into them. the output ends on a whole byte and is never the
+// last block of a stream (see deflateFinish()).
+// returns the number of bytes written to out.
+size_t deflateBlock(DeflateWork* work, const BYTE* data, size_t length, size_t history, BYTE* out)
+{
+    if (history > DEFLATEWINDOWSIZE)
+        history = DEFLATEWINDOWSIZE;
+
+    const BYTE* base = data - history;
+    int32_t end = history + length;
+    memset(work->head, 0xFF, sizeof(work->head));
+    for (int32_t position = 0; position < (int32_t) history && position + MINMATCH <= end; position++)
+        insertPosition(work, base, position);
+
+    BitWriter writer = {out, 0, 0, 0};
+    int32_t blockStart = history;
+    int symbolCount = 0;
+
+    for (int32_t position = history; position < end;)
+    {
+        int distance = 0;
+        int matchLength = end - position >= MINMATCH ? findMatch(work, base, position, end, &distance) : 0;
+
+        if (matchLength == 0)
+        {
+            work->symbols[symbolCount].length = 0;
+            work->symbols[symbolCount++].value = base[position];
+            if (position + MINMATCH <= end)
+                insertPosition(work, base, position);
+            position++;
+        }
+        else
+        {
+            work->symbols[symbolCount].length = matchLength;
+            work->symbols[symbolCount++].value = distance;
+
+            int inserted = matchLength <= MAXINSERTLENGTH ? matchLength : 1;
+            for (int i = 0; i < inserted && position + i + MINMATCH <= end; i++)
+                insertPosition(work, base, position + i);
+            position += matchLength;
+        }
+
+        if (symbolCount == DEFLATEMAXSYMBOLS || position == end)
+        {
+            writeBlock(&writer, work->symbols, symbolCount, base + blockStart, position - blockStart);
+            blockStart = position;
+            symbolCount = 0;
+        }
+    }
+
+    // an empty stored block, so that the output ends on a whole byte.
+    putBits(&writer, 0, 3);
+    alignWriter(&writer);
+    putBits(&writer, 0, 16);
+    putBits(&writer, 0xFFFF, 16);
+    return writer.position;
+}
+
+
+// this function writes the empty last block that ends a stream made
+// with deflateBlock(). returns the number of bytes written (2).
+size_t deflateFinish(BYTE* out)
+{
+    // bit 0: last block, bits 1 - 2: type 1 (fixed codes), then the 7
+    // bit end of block code, which is all zeros.
+    out[0] = 0x03;
+    out[1] = 0x00;
+    return 2;
+}
+
+
+// the adler32 checksum is worked out modulo this number, and the sums
+// can be left to grow for this many bytes before they overflow.
+#define ADLERBASE 65521
+#define ADLERMAXRUN 5552
+
+// this function adds length bytes of data to the adler32 checksum
+// (which starts at 1).
+uint32_t adler32(uint32_t adler, const BYTE* data, size_t length)
+{
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    while (length > 0)
+    {
+        size_t run = length < ADLERMAXRUN ? length : ADLERMAXRUN;
+        length -= run;
+        while (run-- > 0)
+        {
+            a += *data++;
+            b += a;
+        }
+        a %= ADLERBASE;
+        b %= ADLERBASE;
+    }
+
+    return b << 16 | a;
+}
+
+
+// this function returns the adler32 checksum of two pieces of data
+// one after the other, from the checksums of the pieces (the way zlib
+// does it).
+uint32_t adler32Combine(uint32_t first, uint32_t second, size_t secondLength)
+{
+    uint32_t rest = secondLength % ADLERBASE;
+    uint32_t a = first & 0xFFFF;
+    uint32_t b = (uint64_t) rest * a % ADLERBASE;
+    a += (second & 0xFFFF) + ADLERBASE - 1;
+    b += (first >> 16) + (second >> 16) + ADLERBASE - rest;
+
+    if (a >= ADLERBASE)
+        a -= ADLERBASE;
+    if (a >= ADLERBASE)
+        a -= ADLERBASE;
+    if (b >= 2 * ADLERBASE)
+        b -= 2 * ADLERBASE;
+    if (b >= ADLERBASE)
+        b -= ADLERBASE;
+
+    return b << 16 | a;
+}
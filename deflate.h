@@ -0,0 +1,59 @@
+// header file for the deflate compressor and the adler32 checksum
+
+#ifndef DEFLATE_H_
+#define DEFLATE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "helpers.h"
+
+// how far back a match can reach (the size of the window of the
+// decompressor).
+#define DEFLATEWINDOWSIZE 32768
+
+// the number of bits of the hash of 3 bytes that is used to find
+// matches.
+#define DEFLATEHASHBITS 15
+
+// the most symbols that are put in a single compressed block.
+#define DEFLATEMAXSYMBOLS 32768
+
+// the most bytes deflateBlock() writes for length bytes of data.
+#define DEFLATEBOUND(length) ((length) + ((length) / 16384 + 4) * 5 + 16)
+
+// a single literal or match found in the data: length is 0 for a
+// literal (value is the byte), otherwise the match is length bytes
+// that start value bytes back.
+typedef struct
+{
+    uint16_t length;
+    uint16_t value;
+} DeflateSymbol;
+
+// the memory deflateBlock() works in. every thread that compresses
+// needs one of its own.
+typedef struct
+{
+    int32_t head[1 << DEFLATEHASHBITS];
+    int32_t previous[DEFLATEWINDOWSIZE];
+    DeflateSymbol symbols[DEFLATEMAXSYMBOLS];
+} DeflateWork;
+
+
+// the first length and distance of every length and distance code
+// and the number of extra bits that follow the code (see RFC 1951).
+extern const uint16_t deflateLengthBase[29];
+extern const BYTE deflateLengthExtra[29];
+extern const uint16_t deflateDistanceBase[30];
+extern const BYTE deflateDistanceExtra[30];
+
+
+// function declarations
+size_t deflateBlock(DeflateWork* work, const BYTE* data, size_t length, size_t history, BYTE* out);
+size_t deflateFinish(BYTE* out);
+
+uint32_t adler32(uint32_t adler, const BYTE* data, size_t length);
+uint32_t adler32Combine(uint32_t first, uint32_t second, size_t secondLength);
+
+#endif
@@ -1,47 +1,58 @@
-// this file has helper functions required for writemessage.c
-// and readmessage.c to work.
+// this file has helper functions required for writemessage.c,
+// readmessage.c and batchmessage.c to work.
 
-#include <ctype.h>
-#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "helpers.h"
+#include "stego.h"
 
 
 // function to get a string from the user of any size.
-// this works by reallocating memory for the string every
-// time a character is typed in. If the user hits "enter"
-// i.e, inputs a new line character ('\n') then this function
-// stops taking inputs and returns the string (including the new
-// line character).
+// the characters are read into a buffer that doubles in size every
+// time it fills up. If the user hits "enter" i.e, inputs a new line
+// character ('\n') (or the input ends) then this function stops
+// taking inputs and returns the string (including the new line
+// character). returns NULL if there is not enough memory.
 char* get_string(char* prompt)
 {
-    // prints the prompt given.
-    printf("%s", prompt);
+    // prints the prompt given (to stderr, so that it doesn't get
+    // mixed with an output image written to stdout).
+    fprintf(stderr, "%s", prompt);
 
-    // character to store the input.
-    char c;
-
-    // string that stores all the inputted characters.
-    char* string = malloc(sizeof(char));
+    // string that stores all the inputted characters, and the number
+    // of characters it has space for (including the NUL character).
+    size_t capacity = 64;
+    char* string = malloc(capacity);
+    if (string == NULL)
+        return NULL;
 
     // index to keep track of number of characters inputted.
-    int i = 0;
+    size_t i = 0;
 
     // keeps taking inputs until new line character ('\n') is reached.
-    do{
-        // inputs a char into c.
-        scanf("%c", &c);
-
-        // reallocates memory to make space for the newly
-        // inputted character.
-        string = realloc(string, i + 1);
+    int c;
+    while ((c = getchar()) != EOF)
+    {
+        // make the string twice as big when it is full.
+        if (i + 1 == capacity)
+        {
+            capacity *= 2;
+            char* bigger = realloc(string, capacity);
+            if (bigger == NULL)
+            {
+                free(string);
+                return NULL;
+            }
+            string = bigger;
+        }
 
         // add the character to the string.
         string[i++] = c;
-    } while (c != '\n' && c != '\r' && c != EOF);
+        if (c == '\n' || c == '\r')
+            break;
+    }
 
     // add the terminating character (NUL or '\0') to indicate the
     // end of string.
@@ -52,172 +63,60 @@ char* get_string(char* prompt)
 }
 
 
-// this function checks if the file type is either
-// bmp, jpg or png (or unsupported).
-int checkFileType(FILE* in, FILE* out)
-{
-    // buffer to store the first 2 bytes in the input file
-    // that are the "signature" bytes (unique bytes that are
-    // different for every file type).
-    BYTE buffer[SIGNATUREBYTESIZE];
-
-    // set the cursor to the start of the file for both
-    // input and output files (if output file is given).
-    fseek(in, 0, SEEK_SET);
-
-    if (out != NULL)
-        fseek(out, 0, SEEK_SET);
-
-    // read the bytes into the buffer.
-    fread(buffer, SIGNATUREBYTESIZE, 1, in);
-    // write into the output file if given
-    if (out != NULL)
-        fwrite(buffer, SIGNATUREBYTESIZE, 1, out);
-
-    // combine the two 8-bit numbers into a single
-    // 16-bit number
-    int signatureBytes = buffer[0] << 8 | buffer[1];
-
-    // check which type of file it is and return the type.
-    if (signatureBytes == BMPSIGNATUREBYTES)
-        return BMP;
-    else if (signatureBytes == JPGSIGNATUREBYTES)
-        return JPG;
-    else if (signatureBytes == PNGSIGNATUREBYTES)
-        return PNG;
-    else
-        return UNSUPPORTEDTYPE;
-}
-
-
-// function to copy the header data of bmp file
-// from in to out.
-int copyHeaderForBMP(FILE* in, FILE* out)
-{
-    BYTE buffer[BITMAPHEADERSIZE - SIGNATUREBYTESIZE];
-    fread(buffer, BITMAPHEADERSIZE - SIGNATUREBYTESIZE, 1, in);
-    fwrite(buffer, BITMAPHEADERSIZE - SIGNATUREBYTESIZE, 1, out);
-
-    // header data contains the position of the start of pixel array
-    // calculate it, store it and return it.
-    int pixelArrayOffset = (((buffer[10] << 8) | buffer[9]) << 8) | buffer[8];
-    return pixelArrayOffset;
-}
-
-
-// function to read from in and write to out for the specified
-// number of bytes. If the number of bytes specified is -1,
-// read and write all the data from in to out.
-void readNWriteFor(int numberOfBytes, FILE* in, FILE* out)
+// decrypts the text of the given length in place. messages stored by
+// older versions were encrypted by subtracting the hash of the passkey
+// from every byte (new messages are encrypted by stego_encrypt()
+// instead). the hash of the passkey is worked out only once.
+// messages stored by the oldest versions (oldFormat is 1) were encrypted
+// with their new line characters left as they were, so those are left
+// as they are.
+void decryptText(BYTE* text, size_t length, char* passkey, int oldFormat)
 {
-    if (numberOfBytes == -1)
-    {
-        BYTE buffer[BYTESIZE];
-        while(fread(buffer, BYTESIZE, 1, in) != 0)
-            fwrite(buffer, BYTESIZE, 1, out);
-
-        return;
-    }
-    BYTE buffer[numberOfBytes];
-    fread(buffer, numberOfBytes, 1, in);
-    fwrite(buffer, numberOfBytes, 1, out);
-}
-
-// this function takes in a buffer of data and an int
-// (which can also be a char). It edits the LSB of the
-// bytes of data in the buffer to store the int/char.
-void editBufferToStoreChar(BYTE* buffer, int ch)
-{
-    for (int i = 0; i < 8; i++)
-    {
-        if (ch % 2 == 1)
-        {
-            changeLSBOf(&buffer[i], 1);
-        }
-        else
-            changeLSBOf(&buffer[i], 0);
-
-        ch /= 2;
-    }
-}
-
-
-// this function changes the LSB of the given BYTE
-// of data to the specified bit.
-void changeLSBOf(BYTE* byte, int toWhat)
-{
-    if ((int)(*byte) % 2 == toWhat)
-        return;
+    int hashNum = hash(passkey);
 
-    else
+    for (size_t i = 0; i < length; i++)
     {
-        if (toWhat == 1)
-            *byte = ((int)*byte) + 1;
-        else
-            *byte = ((int)*byte) - 1;
+        if (oldFormat == 0 || text[i] != '\n')
+            text[i] = (text[i] + hashNum);
     }
 }
 
 
-// this function reads the LSB of each byte in the
-// buffer, calculates it into a single integer, and
-// prints it as a char.
-int readCharFromLSBAndPrint(BYTE* buffer, char* passkey)
+// decrypts a message that was not encrypted by stego_encrypt() (its
+// header has no STEGO_ENCRYPTED) with the passkey. only the versions up
+// to STEGO_SHIFTVERSION encrypted such a message (with decryptText()),
+// a newer one is stored as it is and is left alone.
+// returns 1 if it was decrypted and 0 if the passkey was not needed.
+int decryptOldMessage(BYTE* message, size_t length, char* passkey, int version)
 {
-    int ch = 0;
-    for (int i = 0; i < BYTESIZE; i++)
-    {
-        ch += (buffer[i] % 2) * pow(2, i);
-    }
-
-    if (passkey != NULL && ch != 0)
-        ch = decryptChar(ch, passkey);
+    if (version > STEGO_SHIFTVERSION)
+        return 0;
 
-    printf("%c", ch);
-
-    // if the buffer contained the special sequence to indicate the end of string
-    // i.e, 0000 0000 or just 0, then return 1 to signify that all of the text
-    // was printed.
-    if (ch == 0)
-        return 1;
-
-    // if end of text not reached, return 0.
-    return 0;
+    decryptText(message, length, passkey, version == 0);
+    return 1;
 }
 
 
-// this function reads the header of a bmp file and returns the pixel
-// array position of the said file that is stored in the header.
-int readHeaderForBMP(FILE* file)
-{
-    BYTE buffer[BITMAPHEADERSIZE - SIGNATUREBYTESIZE];
-    fread(buffer, 1, BITMAPHEADERSIZE - SIGNATUREBYTESIZE, file);
-
-    int pixelArrayOffset = (((buffer[10] << 8) | buffer[9]) << 8) | buffer[8];
-    return pixelArrayOffset;
-}
-
-// this function applies a simple encryption algorithm on the
-// given text.
-void encrypt(char* text, char* passkey)
+// tells if the bytes read from an image that has no header (after they
+// are decrypted) are a message stored by the first versions. in a jpg
+// or png it is anything after the end of the image. in a bmp it is the
+// text up to the first 0 byte in the LSBs of the pixels, and the pixels
+// of any bmp have one, so only text (no control characters other than
+// tabs and new lines) is taken for a message there.
+// returns 1 if it is a message and 0 if it isn't.
+int isOldMessage(const BYTE* message, size_t length, int isBMP)
 {
-    int hashNum = hash(passkey),  len = strlen(text);
+    if (length == 0)
+        return 0;
 
-    for (int i = 0; i < len; i++)
+    for (size_t i = 0; isBMP && i < length; i++)
     {
-        text[i] = (text[i] - hashNum);
+        BYTE c = message[i];
+        if ((c < ' ' && c != '\t' && c != '\n' && c != '\r') || c == 0x7F)
+            return 0;
     }
-    text[len - 1] = '\n';
-}
 
-// decrypts the char passed.
-char decryptChar(char c, char* passkey)
-{
-    if (c == '\n')
-        return c;
-
-    int hashNum = hash(passkey);
-    return (c + hashNum);
+    return 1;
 }
 
 // generates a simple hash for given passkey.
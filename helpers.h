@@ -3,15 +3,14 @@
 #ifndef HELPERS_H_
 #define HELPERS_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 // naming the unsigned 8-bit integer type
 // (included in ctype.h) to BYTE
 typedef __uint8_t BYTE;
 
 // macros for everything
-#define BMP 1
-#define JPG 2
-#define PNG 3
-#define UNSUPPORTEDTYPE -1
 #define BITMAPHEADERSIZE 14
 #define BMPSIGNATUREBYTES 0x424D
 #define JPGSIGNATUREBYTES 0xFFD8
@@ -24,18 +23,10 @@ typedef __uint8_t BYTE;
 
 // functions that are used only in writemessage.c
 char* get_string(char* prompt);
-int checkFileType(FILE* in, FILE* out);
-int copyHeaderForBMP(FILE* in, FILE* out);
-void readNWriteFor(int numberOfBytes, FILE* in, FILE* out);
-void editBufferToStoreChar(BYTE* buffer, int ch);
-void changeLSBOf(BYTE* byte, int toWhat);
-
-// functions that are used only in readmessage.c
-int readCharFromLSBAndPrint(BYTE* buffer, char* passkey);
-int readHeaderForBMP(FILE* file);
-
-void encrypt(char* text, char* passkey);
-char decryptChar(char c, char* passkey);
+
+void decryptText(BYTE* text, size_t length, char* passkey, int oldFormat);
+int decryptOldMessage(BYTE* message, size_t length, char* passkey, int version);
+int isOldMessage(const BYTE* message, size_t length, int isBMP);
 int hash(char* passkey);
 
 #endif
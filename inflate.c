@@ -0,0 +1,455 @@
+// this file has the zlib decompressor (RFC 1950 and 1951) that libstego
+// uses to read the pixels of a png a few rows at a time.
+//
+// the compressed data is given a piece at a time by a function (the
+// IDAT chunks of a png for example) and the output is asked for a
+// piece at a time with inflateRead(), so the whole output never has
+// to be in memory: only the last 32 KB of it are kept, which is as far
+// back as a match can point.
+//
+// huffman codes of up to INFLATEFASTBITS bits are decoded with a
+// single table lookup, longer (rare) ones a bit at a time. the adler32
+// checksum at the end of the stream is not checked.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "deflate.h"
+#include "helpers.h"
+#include "inflate.h"
+
+// what the decompressor is doing.
+#define ZLIBHEADER 0
+#define BLOCKHEADER 1
+#define STORED 2
+#define CODES 3
+#define COPY 4
+#define DONE 5
+
+// the longest huffman code.
+#define MAXCODELENGTH 15
+
+// the end of block code.
+#define ENDOFBLOCK 256
+
+// the order the lengths of the code length codes are written in.
+static const BYTE codeLengthOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+
+// this function starts decompressing a zlib stream whose compressed
+// data is given by the input function.
+void inflateStart(Inflater* inflater, InflateInput input, void* context)
+{
+    inflater->input = input;
+    inflater->context = context;
+    inflater->next = NULL;
+    inflater->available = 0;
+    inflater->bits = 0;
+    inflater->bitCount = 0;
+    inflater->paddingBits = 0;
+    inflater->state = ZLIBHEADER;
+    inflater->lastBlock = 0;
+    inflater->storedLeft = 0;
+    inflater->copyLength = 0;
+    inflater->copyDistance = 0;
+    inflater->failed = 0;
+    inflater->total = 0;
+}
+
+
+// this function makes sure the next piece of input is there.
+// returns 0 if there is no more input.
+static int refill(Inflater* inflater)
+{
+    while (inflater->available == 0 && inflater->input != NULL)
+    {
+        inflater->available = inflater->input(inflater->context, &inflater->next);
+        if (inflater->available == 0)
+            inflater->input = NULL;
+    }
+
+    return inflater->available > 0;
+}
+
+
+// this function loads bytes into the bit buffer until it has at least
+// count bits. zeros are loaded after the end of the input (a huffman
+// code is looked up with more bits than it may have), using them is
+// an error (see dropBits()).
+static void needBits(Inflater* inflater, int count)
+{
+    while (inflater->bitCount < count)
+    {
+        BYTE byte = 0;
+        if (refill(inflater))
+        {
+            byte = *inflater->next++;
+            inflater->available--;
+        }
+        else
+            inflater->paddingBits += BYTESIZE;
+
+        inflater->bits |= (uint64_t) byte << inflater->bitCount;
+        inflater->bitCount += BYTESIZE;
+    }
+}
+
+
+static void dropBits(Inflater* inflater, int count)
+{
+    inflater->bits >>= count;
+    inflater->bitCount -= count;
+    if (inflater->bitCount < inflater->paddingBits)
+        inflater->failed = 1;
+}
+
+
+static uint32_t getBits(Inflater* inflater, int count)
+{
+    needBits(inflater, count);
+    uint32_t value = inflater->bits & (((uint64_t) 1 << count) - 1);
+    dropBits(inflater, count);
+    return value;
+}
+
+
+// this function builds the huffman code for the code lengths of count
+// symbols. returns 1 if it could and 0 if there are more codes of
+// some length than can exist.
+static int buildCode(InflateCode* code, const BYTE* lengths, int count)
+{
+    memset(code->counts, 0, sizeof(code->counts));
+    for (int symbol = 0; symbol < count; symbol++)
+        code->counts[lengths[symbol]]++;
+    code->counts[0] = 0;
+
+    int left = 1;
+    for (int length = 1; length <= MAXCODELENGTH; length++)
+    {
+        left = (left << 1) - code->counts[length];
+        if (left < 0)
+            return 0;
+    }
+
+    // the symbols sorted by the length of their code.
+    int offsets[MAXCODELENGTH + 1];
+    offsets[1] = 0;
+    for (int length = 1; length < MAXCODELENGTH; length++)
+        offsets[length + 1] = offsets[length] + code->counts[length];
+    for (int symbol = 0; symbol < count; symbol++)
+    {
+        if (lengths[symbol] != 0)
+            code->symbols[offsets[lengths[symbol]]++] = symbol;
+    }
+
+    // the short codes go in the table, once for every value the bits
+    // after them can have. the codes are stored with their first bit
+    // in the least significant bit.
+    memset(code->fast, 0, sizeof(code->fast));
+    int value = 0, index = 0;
+    for (int length = 1; length <= INFLATEFASTBITS; length++)
+    {
+        for (int i = 0; i < code->counts[length]; i++, value++, index++)
+        {
+            int reversed = 0;
+            for (int bit = 0; bit < length; bit++)
+                reversed |= (value >> bit & 1) << (length - 1 - bit);
+
+            for (int entry = reversed; entry < 1 << INFLATEFASTBITS; entry += 1 << length)
+                code->fast[entry] = code->symbols[index] << 4 | length;
+        }
+        value <<= 1;
+    }
+
+    return 1;
+}
+
+
+// this function decodes the next symbol with the code.
+// returns the symbol or -1 if the bits are not a code.
+static int decodeSymbol(Inflater* inflater, const InflateCode* code)
+{
+    needBits(inflater, MAXCODELENGTH);
+    int entry = code->fast[inflater->bits & ((1 << INFLATEFASTBITS) - 1)];
+    if (entry != 0)
+    {
+        dropBits(inflater, entry & 15);
+        return entry >> 4;
+    }
+
+    // a long code, the codes of every length follow the codes of the
+    // length before it.
+    uint64_t bits = inflater->bits;
+    int value = 0, first = 0, index = 0;
+    for (int length = 1; length <= MAXCODELENGTH; length++)
+    {
+        value |= bits & 1;
+        bits >>= 1;
+
+        int count = code->counts[length];
+        if (value - first < count)
+        {
+            dropBits(inflater, length);
+            return code->symbols[index + value - first];
+        }
+
+        index += count;
+        first = (first + count) << 1;
+        value <<= 1;
+    }
+
+    inflater->failed = 1;
+    return -1;
+}
+
+
+// this function builds the codes of a block that uses the fixed codes.
+static void fixedCodes(Inflater* inflater)
+{
+    BYTE lengths[288];
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 112);
+    memset(lengths + 256, 7, 24);
+    memset(lengths + 280, 8, 8);
+    buildCode(&inflater->literals, lengths, 288);
+
+    memset(lengths, 5, 30);
+    buildCode(&inflater->distances, lengths, 30);
+}
+
+
+// this function reads the codes of a block that has its own codes.
+// returns 1 if they make sense and 0 if they don't.
+static int readCodes(Inflater* inflater)
+{
+    int literalCount = getBits(inflater, 5) + 257;
+    int distanceCount = getBits(inflater, 5) + 1;
+    int codeLengthCount = getBits(inflater, 4) + 4;
+    if (literalCount > 286 || distanceCount > 30)
+        return 0;
+
+    BYTE lengths[286 + 30] = {0};
+    for (int i = 0; i < codeLengthCount; i++)
+        lengths[codeLengthOrder[i]] = getBits(inflater, 3);
+
+    InflateCode codeLengths;
+    if (!buildCode(&codeLengths, lengths, 19))
+        return 0;
+
+    // the code lengths of both codes, with runs of the same length
+    // written as a single symbol (16 repeats the last length, 17 and
+    // 18 write zeros).
+    int total = literalCount + distanceCount;
+    for (int i = 0; i < total && !inflater->failed;)
+    {
+        int symbol = decodeSymbol(inflater, &codeLengths);
+        if (symbol < 0)
+            return 0;
+
+        if (symbol < 16)
+        {
+            lengths[i++] = symbol;
+            continue;
+        }
+
+        int value = 0, repeat;
+        if (symbol == 16)
+        {
+            if (i == 0)
+                return 0;
+            value = lengths[i - 1];
+            repeat = 3 + getBits(inflater, 2);
+        }
+        else if (symbol == 17)
+            repeat = 3 + getBits(inflater, 3);
+        else
+            repeat = 11 + getBits(inflater, 7);
+
+        if (repeat > total - i)
+            return 0;
+        memset(lengths + i, value, repeat);
+        i += repeat;
+    }
+
+    return lengths[ENDOFBLOCK] != 0 && buildCode(&inflater->literals, lengths, literalCount)
+           && buildCode(&inflater->distances, lengths + literalCount, distanceCount);
+}
+
+
+// this function adds output bytes to the window.
+static void addToWindow(Inflater* inflater, const BYTE* bytes, size_t length)
+{
+    if (length > DEFLATEWINDOWSIZE)
+    {
+        inflater->total += length - DEFLATEWINDOWSIZE;
+        bytes += length - DEFLATEWINDOWSIZE;
+        length = DEFLATEWINDOWSIZE;
+    }
+
+    while (length > 0)
+    {
+        size_t position = inflater->total & (DEFLATEWINDOWSIZE - 1);
+        size_t piece = DEFLATEWINDOWSIZE - position < length ? DEFLATEWINDOWSIZE - position : length;
+        memcpy(inflater->window + position, bytes, piece);
+        inflater->total += piece;
+        bytes += piece;
+        length -= piece;
+    }
+}
+
+
+// this function copies up to count bytes of a stored block to out.
+// returns the number of bytes copied.
+static size_t readStored(Inflater* inflater, BYTE* out, size_t count)
+{
+    if (count > inflater->storedLeft)
+        count = inflater->storedLeft;
+
+    // the bytes that are already in the bit buffer come first.
+    size_t copied = 0;
+    while (copied < count && inflater->bitCount >= BYTESIZE)
+        out[copied++] = getBits(inflater, BYTESIZE);
+
+    while (copied < count && !inflater->failed)
+    {
+        if (!refill(inflater))
+        {
+            inflater->failed = 1;
+            break;
+        }
+
+        size_t piece = count - copied < inflater->available ? count - copied : inflater->available;
+        memcpy(out + copied, inflater->next, piece);
+        inflater->next += piece;
+        inflater->available -= piece;
+        copied += piece;
+    }
+
+    addToWindow(inflater, out, copied);
+    inflater->storedLeft -= copied;
+    return copied;
+}
+
+
+// this function reads the header of the next block.
+static void readBlockHeader(Inflater* inflater)
+{
+    if (inflater->lastBlock)
+    {
+        inflater->state = DONE;
+        return;
+    }
+
+    inflater->lastBlock = getBits(inflater, 1);
+    int type = getBits(inflater, 2);
+    if (type == 0)
+    {
+        // a stored block starts on a whole byte.
+        dropBits(inflater, inflater->bitCount % BYTESIZE);
+        uint32_t length = getBits(inflater, 16);
+        uint32_t check = getBits(inflater, 16);
+        if (length != (~check & 0xFFFF))
+            inflater->failed = 1;
+
+        inflater->storedLeft = length;
+        inflater->state = STORED;
+    }
+    else if (type == 1)
+    {
+        fixedCodes(inflater);
+        inflater->state = CODES;
+    }
+    else if (type == 2 && readCodes(inflater))
+        inflater->state = CODES;
+    else
+        inflater->failed = 1;
+}
+
+
+// this function decompresses up to count bytes into out.
+// returns the number of bytes decompressed, which is less than count
+// only at the end of the stream or if the stream is damaged (failed is
+// set then).
+size_t inflateRead(Inflater* inflater, BYTE* out, size_t count)
+{
+    size_t produced = 0;
+    while (produced < count && !inflater->failed)
+    {
+        if (inflater->state == ZLIBHEADER)
+        {
+            // compression method 8 (deflate), no preset dictionary and
+            // a multiple of 31.
+            int method = getBits(inflater, BYTESIZE);
+            int flags = getBits(inflater, BYTESIZE);
+            if ((method & 15) != 8 || (method << 8 | flags) % 31 != 0 || (flags & 0x20) != 0)
+                inflater->failed = 1;
+            inflater->state = BLOCKHEADER;
+        }
+        else if (inflater->state == BLOCKHEADER)
+            readBlockHeader(inflater);
+        else if (inflater->state == STORED)
+        {
+            if (inflater->storedLeft == 0)
+                inflater->state = BLOCKHEADER;
+            else
+                produced += readStored(inflater, out + produced, count - produced);
+        }
+        else if (inflater->state == CODES)
+        {
+            int symbol = decodeSymbol(inflater, &inflater->literals);
+            if (symbol < 0)
+                break;
+
+            if (symbol < ENDOFBLOCK)
+            {
+                out[produced++] = symbol;
+                inflater->window[inflater->total++ & (DEFLATEWINDOWSIZE - 1)] = symbol;
+                continue;
+            }
+            if (symbol == ENDOFBLOCK)
+            {
+                inflater->state = BLOCKHEADER;
+                continue;
+            }
+
+            // a match: the length code and its extra bits, then the
+            // distance code and its extra bits.
+            symbol -= 257;
+            if (symbol >= 29)
+            {
+                inflater->failed = 1;
+                break;
+            }
+            inflater->copyLength = deflateLengthBase[symbol] + getBits(inflater, deflateLengthExtra[symbol]);
+
+            int distanceSymbol = decodeSymbol(inflater, &inflater->distances);
+            if (distanceSymbol < 0 || distanceSymbol >= 30)
+            {
+                inflater->failed = 1;
+                break;
+            }
+            inflater->copyDistance = deflateDistanceBase[distanceSymbol]
+                                     + getBits(inflater, deflateDistanceExtra[distanceSymbol]);
+            if ((uint64_t) inflater->copyDistance > inflater->total)
+                inflater->failed = 1;
+            inflater->state = COPY;
+        }
+        else if (inflater->state == COPY)
+        {
+            while (inflater->copyLength > 0 && produced < count)
+            {
+                BYTE byte = inflater->window[(inflater->total - inflater->copyDistance) & (DEFLATEWINDOWSIZE - 1)];
+                out[produced++] = byte;
+                inflater->window[inflater->total++ & (DEFLATEWINDOWSIZE - 1)] = byte;
+                inflater->copyLength--;
+            }
+
+            if (inflater->copyLength == 0)
+                inflater->state = CODES;
+        }
+        else
+            break;
+    }
+
+    return produced;
+}
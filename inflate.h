@@ -0,0 +1,65 @@
+// header file for the streaming zlib decompressor
+
+#ifndef INFLATE_H_
+#define INFLATE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "deflate.h"
+#include "helpers.h"
+
+// the number of bits of a code that are looked up in the fast tables,
+// longer codes are decoded a bit at a time.
+#define INFLATEFASTBITS 10
+
+// the function that gives the decompressor its input a piece at a
+// time: it points bytes at the next piece and returns its length, or
+// 0 when there is no more.
+typedef size_t (*InflateInput)(void* context, const BYTE** bytes);
+
+// a huffman code of the compressed data: the number of codes of every
+// length and the symbols in the order of their codes, and a table that
+// gives the symbol (and the length of its code) of the next
+// INFLATEFASTBITS bits (0 for a longer code).
+typedef struct
+{
+    uint16_t counts[16];
+    uint16_t symbols[288];
+    uint16_t fast[1 << INFLATEFASTBITS];
+} InflateCode;
+
+// the state of a stream that is being decompressed, so that the output
+// can be asked for a piece at a time. only the last DEFLATEWINDOWSIZE
+// bytes of the output are kept (matches can point back that far).
+typedef struct
+{
+    InflateInput input;
+    void* context;
+    const BYTE* next;
+    size_t available;
+
+    uint64_t bits;
+    int bitCount;
+    int paddingBits;
+
+    int state;
+    int lastBlock;
+    size_t storedLeft;
+    int copyLength;
+    int copyDistance;
+    int failed;
+
+    uint64_t total;
+    BYTE window[DEFLATEWINDOWSIZE];
+
+    InflateCode literals;
+    InflateCode distances;
+} Inflater;
+
+
+// function declarations
+void inflateStart(Inflater* inflater, InflateInput input, void* context);
+size_t inflateRead(Inflater* inflater, BYTE* out, size_t count);
+
+#endif
@@ -0,0 +1,797 @@
+// this file stores a message in the DCT coefficients of a baseline jpg
+// (and reads it back), for the jpg path of stego.c.
+//
+// the pixels of a jpg are stored as blocks of 8x8 DCT coefficients
+// that are quantized (divided and rounded) and then huffman coded into
+// a single stream of bits, the entropy coded data of the scan. the
+// image is never turned into pixels here: the scan is huffman decoded
+// a block at a time, the message goes into the lowest bit of the AC
+// coefficients that are not 0, 1 or -1, and the block is huffman coded
+// again with the tables of the image.
+//
+// the lowest bit of such a coefficient can change without changing
+// its size (the number of bits it takes), so its huffman symbol stays
+// the same and only its extra bits change, and it never becomes 0, 1
+// or -1, so the coefficients that hold the message are the same ones
+// when it is read back. the scan only changes size where a 0xFF byte
+// appears or disappears (it is written as 0xFF00).
+//
+// huffman codes of up to JPGFASTBITS bits (almost all of them) are
+// decoded with a single table lookup, longer ones a length at a time.
+// the entropy coded data is read 8 bytes at a time and written 4 bytes
+// at a time, unless there is a 0xFF byte among them.
+// only baseline and extended huffman coded jpgs with a single scan can
+// do this, progressive and arithmetic coded ones can't.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "helpers.h"
+#include "jpgcoefficients.h"
+#include "jpgmarkers.h"
+#include "stego.h"
+
+// the number of bits the bit buffer of the reader holds.
+#define BUFFERBITS 64
+
+// the longest huffman code.
+#define MAXCODELENGTH 16
+
+// the number of coefficients in a block.
+#define BLOCKSIZE 64
+
+// the run and size of the symbol for 16 zero coefficients in a row.
+#define ZERORUN 0xF0
+
+
+// this function builds a huffman table from the number of codes of
+// every length (1 - 16) and the symbols in the order of their codes.
+// returns 1 if the table makes sense and 0 if it doesn't.
+static int buildHuffman(JPGHuffman* table, const BYTE* counts, const BYTE* values, int valueCount)
+{
+    memset(table, 0, sizeof(*table));
+    memcpy(table->values, values, valueCount);
+
+    // the codes of every length are the numbers after the last code of
+    // the length before it (doubled).
+    int32_t code = 0;
+    int k = 0;
+    for (int length = 1; length <= MAXCODELENGTH; length++)
+    {
+        table->valueOffset[length] = k - code;
+        for (int i = 0; i < counts[length - 1]; i++, k++, code++)
+        {
+            // there are more codes than fit in this length.
+            if (code >= 1 << length)
+                return 0;
+
+            BYTE symbol = values[k];
+            table->codes[symbol] = code;
+            table->codeLengths[symbol] = length;
+
+            if (length <= JPGFASTBITS)
+            {
+                int shift = JPGFASTBITS - length;
+                for (int fill = 0; fill < 1 << shift; fill++)
+                    table->fast[code << shift | fill] = length << 8 | symbol;
+            }
+        }
+
+        table->maxCode[length] = counts[length - 1] > 0 ? code - 1 : -1;
+        code <<= 1;
+    }
+
+    table->defined = 1;
+    return 1;
+}
+
+
+// this function reads the huffman tables of a DHT segment.
+// returns STEGO_OK or STEGO_BADIMAGE.
+static int readHuffmanTables(JPGCoefficients* jpg, const BYTE* data, size_t length)
+{
+    while (length > 0)
+    {
+        if (length < 1 + MAXCODELENGTH)
+            return STEGO_BADIMAGE;
+
+        int tableClass = data[0] >> 4, number = data[0] & 15;
+        int valueCount = 0;
+        for (int i = 0; i < MAXCODELENGTH; i++)
+            valueCount += data[1 + i];
+        if (tableClass > 1 || number > 3 || valueCount > 256 || length < 1 + MAXCODELENGTH + (size_t) valueCount)
+            return STEGO_BADIMAGE;
+
+        JPGHuffman* table = tableClass == 0 ? &jpg->dc[number] : &jpg->ac[number];
+        if (!buildHuffman(table, data + 1, data + 1 + MAXCODELENGTH, valueCount))
+            return STEGO_BADIMAGE;
+
+        data += 1 + MAXCODELENGTH + valueCount;
+        length -= 1 + MAXCODELENGTH + valueCount;
+    }
+
+    return STEGO_OK;
+}
+
+
+// this function reads the SOF segment of a baseline (or extended)
+// jpg: the size of the image and its components.
+// returns STEGO_OK, STEGO_NOPIXELS or STEGO_BADIMAGE.
+static int readFrame(JPGCoefficients* jpg, const BYTE* data, size_t length)
+{
+    if (length < 6)
+        return STEGO_BADIMAGE;
+
+    jpg->height = data[1] << 8 | data[2];
+    jpg->width = data[3] << 8 | data[4];
+    jpg->componentCount = data[5];
+    if (jpg->componentCount < 1 || jpg->componentCount > 4 || length < 6 + 3 * (size_t) jpg->componentCount
+        || jpg->width == 0)
+        return STEGO_BADIMAGE;
+
+    // a height of 0 is given later by a DNL segment, which is very rare.
+    if (jpg->height == 0 || (data[0] != 8 && data[0] != 12))
+        return STEGO_NOPIXELS;
+
+    for (int i = 0; i < jpg->componentCount; i++)
+    {
+        const BYTE* component = data + 6 + 3 * i;
+        jpg->components[i].id = component[0];
+        jpg->components[i].horizontal = component[1] >> 4;
+        jpg->components[i].vertical = component[1] & 15;
+        if (jpg->components[i].horizontal < 1 || jpg->components[i].horizontal > 4
+            || jpg->components[i].vertical < 1 || jpg->components[i].vertical > 4)
+            return STEGO_BADIMAGE;
+    }
+
+    return STEGO_OK;
+}
+
+
+// returns a / b rounded up.
+static long divideUp(long a, long b)
+{
+    return (a + b - 1) / b;
+}
+
+
+// this function reads the SOS segment and works out the blocks of
+// every minimum coded unit (MCU) of the scan and how many there are.
+// returns STEGO_OK, STEGO_NOPIXELS or STEGO_BADIMAGE.
+static int readScan(JPGCoefficients* jpg, const BYTE* data, size_t length)
+{
+    if (length < 1)
+        return STEGO_BADIMAGE;
+
+    int scanCount = data[0];
+    if (length < 1 + 2 * (size_t) scanCount + 3)
+        return STEGO_BADIMAGE;
+
+    // every component has to be in this scan, and all of its
+    // coefficients (a progressive scan only has some of them).
+    const BYTE* spectral = data + 1 + 2 * scanCount;
+    if (scanCount != jpg->componentCount || spectral[0] != 0 || spectral[1] != BLOCKSIZE - 1 || spectral[2] != 0)
+        return STEGO_NOPIXELS;
+
+    int horizontalMax = 1, verticalMax = 1;
+    for (int i = 0; i < jpg->componentCount; i++)
+    {
+        if (jpg->components[i].horizontal > horizontalMax)
+            horizontalMax = jpg->components[i].horizontal;
+        if (jpg->components[i].vertical > verticalMax)
+            verticalMax = jpg->components[i].vertical;
+    }
+
+    jpg->blocksPerMCU = 0;
+    for (int i = 0; i < scanCount; i++)
+    {
+        int component = 0;
+        while (component < jpg->componentCount && jpg->components[component].id != data[1 + 2 * i])
+            component++;
+        if (component == jpg->componentCount)
+            return STEGO_BADIMAGE;
+
+        JPGComponent* c = &jpg->components[component];
+        c->dcTable = data[2 + 2 * i] >> 4;
+        c->acTable = data[2 + 2 * i] & 15;
+        if (c->dcTable > 3 || c->acTable > 3 || !jpg->dc[c->dcTable].defined || !jpg->ac[c->acTable].defined)
+            return STEGO_BADIMAGE;
+
+        // the blocks of the component in the MCU, left to right and top
+        // to bottom (a scan with a single component has MCUs of a
+        // single block).
+        int blocks = scanCount == 1 ? 1 : c->horizontal * c->vertical;
+        if (jpg->blocksPerMCU + blocks > JPGMAXBLOCKSPERMCU)
+            return STEGO_BADIMAGE;
+        for (int block = 0; block < blocks; block++)
+            jpg->mcuComponents[jpg->blocksPerMCU++] = component;
+    }
+
+    if (scanCount == 1)
+    {
+        const JPGComponent* c = &jpg->components[jpg->mcuComponents[0]];
+        long columns = divideUp(divideUp(jpg->width * c->horizontal, horizontalMax), 8);
+        long rows = divideUp(divideUp(jpg->height * c->vertical, verticalMax), 8);
+        jpg->mcuCount = columns * rows;
+    }
+    else
+        jpg->mcuCount = divideUp(jpg->width, 8 * horizontalMax) * divideUp(jpg->height, 8 * verticalMax);
+
+    return STEGO_OK;
+}
+
+
+// returns 1 for the SOF markers of the jpgs that can't hold a message
+// in their coefficients (progressive, lossless, hierarchical and
+// arithmetic coded ones).
+static int isOtherFrame(int marker)
+{
+    return marker >= 0xC2 && marker <= 0xCF && marker != JPGHUFFMANTABLE && marker != 0xC8;
+}
+
+
+// this function reads the segments before the scan: the huffman
+// tables, the frame, the restart interval and the scan header.
+// returns STEGO_OK, STEGO_NOPIXELS or STEGO_BADIMAGE.
+static int readSegments(JPGCoefficients* jpg)
+{
+    const BYTE* image = jpg->image;
+    size_t size = jpg->size;
+    size_t position = SIGNATUREBYTESIZE;
+    int frame = 0;
+
+    while (position < size)
+    {
+        if (image[position] != JPGMARKERPREFIX)
+            return STEGO_BADIMAGE;
+
+        // skip fill bytes.
+        while (position < size && image[position] == JPGMARKERPREFIX)
+            position++;
+        if (position >= size)
+            return STEGO_BADIMAGE;
+
+        int marker = image[position++];
+        if ((marker >= JPGFIRSTRESTART && marker <= JPGLASTRESTART) || marker == JPGTEMPORARY)
+            continue;
+        if (marker == 0x00 || marker == JPGSTARTOFIMAGE || marker == JPGENDOFIMAGE)
+            return STEGO_BADIMAGE;
+
+        if (size - position < JPGLENGTHSIZE)
+            return STEGO_BADIMAGE;
+        size_t length = image[position] << 8 | image[position + 1];
+        if (length < JPGLENGTHSIZE || length > size - position)
+            return STEGO_BADIMAGE;
+
+        const BYTE* data = image + position + JPGLENGTHSIZE;
+        size_t dataLength = length - JPGLENGTHSIZE;
+        position += length;
+
+        int result = STEGO_OK;
+        if (marker == JPGHUFFMANTABLE)
+            result = readHuffmanTables(jpg, data, dataLength);
+        else if (marker == JPGBASELINE || marker == JPGEXTENDED)
+        {
+            result = readFrame(jpg, data, dataLength);
+            frame = 1;
+        }
+        else if (isOtherFrame(marker) || marker == JPGARITHMETICTABLE)
+            return STEGO_NOPIXELS;
+        else if (marker == JPGRESTARTINTERVAL)
+        {
+            if (dataLength < 2)
+                return STEGO_BADIMAGE;
+            jpg->restartInterval = data[0] << 8 | data[1];
+        }
+        else if (marker == JPGSTARTOFSCAN)
+        {
+            if (!frame)
+                return STEGO_BADIMAGE;
+            jpg->scanStart = position;
+            return readScan(jpg, data, dataLength);
+        }
+
+        if (result != STEGO_OK)
+            return result;
+    }
+
+    return STEGO_BADIMAGE;
+}
+
+
+// returns the 8 bytes as a big endian number.
+static inline uint64_t readBigEndian64(const BYTE* bytes)
+{
+    return (uint64_t) bytes[0] << 56 | (uint64_t) bytes[1] << 48 | (uint64_t) bytes[2] << 40
+           | (uint64_t) bytes[3] << 32 | (uint64_t) bytes[4] << 24 | (uint64_t) bytes[5] << 16
+           | (uint64_t) bytes[6] << 8 | bytes[7];
+}
+
+
+// this function loads bytes of the entropy coded data into the bit
+// buffer a byte at a time until it has at least 56 bits. 0xFF00 is a
+// 0xFF byte. zeros are loaded at a marker (a restart marker or the
+// end of the scan), using them is an error (see decodeBlock()).
+static void fillBitsSlowly(JPGBitReader* reader)
+{
+    const BYTE* data = reader->data;
+    while (reader->count <= BUFFERBITS - 8)
+    {
+        uint64_t byte = 0;
+        if (reader->position < reader->end && data[reader->position] != JPGMARKERPREFIX)
+            byte = data[reader->position++];
+        else if (reader->position + 1 < reader->end && data[reader->position + 1] == 0x00)
+        {
+            byte = JPGMARKERPREFIX;
+            reader->position += 2;
+        }
+        else
+            reader->padding += 8;
+
+        reader->bits |= byte << (BUFFERBITS - 8 - reader->count);
+        reader->count += 8;
+    }
+}
+
+
+// this function fills the bit buffer so that it has at least 56 bits.
+// most of the time there is no 0xFF byte in the next 8, so they are
+// loaded at once. the bits after the ones that are counted are the
+// start of the next byte, which is loaded again the next time.
+static inline void fillBits(JPGBitReader* reader)
+{
+    if (reader->position + sizeof(uint64_t) <= reader->end)
+    {
+        uint64_t next = readBigEndian64(reader->data + reader->position);
+        uint64_t inverted = ~next;
+        if (((inverted - 0x0101010101010101ULL) & ~inverted & 0x8080808080808080ULL) == 0)
+        {
+            reader->bits |= next >> reader->count;
+            reader->position += (BUFFERBITS - 1 - reader->count) / 8;
+            reader->count |= BUFFERBITS - 8;
+            return;
+        }
+    }
+
+    fillBitsSlowly(reader);
+}
+
+
+// this function reads the next count (0 - 16) bits. there have to be
+// that many in the bit buffer.
+static inline unsigned int readBits(JPGBitReader* reader, int count)
+{
+    unsigned int value = reader->bits >> (BUFFERBITS - 1 - count) >> 1;
+    reader->bits <<= count;
+    reader->count -= count;
+    return value;
+}
+
+
+// this function decodes a huffman code that is longer than
+// JPGFASTBITS bits, a length at a time.
+static int decodeLongSymbol(JPGBitReader* reader, const JPGHuffman* table)
+{
+    for (int length = JPGFASTBITS + 1; length <= MAXCODELENGTH; length++)
+    {
+        int32_t code = reader->bits >> (BUFFERBITS - length);
+        if (code <= table->maxCode[length])
+        {
+            readBits(reader, length);
+            return table->values[table->valueOffset[length] + code];
+        }
+    }
+
+    reader->failed = 1;
+    return 0;
+}
+
+
+// this function decodes the next huffman symbol with the table. there
+// have to be at least MAXCODELENGTH bits in the bit buffer.
+static inline int decodeSymbol(JPGBitReader* reader, const JPGHuffman* table)
+{
+    int entry = table->fast[reader->bits >> (BUFFERBITS - JPGFASTBITS)];
+    if (entry == 0)
+        return decodeLongSymbol(reader, table);
+
+    readBits(reader, entry >> 8);
+    return entry & 0xFF;
+}
+
+
+// this function decodes the next block of the component. the bit
+// buffer is filled before every symbol, which is enough for its code
+// and its extra bits (31 bits at most).
+// returns 1 if it was decoded and 0 if the data is damaged.
+static int decodeBlock(JPGCoefficients* jpg, int component)
+{
+    // the reader is copied so that it stays in registers (the symbols
+    // are bytes, which could be anything else as far as the compiler
+    // knows).
+    JPGBitReader reader = jpg->reader;
+    JPGBlock* block = &jpg->block;
+    const JPGComponent* c = &jpg->components[component];
+    const JPGHuffman* table = &jpg->ac[c->acTable];
+    block->component = component;
+
+    fillBits(&reader);
+    int size = decodeSymbol(&reader, &jpg->dc[c->dcTable]);
+    if (size > 15)
+    {
+        size = 0;
+        reader.failed = 1;
+    }
+    block->symbols[0] = size;
+    block->bits[0] = readBits(&reader, size);
+    int count = 1;
+
+    // the AC coefficients up to the end of block symbol (or the last
+    // coefficient).
+    int k = 1;
+    while (k < BLOCKSIZE)
+    {
+        fillBits(&reader);
+        int symbol = decodeSymbol(&reader, table);
+        block->symbols[count] = symbol;
+        block->bits[count] = readBits(&reader, symbol & 15);
+        count++;
+
+        if (symbol == 0x00)
+            break;
+        k += symbol == ZERORUN ? 16 : (symbol >> 4) + 1;
+    }
+
+    // the padding at the end of the bit buffer must not have been used
+    // (the block went past a marker), and the block must not have more
+    // than 64 coefficients.
+    if (reader.count < reader.padding || k > BLOCKSIZE)
+        reader.failed = 1;
+
+    block->count = count;
+    jpg->reader = reader;
+    return !reader.failed;
+}
+
+
+// this function writes the entropy coded data that is in the buffer.
+static void flushOutput(JPGCoefficients* jpg)
+{
+    JPGBitWriter* writer = &jpg->writer;
+    if (writer->length > 0 && !jpg->output->write(jpg->output->context, writer->buffer, writer->length))
+        jpg->writeFailed = 1;
+    writer->length = 0;
+}
+
+
+// this function writes the top 32 of the bits that are not written
+// yet, a 0xFF byte as 0xFF00. most of the time there is no 0xFF byte
+// in them, so they are written at once.
+static void writeWord(JPGBitWriter* writer)
+{
+    writer->count -= 32;
+    uint32_t word = writer->bits >> writer->count;
+    uint32_t inverted = ~word;
+    BYTE* out = writer->buffer + writer->length;
+    if (((inverted - 0x01010101u) & ~inverted & 0x80808080u) == 0)
+    {
+        out[0] = word >> 24;
+        out[1] = word >> 16;
+        out[2] = word >> 8;
+        out[3] = word;
+        writer->length += 4;
+        return;
+    }
+
+    for (int shift = 24; shift >= 0; shift -= 8)
+    {
+        BYTE byte = word >> shift;
+        writer->buffer[writer->length++] = byte;
+        if (byte == JPGMARKERPREFIX)
+            writer->buffer[writer->length++] = 0x00;
+    }
+}
+
+
+// this function adds count (0 - 31) bits to the entropy coded data.
+static inline void putBits(JPGBitWriter* writer, uint32_t value, int count)
+{
+    writer->bits = writer->bits << count | value;
+    writer->count += count;
+    if (writer->count >= 32)
+        writeWord(writer);
+}
+
+
+// this function fills the last byte of the entropy coded data with 1
+// bits and writes every byte that is left, before a marker.
+static void padToByte(JPGBitWriter* writer)
+{
+    if (writer->count % 8 != 0)
+        putBits(writer, (1 << (8 - writer->count % 8)) - 1, 8 - writer->count % 8);
+
+    while (writer->count >= 8)
+    {
+        writer->count -= 8;
+        BYTE byte = writer->bits >> writer->count;
+        writer->buffer[writer->length++] = byte;
+        if (byte == JPGMARKERPREFIX)
+            writer->buffer[writer->length++] = 0x00;
+    }
+}
+
+
+// this function huffman codes the current block again with the tables
+// of its component. a block takes less than 512 bytes (1024 with a
+// 0x00 after every byte), the buffer is written out before there is
+// less room than that in it.
+static void encodeBlock(JPGCoefficients* jpg)
+{
+    if (jpg->writer.length > JPGOUTPUTSIZE - 1024)
+        flushOutput(jpg);
+
+    JPGBitWriter writer = jpg->writer;
+    const JPGBlock* block = &jpg->block;
+    const JPGComponent* c = &jpg->components[block->component];
+    const JPGHuffman* table = &jpg->dc[c->dcTable];
+
+    // the code of every symbol and its extra bits are added at once.
+    BYTE size = block->symbols[0];
+    putBits(&writer, (uint32_t) table->codes[size] << size | block->bits[0], table->codeLengths[size] + size);
+
+    table = &jpg->ac[c->acTable];
+    for (int i = 1; i < block->count; i++)
+    {
+        BYTE symbol = block->symbols[i];
+        size = symbol & 15;
+        putBits(&writer, (uint32_t) table->codes[symbol] << size | block->bits[i], table->codeLengths[symbol] + size);
+    }
+
+    jpg->writer = writer;
+}
+
+
+// this function goes past the restart marker with the given number
+// (0 - 7). the bits before it are padding.
+// returns 1 if the marker is there and 0 if it is not.
+static int readRestart(JPGBitReader* reader, int number)
+{
+    reader->bits = 0;
+    reader->count = 0;
+    reader->padding = 0;
+
+    const BYTE* data = reader->data;
+    while (reader->position + 1 < reader->end && data[reader->position] == JPGMARKERPREFIX
+           && data[reader->position + 1] == JPGMARKERPREFIX)
+        reader->position++;
+
+    if (reader->end - reader->position < 2 || data[reader->position] != JPGMARKERPREFIX
+        || data[reader->position + 1] != JPGFIRSTRESTART + number)
+        return 0;
+
+    reader->position += 2;
+    return 1;
+}
+
+
+// this function moves the cursor to the first AC coefficient of the
+// next block (when writing, the current block is written first).
+// returns STEGO_OK, STEGO_NOSPACE if there are no more blocks or
+// STEGO_BADIMAGE.
+static int nextBlock(JPGCoefficients* jpg)
+{
+    if (jpg->loaded)
+    {
+        if (jpg->output != NULL)
+            encodeBlock(jpg);
+
+        jpg->loaded = 0;
+        if (++jpg->blockInMCU == jpg->blocksPerMCU)
+        {
+            jpg->blockInMCU = 0;
+            jpg->mcu++;
+        }
+    }
+
+    if (jpg->mcu == jpg->mcuCount)
+        return STEGO_NOSPACE;
+
+    // every restartInterval MCUs there is a restart marker.
+    if (jpg->blockInMCU == 0 && jpg->mcu > 0 && jpg->restartInterval > 0 && jpg->mcu % jpg->restartInterval == 0)
+    {
+        int number = (jpg->mcu / jpg->restartInterval - 1) % 8;
+        if (!readRestart(&jpg->reader, number))
+            return STEGO_BADIMAGE;
+
+        if (jpg->output != NULL)
+        {
+            padToByte(&jpg->writer);
+            jpg->writer.buffer[jpg->writer.length++] = JPGMARKERPREFIX;
+            jpg->writer.buffer[jpg->writer.length++] = JPGFIRSTRESTART + number;
+        }
+    }
+
+    if (!decodeBlock(jpg, jpg->mcuComponents[jpg->blockInMCU]))
+        return STEGO_BADIMAGE;
+
+    jpg->loaded = 1;
+    jpg->coefficient = 1;
+    return STEGO_OK;
+}
+
+
+// returns the size of the coefficient at the cursor if it can hold a
+// bit of the message (2 or more), 0 if it can't.
+static int usableSize(const JPGCoefficients* jpg)
+{
+    int size = jpg->block.symbols[jpg->coefficient] & 15;
+    return size >= 2 ? size : 0;
+}
+
+
+// this function frees everything startJPGCoefficients() allocated.
+void endJPGCoefficients(JPGCoefficients* jpg)
+{
+    free(jpg->writer.buffer);
+    jpg->writer.buffer = NULL;
+}
+
+
+// this function starts reading the coefficients of the jpg image.
+// when output is not NULL the image is written to it again as the
+// message is embedded (the segments before the scan are written right
+// away).
+// endJPGCoefficients() must be called afterwards, whatever the result.
+// returns STEGO_OK, STEGO_NOPIXELS, STEGO_BADIMAGE, STEGO_NOMEMORY or
+// STEGO_WRITEFAILED.
+int startJPGCoefficients(JPGCoefficients* jpg, const BYTE* image, size_t size, const stego_output* output)
+{
+    memset(jpg, 0, sizeof(*jpg));
+    jpg->image = image;
+    jpg->size = size;
+    jpg->output = output;
+
+    int result = readSegments(jpg);
+    if (result != STEGO_OK)
+        return result;
+
+    long long end = skipEntropyCodedData(image, size, jpg->scanStart);
+    if (end < 0)
+        return STEGO_BADIMAGE;
+    jpg->scanEnd = end;
+    jpg->reader.data = image;
+    jpg->reader.position = jpg->scanStart;
+    jpg->reader.end = jpg->scanEnd;
+
+    if (output == NULL)
+        return STEGO_OK;
+
+    jpg->writer.buffer = malloc(JPGOUTPUTSIZE);
+    if (jpg->writer.buffer == NULL)
+        return STEGO_NOMEMORY;
+
+    return output->write(output->context, image, jpg->scanStart) ? STEGO_OK : STEGO_WRITEFAILED;
+}
+
+
+// this function stores count payload bytes in the lowest bits of the
+// AC coefficients that are not 0, 1 or -1, starting at the cursor.
+// returns STEGO_OK, STEGO_NOSPACE, STEGO_BADIMAGE or STEGO_WRITEFAILED.
+int embedInJPGCoefficients(JPGCoefficients* jpg, const BYTE* payload, size_t count)
+{
+    uint64_t bitNumber = 0;
+    while (bitNumber < (uint64_t) count * BYTESIZE)
+    {
+        if (!jpg->loaded || jpg->coefficient == jpg->block.count)
+        {
+            int result = nextBlock(jpg);
+            if (result != STEGO_OK)
+                return result;
+            if (jpg->writeFailed)
+                return STEGO_WRITEFAILED;
+            continue;
+        }
+
+        // the extra bits of a negative coefficient (their top bit is 0)
+        // are its value minus 1, so its lowest bit is stored inverted.
+        int size = usableSize(jpg);
+        if (size != 0)
+        {
+            uint16_t* bits = &jpg->block.bits[jpg->coefficient];
+            int negative = !(*bits >> (size - 1) & 1);
+            int bit = payload[bitNumber / BYTESIZE] >> (bitNumber % BYTESIZE) & 1;
+            *bits = (*bits & ~1) | (bit ^ negative);
+            bitNumber++;
+        }
+        jpg->coefficient++;
+    }
+
+    return STEGO_OK;
+}
+
+
+// this function reads count payload bytes from the lowest bits of the
+// AC coefficients that are not 0, 1 or -1, starting at the cursor.
+// returns STEGO_OK, STEGO_NOSPACE or STEGO_BADIMAGE.
+int extractFromJPGCoefficients(JPGCoefficients* jpg, BYTE* payload, size_t count)
+{
+    uint64_t bitNumber = 0;
+    while (bitNumber < (uint64_t) count * BYTESIZE)
+    {
+        if (!jpg->loaded || jpg->coefficient == jpg->block.count)
+        {
+            int result = nextBlock(jpg);
+            if (result != STEGO_OK)
+                return result;
+            continue;
+        }
+
+        int size = usableSize(jpg);
+        if (size != 0)
+        {
+            uint16_t bits = jpg->block.bits[jpg->coefficient];
+            int negative = !(bits >> (size - 1) & 1);
+            if (bitNumber % BYTESIZE == 0)
+                payload[bitNumber / BYTESIZE] = 0;
+            payload[bitNumber / BYTESIZE] |= ((bits & 1) ^ negative) << (bitNumber % BYTESIZE);
+            bitNumber++;
+        }
+        jpg->coefficient++;
+    }
+
+    return STEGO_OK;
+}
+
+
+// this function counts the coefficients that can hold a bit of the
+// message, from the cursor to the end of the scan, or until at least
+// limit of them were found (so a small message doesn't have to decode
+// the whole scan to know it fits).
+// returns STEGO_OK or STEGO_BADIMAGE.
+int countJPGCoefficients(JPGCoefficients* jpg, uint64_t limit, uint64_t* count)
+{
+    *count = 0;
+    while (*count < limit)
+    {
+        int result = nextBlock(jpg);
+        if (result == STEGO_NOSPACE)
+            return STEGO_OK;
+        if (result != STEGO_OK)
+            return result;
+
+        for (; jpg->coefficient < jpg->block.count; jpg->coefficient++)
+            *count += usableSize(jpg) != 0;
+    }
+
+    return STEGO_OK;
+}
+
+
+// this function writes the rest of the image after the message was
+// embedded: the rest of the blocks and the segments after the scan.
+// returns STEGO_OK, STEGO_BADIMAGE or STEGO_WRITEFAILED.
+int finishJPGCoefficients(JPGCoefficients* jpg)
+{
+    int result;
+    while ((result = nextBlock(jpg)) == STEGO_OK && !jpg->writeFailed)
+        ;
+    if (jpg->writeFailed)
+        return STEGO_WRITEFAILED;
+    if (result != STEGO_NOSPACE)
+        return result;
+
+    padToByte(&jpg->writer);
+    flushOutput(jpg);
+    if (jpg->writeFailed)
+        return STEGO_WRITEFAILED;
+
+    // the segments after the scan, up to the end of image marker
+    // (anything appended after the image is left out).
+    long long end = findJPGEnd(jpg->image, jpg->size);
+    if (end < (long long) jpg->scanEnd)
+        return STEGO_BADIMAGE;
+
+    return jpg->output->write(jpg->output->context, jpg->image + jpg->scanEnd, end - jpg->scanEnd)
+               ? STEGO_OK
+               : STEGO_WRITEFAILED;
+}
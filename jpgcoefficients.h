@@ -0,0 +1,135 @@
+// header file for storing a message in the DCT coefficients of a jpg
+
+#ifndef JPGCOEFFICIENTS_H_
+#define JPGCOEFFICIENTS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "helpers.h"
+#include "stego.h"
+
+// the number of bits of a huffman code that are looked up in the fast
+// tables, longer (rare) codes are decoded a length at a time.
+#define JPGFASTBITS 9
+
+// the most blocks a minimum coded unit can have.
+#define JPGMAXBLOCKSPERMCU 10
+
+// the number of bytes of entropy coded data that are written at a time.
+#define JPGOUTPUTSIZE (1 << 16)
+
+// a huffman table of a jpg, for decoding and for encoding again.
+// fast gives the symbol (low byte) and the length of its code (high
+// byte) of the next JPGFASTBITS bits, 0 for a longer code. a longer
+// code of length l is the value maxCode[l] is checked against, and its
+// symbol is values[valueOffset[l] + code].
+typedef struct
+{
+    int defined;
+    uint16_t fast[1 << JPGFASTBITS];
+    int32_t maxCode[18];
+    int32_t valueOffset[17];
+    BYTE values[256];
+    uint16_t codes[256];
+    BYTE codeLengths[256];
+} JPGHuffman;
+
+// a component of the image (Y, Cb or Cr for example): its sampling
+// factors and the huffman tables the scan uses for it.
+typedef struct
+{
+    int id;
+    int horizontal;
+    int vertical;
+    int dcTable;
+    int acTable;
+} JPGComponent;
+
+// a block of 64 coefficients as it is coded: the DC difference and
+// then the AC coefficients. symbols[0] is the size of the DC
+// difference, every other symbol is a run of zeros and the size of
+// the coefficient after it (a byte 0xRS) and bits are the extra bits
+// that give the value. the block ends with the end of block symbol 0x00
+// unless its last coefficient is not 0.
+typedef struct
+{
+    int count;
+    int component;
+    BYTE symbols[66];
+    uint16_t bits[66];
+} JPGBlock;
+
+// the entropy coded data that is being read. bits has the next count
+// bits at the top. padding is the number of the bits at the bottom
+// that are zeros loaded at a marker (they must not be used).
+typedef struct
+{
+    const BYTE* data;
+    size_t position;
+    size_t end;
+    uint64_t bits;
+    int count;
+    int padding;
+    int failed;
+} JPGBitReader;
+
+// the entropy coded data that is being written, a buffer of
+// JPGOUTPUTSIZE bytes. bits has the last count bits that are not in
+// it yet at the bottom.
+typedef struct
+{
+    BYTE* buffer;
+    size_t length;
+    uint64_t bits;
+    int count;
+} JPGBitWriter;
+
+// the scan of a baseline jpg that is being read (and written again
+// with a message in it when output is not NULL).
+//
+// only a single block is in memory at a time. the cursor is the next
+// coefficient of the block. the message takes the lowest bit of the
+// size of every AC coefficient that is not 0, 1 or -1, which keeps it
+// at the same size: the huffman symbols stay the same and only their
+// extra bits change.
+typedef struct
+{
+    const BYTE* image;
+    size_t size;
+    JPGHuffman dc[4];
+    JPGHuffman ac[4];
+    long width;
+    long height;
+    JPGComponent components[4];
+    int componentCount;
+    int restartInterval;
+    long mcuCount;
+    int blocksPerMCU;
+    int mcuComponents[JPGMAXBLOCKSPERMCU];
+    size_t scanStart;
+    size_t scanEnd;
+
+    JPGBitReader reader;
+
+    JPGBlock block;
+    long mcu;
+    int blockInMCU;
+    int coefficient;
+    int loaded;
+
+    const stego_output* output;
+    JPGBitWriter writer;
+    int writeFailed;
+} JPGCoefficients;
+
+
+// function declarations
+int startJPGCoefficients(JPGCoefficients* jpg, const BYTE* image, size_t size, const stego_output* output);
+int embedInJPGCoefficients(JPGCoefficients* jpg, const BYTE* payload, size_t count);
+int extractFromJPGCoefficients(JPGCoefficients* jpg, BYTE* payload, size_t count);
+int countJPGCoefficients(JPGCoefficients* jpg, uint64_t limit, uint64_t* count);
+int finishJPGCoefficients(JPGCoefficients* jpg);
+void endJPGCoefficients(JPGCoefficients* jpg);
+
+#endif
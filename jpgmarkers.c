@@ -0,0 +1,149 @@
+// this file has the function that finds the end of a jpg file
+// (the byte right after the end of image marker 0xFFD9) in an image
+// that is in memory.
+//
+// a jpg file is a list of segments. every segment starts with a
+// marker (0xFF and a marker byte) and most of them store their length
+// right after the marker, so they are jumped over without reading them.
+// the only data that has to be looked at is the entropy coded data
+// after a start of scan segment, which has no length. it ends at the
+// first 0xFF that is followed by a real marker (0xFF00 is an escaped
+// 0xFF and 0xFFD0 - 0xFFD7 are restart markers). the 0xFF bytes are
+// found with memchr().
+//
+// this way an end of image marker inside a thumbnail (in the exif
+// segment) or at an odd position is handled correctly.
+//
+// if the segments don't make sense (a damaged file), the image is
+// searched for the end of image marker instead, starting with its
+// last 2 bytes.
+
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include "helpers.h"
+#include "jpgmarkers.h"
+
+
+// markers that are not followed by a length.
+static int isStandaloneMarker(int marker)
+{
+    return (marker >= JPGFIRSTRESTART && marker <= JPGLASTRESTART) || marker == JPGTEMPORARY;
+}
+
+
+// this function skips the entropy coded data that starts at position.
+// returns the position of the 0xFF of the marker that ends the data
+// or -1 if the end of the image was reached first.
+long long skipEntropyCodedData(const BYTE* image, size_t size, size_t position)
+{
+    while (position < size)
+    {
+        const BYTE* prefix = memchr(&image[position], JPGMARKERPREFIX, size - position);
+        if (prefix == NULL)
+            return -1;
+
+        // skip fill bytes (extra 0xFF bytes before a marker byte).
+        size_t markerPosition = prefix - image;
+        position = markerPosition + 1;
+        while (position < size && image[position] == JPGMARKERPREFIX)
+            position++;
+
+        if (position >= size)
+            return -1;
+
+        BYTE byte = image[position++];
+        if (byte != 0x00 && (byte < JPGFIRSTRESTART || byte > JPGLASTRESTART))
+            return position - 2;
+    }
+
+    return -1;
+}
+
+
+// this function walks the segments that come after the start of image
+// marker. returns the position right after the end of image marker or
+// -1 if the end of the image (or something that is not a jpg segment)
+// was reached first.
+static long long walkSegments(const BYTE* image, size_t size)
+{
+    size_t position = SIGNATUREBYTESIZE;
+
+    while (position < size)
+    {
+        if (image[position] != JPGMARKERPREFIX)
+            return -1;
+
+        // skip fill bytes.
+        while (position < size && image[position] == JPGMARKERPREFIX)
+            position++;
+        if (position >= size)
+            return -1;
+
+        int marker = image[position++];
+        if (marker == 0x00 || marker == JPGSTARTOFIMAGE)
+            return -1;
+
+        if (marker == JPGENDOFIMAGE)
+            return position;
+
+        if (isStandaloneMarker(marker))
+            continue;
+
+        // the length is stored as a big endian 16-bit number and
+        // includes the 2 bytes of the length itself.
+        if (size - position < JPGLENGTHSIZE)
+            return -1;
+
+        size_t length = image[position] << 8 | image[position + 1];
+        if (length < JPGLENGTHSIZE || length > size - position)
+            return -1;
+        position += length;
+
+        if (marker == JPGSTARTOFSCAN)
+        {
+            long long end = skipEntropyCodedData(image, size, position);
+            if (end < 0)
+                return -1;
+            position = end;
+        }
+    }
+
+    return -1;
+}
+
+
+// this function searches the image for the end of image marker. the
+// last 2 bytes are checked first since a jpg without anything after
+// it ends with the marker, otherwise the first 0xFFD9 is used.
+// returns the position right after the marker or -1.
+static long long probeForJPGEnd(const BYTE* image, size_t size)
+{
+    static const BYTE endOfImage[2] = {JPGMARKERPREFIX, JPGENDOFIMAGE};
+
+    if (size < 2 * SIGNATUREBYTESIZE)
+        return -1;
+
+    if (memcmp(&image[size - 2], endOfImage, 2) == 0)
+        return size;
+
+    const BYTE* found = memmem(&image[SIGNATUREBYTESIZE], size - SIGNATUREBYTESIZE, endOfImage, 2);
+    if (found == NULL)
+        return -1;
+
+    return found - image + 2;
+}
+
+
+// this function finds the end of the jpg image of the given size,
+// i.e, the position right after its end of image marker.
+// returns the position or -1 if it was not found.
+long long findJPGEnd(const BYTE* image, size_t size)
+{
+    long long end = walkSegments(image, size);
+    if (end < 0)
+        end = probeForJPGEnd(image, size);
+
+    return end;
+}
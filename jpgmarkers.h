@@ -0,0 +1,34 @@
+// header file for the jpg marker scanner
+
+#ifndef JPGMARKERS_H_
+#define JPGMARKERS_H_
+
+#include <stddef.h>
+
+#include "helpers.h"
+
+// every marker starts with this byte.
+#define JPGMARKERPREFIX 0xFF
+
+// the markers the scanner needs to know about.
+#define JPGSTARTOFIMAGE 0xD8
+#define JPGENDOFIMAGE 0xD9
+#define JPGSTARTOFSCAN 0xDA
+#define JPGBASELINE 0xC0
+#define JPGEXTENDED 0xC1
+#define JPGHUFFMANTABLE 0xC4
+#define JPGARITHMETICTABLE 0xCC
+#define JPGRESTARTINTERVAL 0xDD
+#define JPGFIRSTRESTART 0xD0
+#define JPGLASTRESTART 0xD7
+#define JPGTEMPORARY 0x01
+
+// the length of a segment is stored in the 2 bytes after its marker.
+#define JPGLENGTHSIZE 2
+
+
+// function declarations
+long long findJPGEnd(const BYTE* image, size_t size);
+long long skipEntropyCodedData(const BYTE* image, size_t size, size_t position);
+
+#endif
@@ -0,0 +1,540 @@
+// this file has the kernels that store payload bytes in (and read
+// them back from) the LSBs of cover bytes.
+//
+// there are three versions of every kernel:
+//  - a portable scalar one that works everywhere.
+//  - an SSE2 one that handles 16 cover bytes (2 payload bytes) per step.
+//  - an AVX2 one that handles 32 cover bytes (4 payload bytes) per step.
+// the best version the cpu supports is picked once when the program
+// starts.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helpers.h"
+#include "lsbkernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVEX86KERNELS 1
+#include <immintrin.h>
+#endif
+
+
+// scalar kernels, these work on any cpu.
+
+static void embedScalar(BYTE* cover, const BYTE* payload, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        BYTE ch = payload[i];
+        for (int bit = 0; bit < BYTESIZE; bit++)
+            cover[bit] = (cover[bit] & 0xFE) | ((ch >> bit) & 1);
+
+        cover += BYTESIZE;
+    }
+}
+
+static void extractScalar(const BYTE* cover, BYTE* payload, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        BYTE ch = 0;
+        for (int bit = 0; bit < BYTESIZE; bit++)
+            ch |= (cover[bit] & 1) << bit;
+
+        payload[i] = ch;
+        cover += BYTESIZE;
+    }
+}
+
+
+#ifdef HAVEX86KERNELS
+
+// SSE2 kernels.
+//
+// to embed, the 2 payload bytes are repeated 8 times each across a
+// 16 byte register, every byte is tested against its own bit
+// (1, 2, 4, ... 128) and the result is turned into 0 or 1 and
+// merged into the cleared LSBs of the cover.
+//
+// to extract, every 64-bit lane is shifted left by 7 which moves
+// the LSB of each byte into its sign bit, and movemask gathers the
+// 16 sign bits into 2 payload bytes.
+
+__attribute__((target("sse2")))
+static void embedSSE2(BYTE* cover, const BYTE* payload, size_t count)
+{
+    const __m128i bitMask = _mm_set_epi8((char) 0x80, 0x40, 0x20, 0x10, 8, 4, 2, 1,
+                                         (char) 0x80, 0x40, 0x20, 0x10, 8, 4, 2, 1);
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i clearLSB = _mm_set1_epi8((char) 0xFE);
+
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128i bytes = _mm_cvtsi32_si128(payload[i] | payload[i + 1] << 8);
+        bytes = _mm_unpacklo_epi8(bytes, bytes);
+        bytes = _mm_unpacklo_epi16(bytes, bytes);
+        bytes = _mm_unpacklo_epi32(bytes, bytes);
+
+        __m128i bits = _mm_and_si128(bytes, bitMask);
+        bits = _mm_and_si128(_mm_cmpeq_epi8(bits, bitMask), ones);
+
+        __m128i data = _mm_loadu_si128((const __m128i*) cover);
+        data = _mm_or_si128(_mm_and_si128(data, clearLSB), bits);
+        _mm_storeu_si128((__m128i*) cover, data);
+
+        cover += 2 * BYTESIZE;
+    }
+
+    embedScalar(cover, payload + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static void extractSSE2(const BYTE* cover, BYTE* payload, size_t count)
+{
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128i data = _mm_loadu_si128((const __m128i*) cover);
+        int mask = _mm_movemask_epi8(_mm_slli_epi64(data, 7));
+
+        payload[i] = mask & 0xFF;
+        payload[i + 1] = mask >> 8;
+        cover += 2 * BYTESIZE;
+    }
+
+    extractScalar(cover, payload + i, count - i);
+}
+
+
+// AVX2 kernels, the same idea as the SSE2 ones but with 4 payload
+// bytes per step. the payload bytes are placed with a byte shuffle
+// (each 128-bit half gets 2 of them).
+
+__attribute__((target("avx2")))
+static void embedAVX2(BYTE* cover, const BYTE* payload, size_t count)
+{
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bitMask = _mm256_set1_epi64x((long long) 0x8040201008040201ULL);
+    const __m256i ones = _mm256_set1_epi8(1);
+    const __m256i clearLSB = _mm256_set1_epi8((char) 0xFE);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        int packed;
+        memcpy(&packed, payload + i, sizeof(packed));
+
+        __m256i bytes = _mm256_shuffle_epi8(_mm256_set1_epi32(packed), spread);
+        __m256i bits = _mm256_and_si256(bytes, bitMask);
+        bits = _mm256_and_si256(_mm256_cmpeq_epi8(bits, bitMask), ones);
+
+        __m256i data = _mm256_loadu_si256((const __m256i*) cover);
+        data = _mm256_or_si256(_mm256_and_si256(data, clearLSB), bits);
+        _mm256_storeu_si256((__m256i*) cover, data);
+
+        cover += 4 * BYTESIZE;
+    }
+
+    embedSSE2(cover, payload + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void extractAVX2(const BYTE* cover, BYTE* payload, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256i data = _mm256_loadu_si256((const __m256i*) cover);
+        int mask = _mm256_movemask_epi8(_mm256_slli_epi64(data, 7));
+
+        memcpy(payload + i, &mask, sizeof(mask));
+        cover += 4 * BYTESIZE;
+    }
+
+    extractSSE2(cover, payload + i, count - i);
+}
+
+#endif
+
+
+// the kernels that are actually used, picked by selectKernels().
+static void (*embedKernel)(BYTE*, const BYTE*, size_t) = embedScalar;
+static void (*extractKernel)(const BYTE*, BYTE*, size_t) = extractScalar;
+static const char* kernelName = "scalar";
+
+
+// this function runs once before main() and picks the fastest
+// kernels the cpu supports. setting the environment variable
+// STEGO_KERNEL to "scalar" or "sse2" forces a slower kernel
+// (useful for comparing them).
+__attribute__((constructor))
+static void selectKernels(void)
+{
+#ifdef HAVEX86KERNELS
+    const char* forced = getenv("STEGO_KERNEL");
+    int allowAVX2 = forced == NULL || strcmp(forced, "avx2") == 0;
+    int allowSSE2 = allowAVX2 || strcmp(forced, "sse2") == 0;
+
+    __builtin_cpu_init();
+    if (allowAVX2 && __builtin_cpu_supports("avx2"))
+    {
+        embedKernel = embedAVX2;
+        extractKernel = extractAVX2;
+        kernelName = "avx2";
+    }
+    else if (allowSSE2 && __builtin_cpu_supports("sse2"))
+    {
+        embedKernel = embedSSE2;
+        extractKernel = extractSSE2;
+        kernelName = "sse2";
+    }
+#endif
+}
+
+
+// this function stores count payload bytes in the LSBs of the
+// 8 * count cover bytes.
+void embedBytesInLSB(BYTE* cover, const BYTE* payload, size_t count)
+{
+    embedKernel(cover, payload, count);
+}
+
+
+// this function reads count payload bytes from the LSBs of the
+// 8 * count cover bytes.
+void extractBytesFromLSB(const BYTE* cover, BYTE* payload, size_t count)
+{
+    extractKernel(cover, payload, count);
+}
+
+
+// kernels for more than 1 bit per cover byte.
+//
+// the payload is treated as a stream of bits (the least significant
+// bit of the first payload byte first, like above) and every cover
+// byte takes the next depth bits of it in its low bits. when depth
+// does not divide 8 the last cover byte may only get some of them.
+
+// when depth divides 8 every payload byte fills a whole number of
+// cover bytes, so no bits have to be carried between payload bytes.
+//
+// 8 cover bytes are handled at a time as one 64-bit number: their low
+// bits are packed together (or spread out) with shifts and masks,
+// which is 3 steps instead of one step per cover byte. the bytes that
+// are left at the end go through the byte loop.
+
+static inline uint64_t loadCover(const BYTE* cover)
+{
+    uint64_t value;
+    memcpy(&value, cover, sizeof(value));
+    return value;
+}
+
+static void embedAligned(BYTE* cover, int depth, const BYTE* payload, size_t count)
+{
+    BYTE mask = (1 << depth) - 1;
+    int perWord = depth;  // payload bytes in 8 cover bytes
+    size_t i = 0;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + perWord <= count; i += perWord)
+    {
+        uint64_t bits;
+        if (depth == 4)
+        {
+            bits = (uint32_t) (payload[i] | payload[i + 1] << 8 | payload[i + 2] << 16 | (uint32_t) payload[i + 3] << 24);
+            bits = (bits | bits << 16) & 0x0000FFFF0000FFFFULL;
+            bits = (bits | bits << 8) & 0x00FF00FF00FF00FFULL;
+            bits = (bits | bits << 4) & 0x0F0F0F0F0F0F0F0FULL;
+        }
+        else
+        {
+            bits = payload[i] | payload[i + 1] << 8;
+            bits = (bits | bits << 24) & 0x000000FF000000FFULL;
+            bits = (bits | bits << 12) & 0x000F000F000F000FULL;
+            bits = (bits | bits << 6) & 0x0303030303030303ULL;
+        }
+
+        uint64_t lowBits = 0x0101010101010101ULL * mask;
+        uint64_t value = (loadCover(cover) & ~lowBits) | bits;
+        memcpy(cover, &value, sizeof(value));
+        cover += sizeof(value);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        BYTE ch = payload[i];
+        for (int part = 0; part < BYTESIZE / depth; part++)
+            cover[part] = (cover[part] & ~mask) | ((ch >> (part * depth)) & mask);
+
+        cover += BYTESIZE / depth;
+    }
+}
+
+static void extractAligned(const BYTE* cover, int depth, BYTE* payload, size_t count)
+{
+    BYTE mask = (1 << depth) - 1;
+    int perWord = depth;  // payload bytes in 8 cover bytes
+    size_t i = 0;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + perWord <= count; i += perWord)
+    {
+        uint64_t bits = loadCover(cover) & (0x0101010101010101ULL * mask);
+        if (depth == 4)
+        {
+            bits = (bits | bits >> 4) & 0x00FF00FF00FF00FFULL;
+            bits = (bits | bits >> 8) & 0x0000FFFF0000FFFFULL;
+            bits = (bits | bits >> 16);
+            payload[i + 2] = bits >> 16;
+            payload[i + 3] = bits >> 24;
+        }
+        else
+        {
+            bits = (bits | bits >> 6) & 0x000F000F000F000FULL;
+            bits = (bits | bits >> 12) & 0x000000FF000000FFULL;
+            bits = (bits | bits >> 24);
+        }
+
+        payload[i] = bits;
+        payload[i + 1] = bits >> 8;
+        cover += sizeof(bits);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        BYTE ch = 0;
+        for (int part = 0; part < BYTESIZE / depth; part++)
+            ch |= (cover[part] & mask) << (part * depth);
+
+        payload[i] = ch;
+        cover += BYTESIZE / depth;
+    }
+}
+
+
+// this function stores count payload bytes in the low depth bits of
+// the coverBytesFor(depth, count) cover bytes.
+void embedBitsInLSB(BYTE* cover, int depth, const BYTE* payload, size_t count)
+{
+    if (depth == 1)
+    {
+        embedKernel(cover, payload, count);
+        return;
+    }
+    if (depth == 2)
+    {
+        embedAligned(cover, 2, payload, count);
+        return;
+    }
+    if (depth == 4)
+    {
+        embedAligned(cover, 4, payload, count);
+        return;
+    }
+
+    unsigned int bits = 0;
+    int bitCount = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        bits |= payload[i] << bitCount;
+        bitCount += BYTESIZE;
+
+        while (bitCount >= depth)
+        {
+            BYTE mask = (1 << depth) - 1;
+            *cover = (*cover & ~mask) | (bits & mask);
+            cover++;
+            bits >>= depth;
+            bitCount -= depth;
+        }
+    }
+
+    // the bits that are left over go in the last cover byte.
+    if (bitCount > 0)
+    {
+        BYTE mask = (1 << bitCount) - 1;
+        *cover = (*cover & ~mask) | (bits & mask);
+    }
+}
+
+
+// this function reads count payload bytes from the low depth bits of
+// the coverBytesFor(depth, count) cover bytes.
+void extractBitsFromLSB(const BYTE* cover, int depth, BYTE* payload, size_t count)
+{
+    if (depth == 1)
+    {
+        extractKernel(cover, payload, count);
+        return;
+    }
+    if (depth == 2)
+    {
+        extractAligned(cover, 2, payload, count);
+        return;
+    }
+    if (depth == 4)
+    {
+        extractAligned(cover, 4, payload, count);
+        return;
+    }
+
+    unsigned int bits = 0;
+    int bitCount = 0;
+    BYTE mask = (1 << depth) - 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        while (bitCount < BYTESIZE)
+        {
+            bits |= (*cover++ & mask) << bitCount;
+            bitCount += depth;
+        }
+
+        payload[i] = bits;
+        bits >>= BYTESIZE;
+        bitCount -= BYTESIZE;
+    }
+}
+
+
+// returns the number of cover bytes that hold count payload bytes
+// when depth bits are stored in each of them.
+size_t coverBytesFor(int depth, size_t count)
+{
+    return (count * BYTESIZE + depth - 1) / depth;
+}
+
+
+// kernels that only use some of the bytes of every pixel (the
+// selected channels) and skip the padding at the end of every row.
+// index is the position of the first cover byte to use, counted from
+// the start of the pixel array.
+//
+// they work a chunk at a time: the selected bytes of as many rows as
+// fit are gathered into a buffer (a single memcpy() per row when
+// every byte of the pixels is selected), the kernels above run on
+// the buffer and the bytes are put back. ROWCHUNKSIZE is a multiple
+// of 8, so every chunk holds a whole number of groups of depth
+// payload bytes.
+
+#define ROWCHUNKSIZE 4096
+
+
+// this function copies count selected bytes, starting at the selected
+// byte at position, from the pixel array into buffer (or the other
+// way around if toPixels is 1). position is moved past them.
+static void moveSelected(BYTE* pixels, const ChannelSelection* selection, size_t* position, BYTE* buffer,
+                         size_t count, int toPixels)
+{
+    int allSelected = selection->channels == (1 << selection->bytesPerPixel) - 1;
+    size_t row = *position / selection->stride;
+    size_t column = *position % selection->stride;
+
+    while (count > 0)
+    {
+        BYTE* rowStart = pixels + row * selection->stride;
+
+        if (allSelected)
+        {
+            size_t length = selection->rowBytes - column;
+            if (length > count)
+                length = count;
+
+            if (toPixels)
+                memcpy(rowStart + column, buffer, length);
+            else
+                memcpy(buffer, rowStart + column, length);
+
+            buffer += length;
+            count -= length;
+            column += length;
+        }
+        else
+        {
+            int channel = column % selection->bytesPerPixel;
+            for (; count > 0 && column < selection->rowBytes; column++)
+            {
+                if (selection->channels >> channel & 1)
+                {
+                    if (toPixels)
+                        rowStart[column] = *buffer;
+                    else
+                        *buffer = rowStart[column];
+                    buffer++;
+                    count--;
+                }
+
+                if (++channel == selection->bytesPerPixel)
+                    channel = 0;
+            }
+        }
+
+        // the padding is skipped by going to the start of the next row.
+        if (column >= selection->rowBytes)
+        {
+            row++;
+            column = 0;
+        }
+    }
+
+    *position = row * selection->stride + column;
+}
+
+
+// this function stores count payload bytes in the low depth bits of
+// the selected bytes of the pixel array, starting at index.
+void embedBitsInChannels(BYTE* pixels, const ChannelSelection* selection, size_t index, int depth,
+                         const BYTE* payload, size_t count)
+{
+    BYTE buffer[ROWCHUNKSIZE];
+    size_t perChunk = ROWCHUNKSIZE / BYTESIZE * depth;
+
+    while (count > 0)
+    {
+        size_t chunk = count < perChunk ? count : perChunk;
+        size_t coverBytes = coverBytesFor(depth, chunk);
+
+        size_t position = index;
+        moveSelected(pixels, selection, &position, buffer, coverBytes, 0);
+        embedBitsInLSB(buffer, depth, payload, chunk);
+        moveSelected(pixels, selection, &index, buffer, coverBytes, 1);
+
+        payload += chunk;
+        count -= chunk;
+    }
+}
+
+
+// this function reads count payload bytes from the low depth bits of
+// the selected bytes of the pixel array, starting at index.
+void extractBitsFromChannels(const BYTE* pixels, const ChannelSelection* selection, size_t index, int depth,
+                             BYTE* payload, size_t count)
+{
+    BYTE buffer[ROWCHUNKSIZE];
+    size_t perChunk = ROWCHUNKSIZE / BYTESIZE * depth;
+
+    while (count > 0)
+    {
+        size_t chunk = count < perChunk ? count : perChunk;
+
+        // the pixels are only read here.
+        moveSelected((BYTE*) pixels, selection, &index, buffer, coverBytesFor(depth, chunk), 0);
+        extractBitsFromLSB(buffer, depth, payload, chunk);
+
+        payload += chunk;
+        count -= chunk;
+    }
+}
+
+
+// returns the name of the kernels in use ("scalar", "sse2" or "avx2").
+const char* lsbKernelName(void)
+{
+    return kernelName;
+}
@@ -0,0 +1,44 @@
+// header file for the LSB embedding and extraction kernels
+
+#ifndef LSBKERNELS_H_
+#define LSBKERNELS_H_
+
+#include <stddef.h>
+
+#include "helpers.h"
+
+
+// the bytes of a pixel array that the channel kernels use: the
+// channels (bit 0 for the first byte of every pixel, bit 1 for the
+// second, ...) of the first rowBytes bytes of every stride bytes.
+typedef struct
+{
+    size_t rowBytes;
+    size_t stride;
+    int bytesPerPixel;
+    int channels;
+} ChannelSelection;
+
+
+// function declarations
+
+// every payload byte is spread over the LSBs of 8 cover bytes, the
+// least significant bit of the payload byte going into the first
+// cover byte. so cover must have 8 * count bytes.
+void embedBytesInLSB(BYTE* cover, const BYTE* payload, size_t count);
+void extractBytesFromLSB(const BYTE* cover, BYTE* payload, size_t count);
+
+// the same with depth (1 - 4) bits per cover byte.
+void embedBitsInLSB(BYTE* cover, int depth, const BYTE* payload, size_t count);
+void extractBitsFromLSB(const BYTE* cover, int depth, BYTE* payload, size_t count);
+size_t coverBytesFor(int depth, size_t count);
+
+// the same using only the selected bytes of a pixel array.
+void embedBitsInChannels(BYTE* pixels, const ChannelSelection* selection, size_t index, int depth,
+                         const BYTE* payload, size_t count);
+void extractBitsFromChannels(const BYTE* pixels, const ChannelSelection* selection, size_t index, int depth,
+                             BYTE* payload, size_t count);
+
+const char* lsbKernelName(void);
+
+#endif
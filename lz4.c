@@ -0,0 +1,275 @@
+// this file has the LZ4 block compressor and decompressor that libstego
+// uses to make a message smaller before it is stored (see
+// compression.c).
+//
+// the data is a list of sequences, each of them some literal bytes and
+// then a match: a copy of at least 4 bytes that starts up to 65535
+// bytes back. a sequence starts with a token byte with the number of
+// literals in its high 4 bits and the length of the match minus 4 in
+// its low 4 bits (15 means more bytes of 255 follow, up to a byte that
+// is less than 255), then come the literals and the distance of the
+// match as a little endian 16-bit number. the last sequence only has
+// literals, and the last 5 bytes are always literals, the same as the
+// LZ4 block format, so any LZ4 decompressor can read it.
+//
+// matches are found with a hash table of the last position of every
+// 4 byte sequence and no chains, and the search speeds up in data that
+// has no matches, so noisy data costs little. there is no entropy
+// coding, so both directions run at memory speed (a few cycles per
+// byte).
+
+#include <stdint.h>
+#include <string.h>
+
+#include "helpers.h"
+#include "lz4.h"
+
+// the shortest match.
+#define MINMATCH 4
+
+// the last bytes of the data that are always literals, and how far
+// from the end the last match can start.
+#define LASTLITERALS 5
+#define MATCHLIMIT 12
+
+// the number of misses after which the search takes bigger steps.
+#define SKIPSHIFT 6
+
+
+// returns 4 bytes of data as a number.
+static uint32_t read32(const BYTE* bytes)
+{
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+
+// returns 8 bytes of data as a number.
+static uint64_t read64(const BYTE* bytes)
+{
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+
+// returns the hash of 4 bytes of data.
+static uint32_t hashOf(uint32_t value)
+{
+    return (value * 2654435761u) >> (32 - LZ4HASHBITS);
+}
+
+
+// this function writes a length of 15 or more after a token: the
+// bytes of 255 and the last byte that is less than 255.
+static BYTE* writeLength(BYTE* out, size_t length)
+{
+    for (; length >= 255; length -= 255)
+        *out++ = 255;
+    *out++ = length;
+    return out;
+}
+
+
+// this function writes a sequence, the literals and then a match
+// (none if matchLength is 0, for the last sequence).
+// returns where the next sequence goes.
+static BYTE* writeSequence(BYTE* out, const BYTE* literals, size_t literalLength, size_t distance,
+                           size_t matchLength)
+{
+    BYTE* token = out++;
+    *token = (literalLength < 15 ? literalLength : 15) << 4;
+    if (literalLength >= 15)
+        out = writeLength(out, literalLength - 15);
+
+    memcpy(out, literals, literalLength);
+    out += literalLength;
+    if (matchLength == 0)
+        return out;
+
+    out[0] = distance;
+    out[1] = distance >> 8;
+    out += 2;
+
+    matchLength -= MINMATCH;
+    *token |= matchLength < 15 ? matchLength : 15;
+    if (matchLength >= 15)
+        out = writeLength(out, matchLength - 15);
+
+    return out;
+}
+
+
+// returns the number of bytes from a to limit that are the same as the
+// ones from b.
+static size_t matchLengthOf(const BYTE* a, const BYTE* b, const BYTE* limit)
+{
+    const BYTE* start = a;
+    while (a + 8 <= limit)
+    {
+        uint64_t difference = read64(a) ^ read64(b);
+        if (difference != 0)
+            return a - start + (__builtin_ctzll(difference) >> 3);
+        a += 8;
+        b += 8;
+    }
+
+    while (a < limit && *a == *b)
+    {
+        a++;
+        b++;
+    }
+
+    return a - start;
+}
+
+
+// this function compresses length bytes of data (less than 4 GB) into
+// out, which must have space for LZ4BOUND(length) bytes.
+// returns the number of bytes written.
+size_t lz4Compress(LZ4Table* table, const BYTE* data, size_t length, BYTE* out)
+{
+    const BYTE* end = data + length;
+    const BYTE* anchor = data;
+    BYTE* start = out;
+
+    if (length > MATCHLIMIT)
+    {
+        const BYTE* matchEnd = end - LASTLITERALS;
+        const BYTE* searchEnd = end - MATCHLIMIT;
+        memset(table->positions, 0, sizeof(table->positions));
+
+        const BYTE* position = data + 1;
+        while (position < searchEnd)
+        {
+            // find the next match, taking bigger steps the longer
+            // there isn't one.
+            const BYTE* match;
+            unsigned misses = 1 << SKIPSHIFT;
+            while (1)
+            {
+                uint32_t value = read32(position);
+                uint32_t hash = hashOf(value);
+                match = data + table->positions[hash];
+                table->positions[hash] = position - data;
+                if (position - match <= LZ4WINDOWSIZE && read32(match) == value)
+                    break;
+
+                position += misses++ >> SKIPSHIFT;
+                if (position >= searchEnd)
+                    goto lastLiterals;
+            }
+
+            // the match may start earlier than where it was found.
+            while (position > anchor && match > data && position[-1] == match[-1])
+            {
+                position--;
+                match--;
+            }
+
+            size_t matchLength = MINMATCH + matchLengthOf(position + MINMATCH, match + MINMATCH, matchEnd);
+            out = writeSequence(out, anchor, position - anchor, position - match, matchLength);
+            position += matchLength;
+            anchor = position;
+
+            // the position just before the next one is a likely start
+            // of a later match.
+            if (position < searchEnd)
+                table->positions[hashOf(read32(position - 2))] = position - 2 - data;
+        }
+    }
+
+lastLiterals:
+    out = writeSequence(out, anchor, end - anchor, 0, 0);
+    return out - start;
+}
+
+
+// this function reads a length of 15 or more after a token (the bytes
+// after the first 15).
+// returns 1 if it could and 0 if the compressed data ended first.
+static int readLength(const BYTE** compressed, const BYTE* end, size_t* length)
+{
+    BYTE byte;
+    do
+    {
+        if (*compressed >= end)
+            return 0;
+        byte = *(*compressed)++;
+        *length += byte;
+    } while (byte == 255);
+
+    return 1;
+}
+
+
+// this function decompresses data that was compressed with
+// lz4Compress() (or any LZ4 compressor) into out, which must be
+// exactly length bytes long. damaged data never makes it read or write
+// outside the buffers.
+// returns 1 if the data decompressed to exactly length bytes and 0 if
+// it didn't.
+int lz4Decompress(const BYTE* compressed, size_t compressedLength, BYTE* out, size_t length)
+{
+    const BYTE* in = compressed;
+    const BYTE* inEnd = compressed + compressedLength;
+    BYTE* position = out;
+    BYTE* outEnd = out + length;
+
+    while (in < inEnd)
+    {
+        BYTE token = *in++;
+
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !readLength(&in, inEnd, &literalLength))
+            return 0;
+        if (literalLength > (size_t) (inEnd - in) || literalLength > (size_t) (outEnd - position))
+            return 0;
+
+        // the literals are copied 16 bytes at a time when there is room
+        // after them in both buffers.
+        if (literalLength <= 16 && inEnd - in >= 16 && outEnd - position >= 16)
+            memcpy(position, in, 16);
+        else
+            memcpy(position, in, literalLength);
+        position += literalLength;
+        in += literalLength;
+
+        // the last sequence has no match.
+        if (in == inEnd)
+            break;
+
+        if (inEnd - in < 2)
+            return 0;
+        size_t distance = in[0] | in[1] << 8;
+        in += 2;
+        if (distance == 0 || distance > (size_t) (position - out))
+            return 0;
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !readLength(&in, inEnd, &matchLength))
+            return 0;
+        matchLength += MINMATCH;
+        if (matchLength > (size_t) (outEnd - position))
+            return 0;
+
+        // a match that doesn't overlap itself by less than 8 bytes is
+        // copied 8 bytes at a time when there is room after it.
+        const BYTE* match = position - distance;
+        BYTE* matchEnd = position + matchLength;
+        if (distance >= 8 && outEnd - matchEnd >= 8)
+        {
+            for (; position < matchEnd; position += 8, match += 8)
+                memcpy(position, match, 8);
+        }
+        else
+        {
+            for (; position < matchEnd; position++, match++)
+                *position = *match;
+        }
+        position = matchEnd;
+    }
+
+    return position == outEnd;
+}
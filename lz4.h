@@ -0,0 +1,34 @@
+// header file for the LZ4 block compressor and decompressor
+
+#ifndef LZ4_H_
+#define LZ4_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "helpers.h"
+
+// the number of bits of the hash of 4 bytes that is used to find
+// matches.
+#define LZ4HASHBITS 12
+
+// how far back a match can reach.
+#define LZ4WINDOWSIZE 65535
+
+// the most bytes lz4Compress() writes for length bytes of data.
+#define LZ4BOUND(length) ((length) + (length) / 255 + 16)
+
+// the memory lz4Compress() works in: the last position (from the start
+// of the data) every hash was seen at. every thread that compresses
+// needs one of its own.
+typedef struct
+{
+    uint32_t positions[1 << LZ4HASHBITS];
+} LZ4Table;
+
+
+// function declarations
+size_t lz4Compress(LZ4Table* table, const BYTE* data, size_t length, BYTE* out);
+int lz4Decompress(const BYTE* compressed, size_t compressedLength, BYTE* out, size_t length);
+
+#endif
@@ -0,0 +1,700 @@
+// this file has the functions that bring the input image into memory
+// for libstego (stego.c) and write the output image, for
+// writemessage.c, readmessage.c and batchmessage.c.
+//
+// a regular file is mapped into memory, anything else (a pipe for
+// example) is read into memory in large blocks. the output image is
+// written by copying the unchanged part of the input inside the
+// kernel with copy_file_range() or sendfile() and writing only the
+// bytes that change. a png with the message in its pixels (or a jpg
+// with it in its coefficients) is written in order as it is compressed
+// again (see pngpixels.c and jpgcoefficients.c).
+//
+// an image can also be patched where it is (writemessage --in-place)
+// or in a clone of it (--clone): only the bytes of the patch are
+// written with pwrite(), which is what matters on a network
+// filesystem. an output image can be written to a temporary file that
+// is synced and renamed over it at the end (--sync), so that it is
+// never seen half written.
+//
+// the I/O is counted and the copy and embed phases are timed for
+// --stats (see stats.c).
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "helpers.h"
+#include "mappedio.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "stego.h"
+#include "threadpool.h"
+
+
+// this function maps the whole file into memory for reading.
+// the mapping is private, so the data can be changed in memory (to
+// encrypt a payload for example) without changing the file.
+// returns 1 if the file was mapped and 0 if it could not be
+// mapped (the file is not a regular file, is empty or mmap failed).
+int mapFileForReading(FILE* file, MappedFile* map)
+{
+    struct stat info;
+    int fd = fileno(file);
+
+    // only regular files can be mapped, pipes and terminals can not.
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0)
+        return 0;
+
+    void* data = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return 0;
+
+    // the file is going to be read from start to end so tell the
+    // kernel to read ahead aggressively.
+    madvise(data, info.st_size, MADV_SEQUENTIAL);
+
+    map->data = data;
+    map->size = info.st_size;
+    map->fd = fd;
+    map->isMapped = 1;
+    COUNT(bytesMapped, map->size);
+    return 1;
+}
+
+
+// this function resizes the output file to the given size and maps
+// it into memory for writing. the file must have been opened for
+// reading and writing ("w+") for the mapping to work.
+// returns 1 if the file was mapped and 0 if it could not be mapped.
+int mapFileForWriting(FILE* file, size_t size, MappedFile* map)
+{
+    struct stat info;
+    int fd = fileno(file);
+
+    // write out whatever is still sitting in the stdio buffer
+    // so that it doesn't get written over the mapped data later.
+    fflush(file);
+
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || size == 0)
+        return 0;
+
+    if (ftruncate(fd, size) != 0)
+        return 0;
+
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+        return 0;
+
+    map->data = data;
+    map->size = size;
+    map->fd = fd;
+    map->isMapped = 1;
+    COUNT(bytesMapped, size);
+    return 1;
+}
+
+
+// this function brings the whole file into memory: it is mapped if it
+// is a regular file, otherwise it is read into memory in large blocks.
+// returns 1 on success and 0 if the file could not be read.
+int loadFile(FILE* file, MappedFile* map)
+{
+    if (mapFileForReading(file, map) == 1)
+        return 1;
+
+    size_t size = 0;
+    size_t capacity = 0;
+    BYTE* data = NULL;
+    while (1)
+    {
+        if (size == capacity)
+        {
+            capacity = capacity == 0 ? LARGEBLOCKSIZE : capacity * 2;
+            BYTE* bigger = realloc(data, capacity);
+            if (bigger == NULL)
+            {
+                free(data);
+                return 0;
+            }
+            data = bigger;
+        }
+
+        size_t bytesRead = fread(data + size, 1, capacity - size, file);
+        COUNT(readCalls, 1);
+        COUNT(bytesRead, bytesRead);
+        if (bytesRead == 0)
+            break;
+        size += bytesRead;
+    }
+
+    map->data = data;
+    map->size = size;
+    map->fd = -1;
+    map->isMapped = 0;
+    return 1;
+}
+
+
+// this function unmaps (or frees) a file that was brought into memory
+// by one of the functions above.
+void unmapFile(MappedFile* map)
+{
+    if (map->data != NULL)
+    {
+        if (map->isMapped == 1)
+            munmap(map->data, map->size);
+        else
+            free(map->data);
+    }
+
+    map->data = NULL;
+    map->size = 0;
+    map->fd = -1;
+    map->isMapped = 0;
+}
+
+
+// this function copies length bytes, starting at inOffset in the
+// file inFd, to the current position of outFd.
+//
+// the copy is first handed to the kernel with copy_file_range()
+// (which never brings the data into user space and can share the
+// blocks on filesystems that support it). if that is not possible
+// (outFd is a pipe, the files are on different filesystems, an old
+// kernel...) sendfile() is tried and if that fails too, the data is
+// copied with pread() and write() in large blocks.
+//
+// returns the number of bytes that were copied.
+size_t copyFileRegion(int inFd, off_t inOffset, int outFd, size_t length)
+{
+    size_t copied = 0;
+
+    while (copied < length)
+    {
+        ssize_t result = copy_file_range(inFd, &inOffset, outFd, NULL, length - copied, 0);
+        COUNT(copyCalls, 1);
+        if (result <= 0)
+            break;
+        copied += result;
+    }
+
+    while (copied < length)
+    {
+        ssize_t result = sendfile(outFd, inFd, &inOffset, length - copied);
+        COUNT(copyCalls, 1);
+        if (result <= 0)
+            break;
+        copied += result;
+    }
+    COUNT(bytesCopied, copied);
+
+    if (copied < length)
+    {
+        BYTE* block = malloc(LARGEBLOCKSIZE);
+        if (block == NULL)
+            return copied;
+
+        while (copied < length)
+        {
+            size_t blockSize = length - copied;
+            if (blockSize > LARGEBLOCKSIZE)
+                blockSize = LARGEBLOCKSIZE;
+
+            ssize_t bytesRead = pread(inFd, block, blockSize, inOffset);
+            COUNT(readCalls, 1);
+            if (bytesRead < 0 && errno == EINTR)
+                continue;
+            if (bytesRead <= 0)
+                break;
+
+            // write() may write less than it was asked to (into a
+            // pipe for example), so keep writing until the whole
+            // block is out.
+            ssize_t written = 0;
+            while (written < bytesRead)
+            {
+                ssize_t result = write(outFd, block + written, bytesRead - written);
+                COUNT(writeCalls, 1);
+                if (result < 0 && errno == EINTR)
+                    continue;
+                if (result <= 0)
+                    break;
+                written += result;
+            }
+            COUNT(bytesRead, bytesRead);
+            COUNT(bytesWritten, written);
+
+            inOffset += written;
+            copied += written;
+            if (written < bytesRead)
+                break;
+        }
+        free(block);
+    }
+
+    return copied;
+}
+
+
+// this function writes length bytes to out with a single call.
+// returns 1 if they were all written.
+static int writeBytes(const BYTE* bytes, size_t length, FILE* out)
+{
+    if (length == 0)
+        return 1;
+
+    size_t written = fwrite(bytes, 1, length, out);
+    COUNT(writeCalls, 1);
+    COUNT(bytesWritten, written);
+    return written == length;
+}
+
+
+// this function writes length bytes to the file descriptor, going
+// through the kernel copy functions when the bytes are part of a
+// file that is mapped.
+static int writeRegion(MappedFile* in, size_t offset, size_t length, FILE* out)
+{
+    if (length == 0)
+        return 1;
+
+    size_t copied = 0;
+    if (in->fd >= 0)
+    {
+        fflush(out);
+        copied = copyFileRegion(in->fd, offset, fileno(out), length);
+    }
+
+    return writeBytes(in->data + offset + copied, length - copied, out);
+}
+
+
+// this function copies the bytes [offset, offset + length) of the
+// input image to the same place in the mapped output image, inside
+// the kernel if it can.
+static void copyToMappedRegion(MappedFile* in, MappedFile* out, size_t offset, size_t length)
+{
+    if (length == 0)
+        return;
+
+    size_t copied = 0;
+    if (in->fd >= 0 && lseek(out->fd, offset, SEEK_SET) == (off_t) offset)
+        copied = copyFileRegion(in->fd, offset, out->fd, length);
+    if (copied != length)
+        memcpy(out->data + offset + copied, in->data + offset + copied, length - copied);
+}
+
+
+// returns the number of bytes that are different in a and b.
+static size_t countChanged(const BYTE* a, const BYTE* b, size_t length)
+{
+    size_t changed = 0;
+    for (size_t i = 0; i < length; i++)
+        changed += a[i] != b[i];
+    return changed;
+}
+
+
+// this function counts the bytes of the patch for --stats, and how
+// many of them are different from the bytes of the input image they
+// take the place of.
+static void countPatch(MappedFile* in, size_t patchOffset, size_t patchLength, const BYTE* patch)
+{
+    if (stats == NULL)
+        return;
+
+    size_t overlap = 0;
+    if (patchOffset < in->size)
+        overlap = in->size - patchOffset;
+    if (overlap > patchLength)
+        overlap = patchLength;
+
+    COUNT(patchBytes, patchLength);
+    COUNT(coverBytesModified, countChanged(in->data + patchOffset, patch, overlap));
+}
+
+
+// where a png or jpg with the message in its pixels is written.
+typedef struct
+{
+    FILE* out;
+    int threadCount;
+} StreamWriter;
+
+
+// this function writes the next bytes of the image (see
+// stego_output in stego.h).
+static int writeStreamBytes(void* context, const uint8_t* bytes, size_t length)
+{
+    StreamWriter* writer = context;
+    return writeBytes(bytes, length, writer->out);
+}
+
+
+// this function runs the compression of the blocks of the png on the
+// thread pool.
+static void runStreamTasks(void* context, long taskCount, void (*task)(void* taskContext, long task, int worker),
+                           void* taskContext)
+{
+    StreamWriter* writer = context;
+    runTasks(taskCount, writer->threadCount, task, taskContext);
+}
+
+
+// this function writes a png or jpg with the message in its pixels to
+// out, compressing a png with up to threadCount threads.
+// returns 1 if the image was written and 0 if it was not.
+static int writePixelImage(MappedFile* in, stego_layout* layout, BYTE* message, size_t length, FILE* out,
+                           int threadCount)
+{
+    StreamWriter writer = {out, threadCount};
+    stego_output output = {writeStreamBytes, runStreamTasks, &writer, threadCount};
+
+    double start = phaseStart();
+    int result = stego_embed_stream(in->data, in->size, layout, message, length, &output);
+    phaseEnd("embed", start);
+
+    return result == STEGO_OK && fflush(out) == 0;
+}
+
+
+// this function writes length bytes at offset in the file fd. pwrite()
+// may write less than it was asked to, so it keeps writing until they
+// are all in.
+// returns 1 if they were written and 0 if they weren't.
+static int writeAt(int fd, const BYTE* bytes, size_t length, size_t offset)
+{
+    for (size_t done = 0; done < length;)
+    {
+        ssize_t result = pwrite(fd, bytes + done, length - done, offset + done);
+        COUNT(writeCalls, 1);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            return 0;
+
+        COUNT(bytesWritten, result);
+        done += result;
+    }
+
+    return 1;
+}
+
+
+// this function cuts (or grows) the file fd to size bytes if it is not
+// that long already.
+// returns 1 if it could and 0 if it couldn't.
+static int resizeFile(int fd, size_t size)
+{
+    struct stat info;
+    return fstat(fd, &info) == 0 && ((size_t) info.st_size == size || ftruncate(fd, size) == 0);
+}
+
+
+// this function writes the output image of a huge bmp to the regular
+// file out through the pipeline (see pipeline.c), so neither the input
+// nor the output image has to be brought into memory: the parts that
+// are kept around the patch are copied inside the kernel and the patch
+// is streamed a block at a time.
+// returns 1 if the image was written, 0 if it was not and -1 if the
+// pipeline can't be used for it (nothing was written then).
+static int pipeToFile(MappedFile* in, stego_layout* layout, BYTE* message, size_t length, FILE* out,
+                      int threadCount)
+{
+    struct stat info;
+    int fd = fileno(out);
+    fflush(out);
+    if (in->fd < 0 || layout->patchLength < PIPELINETHRESHOLD || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+        return -1;
+
+    int written = pipeEmbeddedImage(in, layout, message, length, fd, threadCount);
+    if (written != 1)
+        return written;
+
+    double start = phaseStart();
+    size_t patchEnd = layout->patchOffset + layout->patchLength;
+    size_t offsets[2] = {0, patchEnd};
+    size_t lengths[2] = {layout->patchOffset, layout->keepLength > patchEnd ? layout->keepLength - patchEnd : 0};
+    for (int i = 0; i < 2 && written; i++)
+    {
+        size_t copied = 0;
+        if (lengths[i] > 0 && lseek(fd, offsets[i], SEEK_SET) == (off_t) offsets[i])
+            copied = copyFileRegion(in->fd, offsets[i], fd, lengths[i]);
+        written = writeAt(fd, in->data + offsets[i] + copied, lengths[i] - copied, offsets[i] + copied);
+    }
+    written = written && resizeFile(fd, layout->outputSize)
+              && lseek(fd, layout->outputSize, SEEK_SET) == (off_t) layout->outputSize;
+    phaseEnd("copy", start);
+
+    return written;
+}
+
+
+// this function writes the output image described by the layout
+// (see stego_plan() in stego.h) for the image in, with the message
+// stored in it, to out. the patch is produced with up to threadCount
+// threads (see parallel.c).
+//
+// if out is a regular file the unchanged part of the image is copied
+// inside the kernel and the patch is produced straight in the mapped
+// output file. otherwise (a pipe for example) the image is written in
+// order: the part before the patch, the patch and the part after it.
+// a png or jpg with the message in its pixels is always written in
+// order.
+//
+// returns 1 if the image was written and 0 if it was not.
+int writeEmbeddedImage(MappedFile* in, stego_layout* layout, BYTE* message, size_t length, FILE* out,
+                       int threadCount)
+{
+    if (layout->flags & STEGO_PIXELS)
+        return writePixelImage(in, layout, message, length, out, threadCount);
+
+    int piped = pipeToFile(in, layout, message, length, out, threadCount);
+    if (piped >= 0)
+        return piped;
+
+    size_t patchEnd = layout->patchOffset + layout->patchLength;
+
+    MappedFile outMap;
+    if (mapFileForWriting(out, layout->outputSize, &outMap) == 1)
+    {
+        // copy the parts that are kept around the patch (the patch
+        // starts with the original bytes anyway), and produce the
+        // patch.
+        double start = phaseStart();
+        copyToMappedRegion(in, &outMap, 0, layout->patchOffset);
+        if (layout->keepLength > patchEnd)
+            copyToMappedRegion(in, &outMap, patchEnd, layout->keepLength - patchEnd);
+        phaseEnd("copy", start);
+
+        start = phaseStart();
+        int result = embedInParallel(in->data, in->size, layout, message, length,
+                                     outMap.data + layout->patchOffset, threadCount);
+        phaseEnd("embed", start);
+
+        countPatch(in, layout->patchOffset, layout->patchLength, outMap.data + layout->patchOffset);
+        unmapFile(&outMap);
+        return result == STEGO_OK;
+    }
+
+    BYTE* patch = malloc(layout->patchLength);
+    if (patch == NULL)
+        return 0;
+
+    double start = phaseStart();
+    int written = embedInParallel(in->data, in->size, layout, message, length, patch, threadCount) == STEGO_OK;
+    phaseEnd("embed", start);
+    countPatch(in, layout->patchOffset, layout->patchLength, patch);
+
+    start = phaseStart();
+    written = written && writeRegion(in, 0, layout->patchOffset, out)
+              && writeBytes(patch, layout->patchLength, out);
+    free(patch);
+
+    // the part of the image that comes after the patch (for a bmp).
+    if (written && layout->keepLength > patchEnd)
+        written = writeRegion(in, patchEnd, layout->keepLength - patchEnd, out);
+
+    written = written && fflush(out) == 0;
+    phaseEnd("copy", start);
+    return written;
+}
+
+
+// this function makes the file outFd (which is empty) a copy of the
+// first size bytes of the file inFd. on a filesystem that can share
+// blocks between files (btrfs, xfs) the copy is a reflink that takes
+// no space and no time, otherwise it is copied inside the kernel (see
+// copyFileRegion()).
+// returns 1 if the whole file was copied and 0 if it wasn't.
+int cloneFile(int inFd, int outFd, size_t size)
+{
+    double start = phaseStart();
+    struct stat info;
+    int cloned = fstat(inFd, &info) == 0 && (size_t) info.st_size == size && ioctl(outFd, FICLONE, inFd) == 0;
+    if (cloned)
+    {
+        COUNT(copyCalls, 1);
+        COUNT(bytesCopied, size);
+    }
+    else
+        cloned = lseek(outFd, 0, SEEK_SET) == 0 && copyFileRegion(inFd, 0, outFd, size) == size;
+    phaseEnd("copy", start);
+
+    return cloned;
+}
+
+
+// this function writes the message into a file that already holds the
+// input image (the input image itself, or a clone of it), as the
+// layout says (see stego_plan() in stego.h): only the patch is written
+// with pwrite(), and the file is cut to the size of the output image
+// if that is different (a png or jpg that had a longer message
+// appended before). the patch is produced with up to threadCount
+// threads first, so the file can be the one in is mapped from.
+// a png or jpg with the message in its pixels can't be patched.
+// returns 1 if the image was patched and 0 if it was not.
+int patchEmbeddedImage(MappedFile* in, stego_layout* layout, BYTE* message, size_t length, int fd,
+                       int threadCount)
+{
+    if (layout->flags & STEGO_PIXELS)
+        return 0;
+
+    // a huge patch is streamed a block at a time instead of being
+    // produced in memory first.
+    if (layout->patchLength >= PIPELINETHRESHOLD)
+    {
+        int piped = pipeEmbeddedImage(in, layout, message, length, fd, threadCount);
+        if (piped >= 0)
+        {
+            double start = phaseStart();
+            piped = piped && resizeFile(fd, layout->outputSize);
+            phaseEnd("write", start);
+            return piped;
+        }
+    }
+
+    BYTE* patch = malloc(layout->patchLength > 0 ? layout->patchLength : 1);
+    if (patch == NULL)
+        return 0;
+
+    double start = phaseStart();
+    int written = embedInParallel(in->data, in->size, layout, message, length, patch, threadCount) == STEGO_OK;
+    phaseEnd("embed", start);
+    countPatch(in, layout->patchOffset, layout->patchLength, patch);
+
+    start = phaseStart();
+    written = written && writeAt(fd, patch, layout->patchLength, layout->patchOffset)
+              && resizeFile(fd, layout->outputSize);
+    free(patch);
+    phaseEnd("write", start);
+
+    return written;
+}
+
+
+// this function rewrites some bytes of the message stored in the image
+// in, in a file that already holds it (the image itself, or a clone of
+// it), as the updates say (see stego_plan_update() in stego.h). bytes
+// has the new bytes of every update. all the patches are produced
+// first, so the file can be the one in is mapped from, and written in
+// order (a later one wins where they share bytes), then the header
+// with the new length is written last, so a crash never leaves a
+// header that says the message is longer than what was written.
+// the updates must all give the message the same length.
+// returns 1 if the image was patched and 0 if it was not.
+int patchMessageBytes(MappedFile* in, const stego_update* updates, const BYTE* const* bytes, int count, int fd)
+{
+    BYTE** patches = calloc(count, sizeof(BYTE*));
+    BYTE* header = malloc(updates[0].headerLength);
+    int written = patches != NULL && header != NULL;
+
+    double start = phaseStart();
+    for (int i = 0; i < count && written; i++)
+    {
+        patches[i] = malloc(updates[i].patchLength > 0 ? updates[i].patchLength : 1);
+        written = patches[i] != NULL
+                  && stego_embed_update(in->data, in->size, &updates[i], bytes[i], header, patches[i]) == STEGO_OK;
+        if (written)
+            countPatch(in, updates[i].patchOffset, updates[i].patchLength, patches[i]);
+    }
+    if (written)
+        countPatch(in, updates[0].headerOffset, updates[0].headerLength, header);
+    phaseEnd("embed", start);
+
+    start = phaseStart();
+    for (int i = 0; i < count && written; i++)
+        written = writeAt(fd, patches[i], updates[i].patchLength, updates[i].patchOffset);
+    written = written && writeAt(fd, header, updates[0].headerLength, updates[0].headerOffset)
+              && resizeFile(fd, updates[0].outputSize);
+    phaseEnd("write", start);
+
+    for (int i = 0; i < count && patches != NULL; i++)
+        free(patches[i]);
+    free(patches);
+    free(header);
+    return written;
+}
+
+
+// this function opens the file an output image is written to. with
+// sync it is a new temporary file in the same directory as path, which
+// closeOutputFile() renames over path, so that path is never seen
+// half written (the temporary file gets the permissions of the file it
+// replaces, or the ones fopen() would give a new file).
+// returns 1 if the file was opened and 0 if it wasn't.
+int openOutputFile(const char* path, int sync, OutputFile* out)
+{
+    out->path = path;
+    out->sync = sync;
+    out->temporaryPath[0] = '\0';
+    if (!sync)
+    {
+        out->file = fopen(path, "w+");
+        return out->file != NULL;
+    }
+
+    struct stat info;
+    mode_t mask = umask(0);
+    umask(mask);
+    mode_t mode = stat(path, &info) == 0 ? info.st_mode : 0666 & ~mask;
+
+    out->file = NULL;
+    int fd = -1;
+    if ((size_t) snprintf(out->temporaryPath, FILENAME_MAX, "%s.XXXXXX", path) < FILENAME_MAX)
+        fd = mkstemp(out->temporaryPath);
+    if (fd >= 0 && (fchmod(fd, mode & 07777) != 0 || (out->file = fdopen(fd, "w+")) == NULL))
+    {
+        close(fd);
+        unlink(out->temporaryPath);
+    }
+
+    return out->file != NULL;
+}
+
+
+// this function closes an output image that was opened with
+// openOutputFile(). a temporary file is synced to the disk and renamed
+// over the path if the image was written (and so is the directory the
+// rename is in), or removed if it wasn't.
+// returns 1 if the image is where it belongs and 0 if it isn't.
+int closeOutputFile(OutputFile* out, int written)
+{
+    written = fflush(out->file) == 0 && written;
+    if (!out->sync)
+        return fclose(out->file) == 0 && written;
+
+    double start = phaseStart();
+    written = fsync(fileno(out->file)) == 0 && written;
+    written = fclose(out->file) == 0 && written;
+    if (written && rename(out->temporaryPath, out->path) == 0)
+    {
+        char directory[FILENAME_MAX];
+        snprintf(directory, FILENAME_MAX, "%s", out->path);
+        int fd = open(dirname(directory), O_RDONLY | O_DIRECTORY);
+        written = fd >= 0 && fsync(fd) == 0;
+        if (fd >= 0)
+            close(fd);
+    }
+    else
+    {
+        unlink(out->temporaryPath);
+        written = 0;
+    }
+    phaseEnd("sync", start);
+
+    return written;
+}
@@ -0,0 +1,63 @@
+// header file for the functions that bring images into memory and
+// write them out, used by writemessage.c, readmessage.c and
+// batchmessage.c
+
+#ifndef MAPPEDIO_H_
+#define MAPPEDIO_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "helpers.h"
+#include "stego.h"
+
+// size of the blocks that are read from (or written to) a file that
+// can not be mapped (a pipe or a terminal for example).
+#define LARGEBLOCKSIZE (1 << 20)
+
+// a file that has been brought into memory.
+// data points to the first byte of the file and size is the number
+// of bytes in the file. if the file was mapped, isMapped is 1 and fd
+// is the file descriptor it was mapped from, otherwise the data was
+// read into memory and fd is -1.
+typedef struct
+{
+    BYTE* data;
+    size_t size;
+    int fd;
+    int isMapped;
+} MappedFile;
+
+
+// an output image that is being written (see openOutputFile()). file
+// is where it is written to, a temporary file next to path when sync
+// is 1.
+typedef struct
+{
+    FILE* file;
+    const char* path;
+    char temporaryPath[FILENAME_MAX];
+    int sync;
+} OutputFile;
+
+
+// function declarations
+int mapFileForReading(FILE* file, MappedFile* map);
+int mapFileForWriting(FILE* file, size_t size, MappedFile* map);
+int loadFile(FILE* file, MappedFile* map);
+void unmapFile(MappedFile* map);
+
+size_t copyFileRegion(int inFd, off_t inOffset, int outFd, size_t length);
+int writeEmbeddedImage(MappedFile* in, stego_layout* layout, BYTE* message, size_t length, FILE* out,
+                       int threadCount);
+
+int cloneFile(int inFd, int outFd, size_t size);
+int patchEmbeddedImage(MappedFile* in, stego_layout* layout, BYTE* message, size_t length, int fd,
+                       int threadCount);
+int patchMessageBytes(MappedFile* in, const stego_update* updates, const BYTE* const* bytes, int count, int fd);
+
+int openOutputFile(const char* path, int sync, OutputFile* out);
+int closeOutputFile(OutputFile* out, int written);
+
+#endif
@@ -0,0 +1,108 @@
+// this file has the functions that store a message in (or read it from)
+// an image on a pool of threads (see threadpool.c).
+//
+// the message is split into parts that take about PARTCOVERSIZE cover
+// bytes each, and libstego embeds or extracts every part on its own
+// (see stego_embed_patch_part() and stego_extract_part()). the parts
+// never share a byte, so the result is exactly the same as doing it in
+// one go, whatever the number of threads.
+
+#include <stddef.h>
+
+#include "helpers.h"
+#include "parallel.h"
+#include "stego.h"
+#include "threadpool.h"
+
+// the most parts a message is split into.
+#define MAXPARTS 65536
+
+
+// what the parts of an embed or extract share.
+typedef struct
+{
+    const BYTE* image;
+    size_t size;
+    const stego_layout* layout;
+    const BYTE* message;
+    BYTE* buffer;
+    size_t length;
+    int parts;
+    int failed;
+    size_t firstLength;
+} Parts;
+
+
+// returns the number of parts a message of the given length stored
+// with depth bits per cover byte is split into.
+static int partsFor(size_t messageLength, int depth)
+{
+    size_t partLength = (size_t) PARTCOVERSIZE / BYTESIZE * depth;
+    size_t parts = messageLength / partLength + 1;
+    return parts < MAXPARTS ? parts : MAXPARTS;
+}
+
+
+static void embedPart(void* context, long task, int worker)
+{
+    (void) worker;
+    Parts* parts = context;
+
+    int result = stego_embed_patch_part(parts->image, parts->size, parts->layout, parts->message, parts->length,
+                                        parts->buffer, task, parts->parts);
+    if (result != STEGO_OK)
+        __atomic_store_n(&parts->failed, result, __ATOMIC_RELAXED);
+}
+
+
+static void extractPart(void* context, long task, int worker)
+{
+    (void) worker;
+    Parts* parts = context;
+
+    size_t length;
+    int result = stego_extract_part(parts->image, parts->size, parts->buffer, parts->length, &length, task,
+                                    parts->parts);
+    if (result != STEGO_OK)
+        __atomic_store_n(&parts->failed, result, __ATOMIC_RELAXED);
+    if (task == 0)
+        parts->firstLength = length;
+}
+
+
+// this function does what stego_embed_patch() does, using up to
+// threadCount threads.
+// returns the result of stego_embed_patch().
+int embedInParallel(const BYTE* in, size_t size, const stego_layout* layout, const BYTE* message,
+                    size_t messageLength, BYTE* patch, int threadCount)
+{
+    int partCount = stego_type(in, size) == STEGO_BMP ? partsFor(messageLength, layout->depth) : 1;
+    if (threadCount <= 1 || partCount == 1)
+        return stego_embed_patch(in, size, layout, message, messageLength, patch);
+
+    Parts parts = {in, size, layout, message, patch, messageLength, partCount, STEGO_OK, 0};
+    runTasks(partCount, threadCount, embedPart, &parts);
+    return parts.failed;
+}
+
+
+// this function does what stego_extract() does, using up to
+// threadCount threads.
+// returns the result of stego_extract().
+int extractInParallel(const BYTE* image, size_t size, BYTE* message, size_t capacity, size_t* messageLength,
+                      int threadCount)
+{
+    stego_header header;
+    int partCount = 1;
+    if (stego_type(image, size) == STEGO_BMP && stego_read_header(image, size, &header) == STEGO_OK
+        && header.version != 0)
+        partCount = partsFor(header.length, header.depth);
+
+    if (threadCount <= 1 || partCount == 1)
+        return stego_extract(image, size, message, capacity, messageLength);
+
+    Parts parts = {image, size, NULL, NULL, message, capacity, partCount, STEGO_OK, 0};
+    runTasks(partCount, threadCount, extractPart, &parts);
+    *messageLength = parts.firstLength;
+    return parts.failed;
+}
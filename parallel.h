@@ -0,0 +1,22 @@
+// header file for the functions that run libstego on a pool of threads
+
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <stddef.h>
+
+#include "helpers.h"
+#include "stego.h"
+
+// number of cover bytes every part of a bmp is split into, about the
+// size of the L2 cache of a core.
+#define PARTCOVERSIZE (1 << 20)
+
+
+// function declarations
+int embedInParallel(const BYTE* in, size_t size, const stego_layout* layout, const BYTE* message,
+                    size_t messageLength, BYTE* patch, int threadCount);
+int extractInParallel(const BYTE* image, size_t size, BYTE* message, size_t capacity, size_t* messageLength,
+                      int threadCount);
+
+#endif
@@ -0,0 +1,591 @@
+// this file has the pipeline that stores a message in a huge bmp (one
+// of many GB) without the disk and the CPU waiting for each other.
+//
+// the bytes of the image the message goes in are read a block of
+// PIPELINEBLOCKSIZE bytes at a time into PIPELINEDEPTH buffers, and
+// every block that has been read is embedded (see stego_embed_block(),
+// on up to threadCount threads) and written to the output image, while
+// the blocks after it are still being read and the ones before it are
+// still being written. so the device always has several large reads
+// and writes to work on, and the embed only waits when it is faster
+// than the device.
+//
+// the reads and writes go through io_uring (with the raw system calls,
+// there is no liburing) when the kernel has it. when it doesn't (an old
+// kernel, or a container that doesn't allow it) a thread reads the
+// blocks and another one writes them instead, with pread() and
+// pwrite().
+//
+// the input file is only read with the file descriptor it is mapped
+// from, the bytes of the map are never touched (only the headers of
+// the image), so the image never has to fit in memory.
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "helpers.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "stego.h"
+#include "threadpool.h"
+
+// the size of every block and the number of blocks that are being
+// read, embedded or written at the same time.
+#define PIPELINEBLOCKSIZE (8 << 20)
+#define PIPELINEDEPTH 4
+
+// the smallest slice of a block that a thread embeds.
+#define SLICESIZE (1 << 20)
+
+// what a block is doing. with io_uring a block is free, being read or
+// being written. with the threads a block is free (to be read), read
+// (to be embedded) or embedded (to be written).
+#define BLOCKFREE 0
+#define BLOCKREADING 1
+#define BLOCKWRITING 2
+#define BLOCKREAD 1
+#define BLOCKEMBEDDED 2
+
+
+// a buffer of the pipeline and the block of the image that is in it:
+// length bytes at offset of the image, done of which have been read
+// (or written) so far.
+typedef struct
+{
+    BYTE* data;
+    size_t offset;
+    size_t length;
+    size_t done;
+    int state;
+    struct iovec vector;
+} Block;
+
+// everything the pipeline shares. the bytes [start, end) of the image
+// go through it, in blockCount blocks. original keeps the bytes of a
+// block before it is embedded, to count the ones that change for
+// --stats.
+typedef struct
+{
+    const MappedFile* in;
+    const stego_layout* layout;
+    const BYTE* message;
+    size_t length;
+    int outFd;
+    int threadCount;
+    size_t start;
+    size_t end;
+    long blockCount;
+    Block blocks[PIPELINEDEPTH];
+    BYTE* original;
+    int failed;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} Pipeline;
+
+// what the slices of a block that are embedded at the same time
+// share.
+typedef struct
+{
+    Pipeline* pipeline;
+    Block* block;
+    size_t sliceLength;
+    int failed;
+} Slices;
+
+// an io_uring: the submission queue, where the reads and writes are
+// put for the kernel, and the completion queue, where it puts their
+// results. pending is the number of reads and writes that are in the
+// submission queue and haven't been handed to the kernel yet.
+typedef struct
+{
+    int fd;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    struct io_uring_sqe* sqes;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+    unsigned pending;
+} Ring;
+
+
+// this function starts the block with the given number: the bytes of
+// the image it has.
+static void startBlock(Pipeline* pipeline, Block* block, long number)
+{
+    block->offset = pipeline->start + (size_t) number * PIPELINEBLOCKSIZE;
+    block->length = pipeline->end - block->offset < PIPELINEBLOCKSIZE ? pipeline->end - block->offset
+                                                                     : PIPELINEBLOCKSIZE;
+    block->done = 0;
+}
+
+
+static void embedSlice(void* context, long task, int worker)
+{
+    (void) worker;
+    Slices* slices = context;
+    Pipeline* pipeline = slices->pipeline;
+    Block* block = slices->block;
+
+    size_t offset = (size_t) task * slices->sliceLength;
+    size_t length = block->length - offset < slices->sliceLength ? block->length - offset : slices->sliceLength;
+    int result = stego_embed_block(pipeline->in->data, pipeline->layout->patchOffset, pipeline->in->size,
+                                   pipeline->layout, pipeline->message, pipeline->length, block->data + offset,
+                                   block->offset + offset, length);
+    if (result != STEGO_OK)
+        __atomic_store_n(&slices->failed, 1, __ATOMIC_RELAXED);
+}
+
+
+// this function stores the part of the message that goes in the block,
+// in slices of it on up to threadCount threads.
+// returns 1 if it could and 0 if it couldn't.
+static int embedBlock(Pipeline* pipeline, Block* block)
+{
+    double start = phaseStart();
+    if (pipeline->original != NULL)
+        memcpy(pipeline->original, block->data, block->length);
+
+    long sliceCount = (block->length + SLICESIZE - 1) / SLICESIZE;
+    if (sliceCount > pipeline->threadCount)
+        sliceCount = pipeline->threadCount;
+    Slices slices = {pipeline, block, (block->length + sliceCount - 1) / sliceCount, 0};
+    if (sliceCount <= 1)
+        embedSlice(&slices, 0, 0);
+    else
+        runTasks(sliceCount, pipeline->threadCount, embedSlice, &slices);
+
+    if (pipeline->original != NULL)
+    {
+        size_t changed = 0;
+        for (size_t i = 0; i < block->length; i++)
+            changed += pipeline->original[i] != block->data[i];
+        COUNT(coverBytesModified, changed);
+    }
+    phaseEnd("embed", start);
+
+    return slices.failed == 0;
+}
+
+
+// this function sets up an io_uring with space for entries reads and
+// writes.
+// returns 1 if it could and 0 if the kernel doesn't have io_uring (or
+// doesn't allow it).
+static int openRing(Ring* ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+        return 0;
+
+    // the two queues are in one mapping on kernels that can do that.
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cqRingSize > ring->sqRingSize)
+            ring->sqRingSize = ring->cqRingSize;
+        ring->cqRingSize = ring->sqRingSize;
+    }
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    ring->cqRing = ring->sqRing;
+    if (ring->sqRing != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                            IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+
+    if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        if (ring->sqes != MAP_FAILED)
+            munmap(ring->sqes, ring->sqesSize);
+        if (ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing)
+            munmap(ring->cqRing, ring->cqRingSize);
+        if (ring->sqRing != MAP_FAILED)
+            munmap(ring->sqRing, ring->sqRingSize);
+        close(ring->fd);
+        return 0;
+    }
+
+    BYTE* sq = ring->sqRing;
+    BYTE* cq = ring->cqRing;
+    ring->sqHead = (unsigned*) (sq + params.sq_off.head);
+    ring->sqTail = (unsigned*) (sq + params.sq_off.tail);
+    ring->sqMask = (unsigned*) (sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned*) (sq + params.sq_off.array);
+    ring->cqHead = (unsigned*) (cq + params.cq_off.head);
+    ring->cqTail = (unsigned*) (cq + params.cq_off.tail);
+    ring->cqMask = (unsigned*) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+    ring->pending = 0;
+    return 1;
+}
+
+
+// this function takes the io_uring down.
+static void closeRing(Ring* ring)
+{
+    munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing != ring->sqRing)
+        munmap(ring->cqRing, ring->cqRingSize);
+    munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+}
+
+
+// this function puts the read (or write) of the rest of the block in
+// the submission queue. user data is the number of the block, so it
+// can be found again when the read is done.
+static void queueBlock(Ring* ring, int opcode, int fd, Block* block, unsigned long long userData)
+{
+    block->vector.iov_base = block->data + block->done;
+    block->vector.iov_len = block->length - block->done;
+
+    unsigned tail = *ring->sqTail;
+    unsigned index = tail & *ring->sqMask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long) (uintptr_t) &block->vector;
+    sqe->len = 1;
+    sqe->off = block->offset + block->done;
+    sqe->user_data = userData;
+
+    // the kernel must see the entry before it sees the new tail.
+    ring->sqArray[index] = index;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+}
+
+
+// this function hands the reads and writes in the submission queue to
+// the kernel and waits for one of them to be done, if none is done
+// yet.
+// returns 1 with its result in completion, or 0 if io_uring_enter()
+// failed.
+static int waitForCompletion(Ring* ring, struct io_uring_cqe* completion)
+{
+    while (1)
+    {
+        unsigned head = *ring->cqHead;
+        int ready = head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+        if (ready && ring->pending == 0)
+        {
+            *completion = ring->cqes[head & *ring->cqMask];
+            __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+            return 1;
+        }
+
+        long submitted = syscall(__NR_io_uring_enter, ring->fd, ring->pending, ready ? 0 : 1,
+                                 ready ? 0 : IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted < 0 && errno != EINTR)
+            return 0;
+        if (submitted > 0)
+            ring->pending -= submitted;
+    }
+}
+
+
+// this function runs the pipeline with io_uring: a block is read, then
+// embedded (on this thread, while the kernel works on the reads and
+// writes of the other blocks) and then written, and read again with
+// the next block that hasn't been.
+// returns 1 if the whole image went through, 0 if it didn't and -1 if
+// there is no io_uring (nothing was read or written then).
+static int runRing(Pipeline* pipeline)
+{
+    Ring ring;
+    if (!openRing(&ring, 2 * PIPELINEDEPTH))
+        return -1;
+
+    long next = 0;
+    int inFlight = 0;
+    int broken = 0;
+    while (((next < pipeline->blockCount && !pipeline->failed) || inFlight > 0) && !broken)
+    {
+        for (int i = 0; i < PIPELINEDEPTH && next < pipeline->blockCount && !pipeline->failed; i++)
+        {
+            Block* block = &pipeline->blocks[i];
+            if (block->state != BLOCKFREE)
+                continue;
+
+            startBlock(pipeline, block, next++);
+            block->state = BLOCKREADING;
+            queueBlock(&ring, IORING_OP_READV, pipeline->in->fd, block, i);
+            inFlight++;
+        }
+
+        struct io_uring_cqe completion;
+        if (!waitForCompletion(&ring, &completion))
+        {
+            broken = 1;
+            break;
+        }
+
+        Block* block = &pipeline->blocks[completion.user_data];
+        int reading = block->state == BLOCKREADING;
+        if (completion.res == -EINTR || completion.res == -EAGAIN)
+        {
+            queueBlock(&ring, reading ? IORING_OP_READV : IORING_OP_WRITEV,
+                       reading ? pipeline->in->fd : pipeline->outFd, block, completion.user_data);
+            continue;
+        }
+        if (completion.res <= 0)
+        {
+            pipeline->failed = 1;
+            block->state = BLOCKFREE;
+            inFlight--;
+            continue;
+        }
+
+        if (reading)
+        {
+            COUNT(readCalls, 1);
+            COUNT(bytesRead, completion.res);
+        }
+        else
+        {
+            COUNT(writeCalls, 1);
+            COUNT(bytesWritten, completion.res);
+        }
+
+        // a read or write can do fewer bytes than it was asked to, the
+        // rest of the block is queued again then.
+        block->done += completion.res;
+        if (block->done < block->length)
+            queueBlock(&ring, reading ? IORING_OP_READV : IORING_OP_WRITEV,
+                       reading ? pipeline->in->fd : pipeline->outFd, block, completion.user_data);
+        else if (reading && !pipeline->failed && embedBlock(pipeline, block))
+        {
+            block->done = 0;
+            block->state = BLOCKWRITING;
+            queueBlock(&ring, IORING_OP_WRITEV, pipeline->outFd, block, completion.user_data);
+        }
+        else
+        {
+            pipeline->failed |= reading;
+            block->state = BLOCKFREE;
+            inFlight--;
+        }
+    }
+
+    // if io_uring_enter() failed the kernel may still be reading into
+    // the buffers, so they are never freed then.
+    closeRing(&ring);
+    if (broken)
+    {
+        for (int i = 0; i < PIPELINEDEPTH; i++)
+            pipeline->blocks[i].data = NULL;
+        return 0;
+    }
+
+    return !pipeline->failed;
+}
+
+
+// this function waits until the block is in the given state.
+// returns 1 when it is and 0 if the pipeline failed first.
+static int waitForState(Pipeline* pipeline, Block* block, int state)
+{
+    pthread_mutex_lock(&pipeline->lock);
+    while (block->state != state && !pipeline->failed)
+        pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+    int failed = pipeline->failed;
+    pthread_mutex_unlock(&pipeline->lock);
+
+    return !failed;
+}
+
+
+// this function puts the block in the given state (-1 makes the whole
+// pipeline fail), and wakes up the threads that wait for it.
+static void setState(Pipeline* pipeline, Block* block, int state)
+{
+    pthread_mutex_lock(&pipeline->lock);
+    if (state < 0)
+        pipeline->failed = 1;
+    else
+        block->state = state;
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+
+// this function reads (or writes, when writing is 1) the whole block
+// with pread() (or pwrite()), which can do fewer bytes than they were
+// asked to.
+// returns 1 if it could and 0 if it couldn't.
+static int transferBlock(int fd, Block* block, int writing)
+{
+    for (block->done = 0; block->done < block->length;)
+    {
+        BYTE* bytes = block->data + block->done;
+        size_t length = block->length - block->done;
+        off_t offset = block->offset + block->done;
+        ssize_t result = writing ? pwrite(fd, bytes, length, offset) : pread(fd, bytes, length, offset);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            return 0;
+
+        if (writing)
+        {
+            COUNT(writeCalls, 1);
+            COUNT(bytesWritten, result);
+        }
+        else
+        {
+            COUNT(readCalls, 1);
+            COUNT(bytesRead, result);
+        }
+        block->done += result;
+    }
+
+    return 1;
+}
+
+
+// the thread that reads the blocks, in order, into the buffers that
+// are free.
+static void* readBlocks(void* argument)
+{
+    Pipeline* pipeline = argument;
+    for (long i = 0; i < pipeline->blockCount; i++)
+    {
+        Block* block = &pipeline->blocks[i % PIPELINEDEPTH];
+        if (!waitForState(pipeline, block, BLOCKFREE))
+            break;
+
+        startBlock(pipeline, block, i);
+        setState(pipeline, block, transferBlock(pipeline->in->fd, block, 0) ? BLOCKREAD : -1);
+    }
+
+    return NULL;
+}
+
+
+// the thread that writes the blocks, in order, once they are embedded.
+static void* writeBlocks(void* argument)
+{
+    Pipeline* pipeline = argument;
+    for (long i = 0; i < pipeline->blockCount; i++)
+    {
+        Block* block = &pipeline->blocks[i % PIPELINEDEPTH];
+        if (!waitForState(pipeline, block, BLOCKEMBEDDED))
+            break;
+
+        setState(pipeline, block, transferBlock(pipeline->outFd, block, 1) ? BLOCKFREE : -1);
+    }
+
+    return NULL;
+}
+
+
+// this function runs the pipeline with a thread that reads the blocks
+// and one that writes them, this thread embeds them in between.
+// returns 1 if the whole image went through, 0 if it didn't and -1 if
+// the threads could not be started (nothing was written then).
+static int runThreads(Pipeline* pipeline)
+{
+    pthread_t reader, writer;
+    if (pthread_create(&reader, NULL, readBlocks, pipeline) != 0)
+        return -1;
+    if (pthread_create(&writer, NULL, writeBlocks, pipeline) != 0)
+    {
+        setState(pipeline, NULL, -1);
+        pthread_join(reader, NULL);
+        return -1;
+    }
+
+    for (long i = 0; i < pipeline->blockCount; i++)
+    {
+        Block* block = &pipeline->blocks[i % PIPELINEDEPTH];
+        if (!waitForState(pipeline, block, BLOCKREAD))
+            break;
+
+        setState(pipeline, block, embedBlock(pipeline, block) ? BLOCKEMBEDDED : -1);
+    }
+
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+    return !pipeline->failed;
+}
+
+
+// this function writes the patch of the output image (see stego_plan()
+// in stego.h) of a bmp to outFd: the bytes of the image the message
+// goes in are read from the file in is mapped from a block at a time,
+// embedded and written to the same place in outFd, which can be the
+// same file (see the top of the file). the bytes around the patch are
+// left to the caller.
+// returns 1 if the patch was written, 0 if it wasn't and -1 if the
+// pipeline can't be used for the image (nothing was written then).
+int pipeEmbeddedImage(const MappedFile* in, const stego_layout* layout, const BYTE* message, size_t length,
+                      int outFd, int threadCount)
+{
+    if (in->fd < 0 || (layout->flags & STEGO_PIXELS) || layout->patchLength == 0
+        || stego_type(in->data, in->size) != STEGO_BMP)
+        return -1;
+
+    Pipeline pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.in = in;
+    pipeline.layout = layout;
+    pipeline.message = message;
+    pipeline.length = length;
+    pipeline.outFd = outFd;
+    pipeline.threadCount = threadCount < 1 ? 1 : threadCount;
+    pipeline.start = layout->patchOffset;
+    pipeline.end = layout->patchOffset + layout->patchLength;
+    pipeline.blockCount = (layout->patchLength + PIPELINEBLOCKSIZE - 1) / PIPELINEBLOCKSIZE;
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.changed, NULL);
+
+    int result = -1;
+    int allocated = 1;
+    for (int i = 0; i < PIPELINEDEPTH; i++)
+        allocated &= posix_memalign((void**) &pipeline.blocks[i].data, 4096, PIPELINEBLOCKSIZE) == 0;
+    if (allocated && stats != NULL)
+        allocated = (pipeline.original = malloc(PIPELINEBLOCKSIZE)) != NULL;
+
+    if (allocated)
+    {
+        double start = phaseStart();
+        result = runRing(&pipeline);
+        if (result < 0)
+            result = runThreads(&pipeline);
+        phaseEnd("pipeline", start);
+        if (result >= 0)
+            COUNT(patchBytes, layout->patchLength);
+    }
+
+    for (int i = 0; i < PIPELINEDEPTH; i++)
+        free(pipeline.blocks[i].data);
+    free(pipeline.original);
+    pthread_mutex_destroy(&pipeline.lock);
+    pthread_cond_destroy(&pipeline.changed);
+    return result;
+}
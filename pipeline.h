@@ -0,0 +1,22 @@
+// header file for the pipeline that streams a huge bmp through libstego
+// a block at a time, used by mappedio.c
+
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <stddef.h>
+
+#include "helpers.h"
+#include "mappedio.h"
+#include "stego.h"
+
+// the smallest patch that goes through the pipeline, a smaller one is
+// produced in memory in one go (see writeEmbeddedImage()).
+#define PIPELINETHRESHOLD (64 << 20)
+
+
+// function declarations
+int pipeEmbeddedImage(const MappedFile* in, const stego_layout* layout, const BYTE* message, size_t length,
+                      int outFd, int threadCount);
+
+#endif
@@ -0,0 +1,183 @@
+// this file has the function that finds the end of a png file
+// (the byte right after the IEND chunk) in an image that is in memory,
+// the function that reads its IHDR chunk and the CRC of the chunks.
+//
+// a png file is the 8 byte signature followed by a list of chunks.
+// every chunk starts with its length and type, so instead of looking
+// at every byte of the file for IEND, the chunks are walked by reading
+// each 8 byte chunk header and jumping over the chunk data. that only
+// touches the chunk headers (a few dozen for most files, so a mapped
+// file is barely read) and it can't be fooled by IEND bytes that
+// happen to be inside IDAT data.
+//
+// if the chunks don't make sense (a damaged file), the image is
+// searched for the IEND chunk instead, starting with its last bytes.
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+
+#include "helpers.h"
+#include "pngchunks.h"
+
+
+// the complete IEND chunk: length 0, type "IEND" and the CRC.
+static const BYTE endChunk[PNGENDCHUNKSIZE] = {0x00, 0x00, 0x00, 0x00, 0x49, 0x45, 0x4E, 0x44,
+                                               0xAE, 0x42, 0x60, 0x82};
+
+
+// the table of the CRC-32 of every byte, made before main() runs.
+static uint32_t crcTable[256];
+
+
+// chunk types are made of 4 ASCII letters.
+static int isChunkType(const BYTE* type)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        BYTE letter = type[i] & ~0x20;
+        if (letter < 'A' || letter > 'Z')
+            return 0;
+    }
+    return 1;
+}
+
+
+// this function walks the chunks that come after the signature.
+// returns the position right after the IEND chunk or -1 if the end
+// of the image (or a chunk that doesn't make sense) was reached first.
+static long long walkChunks(const BYTE* image, size_t size)
+{
+    size_t position = PNGSIGNATURESIZE;
+
+    while (size - position >= PNGCHUNKHEADERSIZE + PNGCHUNKCRCSIZE)
+    {
+        const BYTE* header = &image[position];
+
+        // the length is stored as a big endian 32-bit number.
+        size_t length = (size_t) header[0] << 24 | header[1] << 16 | header[2] << 8 | header[3];
+        if (length > PNGMAXCHUNKLENGTH || !isChunkType(&header[4]))
+            return -1;
+
+        size_t chunkSize = PNGCHUNKHEADERSIZE + length + PNGCHUNKCRCSIZE;
+        if (chunkSize > size - position)
+            return -1;
+
+        position += chunkSize;
+        if (memcmp(&header[4], &endChunk[4], 4) == 0)
+            return position;
+    }
+
+    return -1;
+}
+
+
+// this function searches the image for the IEND chunk. the last 12
+// bytes are checked first since a png without anything after it ends
+// with IEND, otherwise the first IEND chunk in the image is used.
+// returns the position right after the IEND chunk or -1.
+static long long probeForPNGEnd(const BYTE* image, size_t size)
+{
+    if (size < PNGSIGNATURESIZE + PNGENDCHUNKSIZE)
+        return -1;
+
+    if (memcmp(&image[size - PNGENDCHUNKSIZE], endChunk, PNGENDCHUNKSIZE) == 0)
+        return size;
+
+    const BYTE* found = memmem(&image[PNGSIGNATURESIZE], size - PNGSIGNATURESIZE, endChunk, PNGENDCHUNKSIZE);
+    if (found == NULL)
+        return -1;
+
+    return found - image + PNGENDCHUNKSIZE;
+}
+
+
+// this function finds the end of the png image of the given size,
+// i.e, the position right after its IEND chunk.
+// returns the position or -1 if it was not found.
+long long findPNGEnd(const BYTE* image, size_t size)
+{
+    if (size < PNGSIGNATURESIZE)
+        return -1;
+
+    long long end = walkChunks(image, size);
+    if (end < 0)
+        end = probeForPNGEnd(image, size);
+
+    return end;
+}
+
+
+// reads a big endian 32-bit number.
+uint32_t readBigEndian32(const BYTE* bytes)
+{
+    return (uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16 | (uint32_t) bytes[2] << 8 | bytes[3];
+}
+
+
+// this function reads the IHDR chunk of the png image (only the first
+// size bytes of the image need to be there) into info.
+// returns 1 if it makes sense and 0 if it doesn't.
+int readPNGInfo(const BYTE* image, size_t size, PNGInfo* info)
+{
+    if (size < PNGSIGNATURESIZE + PNGCHUNKHEADERSIZE + PNGHEADERLENGTH)
+        return 0;
+
+    const BYTE* chunk = &image[PNGSIGNATURESIZE];
+    if (readBigEndian32(chunk) != PNGHEADERLENGTH || memcmp(&chunk[4], "IHDR", 4) != 0)
+        return 0;
+
+    const BYTE* data = &chunk[PNGCHUNKHEADERSIZE];
+    uint32_t width = readBigEndian32(data);
+    uint32_t height = readBigEndian32(data + 4);
+    info->width = width;
+    info->height = height;
+    info->bitDepth = data[8];
+    info->colorType = data[9];
+    info->interlaced = data[12];
+    if (width == 0 || height == 0 || width > PNGMAXCHUNKLENGTH || height > PNGMAXCHUNKLENGTH
+        || data[10] != 0 || data[11] != 0 || info->interlaced > 1)
+        return 0;
+
+    // color types 0 (gray), 2 (rgb), 3 (palette), 4 (gray and alpha)
+    // and 6 (rgba).
+    static const int samples[7] = {1, 0, 3, 1, 2, 0, 4};
+    if (info->colorType > 6 || samples[info->colorType] == 0)
+        return 0;
+    info->samplesPerPixel = samples[info->colorType];
+
+    int depth = info->bitDepth;
+    if (depth != 1 && depth != 2 && depth != 4 && depth != 8 && depth != 16)
+        return 0;
+
+    size_t bitsPerPixel = (size_t) info->samplesPerPixel * depth;
+    info->rowBytes = ((size_t) width * bitsPerPixel + BYTESIZE - 1) / BYTESIZE;
+    info->filterStep = bitsPerPixel < BYTESIZE ? 1 : bitsPerPixel / BYTESIZE;
+    return 1;
+}
+
+
+// this function makes the CRC table before main() runs.
+__attribute__((constructor))
+static void makeCRCTable(void)
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = n;
+        for (int k = 0; k < BYTESIZE; k++)
+            crc = crc & 1 ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+        crcTable[n] = crc;
+    }
+}
+
+
+// returns the CRC-32 of the data, which for a chunk is worked out over
+// its type and its data.
+uint32_t pngCRC(const BYTE* data, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++)
+        crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFF;
+}
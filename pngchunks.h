@@ -0,0 +1,56 @@
+// header file for the png chunk walker and header reader
+
+#ifndef PNGCHUNKS_H_
+#define PNGCHUNKS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "helpers.h"
+
+// every png file starts with these 8 bytes.
+#define PNGSIGNATURESIZE 8
+
+// every chunk starts with its length (4 bytes) and its type (4 bytes)
+// and ends with a CRC (4 bytes).
+#define PNGCHUNKHEADERSIZE 8
+#define PNGCHUNKCRCSIZE 4
+
+// the IEND chunk (length 0, type "IEND" and its CRC) is the last
+// chunk of every png file.
+#define PNGENDCHUNKSIZE 12
+
+// the largest length a chunk is allowed to have.
+#define PNGMAXCHUNKLENGTH 0x7FFFFFFFLL
+
+// the IHDR chunk comes first and has 13 bytes of data.
+#define PNGHEADERLENGTH 13
+
+// what the IHDR chunk of a png image says about its pixels.
+//
+// the pixels are stored as rows of rowBytes bytes, every row after a
+// filter type byte, compressed together with zlib in the IDAT chunks.
+// a pixel has samplesPerPixel samples (1 for gray or a palette index,
+// 2 for gray and alpha, 3 for rgb and 4 for rgba) of bitDepth bits.
+// filterStep is the number of bytes a filter looks back to the same
+// sample of the pixel before (at least 1).
+typedef struct
+{
+    long width;
+    long height;
+    int bitDepth;
+    int colorType;
+    int interlaced;
+    int samplesPerPixel;
+    int filterStep;
+    size_t rowBytes;
+} PNGInfo;
+
+
+// function declarations
+long long findPNGEnd(const BYTE* image, size_t size);
+int readPNGInfo(const BYTE* image, size_t size, PNGInfo* info);
+uint32_t readBigEndian32(const BYTE* bytes);
+uint32_t pngCRC(const BYTE* data, size_t length);
+
+#endif
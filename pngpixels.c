@@ -0,0 +1,630 @@
+// this file stores a message in the LSBs of the pixels of a png (and
+// reads it back), for the png path of stego.c.
+//
+// the pixels of a png are rows of samples, every row filtered (made
+// smaller by storing the difference to the pixel before it or above
+// it) and then all of them compressed with zlib into the IDAT chunks.
+// so the rows are decompressed a piece at a time (see inflate.c),
+// unfiltered, the message goes into the LSBs of the samples (the
+// lower byte of a 16-bit sample) and every row is filtered again with
+// the filter it had. only a few rows are ever in memory, whatever the
+// size of the image.
+//
+// the filtered rows are compressed again in blocks of PNGBLOCKSIZE
+// bytes, output->threads * 2 blocks at a time on the threads the
+// caller gives (see deflate.c), and every block becomes an IDAT chunk.
+// once the message is in, the rest of the rows are not unfiltered at
+// all, they are just compressed again as they were.
+//
+// the samples are used in the order they are in the image, like the
+// bytes of a bmp: the header takes 1 bit of each of the first color
+// samples and the message the selected samples after them.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "deflate.h"
+#include "helpers.h"
+#include "inflate.h"
+#include "pngchunks.h"
+#include "pngpixels.h"
+#include "stego.h"
+
+// the zlib header of the output: deflate with a 32 KB window.
+static const BYTE zlibHeader[2] = {0x78, 0x01};
+
+// the most bytes a block can take once compressed, with its chunk
+// length, type and CRC and the zlib header.
+#define COMPRESSEDCHUNKSIZE (PNGCHUNKHEADERSIZE + sizeof(zlibHeader) + DEFLATEBOUND(PNGBLOCKSIZE) + PNGCHUNKCRCSIZE)
+
+
+// returns 1 if the message can go in the pixels of the png: 8 or 16
+// bit samples that are not palette indexes, without interlacing.
+int canHoldPixels(const PNGInfo* info)
+{
+    return (info->bitDepth == 8 || info->bitDepth == 16) && info->colorType != 3 && !info->interlaced;
+}
+
+
+// returns the samples of a pixel that are in the channels (bit 0 for
+// the first sample, bit 1 for the second, ...).
+int sampleMaskOf(const PNGInfo* info, int channels)
+{
+    int gray = (channels & STEGO_COLORCHANNELS) != 0;
+    int alpha = (channels & STEGO_ALPHA) != 0;
+
+    if (info->samplesPerPixel == 1)
+        return gray;
+    else if (info->samplesPerPixel == 2)
+        return gray | alpha << 1;
+
+    int mask = (channels & STEGO_RED ? 1 : 0) | (channels & STEGO_GREEN ? 2 : 0) | (channels & STEGO_BLUE ? 4 : 0);
+    if (info->samplesPerPixel == 4)
+        mask |= alpha << 3;
+    return mask;
+}
+
+
+// returns the number of samples in the mask among the first count
+// samples of the image.
+static uint64_t selectedBefore(int mask, int samplesPerPixel, uint64_t count)
+{
+    return count / samplesPerPixel * __builtin_popcount(mask)
+           + __builtin_popcount(mask & ((1 << count % samplesPerPixel) - 1));
+}
+
+
+// returns the position of the selected sample with the given number
+// (counting from 0).
+static uint64_t positionOfSelected(int mask, int samplesPerPixel, uint64_t number)
+{
+    int perPixel = __builtin_popcount(mask);
+    uint64_t pixel = number / perPixel;
+    int skip = number % perPixel;
+
+    int sample = 0;
+    while (!(mask >> sample & 1) || skip-- > 0)
+        sample++;
+
+    return pixel * samplesPerPixel + sample;
+}
+
+
+// returns the number of message bytes that fit in the samples of the
+// channels with the given depth, after a header of headerSize bytes.
+size_t pixelCapacityOf(const PNGInfo* info, size_t headerSize, int channels, int depth)
+{
+    int mask = sampleMaskOf(info, channels);
+    int colors = sampleMaskOf(info, STEGO_COLORCHANNELS);
+    uint64_t samples = (uint64_t) info->width * info->height * info->samplesPerPixel;
+    if (mask == 0 || depth < 1 || depth > STEGO_MAXDEPTH || selectedBefore(colors, info->samplesPerPixel, samples)
+                                                                  < headerSize * BYTESIZE)
+        return 0;
+
+    uint64_t headerEnd = positionOfSelected(colors, info->samplesPerPixel, headerSize * BYTESIZE - 1) + 1;
+    uint64_t free = selectedBefore(mask, info->samplesPerPixel, samples)
+                    - selectedBefore(mask, info->samplesPerPixel, headerEnd);
+    return free / BYTESIZE * depth + free % BYTESIZE * depth / BYTESIZE;
+}
+
+
+// the predictor of the paeth filter: whichever of the pixel to the
+// left, above and above left is closest to left + above - aboveLeft.
+static BYTE paeth(int left, int above, int aboveLeft)
+{
+    int estimate = left + above - aboveLeft;
+    int toLeft = abs(estimate - left), toAbove = abs(estimate - above), toAboveLeft = abs(estimate - aboveLeft);
+    if (toLeft <= toAbove && toLeft <= toAboveLeft)
+        return left;
+    return toAbove <= toAboveLeft ? above : aboveLeft;
+}
+
+
+// returns the prediction of the filter type for byte i of a row, from
+// the row and the row above it (both unfiltered).
+static BYTE predictionOf(int type, const BYTE* row, const BYTE* above, size_t i, int step)
+{
+    int left = i >= (size_t) step ? row[i - step] : 0;
+    int aboveLeft = i >= (size_t) step ? above[i - step] : 0;
+
+    switch (type)
+    {
+        case 1:
+            return left;
+        case 2:
+            return above[i];
+        case 3:
+            return (left + above[i]) / 2;
+        case 4:
+            return paeth(left, above[i], aboveLeft);
+        default:
+            return 0;
+    }
+}
+
+
+// this function unfilters a row (filter type first) into row.
+static void unfilterRow(const BYTE* filtered, BYTE* row, const BYTE* above, size_t length, int step)
+{
+    int type = filtered[0];
+    if (type == 0)
+    {
+        memcpy(row, filtered + 1, length);
+        return;
+    }
+
+    for (size_t i = 0; i < length; i++)
+        row[i] = filtered[i + 1] + predictionOf(type, row, above, i, step);
+}
+
+
+// this function filters a row with the filter type into filtered
+// (filter type first).
+static void filterRow(int type, const BYTE* row, const BYTE* above, size_t length, int step, BYTE* filtered)
+{
+    filtered[0] = type;
+    for (size_t i = 0; i < length; i++)
+        filtered[i + 1] = row[i] - predictionOf(type, row, above, i, step);
+}
+
+
+// this function gives the inflater the data of the next IDAT chunk.
+// the data ends at a chunk whose CRC is wrong, so that a damaged chunk
+// is never read as pixels (which would give a wrong message that reads
+// like a good one).
+static size_t nextIDAT(void* context, const BYTE** bytes)
+{
+    PNGPixels* pixels = context;
+    while (pixels->chunk < pixels->afterData)
+    {
+        const BYTE* chunk = pixels->image + pixels->chunk;
+        size_t length = readBigEndian32(chunk);
+        if (pngCRC(chunk + 4, length + 4) != readBigEndian32(chunk + PNGCHUNKHEADERSIZE + length))
+        {
+            pixels->chunk = pixels->afterData;
+            return 0;
+        }
+
+        *bytes = chunk + PNGCHUNKHEADERSIZE;
+        pixels->chunk += PNGCHUNKHEADERSIZE + length + PNGCHUNKCRCSIZE;
+        if (length > 0)
+            return length;
+    }
+
+    return 0;
+}
+
+
+// this function finds the IDAT chunks: chunk is set to the first one
+// and afterData to the position right after the last one (they all
+// come one after the other).
+// returns 1 if they were found and 0 if they weren't.
+static int findIDAT(PNGPixels* pixels)
+{
+    size_t position = PNGSIGNATURESIZE;
+    int inData = 0;
+
+    while (pixels->size - position >= PNGCHUNKHEADERSIZE + PNGCHUNKCRCSIZE)
+    {
+        const BYTE* header = pixels->image + position;
+        size_t length = readBigEndian32(header);
+        if (length > PNGMAXCHUNKLENGTH || length > pixels->size - position - PNGCHUNKHEADERSIZE - PNGCHUNKCRCSIZE)
+            break;
+
+        int isData = memcmp(header + 4, "IDAT", 4) == 0;
+        if (isData && !inData)
+            pixels->chunk = position;
+        else if (!isData && inData)
+            break;
+
+        inData = isData;
+        position += PNGCHUNKHEADERSIZE + length + PNGCHUNKCRCSIZE;
+    }
+
+    pixels->afterData = position;
+    return inData || pixels->chunk != 0;
+}
+
+
+// this function sends bytes to the output.
+static int writeOutput(PNGPixels* pixels, const BYTE* bytes, size_t length)
+{
+    return length == 0 || pixels->output->write(pixels->output->context, bytes, length);
+}
+
+
+// this function compresses a single block of the batch into an IDAT
+// chunk (run by the threads of the output).
+static void compressBlock(void* context, long task, int worker)
+{
+    PNGPixels* pixels = context;
+    BYTE* data = pixels->batch + DEFLATEWINDOWSIZE + task * PNGBLOCKSIZE;
+    size_t length = pixels->batchLength - task * PNGBLOCKSIZE;
+    if (length > PNGBLOCKSIZE)
+        length = PNGBLOCKSIZE;
+    size_t history = task > 0 ? DEFLATEWINDOWSIZE : pixels->history;
+
+    // the first block of the image starts the zlib stream.
+    BYTE* chunk = pixels->compressed + task * COMPRESSEDCHUNKSIZE;
+    BYTE* out = chunk + PNGCHUNKHEADERSIZE;
+    size_t outLength = 0;
+    if (!pixels->started && task == 0)
+    {
+        memcpy(out, zlibHeader, sizeof(zlibHeader));
+        outLength = sizeof(zlibHeader);
+    }
+    outLength += deflateBlock(&pixels->work[worker], data, length, history, out + outLength);
+
+    for (int i = 0; i < 4; i++)
+        chunk[i] = outLength >> (8 * (3 - i));
+    memcpy(chunk + 4, "IDAT", 4);
+    uint32_t crc = pngCRC(chunk + 4, outLength + 4);
+    for (int i = 0; i < 4; i++)
+        out[outLength + i] = crc >> (8 * (3 - i));
+
+    pixels->compressedLengths[task] = PNGCHUNKHEADERSIZE + outLength + PNGCHUNKCRCSIZE;
+    pixels->adlers[task] = adler32(1, data, length);
+}
+
+
+// this function compresses the blocks in the batch at the same time
+// and writes them out in order.
+// returns STEGO_OK or STEGO_WRITEFAILED.
+static int compressBatch(PNGPixels* pixels)
+{
+    long blockCount = (pixels->batchLength + PNGBLOCKSIZE - 1) / PNGBLOCKSIZE;
+    if (blockCount == 0)
+        return STEGO_OK;
+
+    const stego_output* output = pixels->output;
+    if (output->run != NULL)
+        output->run(output->context, blockCount, compressBlock, pixels);
+    else
+    {
+        for (long task = 0; task < blockCount; task++)
+            compressBlock(pixels, task, 0);
+    }
+    pixels->started = 1;
+
+    for (long task = 0; task < blockCount; task++)
+    {
+        size_t length = pixels->batchLength - task * PNGBLOCKSIZE;
+        if (length > PNGBLOCKSIZE)
+            length = PNGBLOCKSIZE;
+        pixels->adler = adler32Combine(pixels->adler, pixels->adlers[task], length);
+
+        if (!writeOutput(pixels, pixels->compressed + task * COMPRESSEDCHUNKSIZE, pixels->compressedLengths[task]))
+            return STEGO_WRITEFAILED;
+    }
+
+    // the end of the batch is the history of the next one.
+    size_t keep = pixels->history + pixels->batchLength;
+    if (keep > DEFLATEWINDOWSIZE)
+        keep = DEFLATEWINDOWSIZE;
+    memmove(pixels->batch + DEFLATEWINDOWSIZE - keep, pixels->batch + DEFLATEWINDOWSIZE + pixels->batchLength - keep,
+            keep);
+    pixels->history = keep;
+    pixels->batchLength = 0;
+    return STEGO_OK;
+}
+
+
+// returns the free space in the batch, compressing it first if it is
+// full. returns 0 if it could not be written.
+static size_t batchSpace(PNGPixels* pixels)
+{
+    size_t capacity = (size_t) pixels->blocks * PNGBLOCKSIZE;
+    if (pixels->batchLength == capacity && compressBatch(pixels) != STEGO_OK)
+        return 0;
+
+    return capacity - pixels->batchLength;
+}
+
+
+// this function adds filtered rows to the batch.
+// returns STEGO_OK or STEGO_WRITEFAILED.
+static int addToBatch(PNGPixels* pixels, const BYTE* bytes, size_t length)
+{
+    while (length > 0)
+    {
+        size_t space = batchSpace(pixels);
+        if (space == 0)
+            return STEGO_WRITEFAILED;
+
+        size_t piece = length < space ? length : space;
+        memcpy(pixels->batch + DEFLATEWINDOWSIZE + pixels->batchLength, bytes, piece);
+        pixels->batchLength += piece;
+        bytes += piece;
+        length -= piece;
+    }
+
+    return STEGO_OK;
+}
+
+
+// this function adds the current row to the batch, filtered again if
+// it or the row above it was changed.
+// returns STEGO_OK or STEGO_WRITEFAILED.
+static int writeRow(PNGPixels* pixels)
+{
+    int result;
+    if (pixels->rowChanged || pixels->previousRowChanged)
+    {
+        filterRow(pixels->filtered[0], pixels->changed, pixels->previousChanged, pixels->info.rowBytes,
+                  pixels->info.filterStep, pixels->filtered);
+    }
+    result = addToBatch(pixels, pixels->filtered, pixels->info.rowBytes + 1);
+
+    pixels->previousRowChanged = pixels->rowChanged;
+    pixels->rowChanged = 0;
+    return result;
+}
+
+
+// this function moves the cursor to the start of the next row (when
+// writing, the current row is written first).
+// returns STEGO_OK, STEGO_NOSPACE if there are no more rows,
+// STEGO_BADIMAGE or STEGO_WRITEFAILED.
+static int nextRow(PNGPixels* pixels)
+{
+    if (pixels->row == pixels->info.height)
+        return STEGO_NOSPACE;
+
+    if (pixels->output != NULL && pixels->row > 0)
+    {
+        int result = writeRow(pixels);
+        if (result != STEGO_OK)
+            return result;
+    }
+
+    BYTE* swap = pixels->previousOriginal;
+    pixels->previousOriginal = pixels->original;
+    pixels->original = swap;
+    swap = pixels->previousChanged;
+    pixels->previousChanged = pixels->changed;
+    pixels->changed = swap;
+
+    size_t length = pixels->info.rowBytes;
+    if (inflateRead(pixels->inflater, pixels->filtered, length + 1) != length + 1 || pixels->filtered[0] > 4)
+        return STEGO_BADIMAGE;
+
+    unfilterRow(pixels->filtered, pixels->original, pixels->previousOriginal, length, pixels->info.filterStep);
+    if (pixels->output != NULL)
+        memcpy(pixels->changed, pixels->original, length);
+
+    pixels->row++;
+    pixels->sample = 0;
+    return STEGO_OK;
+}
+
+
+// this function frees everything startPNGPixels() allocated.
+void endPNGPixels(PNGPixels* pixels)
+{
+    free(pixels->inflater);
+    free(pixels->rows);
+    free(pixels->batch);
+    free(pixels->work);
+    free(pixels->compressed);
+    free(pixels->compressedLengths);
+    free(pixels->adlers);
+    pixels->inflater = NULL;
+    pixels->rows = NULL;
+    pixels->batch = NULL;
+    pixels->work = NULL;
+    pixels->compressed = NULL;
+    pixels->compressedLengths = NULL;
+    pixels->adlers = NULL;
+}
+
+
+// this function starts reading the pixels of the png image. when
+// output is not NULL the image is written to it again as the message
+// is embedded (the chunks before the pixels are written right away).
+// endPNGPixels() must be called afterwards, whatever the result.
+// returns STEGO_OK, STEGO_NOPIXELS, STEGO_BADIMAGE, STEGO_NOMEMORY or
+// STEGO_WRITEFAILED.
+int startPNGPixels(PNGPixels* pixels, const BYTE* image, size_t size, const stego_output* output)
+{
+    memset(pixels, 0, sizeof(*pixels));
+    pixels->image = image;
+    pixels->size = size;
+    pixels->output = output;
+    pixels->adler = 1;
+
+    if (!readPNGInfo(image, size, &pixels->info) || !canHoldPixels(&pixels->info))
+        return STEGO_NOPIXELS;
+    if (!findIDAT(pixels))
+        return STEGO_BADIMAGE;
+
+    pixels->sampleBytes = pixels->info.bitDepth / BYTESIZE;
+    pixels->rowSamples = pixels->info.rowBytes / pixels->sampleBytes;
+
+    // the filtered row, then the rows as they are and with the
+    // message (the rows before the first one are all zeros).
+    size_t rowSize = pixels->info.rowBytes + 1;
+    pixels->inflater = malloc(sizeof(Inflater));
+    pixels->rows = calloc(5, rowSize);
+    if (pixels->inflater == NULL || pixels->rows == NULL)
+        return STEGO_NOMEMORY;
+
+    pixels->filtered = pixels->rows;
+    pixels->original = pixels->rows + rowSize;
+    pixels->previousOriginal = pixels->rows + 2 * rowSize;
+    pixels->changed = pixels->rows + 3 * rowSize;
+    pixels->previousChanged = pixels->rows + 4 * rowSize;
+    inflateStart(pixels->inflater, nextIDAT, pixels);
+
+    if (output == NULL)
+        return STEGO_OK;
+
+    pixels->workers = output->run != NULL && output->threads > 1 ? output->threads : 1;
+    pixels->blocks = 2 * pixels->workers;
+    pixels->batch = malloc(DEFLATEWINDOWSIZE + (size_t) pixels->blocks * PNGBLOCKSIZE);
+    pixels->work = malloc(pixels->workers * sizeof(DeflateWork));
+    pixels->compressed = malloc(pixels->blocks * COMPRESSEDCHUNKSIZE);
+    pixels->compressedLengths = malloc(pixels->blocks * sizeof(size_t));
+    pixels->adlers = malloc(pixels->blocks * sizeof(uint32_t));
+    if (pixels->batch == NULL || pixels->work == NULL || pixels->compressed == NULL
+        || pixels->compressedLengths == NULL || pixels->adlers == NULL)
+        return STEGO_NOMEMORY;
+
+    // the signature and the chunks before the pixels stay the same.
+    return writeOutput(pixels, image, pixels->chunk) ? STEGO_OK : STEGO_WRITEFAILED;
+}
+
+
+// this function stores count payload bytes in the depth LSBs of the
+// samples of the channels, starting at the cursor.
+// returns STEGO_OK, STEGO_NOSPACE, STEGO_BADIMAGE or STEGO_WRITEFAILED.
+int embedInPNGPixels(PNGPixels* pixels, int channels, int depth, const BYTE* payload, size_t count)
+{
+    int mask = sampleMaskOf(&pixels->info, channels);
+    int samplesPerPixel = pixels->info.samplesPerPixel;
+    int channel = pixels->sample % samplesPerPixel;
+
+    unsigned int bits = 0;
+    int bitCount = 0;
+    size_t i = 0;
+    while (i < count || bitCount > 0)
+    {
+        if (pixels->row == 0 || pixels->sample == pixels->rowSamples)
+        {
+            int result = nextRow(pixels);
+            if (result != STEGO_OK)
+                return result;
+            channel = 0;
+        }
+
+        if (mask >> channel & 1)
+        {
+            if (bitCount < depth && i < count)
+            {
+                bits |= payload[i++] << bitCount;
+                bitCount += BYTESIZE;
+            }
+
+            int used = bitCount < depth ? bitCount : depth;
+            BYTE lowBits = (1 << used) - 1;
+            BYTE* sample = pixels->changed + pixels->sample * pixels->sampleBytes + pixels->sampleBytes - 1;
+            *sample = (*sample & ~lowBits) | (bits & lowBits);
+            bits >>= used;
+            bitCount -= used;
+            pixels->rowChanged = 1;
+        }
+
+        pixels->sample++;
+        if (++channel == samplesPerPixel)
+            channel = 0;
+    }
+
+    return STEGO_OK;
+}
+
+
+// this function reads count payload bytes from the depth LSBs of the
+// samples of the channels, starting at the cursor.
+// returns STEGO_OK, STEGO_NOSPACE or STEGO_BADIMAGE.
+int extractFromPNGPixels(PNGPixels* pixels, int channels, int depth, BYTE* payload, size_t count)
+{
+    int mask = sampleMaskOf(&pixels->info, channels);
+    int samplesPerPixel = pixels->info.samplesPerPixel;
+    int channel = pixels->sample % samplesPerPixel;
+    BYTE lowBits = (1 << depth) - 1;
+
+    unsigned int bits = 0;
+    int bitCount = 0;
+    size_t i = 0;
+    while (i < count)
+    {
+        if (pixels->row == 0 || pixels->sample == pixels->rowSamples)
+        {
+            int result = nextRow(pixels);
+            if (result != STEGO_OK)
+                return result;
+            channel = 0;
+        }
+
+        if (mask >> channel & 1)
+        {
+            BYTE sample = pixels->original[pixels->sample * pixels->sampleBytes + pixels->sampleBytes - 1];
+            bits |= (sample & lowBits) << bitCount;
+            bitCount += depth;
+            if (bitCount >= BYTESIZE)
+            {
+                payload[i++] = bits;
+                bits >>= BYTESIZE;
+                bitCount -= BYTESIZE;
+            }
+        }
+
+        pixels->sample++;
+        if (++channel == samplesPerPixel)
+            channel = 0;
+    }
+
+    return STEGO_OK;
+}
+
+
+// this function writes the rest of the image after the message was
+// embedded: the rest of the rows, the end of the zlib stream and the
+// chunks after the pixels.
+// returns STEGO_OK, STEGO_BADIMAGE or STEGO_WRITEFAILED.
+int finishPNGPixels(PNGPixels* pixels)
+{
+    // the rows are filtered again up to the one after the last row
+    // that was changed.
+    int result = STEGO_OK;
+    while (result == STEGO_OK && pixels->row < pixels->info.height
+           && (pixels->row == 0 || pixels->rowChanged || pixels->previousRowChanged))
+        result = nextRow(pixels);
+    if (result == STEGO_OK && pixels->row > 0)
+        result = writeRow(pixels);
+
+    // the rest of the rows stay exactly as they are stored.
+    uint64_t left = (uint64_t) (pixels->info.height - pixels->row) * (pixels->info.rowBytes + 1);
+    while (result == STEGO_OK && left > 0)
+    {
+        size_t space = batchSpace(pixels);
+        if (space == 0)
+            return STEGO_WRITEFAILED;
+
+        size_t piece = left < space ? left : space;
+        if (inflateRead(pixels->inflater, pixels->batch + DEFLATEWINDOWSIZE + pixels->batchLength, piece) != piece)
+            return STEGO_BADIMAGE;
+        pixels->batchLength += piece;
+        left -= piece;
+    }
+    if (result == STEGO_OK)
+        result = compressBatch(pixels);
+    if (result != STEGO_OK)
+        return result;
+
+    // the end of the zlib stream (the last block and the adler32 of
+    // the rows) in a small chunk of its own.
+    BYTE chunk[PNGCHUNKHEADERSIZE + 6 + PNGCHUNKCRCSIZE];
+    BYTE* data = chunk + PNGCHUNKHEADERSIZE;
+    size_t length = deflateFinish(data);
+    for (int i = 0; i < 4; i++)
+        data[length + i] = pixels->adler >> (8 * (3 - i));
+    length += 4;
+
+    memcpy(chunk, "\0\0\0\0IDAT", PNGCHUNKHEADERSIZE);
+    chunk[3] = length;
+    uint32_t crc = pngCRC(chunk + 4, length + 4);
+    for (int i = 0; i < 4; i++)
+        data[length + i] = crc >> (8 * (3 - i));
+
+    if (!writeOutput(pixels, chunk, sizeof(chunk)))
+        return STEGO_WRITEFAILED;
+
+    // the chunks after the pixels, up to IEND (anything appended after
+    // the image is left out).
+    long long end = findPNGEnd(pixels->image, pixels->size);
+    if (end < (long long) pixels->afterData)
+        return STEGO_BADIMAGE;
+
+    return writeOutput(pixels, pixels->image + pixels->afterData, end - pixels->afterData) ? STEGO_OK
+                                                                                          : STEGO_WRITEFAILED;
+}
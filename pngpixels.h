@@ -0,0 +1,76 @@
+// header file for storing a message in the pixels of a png a few rows
+// at a time
+
+#ifndef PNGPIXELS_H_
+#define PNGPIXELS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "deflate.h"
+#include "helpers.h"
+#include "inflate.h"
+#include "pngchunks.h"
+#include "stego.h"
+
+// the number of bytes of filtered rows in every block that is
+// compressed on its own (see deflate.c).
+#define PNGBLOCKSIZE (1 << 17)
+
+// the pixels of a png that are being read (and written again with a
+// message in them when output is not NULL).
+//
+// only a few rows are in memory at a time: the current row as it is
+// stored (filtered), the current and the previous row as they are
+// (unfiltered) and, when writing, the same two rows with the message
+// in them. the cursor is the next sample of the current row.
+typedef struct
+{
+    const BYTE* image;
+    size_t size;
+    PNGInfo info;
+    int sampleBytes;
+    size_t rowSamples;
+
+    Inflater* inflater;
+    size_t chunk;
+    size_t afterData;
+
+    BYTE* rows;
+    BYTE* filtered;
+    BYTE* original;
+    BYTE* previousOriginal;
+    BYTE* changed;
+    BYTE* previousChanged;
+    long row;
+    size_t sample;
+    int rowChanged;
+    int previousRowChanged;
+
+    const stego_output* output;
+    int blocks;
+    int workers;
+    BYTE* batch;
+    size_t history;
+    size_t batchLength;
+    DeflateWork* work;
+    BYTE* compressed;
+    size_t* compressedLengths;
+    uint32_t* adlers;
+    uint32_t adler;
+    int started;
+} PNGPixels;
+
+
+// function declarations
+int canHoldPixels(const PNGInfo* info);
+int sampleMaskOf(const PNGInfo* info, int channels);
+size_t pixelCapacityOf(const PNGInfo* info, size_t headerSize, int channels, int depth);
+
+int startPNGPixels(PNGPixels* pixels, const BYTE* image, size_t size, const stego_output* output);
+int embedInPNGPixels(PNGPixels* pixels, int channels, int depth, const BYTE* payload, size_t count);
+int extractFromPNGPixels(PNGPixels* pixels, int channels, int depth, BYTE* payload, size_t count);
+int finishPNGPixels(PNGPixels* pixels);
+void endPNGPixels(PNGPixels* pixels);
+
+#endif
@@ -0,0 +1,150 @@
+// ---------------------------------------------------------------------------------------------
+// this program tells how big a message fits in each of the given images, without reading
+// their pixels, so that covers can be picked for payloads before anything is written.
+//
+// only the first PROBESIZE bytes of every image are read (the headers) and the size of the
+// file is taken from the file system. for every image one line of JSON is printed, for
+// example:
+// {"image":"a.bmp","type":"bmp","size":921654,"width":640,"height":480,"bitsPerPixel":24,"rowPadding":0,"pixelArrayOffset":54,"capacity":[115184,230368,345552,460736]}
+//
+// capacity is the number of message bytes that fit in the color samples of the rows with 1,
+// 2, 3 and 4 bits per byte (see the -b option of writemessage). 32-bit bmps also get
+// capacityWithAlpha, the same for -c rgba. a message of any size can be appended to a jpg or
+// png, so their capacity is null. a png that can hold a message in its pixels (see the -p
+// option of writemessage) also gets pixelCapacity, the same for its samples, and
+// pixelCapacityWithAlpha when it has alpha.
+// ---------------------------------------------------------------------------------------------
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bmpinfo.h"
+#include "helpers.h"
+#include "pngchunks.h"
+#include "stego.h"
+
+// number of bytes that are read from the start of every image.
+#define PROBESIZE 512
+
+
+// this function prints the capacities of the bmp (or of the pixels of
+// the png when pixels is 1) for every bit depth with the given channels
+// as a JSON array.
+static void printCapacities(BYTE* head, size_t headLength, size_t size, int channels, int pixels)
+{
+    printf("[");
+    for (int depth = 1; depth <= STEGO_MAXDEPTH; depth++)
+    {
+        stego_options options = {depth, channels, NULL, pixels, NULL, 0, 0};
+        printf("%s%zu", depth == 1 ? "" : ",", stego_capacity(head, headLength, size, &options));
+    }
+    printf("]");
+}
+
+
+// this function prints the JSON line for a single image.
+// returns 1 if the image could be probed and 0 if it couldn't.
+static int probeImage(char* path)
+{
+    printf("{\"image\":\"");
+    for (char* c = path; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            printf("\\%c", *c);
+        else if ((unsigned char) *c < 0x20)
+            printf("\\u%04x", *c);
+        else
+            putchar(*c);
+    }
+    printf("\",");
+
+    // read the headers and the size of the file.
+    BYTE head[PROBESIZE];
+    struct stat info;
+    int fd = open(path, O_RDONLY);
+    ssize_t headLength = fd < 0 ? -1 : pread(fd, head, PROBESIZE, 0);
+    int statOK = fd >= 0 && fstat(fd, &info) == 0;
+    if (fd >= 0)
+        close(fd);
+
+    if (headLength < 0 || !statOK)
+    {
+        printf("\"error\":\"Could not open image.\"}\n");
+        return 0;
+    }
+
+    int type = stego_type(head, headLength);
+    if (type == STEGO_UNSUPPORTED)
+    {
+        printf("\"error\":\"Unsupported file type.\"}\n");
+        return 0;
+    }
+
+    size_t size = info.st_size;
+    if (type != STEGO_BMP)
+    {
+        printf("\"type\":\"%s\",\"size\":%zu,\"capacity\":null", type == STEGO_JPG ? "jpg" : "png", size);
+
+        stego_options options = {1, STEGO_COLORCHANNELS, NULL, 1, NULL, 0, 0};
+        PNGInfo png;
+        if (type == STEGO_PNG && stego_capacity(head, headLength, size, &options) > 0
+            && readPNGInfo(head, headLength, &png))
+        {
+            printf(",\"width\":%ld,\"height\":%ld,\"bitDepth\":%d,\"pixelCapacity\":", png.width, png.height,
+                   png.bitDepth);
+            printCapacities(head, headLength, size, STEGO_COLORCHANNELS, 1);
+            if (png.colorType == 4 || png.colorType == 6)
+            {
+                printf(",\"pixelCapacityWithAlpha\":");
+                printCapacities(head, headLength, size, STEGO_ALLCHANNELS, 1);
+            }
+        }
+
+        printf("}\n");
+        return 1;
+    }
+
+    BMPInfo bmp;
+    if (readBMPInfo(head, headLength, &bmp) == 0)
+    {
+        // RLE and embedded jpg or png pixels have no rows to store a
+        // message in.
+        int compressed = bmp.compression != BMPRGB && bmp.compression != BMPBITFIELDS;
+        printf("\"type\":\"bmp\",\"size\":%zu,\"error\":\"%s\"}\n", size,
+               compressed ? "Compressed bmp images are not supported." : "Invalid bmp header.");
+        return 0;
+    }
+
+    printf("\"type\":\"bmp\",\"size\":%zu,\"width\":%ld,\"height\":%ld,\"bitsPerPixel\":%d,"
+           "\"rowPadding\":%zu,\"pixelArrayOffset\":%zu,\"capacity\":",
+           size, bmp.width, bmp.height, bmp.bitsPerPixel, bmp.stride - bmp.rowBytes, bmp.pixelArrayOffset);
+    printCapacities(head, headLength, size, STEGO_COLORCHANNELS, 0);
+
+    if (bmp.bitsPerPixel == 32)
+    {
+        printf(",\"capacityWithAlpha\":");
+        printCapacities(head, headLength, size, STEGO_ALLCHANNELS, 0);
+    }
+
+    printf("}\n");
+    return 1;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Incorrect usage.\nCorrect usage: ./probeimage <image> (optional)<moreimages>...\n");
+        return -1;
+    }
+
+    // exit with code 1 if any of the images could not be probed.
+    int failed = 0;
+    for (int i = 1; i < argc; i++)
+        failed |= probeImage(argv[i]) == 0;
+
+    return failed;
+}
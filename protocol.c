@@ -0,0 +1,136 @@
+// this file has the functions that send the requests and replies of
+// stegod over its unix socket (see protocol.h), and the file
+// descriptors that go with a request.
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "protocol.h"
+
+
+// this function sends all length bytes over the socket (send() can
+// send fewer). a peer that went away gives an error and not SIGPIPE.
+// returns 1 if it could and 0 if it couldn't.
+int sendAll(int socket, const void* bytes, size_t length)
+{
+    const char* next = bytes;
+    while (length > 0)
+    {
+        ssize_t sent = send(socket, next, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return 0;
+        next += sent;
+        length -= sent;
+    }
+
+    return 1;
+}
+
+
+// this function receives exactly length bytes from the socket.
+// returns 1 if it could and 0 if the peer went away first.
+int receiveAll(int socket, void* bytes, size_t length)
+{
+    char* next = bytes;
+    while (length > 0)
+    {
+        ssize_t received = recv(socket, next, length, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return 0;
+        next += received;
+        length -= received;
+    }
+
+    return 1;
+}
+
+
+// this function sends length bytes over the socket with fdCount file
+// descriptors attached to their first byte (the receiver gets its own
+// copies of them).
+// returns 1 if it could and 0 if it couldn't.
+int sendWithFds(int socket, const void* bytes, size_t length, const int* fds, int fdCount)
+{
+    if (fdCount == 0)
+        return sendAll(socket, bytes, length);
+
+    char control[CMSG_SPACE(sizeof(int) * STEGOD_MAXFDS)];
+    memset(control, 0, sizeof(control));
+    struct iovec vector = {(void*) bytes, length};
+    struct msghdr message = {NULL, 0, &vector, 1, control, CMSG_SPACE(sizeof(int) * fdCount), 0};
+
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int) * fdCount);
+    memcpy(CMSG_DATA(header), fds, sizeof(int) * fdCount);
+
+    ssize_t sent;
+    do
+        sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+    while (sent < 0 && errno == EINTR);
+    if (sent <= 0)
+        return 0;
+
+    // the file descriptors went with the first bytes, the rest are
+    // sent on their own.
+    return sendAll(socket, (const char*) bytes + sent, length - sent);
+}
+
+
+// this function receives exactly length bytes from the socket and the
+// file descriptors that were attached to them (at most STEGOD_MAXFDS,
+// fdCount is set to their number).
+// returns 1 if it could and 0 if the peer went away first or sent too
+// many file descriptors (the ones that came are closed then).
+int receiveWithFds(int socket, void* bytes, size_t length, int* fds, int* fdCount)
+{
+    char control[CMSG_SPACE(sizeof(int) * STEGOD_MAXFDS)];
+    struct iovec vector = {bytes, length};
+    struct msghdr message = {NULL, 0, &vector, 1, control, sizeof(control), 0};
+
+    ssize_t received;
+    do
+        received = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+    while (received < 0 && errno == EINTR);
+
+    // nothing was filled in if recvmsg() failed, not even the control
+    // messages.
+    *fdCount = 0;
+    if (received < 0)
+        return 0;
+
+    for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != NULL; header = CMSG_NXTHDR(&message, header))
+    {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        int count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < count; i++)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+            if (*fdCount < STEGOD_MAXFDS)
+                fds[(*fdCount)++] = fd;
+            else
+                close(fd);
+        }
+    }
+
+    if (received <= 0 || (message.msg_flags & MSG_CTRUNC)
+        || !receiveAll(socket, (char*) bytes + received, length - received))
+    {
+        for (int i = 0; i < *fdCount; i++)
+            close(fds[i]);
+        *fdCount = 0;
+        return 0;
+    }
+
+    return 1;
+}
@@ -0,0 +1,99 @@
+// header file for the requests that stegod takes over its unix socket,
+// used by stegod.c and stegoclient.c
+
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the first 4 bytes of every request and reply ("SGD1"), so a client
+// that speaks something else is told apart at once.
+#define STEGOD_MAGIC 0x31444753u
+
+// the kinds of requests.
+// - a probe request reads the header of the message in the image
+//   (like probeimage and scanimages do).
+// - an extract request reads the message in the image (like
+//   readmessage does).
+// - an embed request stores a message in the image (like writemessage
+//   does) and writes the output image.
+#define STEGOD_PROBE 1
+#define STEGOD_EXTRACT 2
+#define STEGOD_EMBED 3
+
+// the flags of a request.
+// - STEGOD_COMPRESS compresses the message before it is stored.
+// - STEGOD_PIXELS stores the message in the pixels of a PNG or the
+//   coefficients of a JPG.
+// - STEGOD_MESSAGEFD says that the message is in the file descriptor
+//   after the output one, and not in the request.
+#define STEGOD_COMPRESS 1
+#define STEGOD_PIXELS 2
+#define STEGOD_MESSAGEFD 4
+
+// the file descriptors that are sent with a request (SCM_RIGHTS), in
+// this order. the image one is always sent, the output one for an
+// embed request (and for an extract request that wants the message in
+// a file or a shared memory region of its own instead of in the reply)
+// and the message one with STEGOD_MESSAGEFD. a file descriptor can be
+// an open file or a memfd the client filled, the image is mapped either
+// way, so the bytes of the image never go through the socket.
+#define STEGOD_IMAGEFD 0
+#define STEGOD_OUTPUTFD 1
+#define STEGOD_MESSAGEFDINDEX 2
+#define STEGOD_MAXFDS 3
+
+// the longest message that goes through the socket: in an embed
+// request (a longer one is sent with STEGOD_MESSAGEFD) or after the
+// reply to an extract request (a longer one is only written to the
+// output file descriptor, and without one the reply is
+// STEGO_SMALLBUFFER).
+#define STEGOD_MAXINLINELENGTH (4 << 20)
+
+// a request. it is followed by passkeyLength bytes of passkey and then
+// (for an embed request without STEGOD_MESSAGEFD) by messageLength
+// bytes of message.
+typedef struct
+{
+    uint32_t magic;
+    uint32_t kind;
+    uint32_t flags;
+    uint32_t fdCount;
+    uint32_t depth;
+    uint32_t channels;
+    uint32_t passkeyLength;
+    uint32_t reserved;
+    uint64_t messageLength;
+} stegod_request;
+
+// a reply. result is STEGO_OK or an error of libstego (see
+// stego_error()). for a probe request type, version, flags and length
+// are the ones of the image and of the header of its message, and
+// capacity is the number of bytes that can be stored with the depth
+// and channels of the request. for an extract request length is the
+// length of the message, which follows the reply (inlineLength bytes)
+// unless it was written to the output file descriptor (see
+// STEGOD_MAXINLINELENGTH). for an embed request length is the size of
+// the output image.
+typedef struct
+{
+    uint32_t magic;
+    int32_t result;
+    int32_t type;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t length;
+    uint64_t capacity;
+    uint64_t inlineLength;
+} stegod_reply;
+
+
+// function declarations
+int sendAll(int socket, const void* bytes, size_t length);
+int receiveAll(int socket, void* bytes, size_t length);
+int sendWithFds(int socket, const void* bytes, size_t length, const int* fds, int fdCount);
+int receiveWithFds(int socket, void* bytes, size_t length, int* fds, int* fdCount);
+
+#endif
@@ -5,184 +5,541 @@
 //
 // only works if:
 // BMP steganography is done using LSB method from the start of the pixel array.
-// JPG steganography is done by storing the data after End Of File.
-// PNG steganography is done by storing the data after End Of File.
+// JPG steganography is done by storing the data after End Of File, or in the DCT coefficients
+// (writemessage -p), which are huffman decoded a block at a time to read it.
+// PNG steganography is done by storing the data after End Of File, or in the LSBs of the
+// pixels (writemessage -p), which are uncompressed a few rows at a time to read it.
+// a message split across several images (writemessage --shards) is read from all of them at
+// once with --shards.
+// a record of a container (writemessage --record) is read with --record: only the table of
+// contents and the bytes of the record are read from the image, not the other records.
+//
+// the message is written to stdout, or to a file given with -o, and everything else (errors
+// and the final status) is printed to stderr so that it never gets mixed with the message.
 // ---------------------------------------------------------------------------------------------
 
-#include <ctype.h>
-#include <math.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "helpers.h"
+#include "mappedio.h"
+#include "parallel.h"
+#include "stats.h"
+#include "stego.h"
+#include "threadpool.h"
+
+// this function decrypts the message with the passkey. an encrypted
+// message can't be read without it, and a wrong passkey is noticed
+// because the tag in the header doesn't match. messages stored by
+// older versions were encrypted with a simple shift, a newer message
+// that is not encrypted doesn't need the passkey.
+// returns STEGO_OK or STEGO_BADKEY.
+static int decryptMessage(BYTE* message, size_t length, char* passkey, stego_header* header)
+{
+    int result = STEGO_OK;
+    double start = phaseStart();
+    if (header->flags & STEGO_ENCRYPTED)
+    {
+        if (passkey == NULL)
+        {
+            fprintf(stderr, "The message is encrypted, a passkey is needed.\n");
+            result = STEGO_BADKEY;
+        }
+        else if ((result = stego_decrypt(message, length, passkey, &header->crypto)) != STEGO_OK)
+            fprintf(stderr, "%s\n", stego_error(result));
+    }
+    else if (passkey != NULL && decryptOldMessage(message, length, passkey, header->version) == 0)
+        fprintf(stderr, "The message is not encrypted, the passkey is ignored.\n");
+    phaseEnd("decrypt", start);
+
+    return result;
+}
+
+
+// this function decompresses a message that was compressed by
+// writemessage -z (its header says so) and puts it in place of the
+// message.
+// returns STEGO_OK, STEGO_BADMESSAGE or STEGO_NOMEMORY.
+static int decompressMessage(BYTE** message, size_t* length)
+{
+    double start = phaseStart();
+    size_t decompressedLength = 0;
+    BYTE* decompressed = NULL;
+    int result = stego_decompressed_length(*message, *length, &decompressedLength);
+    if (result == STEGO_OK && (decompressed = malloc(decompressedLength + 1)) == NULL)
+        result = STEGO_NOMEMORY;
+    if (result == STEGO_OK)
+        result = stego_decompress(*message, *length, decompressed, decompressedLength, &decompressedLength);
+
+    if (result == STEGO_OK)
+    {
+        free(*message);
+        *message = decompressed;
+        *length = decompressedLength;
+    }
+    else
+    {
+        free(decompressed);
+        fprintf(stderr, "%s\n", stego_error(result));
+    }
+    phaseEnd("decompress", start);
+
+    return result;
+}
+
+
+// this function writes the whole message with a single call, to the
+// output file or to stdout if outputPath is NULL.
+// returns 1 if it was written, 0 if it wasn't and -1 if the output
+// file can't be created.
+static int writeOutput(char* outputPath, BYTE* message, size_t length)
+{
+    FILE* out = outputPath != NULL ? fopen(outputPath, "wb") : stdout;
+    if (out == NULL)
+    {
+        fprintf(stderr, "Could not create output file: %s\n", outputPath);
+        return -1;
+    }
+
+    double start = phaseStart();
+    size_t written = fwrite(message, 1, length, out);
+    COUNT(writeCalls, 1);
+    COUNT(bytesWritten, written);
+    int textPrinted = written == length && fflush(out) == 0;
+    if (out != stdout)
+        textPrinted = fclose(out) == 0 && textPrinted;
+    phaseEnd("write", start);
+
+    return textPrinted;
+}
+
+
+// an image read by readmessage --shards, the header of the shard in it
+// and how reading it went (code is the exit code it gives, 0 while
+// nothing went wrong).
+typedef struct
+{
+    char* path;
+    FILE* file;
+    MappedFile map;
+    stego_header header;
+    size_t offset;
+    int code;
+} ShardImage;
+
+// everything the shards share. shards has the images in the order of
+// their shards.
+typedef struct
+{
+    ShardImage* images;
+    ShardImage** shards;
+    BYTE* message;
+    int threadsPerShard;
+} ShardSet;
+
+
+// this function loads an image and reads the header of the shard in
+// it.
+static void loadShardImage(void* context, long task, int worker)
+{
+    (void) worker;
+    ShardSet* set = context;
+    ShardImage* image = &set->images[task];
+
+    image->file = fopen(image->path, "r");
+    if (image->file == NULL || loadFile(image->file, &image->map) == 0)
+        image->code = 1;
+    else if (stego_type(image->map.data, image->map.size) == STEGO_UNSUPPORTED)
+        image->code = 2;
+    else if (stego_read_header(image->map.data, image->map.size, &image->header) != STEGO_OK
+             || !(image->header.flags & STEGO_SHARDED))
+        image->code = 3;
+}
+
+
+// this function reads a shard into its place in the message and checks
+// that it is not damaged.
+static void extractShard(void* context, long task, int worker)
+{
+    (void) worker;
+    ShardSet* set = context;
+    ShardImage* image = set->shards[task];
+
+    size_t length = 0;
+    BYTE* shard = set->message + image->offset;
+    if (extractInParallel(image->map.data, image->map.size, shard, image->header.length, &length,
+                          set->threadsPerShard) != STEGO_OK
+        || length != image->header.length || stego_checksum(shard, length) != image->header.shard.checksum)
+        image->code = 3;
+}
+
+
+// this function does what readMessage() does for --shards: the images
+// can be given in any order, every one of them has to hold a shard of
+// the same message and all of its shards have to be there. the images
+// are loaded and the shards are read into their places in the message
+// on threadCount threads, a shard at a time per thread, a large bmp can
+// still be read in parts when there are more threads than shards.
+// returns the exit code.
+static int readShards(int imageCount, char* imagePaths[], char* outputPath, char* passkey, int threadCount)
+{
+    ShardSet set = {NULL, NULL, NULL, 1};
+    set.images = calloc(imageCount, sizeof(ShardImage));
+    set.shards = calloc(imageCount, sizeof(ShardImage*));
+    if (set.images == NULL || set.shards == NULL)
+    {
+        fprintf(stderr, "Something went wrong...\n");
+        free(set.images);
+        free(set.shards);
+        return 3;
+    }
+
+    for (int i = 0; i < imageCount; i++)
+        set.images[i].path = imagePaths[i];
+
+    double start = phaseStart();
+    runTasks(imageCount, threadCount, loadShardImage, &set);
+    phaseEnd("load", start);
+
+    // the images are checked in the order they were given so the error
+    // is always the same. exit with error code 1 if an image can't be
+    // opened, 2 if its type is not supported and 3 if the shards don't
+    // make up a whole message.
+    int code = 0;
+    for (int i = 0; i < imageCount && code == 0; i++)
+    {
+        ShardImage* image = &set.images[i];
+        stego_shard* shard = &image->header.shard;
+        code = image->code;
+        if (code == 1)
+            fprintf(stderr, "Could not open image: %s\n", image->path);
+        else if (code == 2)
+            fprintf(stderr, "%s\n", stego_error(STEGO_UNSUPPORTED));
+        else if (code == 3)
+            fprintf(stderr, "No shard of a message was found in: %s\n", image->path);
+        else if (memcmp(shard->id, set.images[0].header.shard.id, STEGO_SHARDIDSIZE) != 0
+                 || shard->count != set.images[0].header.shard.count)
+        {
+            fprintf(stderr, "%s holds a shard of another message.\n", image->path);
+            code = 3;
+        }
+        else if (shard->count != (uint32_t) imageCount)
+        {
+            fprintf(stderr, "The message is split into %u shards, %d images were given.\n", shard->count,
+                    imageCount);
+            code = 3;
+        }
+        else if (set.shards[shard->index] != NULL)
+        {
+            fprintf(stderr, "%s and %s hold the same shard.\n", set.shards[shard->index]->path, image->path);
+            code = 3;
+        }
+        else
+            set.shards[shard->index] = image;
+    }
+
+    // the shards are put back together by their numbers.
+    size_t length = 0;
+    for (int i = 0; i < imageCount && code == 0; i++)
+    {
+        set.shards[i]->offset = length;
+        length += set.shards[i]->header.length;
+        if (length < set.shards[i]->header.length)
+            code = 3;
+    }
+
+    if (code == 0)
+    {
+        set.message = malloc(length + 1);
+        code = set.message != NULL ? 0 : 3;
+    }
+
+    if (code == 0)
+    {
+        start = phaseStart();
+        set.threadsPerShard = threadCount / imageCount > 1 ? threadCount / imageCount : 1;
+        runTasks(imageCount, threadCount, extractShard, &set);
+        phaseEnd("extract", start);
+
+        for (int i = 0; i < imageCount && code == 0; i++)
+        {
+            code = set.shards[i]->code;
+            if (code != 0)
+                fprintf(stderr, "Shard %d of the message is damaged: %s\n", i + 1, set.shards[i]->path);
+        }
+    }
+
+    // every shard has the crypto of the whole message, and says if it
+    // is compressed.
+    int textPrinted = 0;
+    stego_header* header = code == 0 ? &set.shards[0]->header : NULL;
+    if (code == 0 && decryptMessage(set.message, length, passkey, header) == STEGO_OK
+        && (!(header->flags & STEGO_COMPRESSED) || decompressMessage(&set.message, &length) == STEGO_OK))
+    {
+        textPrinted = writeOutput(outputPath, set.message, length);
+        code = textPrinted < 0 ? 4 : 0;
+    }
+
+    free(set.message);
+    for (int i = 0; i < imageCount; i++)
+    {
+        if (set.images[i].file != NULL)
+        {
+            unmapFile(&set.images[i].map);
+            fclose(set.images[i].file);
+        }
+    }
+    free(set.images);
+    free(set.shards);
+
+    if (textPrinted == 1)
+    {
+        fprintf(stderr, "Message read successfully.\n");
+        return 0;
+    }
+    else
+    {
+        fprintf(stderr, "Could not read message.\n");
+        return code != 0 ? code : 3;
+    }
+}
+
+
+// this function prints the names and lengths of the records of the
+// container in the image, for a container that is read without
+// --record.
+static void listRecords(MappedFile* map)
+{
+    stego_toc toc;
+    int result = stego_read_toc(map->data, map->size, &toc);
+    if (result != STEGO_OK)
+    {
+        fprintf(stderr, "%s\n", stego_error(result));
+        return;
+    }
+
+    fprintf(stderr, "This image holds a container of records, read one of them with --record <name>:\n");
+    for (int i = 0; i < STEGO_RECORDSLOTS; i++)
+    {
+        if (toc.records[i].name[0] != '\0')
+            fprintf(stderr, "  %s (%llu bytes)\n", toc.records[i].name,
+                    (unsigned long long) toc.records[i].length);
+    }
+}
+
+
+// this function does what readMessage() does for --record: the record
+// with the given name is read from the container in the image and
+// written to the output file (or stdout). the table of contents says
+// where it is, so only its bytes are read (see stego_extract_range()).
+// returns the exit code.
+static int readRecord(MappedFile* map, char* name, char* outputPath)
+{
+    double start = phaseStart();
+    stego_toc toc;
+    int result = stego_read_toc(map->data, map->size, &toc);
+    int index = result == STEGO_OK ? stego_find_record(&toc, name) : -1;
+    phaseEnd("header", start);
+
+    BYTE* record = NULL;
+    if (result != STEGO_OK)
+        fprintf(stderr, "%s\n", stego_error(result));
+    else if (index < 0)
+        fprintf(stderr, "The container has no record named %s.\n", name);
+    else if ((record = malloc(toc.records[index].length + 1)) == NULL)
+        result = STEGO_NOMEMORY;
+    else
+    {
+        start = phaseStart();
+        result = stego_extract_record(map->data, map->size, &toc, index, record);
+        phaseEnd("extract", start);
+        if (result != STEGO_OK)
+            fprintf(stderr, "%s\n", stego_error(result));
+    }
 
+    int textPrinted = 0;
+    if (result == STEGO_OK && index >= 0)
+        textPrinted = writeOutput(outputPath, record, toc.records[index].length);
+    free(record);
+
+    if (textPrinted == 1)
+    {
+        fprintf(stderr, "Record read successfully.\n");
+        return 0;
+    }
+    else
+    {
+        fprintf(stderr, "Could not read record.\n");
+        return textPrinted < 0 ? 4 : 3;
+    }
+}
+
+
+// this function does everything, main() only prints the statistics
+// afterwards. returns the exit code.
 // argc is the number of command line arguments given.
 // argv is an array of strings containing all the arguments.
-int main(int argc, char* argv[])
+static int readMessage(int argc, char* argv[])
 {
+    // the message is printed to stdout unless an output file is
+    // given with -o.
+    // a message in a large bmp is read in parts by as many threads as
+    // there are cores, unless -j gives the number of threads.
+    // --stats prints how long every phase took and how much I/O was
+    // done (see stats.c).
+    // --shards reads a message that was split across all the images
+    // that are given (see readShards()). the passkey is given with -k
+    // then (it can be given that way without --shards too).
+    // --record reads the record with the given name of a container
+    // (see readRecord()).
+    static const struct option longOptions[] = {{"stats", no_argument, NULL, 's'},
+                                                {"shards", no_argument, NULL, 'S'},
+                                                {"record", required_argument, NULL, 'R'},
+                                                {NULL, 0, NULL, 0}};
+    char* outputPath = NULL;
+    char* recordName = NULL;
+    char* passkey = NULL;
+    int shards = 0;
+    int threadCount = numberOfCores();
+    int option;
+    while ((option = getopt_long(argc, argv, "o:j:k:", longOptions, NULL)) != -1)
+    {
+        if (option == 's')
+            enableStats();
+        else if (option == 'S')
+            shards = 1;
+        else if (option == 'R')
+            recordName = optarg;
+        else if (option == 'k')
+            passkey = optarg;
+        else if (option == 'o')
+            outputPath = optarg;
+        else if (option == 'j')
+            threadCount = atoi(optarg);
+        else
+            argc = 0;
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (shards && argc >= 2)
+        return readShards(argc - 1, argv + 1, outputPath, passkey, threadCount);
+
     // if the number of arguments is not 2, i.e, ONLY the image path
     // of the image with a secret message is not given, exit with
     // an error code -1.
-    if (argc != 2 && argc != 3)
+    if (shards || (argc != 2 && (argc != 3 || passkey != NULL)) || (recordName != NULL && argc != 2))
     {
-        printf("Incorrect usage.\nCorrect usage: ./readmessage <steganographyimage> (optional)<passkey>\n");
+        fprintf(stderr, "Incorrect usage.\nCorrect usage: ./readmessage (optional)-o <outputfile> (optional)-j <threads> (optional)--stats <steganographyimage> (optional)<passkey>\n"
+                        "or: ./readmessage --shards (optional)-k <passkey> (same options) <steganographyimage>...\n"
+                        "or: ./readmessage --record <name> (optional)-o <outputfile> (optional)--stats <steganographyimage>\n");
         return -1;
     }
 
     // store the image path and passkey in its own separate string.
     char* imagepath = argv[1];
-    char* passkey = NULL;
     if (argc == 3)
         passkey = argv[2];
 
     // open the image file from the imagepath
     // if the image path is not valid, exit with error code 1.
+    double start = phaseStart();
     FILE* image = fopen(imagepath, "r");
     if (image == NULL)
     {
-        printf("Could not open image: %s\n", imagepath);
+        fprintf(stderr, "Could not open image: %s\n", imagepath);
         return 1;
     }
 
-    // a variable to keep track of if the secret message has
-    // been printed or not.
-    // 0 -> false (message not printed).
-    // 1 -> true (message printed).
-    int textPrinted = 0;
+    // bring the image into memory (it is mapped if it is a regular
+    // file).
+    MappedFile map;
+    if (loadFile(image, &map) == 0)
+    {
+        fprintf(stderr, "Could not open image: %s\n", imagepath);
+        return 1;
+    }
+    phaseEnd("load", start);
 
-    // check the file type and store it in a variable.
+    // check the file type.
     // if file type is unsupported, exit with error code 2.
-    int fileType = checkFileType(image, NULL);
-    if (fileType == UNSUPPORTEDTYPE)
+    if (stego_type(map.data, map.size) == STEGO_UNSUPPORTED)
     {
-        printf("Unsupported file type.\nSupported file types are BMP, JPG, PNG.\n");
+        fprintf(stderr, "%s\n", stego_error(STEGO_UNSUPPORTED));
         return 2;
     }
 
-    // execute operations according to file type.
-
-    // operations to be done if image type is BMP:
-    if (fileType == BMP)
+    if (recordName != NULL)
     {
-        // create a buffer with space for 8 BYTEs of data
-        BYTE buffer[BYTESIZE];
-
-        // readHeaderForBMP() reads the header and returns
-        // the value of where the pixel array, i.e, all the RGB
-        // values of the image starts.
-        int pixelArrayOffset = readHeaderForBMP(image);
-
-        // move the "cursor" to where the pixel array starts.
-        fseek(image, pixelArrayOffset, SEEK_SET);
-
-        // read the data from the pixel array LSBs and print it.
-        while (fread(buffer, BYTESIZE, 1, image) != 0)
-        {
-            // if the hidden text was completely printed, exit the loop.
-            if (textPrinted == 1)
-                break;
-            // the readCharFromLSBAndPrint() function, as the name
-            // says, reads the LSBs of the bytes, forms the character
-            // that was stored, and prints it. It returns 1 (true)
-            // if all the text was printed. (i.e, the special byte [0000 0000]
-            // that was used to signify the end of text was reached).
-            textPrinted = readCharFromLSBAndPrint(buffer, passkey);
-        }
-        // end of operations for bmp file.
+        int code = readRecord(&map, recordName, outputPath);
+        unmapFile(&map);
+        fclose(image);
+        return code;
     }
-    // operations to be done if image type is JPG:
-    else if (fileType == JPG)
-    {
-        // the two bytes (or 8 bits) that signify the end of file in
-        // a jpg file combined into a single 16 bit number.
-        int endOfImage = 0xFFD9;
-
-        // variable to store the just read bytes.
-        int currBytes = 0x0000;
-
-        // a buffer of the size of the number of signature bytes at
-        // the beginning of a file (2).
-        BYTE buffer[SIGNATUREBYTESIZE];
-
-        // while the just read bytes is not equal the the EOF bytes,
-        // read the file and store the bytes in the buffer.
-        while (currBytes != endOfImage)
-        {
-            fread(buffer, SIGNATUREBYTESIZE, 1, image);
 
-            // this is just syntax to combine two 8-bit numbers into a
-            // single 16-bit number. Look up the operators used here
-            // if interested.
-            currBytes = buffer[0] << 8 | buffer[1];
-        }
+    // a variable to keep track of if the secret message has
+    // been printed or not.
+    // 0 -> false (message not printed).
+    // 1 -> true (message printed).
+    int textPrinted = 0;
 
-        // once the end of file bytes have been reached, all of the data
-        // stored comes after it. So read all of the data and print it.
-        while (fread(buffer, SIGNATUREBYTESIZE, 1, image) != 0)
-        {
-            if (passkey != NULL)
-            {
-                buffer[0] = decryptChar(buffer[0], passkey);
-                buffer[1] = decryptChar(buffer[1], passkey);
-            }
-            printf("%c%c", buffer[0], buffer[1]);
-        }
+    // the header of the message says how long it is, so exactly that
+    // much space is made for it before it is read. only the part of
+    // the image that holds the message is read. the fields of a header
+    // that could not be read are not trusted (its length could be
+    // anything).
+    stego_header header = {0};
+    start = phaseStart();
+    if (stego_read_header(map.data, map.size, &header) != STEGO_OK)
+        header = (stego_header) {0};
+    phaseEnd("header", start);
 
-        // the hidden text has been printed.
-        textPrinted = 1;
-        // end of operations for jpg file.
+    size_t capacity = header.length;
+    BYTE* message = malloc(capacity + 1);
+    size_t length = 0;
+    start = phaseStart();
+    int result = STEGO_SMALLBUFFER;
+    if (header.flags & STEGO_SHARDED)
+    {
+        // a shard is only a piece of a message, it is not read on its
+        // own.
+        fprintf(stderr, "This image holds shard %u of %u of a message, read all of them with --shards.\n",
+                header.shard.index + 1, header.shard.count);
     }
-    // operations to be done if image type is PNG:
-    else if (fileType == PNG)
+    else if (header.flags & STEGO_CONTAINER)
     {
-        // buffer to store ONE BYTE of data.
-        BYTE buffer[1];
-
-        // the sequence of bytes that signify the end of file in a png.
-        int EOFSequence[] = {0x49, 0x45, 0x4E, 0x44, 0xAE, 0x42, 0x60, 0x82};
-
-        // the number of bytes in the EOF sequence.
-        int EOFSequenceLen = 8;
-
-        // index to keep track of the byte in the EOF sequence that has been
-        // found in the file.
-        int index = 0;
+        // so is a container, its records are read one at a time.
+        listRecords(&map);
+    }
+    else if (message != NULL)
+        result = extractInParallel(map.data, map.size, message, capacity, &length, threadCount);
+    phaseEnd("extract", start);
 
-        // keep reading the input file until the EOF sequence is reached.
-        while (fread(buffer, 1, 1, image) != 0)
-        {
-            // if the current byte is following the EOF sequence
-            // increment the index to check for the next byte in the
-            // sequence in the next iteration.
-            if (buffer[0] == EOFSequence[index])
-                index++;
-            // if the current byte doesn't follow the EOF sequence set
-            // the index back to the first byte of the EOF sequence.
-            else
-                index = 0;
-
-            // if the index has reached the end of the EOF sequence, then
-            // exit the loop to store the text.
-            if (index >= EOFSequenceLen)
-                break;
-        }
+    // decrypt the message with the passkey, decompress it and write
+    // it. an image without a header only holds a message of an older
+    // version if it looks like one (see isOldMessage()).
+    if (result == STEGO_OK)
+        result = decryptMessage(message, length, passkey, &header);
+    if (result == STEGO_OK && header.version == 0
+        && !isOldMessage(message, length, stego_type(map.data, map.size) == STEGO_BMP))
+    {
+        fprintf(stderr, "%s\n", stego_error(STEGO_NOMESSAGE));
+        result = STEGO_NOMESSAGE;
+    }
+    if (result == STEGO_OK && (header.flags & STEGO_COMPRESSED))
+        result = decompressMessage(&message, &length);
 
-        // check if the EOF sequence has indeed been read.
-        if (index >= 8)
-        {
-            // read and print whatever was stored after the EOF.
-            while (fread(buffer, 1, 1, image) != 0)
-            {
-                if (passkey != NULL)
-                    buffer[0] = decryptChar(buffer[0], passkey);
-
-                printf("%c", buffer[0]);
-            }
-            // the text has been printed.
-            textPrinted = 1;
-        }
-        // end of operations for png file.
+    if (result == STEGO_OK)
+    {
+        textPrinted = writeOutput(outputPath, message, length);
+        if (textPrinted < 0)
+            return 4;
     }
+    free(message);
+    unmapFile(&map);
 
     // close the opened image to prevent memory leak.
     fclose(image);
@@ -192,13 +549,21 @@ int main(int argc, char* argv[])
     {
         // exit program with code 0 to signify success if the message
         // was read properly.
-        printf("Message read successfully.\n");
+        fprintf(stderr, "Message read successfully.\n");
         return 0;
     }
     else
     {
         // exit the program with code 3 if the message wasnt read properly.
-        printf("Could not read message.\n");
+        fprintf(stderr, "Could not read message.\n");
         return 3;
     }
 }
+
+
+int main(int argc, char* argv[])
+{
+    int code = readMessage(argc, argv);
+    printStats("readmessage", code);
+    return code;
+}
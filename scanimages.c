@@ -0,0 +1,687 @@
+// ---------------------------------------------------------------------------------------------
+// this program finds out which images in whole directory trees carry a message, for audits of
+// millions of files, and keeps what it found in an index so that the next scan only looks at
+// the files that changed.
+//
+// the directories are walked on a pool of threads, a level of the tree at a time, and so are
+// the files. only a few KB of every file are read (see stego_probe()):
+//  - a BMP has the header of its message in the LSBs of the first bytes of its pixel array,
+//    so only the first HEADSIZE bytes of it are read.
+//  - a JPG or PNG has its message appended after the end of the image, so only its last
+//    SHORTTAILSIZE bytes are read (and then its last TAILSIZE bytes, if that was not enough).
+//    a file that ends with the end of the image has no message, one that has the header of a
+//    message right after the end of the image in those bytes does.
+// a file that can't be told apart this way (a message longer than TAILSIZE bytes, or one
+// stored by an older version without a header) is mapped and read the way readmessage reads
+// it. with -p the pixels of every PNG and the coefficients of every JPG are checked for a
+// message too (writemessage -p), which means decoding the start of every image.
+//
+// the index has one line for every file, with the fields separated by tabs:
+//
+//     <path>    <size>    <mtime>    <type>    <message>    <length>    <deep>
+//
+// a tab, new line or backslash in the path is written as \t, \n or \\, so that every file is in
+// the index whatever its name. type is bmp, jpg or png (- for a file that is not an image, ? for
+// one that could not be read), message is 1 if the file carries a message and 0 if it doesn't,
+// length is the length of the message (as it is stored, so encrypted or compressed) and deep is
+// 1 if the pixels or coefficients of the image were checked too (-p). a scan with -p reads a
+// JPG or PNG again if it was only checked without. the index is written to
+// the file given with -x (and read from it first, the files whose size and mtime didn't change
+// are not read again), or to stdout.
+// ---------------------------------------------------------------------------------------------
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "helpers.h"
+#include "mappedio.h"
+#include "stats.h"
+#include "stego.h"
+#include "threadpool.h"
+
+// number of bytes that are read from the start and from the end of
+// every image. most images have no message, and their end is found
+// in the short tail.
+#define HEADSIZE 4096
+#define SHORTTAILSIZE 4096
+#define TAILSIZE 65536
+
+// the types of the index that are not an image type.
+#define NOTANIMAGE 0
+#define UNREADABLE -1
+
+// the first line of the index.
+#define INDEXHEADER "# scanimages index: path, size, mtime, type, message, length, deep"
+
+
+// a file of the trees and what the scan found out about it. deep is 1
+// if its pixels were checked for a message (-p), reused is 1 if it is
+// the same as in the last index.
+typedef struct
+{
+    char* path;
+    long long size;
+    long long seconds;
+    long nanoseconds;
+    int type;
+    int message;
+    unsigned long long length;
+    int deep;
+    int reused;
+} ScanFile;
+
+// a list of files (or of directory paths, with only path set) that
+// grows as things are added to it.
+typedef struct
+{
+    ScanFile* items;
+    size_t count;
+    size_t capacity;
+} FileList;
+
+// what the walk of a single directory found.
+typedef struct
+{
+    FileList files;
+    FileList directories;
+    int failed;
+} Listing;
+
+// the last index, in a hash table by path (slots has the number of the
+// file plus 1, or 0 for an empty slot).
+typedef struct
+{
+    FileList files;
+    size_t* slots;
+    size_t slotCount;
+} Index;
+
+// everything the threads share.
+typedef struct
+{
+    FileList* level;
+    Listing* listings;
+    FileList* files;
+    Index* index;
+    BYTE* buffers;
+    int pixels;
+} Scan;
+
+
+// this function adds a file to the list.
+// returns 1 if it could and 0 if there is not enough memory.
+static int addFile(FileList* list, const ScanFile* file)
+{
+    if (list->count == list->capacity)
+    {
+        size_t capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+        ScanFile* items = realloc(list->items, capacity * sizeof(ScanFile));
+        if (items == NULL)
+            return 0;
+        list->items = items;
+        list->capacity = capacity;
+    }
+
+    list->items[list->count++] = *file;
+    return 1;
+}
+
+
+// this function frees the list and the paths in it.
+static void freeList(FileList* list)
+{
+    for (size_t i = 0; i < list->count; i++)
+        free(list->items[i].path);
+    free(list->items);
+    *list = (FileList) {NULL, 0, 0};
+}
+
+
+// returns the FNV-1a hash of a path.
+static size_t hashOf(const char* path)
+{
+    size_t hash = 14695981039346656037ULL;
+    for (const char* c = path; *c != '\0'; c++)
+        hash = (hash ^ (unsigned char) *c) * 1099511628211ULL;
+    return hash;
+}
+
+
+// returns the name of a type in the index.
+static const char* typeName(int type)
+{
+    if (type == STEGO_BMP)
+        return "bmp";
+    if (type == STEGO_JPG)
+        return "jpg";
+    if (type == STEGO_PNG)
+        return "png";
+    return type == NOTANIMAGE ? "-" : "?";
+}
+
+
+// returns the type with the given name in the index.
+static int typeOf(const char* name)
+{
+    if (strcmp(name, "bmp") == 0)
+        return STEGO_BMP;
+    if (strcmp(name, "jpg") == 0)
+        return STEGO_JPG;
+    if (strcmp(name, "png") == 0)
+        return STEGO_PNG;
+    return strcmp(name, "-") == 0 ? NOTANIMAGE : UNREADABLE;
+}
+
+
+// this function turns the \t, \n and \\ of a path in the index back
+// into a tab, a new line and a backslash, where the path is.
+static void unescapePath(char* path)
+{
+    char* out = path;
+    for (char* c = path; *c != '\0'; c++)
+    {
+        if (*c == '\\' && (c[1] == 't' || c[1] == 'n' || c[1] == '\\'))
+        {
+            c++;
+            *out++ = *c == 't' ? '\t' : *c == 'n' ? '\n' : '\\';
+        }
+        else
+            *out++ = *c;
+    }
+    *out = '\0';
+}
+
+
+// this function reads the last index from the file at path (a missing
+// file is an empty index) and puts it in the hash table.
+// returns 1 if it could and 0 if it couldn't.
+static int loadIndex(const char* path, Index* index)
+{
+    *index = (Index) {{NULL, 0, 0}, NULL, 0};
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return 1;
+
+    double start = phaseStart();
+    MappedFile map;
+    int loaded = loadFile(file, &map);
+    fclose(file);
+    if (!loaded)
+        return 0;
+
+    // every line is split into its fields where the tabs are. an index
+    // written before deep was added has one field less, nothing in it
+    // was checked with -p.
+    char* text = (char*) map.data;
+    for (size_t position = 0; position < map.size;)
+    {
+        char* line = text + position;
+        char* newline = memchr(line, '\n', map.size - position);
+        size_t length = newline != NULL ? (size_t) (newline - line) : map.size - position;
+        position += length + 1;
+        if (length == 0 || line[0] == '#')
+            continue;
+
+        char buffer[2 * FILENAME_MAX + 128];
+        if (length >= sizeof(buffer))
+            continue;
+        memcpy(buffer, line, length);
+        buffer[length] = '\0';
+
+        char* fields[7];
+        int count = 0;
+        for (char* field = strtok(buffer, "\t"); field != NULL && count < 7; field = strtok(NULL, "\t"))
+            fields[count++] = field;
+        if (count < 6)
+            continue;
+
+        unescapePath(fields[0]);
+        char* fraction = strchr(fields[2], '.');
+        ScanFile file = {strdup(fields[0]), atoll(fields[1]), atoll(fields[2]),
+                         fraction != NULL ? atol(fraction + 1) : 0, typeOf(fields[3]), atoi(fields[4]),
+                         strtoull(fields[5], NULL, 10), count == 7 ? atoi(fields[6]) : 0, 0};
+        if (file.path == NULL || !addFile(&index->files, &file))
+        {
+            free(file.path);
+            unmapFile(&map);
+            return 0;
+        }
+    }
+    unmapFile(&map);
+
+    // a table at most half full, so that a path is found in a few
+    // steps.
+    index->slotCount = 16;
+    while (index->slotCount < 2 * index->files.count)
+        index->slotCount *= 2;
+    index->slots = calloc(index->slotCount, sizeof(size_t));
+    if (index->slots == NULL)
+        return 0;
+
+    for (size_t i = 0; i < index->files.count; i++)
+    {
+        size_t slot = hashOf(index->files.items[i].path) & (index->slotCount - 1);
+        while (index->slots[slot] != 0)
+            slot = (slot + 1) & (index->slotCount - 1);
+        index->slots[slot] = i + 1;
+    }
+    phaseEnd("index", start);
+
+    return 1;
+}
+
+
+// returns the file with the given path in the last index, or NULL if
+// it is not in it.
+static const ScanFile* findInIndex(const Index* index, const char* path)
+{
+    if (index->slots == NULL)
+        return NULL;
+
+    size_t slot = hashOf(path) & (index->slotCount - 1);
+    for (; index->slots[slot] != 0; slot = (slot + 1) & (index->slotCount - 1))
+    {
+        const ScanFile* file = &index->files.items[index->slots[slot] - 1];
+        if (strcmp(file->path, path) == 0)
+            return file;
+    }
+
+    return NULL;
+}
+
+
+// compares two files by their paths, for qsort().
+static int comparePaths(const void* a, const void* b)
+{
+    return strcmp(((const ScanFile*) a)->path, ((const ScanFile*) b)->path);
+}
+
+
+// this function lists a directory of the current level of the walk:
+// its regular files (with their size and mtime) and the directories in
+// it. symbolic links are not followed, so the walk never goes around
+// in circles.
+static void listDirectory(void* context, long task, int worker)
+{
+    (void) worker;
+    Scan* scan = context;
+    Listing* listing = &scan->listings[task];
+    const char* path = scan->level->items[task].path;
+
+    DIR* directory = opendir(path);
+    if (directory == NULL)
+    {
+        listing->failed = 1;
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(directory)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        struct stat info;
+        if (fstatat(dirfd(directory), entry->d_name, &info, AT_SYMLINK_NOFOLLOW) != 0
+            || (!S_ISREG(info.st_mode) && !S_ISDIR(info.st_mode)))
+            continue;
+
+        size_t length = strlen(path) + strlen(entry->d_name) + 2;
+        ScanFile file = {malloc(length), info.st_size, info.st_mtim.tv_sec, info.st_mtim.tv_nsec,
+                         UNREADABLE, 0, 0, 0, 0};
+        if (file.path == NULL)
+        {
+            listing->failed = 1;
+            break;
+        }
+        snprintf(file.path, length, "%s%s%s", path, path[strlen(path) - 1] == '/' ? "" : "/", entry->d_name);
+
+        if (!addFile(S_ISDIR(info.st_mode) ? &listing->directories : &listing->files, &file))
+        {
+            free(file.path);
+            listing->failed = 1;
+            break;
+        }
+    }
+
+    closedir(directory);
+
+    // readdir() gives the entries in no particular order.
+    if (listing->files.count > 1)
+        qsort(listing->files.items, listing->files.count, sizeof(ScanFile), comparePaths);
+    if (listing->directories.count > 1)
+        qsort(listing->directories.items, listing->directories.count, sizeof(ScanFile), comparePaths);
+}
+
+
+// this function reads up to length bytes at offset of the file.
+// returns the number of bytes read, or -1 if they couldn't be.
+static ssize_t readAt(int fd, BYTE* buffer, size_t length, off_t offset)
+{
+    ssize_t bytesRead = pread(fd, buffer, length, offset);
+    COUNT(readCalls, 1);
+    if (bytesRead > 0)
+        COUNT(bytesRead, bytesRead);
+    return bytesRead;
+}
+
+
+// this function reads the header of the message in a whole image (it
+// is mapped), for a file stego_probe() can't tell about.
+// returns STEGO_OK, STEGO_NOMESSAGE or STEGO_NOMEMORY (it couldn't be
+// read).
+static int readWholeHeader(int fd, stego_header* header)
+{
+    FILE* file = fdopen(dup(fd), "rb");
+    MappedFile map;
+    if (file == NULL || loadFile(file, &map) == 0)
+    {
+        if (file != NULL)
+            fclose(file);
+        return STEGO_NOMEMORY;
+    }
+
+    int result = stego_read_header(map.data, map.size, header);
+    unmapFile(&map);
+    fclose(file);
+    return result;
+}
+
+
+// this function finds out if a file carries a message, reading as
+// little of it as it can (see the top of the file). a file with the
+// same size and mtime as in the last index is not read at all, unless
+// it is a jpg or png that now has to be checked with -p and wasn't.
+static void scanFile(void* context, long task, int worker)
+{
+    Scan* scan = context;
+    ScanFile* file = &scan->files->items[task];
+
+    const ScanFile* last = findInIndex(scan->index, file->path);
+    int shallow = last != NULL && scan->pixels && !last->deep && (last->type == STEGO_JPG || last->type == STEGO_PNG);
+    if (last != NULL && last->type != UNREADABLE && last->size == file->size && last->seconds == file->seconds
+        && last->nanoseconds == file->nanoseconds && !shallow)
+    {
+        file->type = last->type;
+        file->message = last->message;
+        file->length = last->length;
+        file->deep = last->deep;
+        file->reused = 1;
+        return;
+    }
+    file->deep = scan->pixels;
+
+    int fd = open(file->path, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0)
+        return;
+
+    BYTE* head = scan->buffers + (size_t) worker * (HEADSIZE + TAILSIZE);
+    BYTE* tail = head + HEADSIZE;
+    ssize_t headLength = readAt(fd, head, HEADSIZE, 0);
+    if (headLength < 0)
+    {
+        close(fd);
+        return;
+    }
+
+    file->type = stego_type(head, headLength);
+    if (file->type == STEGO_UNSUPPORTED)
+    {
+        file->type = NOTANIMAGE;
+        close(fd);
+        return;
+    }
+
+    // the short tail of a jpg or png (a bmp only needs its head), and
+    // the long one if the short one was not enough.
+    stego_header header;
+    int result = STEGO_SMALLBUFFER;
+    size_t tailSizes[2] = {file->type == STEGO_BMP ? 0 : SHORTTAILSIZE, TAILSIZE};
+    for (int i = 0; i < 2 && result == STEGO_SMALLBUFFER; i++)
+    {
+        size_t wanted = (size_t) file->size < tailSizes[i] ? (size_t) file->size : tailSizes[i];
+        if (i == 1 && (file->type == STEGO_BMP || wanted <= tailSizes[0]))
+            break;
+        if (wanted > 0 && readAt(fd, tail, wanted, file->size - wanted) != (ssize_t) wanted)
+        {
+            file->type = UNREADABLE;
+            close(fd);
+            return;
+        }
+        result = stego_probe(head, headLength, tail, wanted, file->size, &header);
+    }
+    if (result == STEGO_SMALLBUFFER || (scan->pixels && result == STEGO_NOMESSAGE && file->type != STEGO_BMP))
+        result = readWholeHeader(fd, &header);
+    close(fd);
+
+    // a bmp without a header has no message that can be told apart
+    // from its pixels, a jpg or png has one if anything comes after the
+    // end of the image.
+    if (result == STEGO_OK && (header.version != 0 || (file->type != STEGO_BMP && header.length > 0)))
+    {
+        file->message = 1;
+        file->length = header.length;
+    }
+    else if (result == STEGO_NOMEMORY)
+        file->type = UNREADABLE;
+}
+
+
+// this function walks the trees of the given paths a level at a time,
+// listing the directories of every level on threadCount threads, and
+// adds all their regular files to files (the paths that are files are
+// added as they are).
+// returns the number of paths that could not be listed, or -1 if
+// there is not enough memory.
+static long walkTrees(int pathCount, char* paths[], FileList* files, int threadCount)
+{
+    long failed = 0;
+    FileList level = {NULL, 0, 0};
+    for (int i = 0; i < pathCount; i++)
+    {
+        struct stat info;
+        ScanFile file = {strdup(paths[i]), 0, 0, 0, UNREADABLE, 0, 0, 0, 0};
+        if (stat(paths[i], &info) != 0)
+        {
+            fprintf(stderr, "Could not open: %s\n", paths[i]);
+            free(file.path);
+            failed++;
+            continue;
+        }
+
+        file.size = info.st_size;
+        file.seconds = info.st_mtim.tv_sec;
+        file.nanoseconds = info.st_mtim.tv_nsec;
+        if (file.path == NULL || !addFile(S_ISDIR(info.st_mode) ? &level : files, &file))
+            return -1;
+    }
+
+    Scan scan = {&level, NULL, files, NULL, NULL, 0};
+    while (level.count > 0)
+    {
+        scan.listings = calloc(level.count, sizeof(Listing));
+        if (scan.listings == NULL)
+            return -1;
+        runTasks(level.count, threadCount, listDirectory, &scan);
+
+        // the files and directories are put together in the order of
+        // the directories they are in, so the index is in the same
+        // order every time.
+        FileList next = {NULL, 0, 0};
+        for (size_t i = 0; i < level.count; i++)
+        {
+            Listing* listing = &scan.listings[i];
+            if (listing->failed)
+            {
+                fprintf(stderr, "Could not list directory: %s\n", level.items[i].path);
+                failed++;
+            }
+
+            for (size_t j = 0; j < listing->files.count; j++)
+            {
+                if (!addFile(files, &listing->files.items[j]))
+                    return -1;
+            }
+            for (size_t j = 0; j < listing->directories.count; j++)
+            {
+                if (!addFile(&next, &listing->directories.items[j]))
+                    return -1;
+            }
+            free(listing->files.items);
+            free(listing->directories.items);
+        }
+
+        free(scan.listings);
+        freeList(&level);
+        level = next;
+    }
+
+    return failed;
+}
+
+
+// this function writes a path to the index, with its tabs, new lines
+// and backslashes escaped (see the top of the file).
+static void writePath(const char* path, FILE* out)
+{
+    for (const char* c = path; *c != '\0'; c++)
+    {
+        if (*c == '\t' || *c == '\n' || *c == '\\')
+        {
+            putc('\\', out);
+            putc(*c == '\t' ? 't' : *c == '\n' ? 'n' : '\\', out);
+        }
+        else
+            putc(*c, out);
+    }
+}
+
+
+// this function writes the index to out.
+// returns the number of files carrying a message, or -1 if the index
+// could not be written.
+static long writeIndex(FileList* files, FILE* out)
+{
+    long messages = 0;
+    fprintf(out, INDEXHEADER "\n");
+    for (size_t i = 0; i < files->count; i++)
+    {
+        ScanFile* file = &files->items[i];
+        writePath(file->path, out);
+        fprintf(out, "\t%lld\t%lld.%09ld\t%s\t%d\t%llu\t%d\n", file->size, file->seconds, file->nanoseconds,
+                typeName(file->type), file->message, file->length, file->deep);
+        messages += file->message;
+    }
+
+    return ferror(out) ? -1 : messages;
+}
+
+
+// this function does everything, main() only prints the statistics
+// afterwards. returns the exit code.
+static int scanImages(int argc, char* argv[])
+{
+    // the files are scanned on as many threads as there are cores,
+    // unless -j gives the number of threads.
+    // -x gives the index file, which is read first and written again
+    // at the end (without it, the index is printed to stdout).
+    // -p checks the pixels of every png and the coefficients of every
+    // jpg for a message too.
+    // --stats prints how long every phase took and how much I/O was
+    // done (see stats.c).
+    static const struct option longOptions[] = {{"stats", no_argument, NULL, 's'}, {NULL, 0, NULL, 0}};
+    char* indexPath = NULL;
+    int pixels = 0;
+    int threadCount = numberOfCores();
+    int option;
+    while ((option = getopt_long(argc, argv, "j:x:p", longOptions, NULL)) != -1)
+    {
+        if (option == 's')
+            enableStats();
+        else if (option == 'j')
+            threadCount = atoi(optarg);
+        else if (option == 'x')
+            indexPath = optarg;
+        else if (option == 'p')
+            pixels = 1;
+        else
+            argc = 0;
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (argc < 2 || threadCount < 1)
+    {
+        fprintf(stderr, "Incorrect usage.\nCorrect usage: ./scanimages (optional)-x <indexfile> (optional)-p (optional)-j <threads> (optional)--stats <directory> (optional)<moredirectories>...\n");
+        return -1;
+    }
+
+    Index index;
+    if (indexPath != NULL && loadIndex(indexPath, &index) == 0)
+    {
+        fprintf(stderr, "Could not read index: %s\n", indexPath);
+        return 1;
+    }
+    else if (indexPath == NULL)
+        index = (Index) {{NULL, 0, 0}, NULL, 0};
+
+    // walk the trees, then scan all the files they have.
+    double start = phaseStart();
+    FileList files = {NULL, 0, 0};
+    long failed = walkTrees(argc - 1, argv + 1, &files, threadCount);
+    phaseEnd("walk", start);
+
+    Scan scan = {NULL, NULL, &files, &index, malloc((size_t) threadCount * (HEADSIZE + TAILSIZE)), pixels};
+    if (failed < 0 || scan.buffers == NULL)
+    {
+        fprintf(stderr, "Something went wrong...\n");
+        return 4;
+    }
+
+    start = phaseStart();
+    runTasks(files.count, threadCount, scanFile, &scan);
+    phaseEnd("scan", start);
+
+    // the index is replaced at once, so a crash never leaves half of
+    // it.
+    start = phaseStart();
+    OutputFile out = {stdout, NULL, "", 0};
+    long messages = -1;
+    if (indexPath == NULL || openOutputFile(indexPath, 1, &out))
+        messages = writeIndex(&files, out.file);
+    int written = indexPath == NULL ? fflush(stdout) == 0 && messages >= 0 : closeOutputFile(&out, messages >= 0);
+    phaseEnd("write", start);
+
+    size_t reused = 0;
+    for (size_t i = 0; i < files.count; i++)
+        reused += files.items[i].reused;
+    size_t count = files.count;
+    free(scan.buffers);
+    freeList(&files);
+    freeList(&index.files);
+    free(index.slots);
+
+    if (!written)
+    {
+        fprintf(stderr, "Could not write index.\n");
+        return 2;
+    }
+
+    fprintf(stderr, "Scanned %zu files (%zu unchanged since the last scan), %ld carry a message.\n", count,
+            reused, messages);
+    return failed > 0 ? 1 : 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+    int code = scanImages(argc, argv);
+    printStats("scanimages", code);
+    return code;
+}
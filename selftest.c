@@ -0,0 +1,1111 @@
+// ---------------------------------------------------------------------------------------------
+// this program checks the ciphers and hashes of libstego against known answers, so that a
+// mistake in one of the kernels is caught before it damages a message, and that messages
+// stored in made up covers (see covers.c) read back the way they were stored. run it with
+// "make test", which runs it once for every kernel (STEGO_KERNEL=scalar, sse2 and avx2, a
+// kernel the cpu doesn't have falls back to a slower one).
+//
+// the answers are the test vectors of RFC 8439 (ChaCha20 in 2.4.2, Poly1305 in 2.5.2), of
+// FIPS 180-2 (SHA-256) and of RFC 7914 (PBKDF2 with SHA-256, in 11.1), the common PBKDF2
+// vector for "password", "salt" and 4096 iterations, and the SHA-256 of 1000 bytes encrypted
+// with ChaCha20, which goes through the 4 and 8 block paths of the SIMD kernels (worked out
+// with a separate implementation).
+//
+// a message that is not encrypted is read back with a passkey too, which must leave it as it
+// is unless it was stored by a version that encrypted it with a shift, and the pixels of a bmp
+// without a header must not be taken for a message of the first versions. a depth or channels
+// an image can't store a message with must be refused. the records of a container are
+// replaced over and over, which must not make it keep growing.
+//
+// messages are compressed and decompressed (with LZ4, see lz4.c and compression.c), and a block
+// of the LZ4 block format is read. blocks and messages that were cut short or damaged must be
+// refused.
+//
+// zlib data of known answers is decompressed (see inflate.c), and data compressed in pieces
+// with the compressor of the png path (see deflate.c), which must fail when it is cut short or
+// damaged. messages are stored in the pixels of a png and read back, and must not be read from
+// a png that was cut short or has a damaged IDAT chunk.
+//
+// messages are stored in the coefficients of a jpg (see jpgcoefficients.c) and read back. a
+// scan that was cut short or has a code that isn't in its huffman table, and a huffman table
+// with the wrong number of codes, must be refused.
+//
+// a container of records is stored in a bmp, and records are replaced and added by rewriting
+// only their bytes and the table of contents (see container.c). a table of contents that is
+// damaged or says a record is outside the container, and a damaged record, must be refused.
+//
+// every check prints one line, ok or FAILED, and the exit code is the number of checks that
+// failed.
+// ---------------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chacha20.h"
+#include "covers.h"
+#include "deflate.h"
+#include "helpers.h"
+#include "inflate.h"
+#include "lz4.h"
+#include "sha256.h"
+#include "stego.h"
+
+// the length of the message of the long ChaCha20 check.
+#define LONGLENGTH 1000
+
+// the seed the covers are made from.
+#define SEED 0x5e1f7e57ULL
+
+// the length of the longest message the compression is checked with,
+// which is more than one block of it (4 MB).
+#define COMPRESSLENGTH (5 << 20)
+
+// the length of the data the deflate compressor is checked with, and
+// the pieces it is compressed in.
+#define DEFLATELENGTH 200000
+#define DEFLATEPIECE 65536
+
+
+// zlib data that is given to the inflater piece bytes at a time.
+typedef struct
+{
+    const BYTE* data;
+    size_t length;
+    size_t piece;
+} ZlibInput;
+
+
+// this function turns a string of hex digits into bytes.
+// returns the number of bytes.
+static size_t parseHex(const char* hex, BYTE* bytes)
+{
+    size_t length = 0;
+    for (; hex[0] != '\0' && hex[1] != '\0'; hex += 2)
+    {
+        unsigned value;
+        sscanf(hex, "%2x", &value);
+        bytes[length++] = value;
+    }
+
+    return length;
+}
+
+
+// this function prints the result of a check.
+// returns passed.
+static int report(const char* name, int passed)
+{
+    printf("%-24s %s\n", name, passed ? "ok" : "FAILED");
+    return passed;
+}
+
+
+// this function compares the bytes that came out of a check with the
+// known answer (in hex) and prints the result.
+// returns 1 if they are the same and 0 if they aren't.
+static int check(const char* name, const BYTE* bytes, size_t length, const char* expected)
+{
+    BYTE answer[256];
+    return report(name, parseHex(expected, answer) == length && memcmp(bytes, answer, length) == 0);
+}
+
+
+// this function works out the SHA-256 of length bytes of data into
+// digest, giving them to the hash in pieces of the given size so that
+// its buffering is used.
+static void hashInPieces(const BYTE* data, size_t length, size_t piece, BYTE* digest)
+{
+    SHA256 hash;
+    sha256Start(&hash);
+    for (size_t i = 0; i < length; i += piece)
+        sha256Add(&hash, data + i, length - i < piece ? length - i : piece);
+    sha256Finish(&hash, digest);
+}
+
+
+// this function stores a message that is not encrypted in a bmp and
+// reads it back with a passkey, and decrypts messages of the versions
+// that encrypted them with a shift.
+// returns the number of checks that failed.
+static int checkPasskeys(void)
+{
+    int failed = 0;
+    const char* text = "Hello,\nworld.";
+    size_t textLength = strlen(text);
+    char passkey[] = "key";
+    int shift = hash(passkey);
+
+    Cover cover;
+    if (makeBMP(&cover, 64, 64, 24, SEED) == 0)
+        return !report("passkey not encrypted", 0);
+
+    stego_layout layout;
+    BYTE* image = NULL;
+    if (stego_plan(cover.data, cover.size, textLength, NULL, &layout) == STEGO_OK)
+        image = malloc(layout.outputSize);
+    BYTE message[64];
+    size_t length = 0;
+    stego_header header;
+    int passed = image != NULL
+                 && stego_embed(cover.data, cover.size, (const BYTE*) text, textLength, NULL, image,
+                                layout.outputSize, &length) == STEGO_OK
+                 && stego_read_header(image, length, &header) == STEGO_OK && header.version == STEGO_VERSION
+                 && !(header.flags & STEGO_ENCRYPTED)
+                 && stego_extract(image, length, message, sizeof(message), &length) == STEGO_OK
+                 && decryptOldMessage(message, length, passkey, header.version) == 0
+                 && length == textLength && memcmp(message, text, textLength) == 0;
+    failed += !report("passkey not encrypted", passed);
+    free(image);
+    free(cover.data);
+
+    // version 1 shifted every byte, the first versions (without a
+    // header) every byte but the new lines.
+    for (size_t i = 0; i < textLength; i++)
+        message[i] = text[i] - shift;
+    passed = decryptOldMessage(message, textLength, passkey, STEGO_SHIFTVERSION) == 1
+             && memcmp(message, text, textLength) == 0;
+    failed += !report("passkey version 1", passed);
+
+    for (size_t i = 0; i < textLength; i++)
+        message[i] = text[i] == '\n' ? '\n' : text[i] - shift;
+    passed = decryptOldMessage(message, textLength, passkey, 0) == 1 && memcmp(message, text, textLength) == 0;
+    failed += !report("passkey no header", passed);
+
+    return failed;
+}
+
+
+// this function reads the pixels of a bmp that has no message, which
+// must not be taken for a message of an older version, and checks what
+// is.
+// returns the number of checks that failed.
+static int checkOldMessages(void)
+{
+    int failed = 0;
+    Cover cover;
+    BYTE message[4096];
+    size_t length = 0;
+    int passed = makeBMP(&cover, 64, 64, 24, SEED)
+                 && stego_extract(cover.data, cover.size, message, sizeof(message), &length) == STEGO_OK
+                 && !isOldMessage(message, length, 1);
+    failed += !report("no header noise", passed);
+    free(cover.data);
+
+    const BYTE* text = (const BYTE*) "Hello,\tworld.\r\n";
+    const BYTE noise[] = {'H', 'i', 0x1B, 0xC3};
+    passed = isOldMessage(text, strlen((const char*) text), 1) && !isOldMessage(text, 0, 1)
+             && !isOldMessage(noise, 4, 1) && isOldMessage(noise, 4, 0) && !isOldMessage(noise, 0, 0);
+    failed += !report("no header text", passed);
+
+    return failed;
+}
+
+
+// this function plans messages with another depth and channels in a
+// png and a jpg, which only the pixels of the png can store.
+// returns the number of checks that failed.
+static int checkOptions(void)
+{
+    Cover png, jpg;
+    if (makePNG(&png, 64, 64, SEED) == 0 || makeBaselineJPG(&jpg, 64, 64, SEED) == 0)
+        return !report("depth outside bmp", 0);
+
+    stego_layout layout;
+    stego_options deep = {2, STEGO_COLORCHANNELS, NULL, 0, NULL, 0, 0};
+    stego_options red = {1, STEGO_RED, NULL, 1, NULL, 0, 0};
+    int passed = stego_plan(png.data, png.size, 10, &deep, &layout) == STEGO_BADOPTIONS
+                 && stego_plan(jpg.data, jpg.size, 10, &deep, &layout) == STEGO_BADOPTIONS
+                 && stego_plan(jpg.data, jpg.size, 10, &red, &layout) == STEGO_BADOPTIONS
+                 && stego_plan(png.data, png.size, 10, &red, &layout) == STEGO_OK;
+    deep.pixels = 1;
+    passed = passed && stego_plan(png.data, png.size, 10, &deep, &layout) == STEGO_OK && layout.depth == 2;
+    free(png.data);
+    free(jpg.data);
+    return !report("depth outside bmp", passed);
+}
+
+
+// this function replaces the records of a container over and over with
+// records of other lengths, which must not make the container grow
+// much past the space the longest of them take, and checks that no two
+// records share a byte and that the table of contents reads back.
+// returns the number of checks that failed.
+static int checkRecordSpace(void)
+{
+    static const char* names[] = {"a", "b", "c"};
+    static const size_t lengths[][3] = {{100, 50, 10}, {300, 50, 10}, {100, 200, 10}, {300, 20, 0}, {40, 200, 10}};
+    BYTE bytes[300] = {0};
+    stego_toc toc;
+    stego_new_toc(&toc);
+
+    int passed = 1;
+    for (int round = 0; round < 50 && passed; round++)
+    {
+        for (int i = 0; i < 3 && passed; i++)
+        {
+            int index;
+            passed = stego_put_record(&toc, names[i], bytes, lengths[round % 5][i], &index) == STEGO_OK;
+        }
+
+        for (int i = 0; i < STEGO_RECORDSLOTS; i++)
+        {
+            for (int j = i + 1; j < STEGO_RECORDSLOTS; j++)
+            {
+                const stego_record* a = &toc.records[i];
+                const stego_record* b = &toc.records[j];
+                if (a->name[0] != '\0' && b->name[0] != '\0' && a->length > 0 && b->length > 0
+                    && a->offset < b->offset + b->length && b->offset < a->offset + a->length)
+                    passed = 0;
+            }
+        }
+    }
+    passed = passed && toc.length <= STEGO_TOCSIZE + 2 * (300 + 200 + 10);
+
+    BYTE tocBytes[STEGO_TOCSIZE];
+    stego_toc parsed;
+    stego_write_toc(&toc, tocBytes);
+    passed = passed && stego_parse_toc(tocBytes, toc.length, &parsed) == STEGO_OK && parsed.length == toc.length;
+    for (int i = 0; passed && i < STEGO_RECORDSLOTS; i++)
+        passed = strcmp(parsed.records[i].name, toc.records[i].name) == 0
+                 && parsed.records[i].offset == toc.records[i].offset
+                 && parsed.records[i].length == toc.records[i].length;
+
+    printf("%-24s %s (%llu bytes)\n", "container replaced", passed ? "ok" : "FAILED",
+           (unsigned long long) toc.length);
+    return !passed;
+}
+
+
+// this function fills length bytes with words picked at random from a
+// few, which compress the way text does.
+static void fillText(BYTE* buffer, size_t length, uint64_t seed)
+{
+    static const char* words[] = {"the ", "pixel ", "of ", "an ", "image ", "hides ", "a ", "message ",
+                                  "in ", "its ", "lowest ", "bits, ", "which ", "nobody ", "sees. ", "and "};
+    fillRandom(buffer, length, seed);
+    for (size_t i = 0; i < length;)
+    {
+        const char* word = words[buffer[i] % 16];
+        for (; *word != '\0' && i < length; word++)
+            buffer[i++] = *word;
+    }
+}
+
+
+// this function compresses length bytes of data with lz4Compress() and
+// decompresses them again.
+// returns 1 if they came back as they were and 0 if they didn't.
+static int lz4RoundTrip(const BYTE* data, size_t length)
+{
+    LZ4Table* table = malloc(sizeof(LZ4Table));
+    BYTE* compressed = malloc(LZ4BOUND(length));
+    BYTE* out = malloc(length + 1);
+    int passed = table != NULL && compressed != NULL && out != NULL;
+    if (passed)
+    {
+        size_t compressedLength = lz4Compress(table, data, length, compressed);
+        passed = compressedLength <= LZ4BOUND(length)
+                 && lz4Decompress(compressed, compressedLength, out, length)
+                 && memcmp(out, data, length) == 0
+                 && !lz4Decompress(compressed, compressedLength, out, length + 1);
+    }
+
+    free(table);
+    free(compressed);
+    free(out);
+    return passed;
+}
+
+
+// this function compresses length bytes of data with stego_compress()
+// and decompresses them again, and checks that every shorter piece of
+// the compressed message is refused. compressedLength is set to the
+// length of the compressed message.
+// returns 1 if the message came back and the pieces were refused and 0
+// if not.
+static int compressRoundTrip(const BYTE* data, size_t length, size_t* compressedLength)
+{
+    size_t capacity = stego_compress_bound(length);
+    BYTE* compressed = malloc(capacity + 1);
+    BYTE* out = malloc(length + 1);
+    size_t outLength = 0;
+    int passed = compressed != NULL && out != NULL
+                 && stego_compress(data, length, compressed, capacity, compressedLength) == STEGO_OK
+                 && stego_decompress(compressed, *compressedLength, out, length + 1, &outLength) == STEGO_OK
+                 && outLength == length && memcmp(out, data, length) == 0;
+
+    // the pieces that end in the framing, in the first block and at the
+    // end, and a byte too many.
+    size_t pieces[] = {0, 4, STEGO_COMPRESSIONSIZE, STEGO_COMPRESSIONSIZE + 3, STEGO_COMPRESSIONSIZE + 40,
+                       *compressedLength / 2, *compressedLength - 1};
+    for (int i = 0; passed && i < (int) (sizeof(pieces) / sizeof(pieces[0])); i++)
+        passed = pieces[i] >= *compressedLength
+                 || stego_decompress(compressed, pieces[i], out, length + 1, &outLength) == STEGO_BADMESSAGE;
+    if (passed)
+    {
+        compressed[*compressedLength] = 0;
+        passed = stego_decompress(compressed, *compressedLength + 1, out, length + 1, &outLength)
+                 == STEGO_BADMESSAGE;
+    }
+
+    free(compressed);
+    free(out);
+    return passed;
+}
+
+
+// this function compresses and decompresses short and long messages
+// of text, noise and runs of one byte, checks a block against the
+// LZ4 block format and that damaged blocks are refused.
+// returns the number of checks that failed.
+static int checkCompression(void)
+{
+    int failed = 0;
+    BYTE* data = malloc(COMPRESSLENGTH);
+    if (data == NULL)
+        return !report("lz4 round trip", 0);
+
+    // every length up to a few sequences, and text, noise and a run of
+    // one byte (matches that overlap themselves and lengths of many
+    // bytes of 255), and text that only repeats further back than a
+    // match can reach.
+    int passed = 1;
+    fillText(data, 100, SEED);
+    for (size_t length = 0; passed && length <= 100; length++)
+        passed = lz4RoundTrip(data, length);
+    fillText(data, 200000, SEED);
+    passed = passed && lz4RoundTrip(data, 200000);
+    fillRandom(data, 200000, SEED);
+    passed = passed && lz4RoundTrip(data, 200000);
+    memset(data, 'a', 200000);
+    passed = passed && lz4RoundTrip(data, 200000);
+    fillText(data, LZ4WINDOWSIZE + 1, SEED);
+    memcpy(data + LZ4WINDOWSIZE + 1, data, LZ4WINDOWSIZE + 1);
+    passed = passed && lz4RoundTrip(data, 2 * (LZ4WINDOWSIZE + 1));
+    failed += !report("lz4 round trip", passed);
+
+    // a block as the LZ4 block format has it: "abc", a match of 9 bytes
+    // 3 back, and the literals "xyzzy".
+    BYTE block[32];
+    BYTE out[32];
+    size_t blockLength = parseHex("3561626303005078797a7a79", block);
+    passed = lz4Decompress(block, blockLength, out, 17) && memcmp(out, "abcabcabcabcxyzzy", 17) == 0;
+    failed += !report("lz4 block format", passed);
+
+    // every shorter piece of the block, a block that asks for more or
+    // fewer bytes, a match of distance 0 or from before the start, and
+    // literals past the end.
+    for (size_t i = 0; passed && i < blockLength; i++)
+        passed = !lz4Decompress(block, i, out, 17);
+    passed = passed && !lz4Decompress(block, blockLength, out, 16) && !lz4Decompress(block, blockLength, out, 18);
+    BYTE damaged[32];
+    memcpy(damaged, block, blockLength);
+    damaged[4] = 0;
+    passed = passed && !lz4Decompress(damaged, blockLength, out, 17);
+    damaged[4] = 4;
+    passed = passed && !lz4Decompress(damaged, blockLength, out, 17);
+    memcpy(damaged, block, blockLength);
+    damaged[6] = 0x90;
+    passed = passed && !lz4Decompress(damaged, blockLength, out, 17) && !lz4Decompress(damaged, blockLength, out, 21);
+    damaged[0] = 0xF5;
+    passed = passed && !lz4Decompress(damaged, blockLength, out, 17);
+    failed += !report("lz4 damaged", passed);
+
+    // messages of more than one block, an empty one and noise, which is
+    // stored as it is in the framing and a length for every block.
+    size_t compressedLength = 0;
+    fillText(data, COMPRESSLENGTH, SEED);
+    passed = compressRoundTrip(data, COMPRESSLENGTH, &compressedLength) && compressedLength < COMPRESSLENGTH / 2
+             && compressRoundTrip(data, 0, &compressedLength) && compressedLength == STEGO_COMPRESSIONSIZE;
+    fillRandom(data, 100000, SEED);
+    passed = passed && compressRoundTrip(data, 100000, &compressedLength)
+             && compressedLength == STEGO_COMPRESSIONSIZE + 4 + 100000;
+    failed += !report("compress round trip", passed);
+
+    // a length that doesn't add up to the blocks, a block that says it
+    // is stored but is compressed, and a damaged block.
+    BYTE compressed[128];
+    BYTE message[64];
+    size_t messageLength;
+    memcpy(message, "abcabcabcabcabcabcabcabcabcabcabcabcabcabc", 42);
+    passed = stego_compress(message, 42, compressed, sizeof(compressed), &compressedLength) == STEGO_OK
+             && compressedLength < STEGO_COMPRESSIONSIZE + 4 + 42;
+    if (passed)
+    {
+        compressed[0]++;
+        passed = stego_decompress(compressed, compressedLength, message, sizeof(message), &messageLength)
+                 == STEGO_BADMESSAGE;
+        compressed[0]--;
+        compressed[STEGO_COMPRESSIONSIZE + 3] |= 0x80;
+        passed = passed
+                 && stego_decompress(compressed, compressedLength, message, sizeof(message), &messageLength)
+                        == STEGO_BADMESSAGE;
+        compressed[STEGO_COMPRESSIONSIZE + 3] &= 0x7f;
+        compressed[compressedLength - 7] ^= 0xff;
+        passed = passed
+                 && stego_decompress(compressed, compressedLength, message, sizeof(message), &messageLength)
+                        == STEGO_BADMESSAGE;
+    }
+    failed += !report("compress damaged", passed);
+
+    free(data);
+    return failed;
+}
+
+
+// this function gives the inflater the next piece of the zlib data.
+static size_t nextPiece(void* context, const BYTE** bytes)
+{
+    ZlibInput* input = context;
+    size_t length = input->length < input->piece ? input->length : input->piece;
+    *bytes = input->data;
+    input->data += length;
+    input->length -= length;
+    return length;
+}
+
+
+// this function decompresses length bytes of zlib data, given to the
+// inflater piece bytes at a time, into out (which has space for
+// capacity bytes), asking for at most 1000 bytes at a time. failed is
+// set if the inflater found the data damaged or cut short.
+// returns the number of bytes decompressed.
+static size_t inflateAll(const BYTE* data, size_t length, size_t piece, BYTE* out, size_t capacity, int* failed)
+{
+    Inflater* inflater = malloc(sizeof(Inflater));
+    if (inflater == NULL)
+    {
+        *failed = 1;
+        return 0;
+    }
+
+    ZlibInput input = {data, length, piece};
+    inflateStart(inflater, nextPiece, &input);
+    size_t produced = 0;
+    while (produced < capacity)
+    {
+        size_t count = capacity - produced < 1000 ? capacity - produced : 1000;
+        size_t read = inflateRead(inflater, out + produced, count);
+        produced += read;
+        if (read < count)
+            break;
+    }
+
+    *failed = inflater->failed;
+    free(inflater);
+    return produced;
+}
+
+
+// this function stores a message in a cover with the options. image is
+// allocated (the caller frees it) and size set to its size.
+// returns the result of stego_plan() or stego_embed().
+static int embedMessage(const Cover* cover, const BYTE* message, size_t length, const stego_options* options,
+                        BYTE** image, size_t* size)
+{
+    *image = NULL;
+    stego_layout layout;
+    int result = stego_plan(cover->data, cover->size, length, options, &layout);
+    if (result != STEGO_OK)
+        return result;
+
+    // the size of a png or jpg with the message in its pixels is only
+    // known once it is made (it is given with STEGO_SMALLBUFFER).
+    *size = layout.outputSize;
+    if (layout.flags & STEGO_PIXELS)
+        result = stego_embed(cover->data, cover->size, message, length, options, NULL, 0, size);
+    if (result != STEGO_OK && result != STEGO_SMALLBUFFER)
+        return result;
+
+    *image = malloc(*size);
+    if (*image == NULL)
+        return STEGO_NOMEMORY;
+    result = stego_embed(cover->data, cover->size, message, length, options, *image, *size, size);
+    if (result != STEGO_OK)
+    {
+        free(*image);
+        *image = NULL;
+    }
+    return result;
+}
+
+
+// returns 1 if the image holds the message and 0 if it doesn't (or it
+// can't be read).
+static int readsBack(const BYTE* image, size_t size, const BYTE* message, size_t length)
+{
+    BYTE* out = malloc(length + 1);
+    size_t outLength = 0;
+    int passed = out != NULL && stego_extract(image, size, out, length + 1, &outLength) == STEGO_OK
+                 && outLength == length && memcmp(out, message, length) == 0;
+    free(out);
+    return passed;
+}
+
+
+// this function decompresses zlib data of known answers, compresses
+// data with the deflate compressor of the png path in pieces and reads
+// it back, and checks that damaged or cut short data is refused.
+// returns the number of checks that failed.
+static int checkInflate(void)
+{
+    int failed = 0;
+    int damaged;
+
+    // "hello" compressed by zlib (a block of the fixed codes) and stored,
+    // and text compressed with a block of its own codes.
+    BYTE fixed[32];
+    BYTE stored[32];
+    BYTE dynamic[128];
+    BYTE out[512];
+    size_t fixedLength = parseHex("789ccb48cdc9c90700062c0215", fixed);
+    size_t storedLength = parseHex("7801010500faff68656c6c6f062c0215", stored);
+    size_t dynamicLength = parseHex(
+        "78dacd8dd10d83300c4457b9012a760ae45247c231c2ae42b7af618afeddd393de851047bfb8c31aca40d7f226a4573a0a94"
+        "ee37f714e1d86dd2036bee17a6f44d306cb5fa8593be20fe365646bd83036e4aa89d44f08ac4e7473ead697e6cf6d4d34e3b"
+        "4332bdfc0047566710",
+        dynamic);
+    const char* text = "the pixel of an image hides a message in its lowest bits, which nobody sees. ";
+    char expected[512];
+    snprintf(expected, sizeof(expected), "%s%s%sand then some more text so the huffman codes are worth it.", text,
+             text, text);
+    size_t expectedLength = strlen(expected);
+
+    int passed = inflateAll(fixed, fixedLength, 1, out, sizeof(out), &damaged) == 5 && !damaged
+                 && memcmp(out, "hello", 5) == 0
+                 && inflateAll(stored, storedLength, 3, out, sizeof(out), &damaged) == 5 && !damaged
+                 && memcmp(out, "hello", 5) == 0
+                 && inflateAll(dynamic, dynamicLength, 7, out, sizeof(out), &damaged) == expectedLength
+                 && !damaged && memcmp(out, expected, expectedLength) == 0;
+    failed += !report("inflate zlib", passed);
+
+    // every piece cut short before the adler32 (which isn't read), a
+    // header that isn't deflate or isn't a multiple of 31, a block of
+    // type 3, a stored length that doesn't match its complement and a
+    // match from before the start.
+    for (size_t i = 0; passed && i < fixedLength - 4; i++)
+        passed = inflateAll(fixed, i, 1, out, sizeof(out), &damaged) <= 5 && damaged;
+    for (size_t i = 0; passed && i < dynamicLength - 4; i++)
+        passed = inflateAll(dynamic, i, 5, out, sizeof(out), &damaged) <= expectedLength && damaged;
+    BYTE bad[32];
+    memcpy(bad, fixed, fixedLength);
+    bad[0] = 0x79;
+    passed = passed && inflateAll(bad, fixedLength, 1, out, sizeof(out), &damaged) == 0 && damaged;
+    bad[0] = 0x78;
+    bad[1] = 0x9d;
+    passed = passed && inflateAll(bad, fixedLength, 1, out, sizeof(out), &damaged) == 0 && damaged;
+    bad[1] = 0x9c;
+    bad[2] = 0xcf;
+    passed = passed && inflateAll(bad, fixedLength, 1, out, sizeof(out), &damaged) == 0 && damaged;
+    memcpy(bad, stored, storedLength);
+    bad[5] = 0xfb;
+    passed = passed && inflateAll(bad, storedLength, 1, out, sizeof(out), &damaged) == 0 && damaged;
+    failed += !report("inflate damaged", passed);
+
+    // text compressed in pieces that reach back into the ones before
+    // them, and read back in small and big pieces. only the first piece
+    // is a stream on its own: the others must fail without theirs.
+    BYTE* data = malloc(DEFLATELENGTH);
+    DeflateWork* work = malloc(sizeof(DeflateWork));
+    BYTE* compressed = malloc(2 + 4 * DEFLATEBOUND(DEFLATEPIECE) + 6);
+    BYTE* back = malloc(DEFLATELENGTH + 1);
+    passed = data != NULL && work != NULL && compressed != NULL && back != NULL;
+    if (passed)
+    {
+        fillText(data, DEFLATELENGTH, SEED);
+        size_t length = parseHex("7801", compressed);
+        size_t second = 0;
+        uint32_t adler = 1;
+        for (size_t offset = 0; offset < DEFLATELENGTH; offset += DEFLATEPIECE)
+        {
+            size_t piece = DEFLATELENGTH - offset < DEFLATEPIECE ? DEFLATELENGTH - offset : DEFLATEPIECE;
+            if (offset == DEFLATEPIECE)
+                second = length;
+            length += deflateBlock(work, data + offset, piece, offset, compressed + length);
+            adler = adler32Combine(adler, adler32(1, data + offset, piece), piece);
+        }
+        length += deflateFinish(compressed + length);
+        for (int i = 0; i < 4; i++)
+            compressed[length++] = adler >> (8 * (3 - i));
+
+        passed = adler == adler32(1, data, DEFLATELENGTH) && length < DEFLATELENGTH / 2
+                 && inflateAll(compressed, length, 1, back, DEFLATELENGTH + 1, &damaged) == DEFLATELENGTH
+                 && !damaged && memcmp(back, data, DEFLATELENGTH) == 0
+                 && inflateAll(compressed, length, 40000, back, DEFLATELENGTH + 1, &damaged) == DEFLATELENGTH
+                 && !damaged && memcmp(back, data, DEFLATELENGTH) == 0
+                 && inflateAll(compressed, length / 2, 4096, back, DEFLATELENGTH + 1, &damaged) < DEFLATELENGTH
+                 && damaged;
+
+        memcpy(compressed + second - 2, "\x78\x01", 2);
+        passed = passed && inflateAll(compressed + second - 2, length - second + 2, 4096, back, DEFLATELENGTH + 1,
+                                      &damaged) < DEFLATELENGTH - DEFLATEPIECE
+                 && damaged;
+    }
+    failed += !report("deflate round trip", passed);
+
+    free(data);
+    free(work);
+    free(compressed);
+    free(back);
+    return failed;
+}
+
+
+// this function stores messages in the pixels of a png, close to as
+// many bytes as they can hold, reads them back, stores another one in
+// the png that was made, and checks that an image that was cut short
+// or has a damaged IDAT chunk doesn't give the message.
+// returns the number of checks that failed.
+static int checkPNGPixels(void)
+{
+    int failed = 0;
+    Cover cover;
+    if (makePNG(&cover, 256, 256, SEED) == 0)
+        return !report("png pixels", 0);
+
+    stego_options options = {1, STEGO_COLORCHANNELS, NULL, 1, NULL, 0, 0};
+    stego_options deep = {2, STEGO_COLORCHANNELS, NULL, 1, NULL, 0, 0};
+    size_t length = stego_capacity(cover.data, cover.size, cover.size, &options) - 16;
+    size_t deepLength = stego_capacity(cover.data, cover.size, cover.size, &deep) - 16;
+    BYTE* message = malloc(deepLength);
+    BYTE* image = NULL;
+    BYTE* again = NULL;
+    size_t size = 0, againSize = 0;
+    int passed = message != NULL;
+    if (passed)
+    {
+        fillText(message, deepLength, SEED);
+        passed = embedMessage(&cover, message, length, &options, &image, &size) == STEGO_OK
+                 && readsBack(image, size, message, length);
+        Cover made = {"", image, size};
+        passed = passed && embedMessage(&made, message + 1, deepLength - 1, &deep, &again, &againSize) == STEGO_OK
+                 && readsBack(again, againSize, message + 1, deepLength - 1);
+    }
+    failed += !report("png pixels", passed);
+
+    // the message takes all but the last rows, so that cutting off the
+    // last quarter of the image loses some of it.
+    if (passed)
+    {
+        BYTE* out = malloc(length);
+        size_t outLength;
+        passed = out != NULL && stego_extract(image, size / 2, out, length, &outLength) != STEGO_OK
+                 && stego_extract(image, size * 3 / 4, out, length, &outLength) != STEGO_OK;
+
+        // a bit of a pixel in the last rows (which only the CRC of its
+        // chunk can tell), then one in the chunk that has the header.
+        image[size * 3 / 4] ^= 1;
+        passed = passed && stego_extract(image, size, out, length, &outLength) != STEGO_OK;
+        image[size * 3 / 4] ^= 1;
+        image[size / 8] ^= 1;
+        passed = passed && !readsBack(image, size, message, length);
+        free(out);
+    }
+    failed += !report("png pixels damaged", passed);
+
+    free(cover.data);
+    free(message);
+    free(image);
+    free(again);
+    return failed;
+}
+
+
+// returns the position of the first segment of a jpg with the marker
+// (the 0xFF in front of it), or 0 if there is none.
+static size_t findSegment(const BYTE* image, size_t size, BYTE marker)
+{
+    for (size_t i = 2; i + 3 < size; i++)
+    {
+        if (image[i] == 0xFF && image[i + 1] == marker)
+            return i;
+    }
+
+    return 0;
+}
+
+
+// returns the position of the scan of a jpg (right after the segment
+// that starts it), or 0 if there is none.
+static size_t findScan(const BYTE* image, size_t size)
+{
+    size_t segment = findSegment(image, size, 0xDA);
+    return segment > 0 ? segment + 2 + (image[segment + 2] << 8 | image[segment + 3]) : 0;
+}
+
+
+// this function stores messages in the coefficients of a jpg, close to
+// as many bytes as they can hold, reads them back and stores another
+// one in the jpg that was made. a scan that was cut short or has a
+// code that isn't in its huffman table and a huffman table with the
+// wrong number of codes must be refused.
+// returns the number of checks that failed.
+static int checkJPGCoefficients(void)
+{
+    int failed = 0;
+    Cover cover;
+    if (makeBaselineJPG(&cover, 256, 256, SEED) == 0)
+        return !report("jpg coefficients", 0);
+
+    stego_options options = {1, STEGO_COLORCHANNELS, NULL, 1, NULL, 0, 0};
+    size_t length = stego_capacity(cover.data, cover.size, cover.size, &options) - 4;
+    BYTE* message = malloc(length);
+    BYTE* image = NULL;
+    BYTE* again = NULL;
+    size_t size = 0, againSize = 0;
+    int passed = message != NULL && length > 1000;
+    if (passed)
+    {
+        fillText(message, length, SEED);
+        passed = embedMessage(&cover, message, length, &options, &image, &size) == STEGO_OK
+                 && readsBack(image, size, message, length);
+        Cover made = {"", image, size};
+        passed = passed && embedMessage(&made, message + 1, length - 1, &options, &again, &againSize) == STEGO_OK
+                 && readsBack(again, againSize, message + 1, length - 1);
+    }
+    failed += !report("jpg coefficients", passed);
+
+    // the image cut short, and cut short with the end of image marker
+    // after the part of the scan that is left.
+    BYTE* damaged = NULL;
+    BYTE* refused = NULL;
+    size_t refusedSize;
+    if (passed)
+    {
+        damaged = malloc(size > cover.size ? size : cover.size);
+        size_t scan = findScan(image, size);
+        size_t coverScan = findScan(cover.data, cover.size);
+        size_t cut = size * 3 / 4;
+        passed = damaged != NULL && scan > 0 && coverScan > 0 && cut > scan
+                 && !readsBack(image, size / 2, message, length);
+        if (passed)
+        {
+            memcpy(damaged, image, cut);
+            damaged[cut] = 0xFF;
+            damaged[cut + 1] = 0xD9;
+            passed = !readsBack(damaged, cut + 2, message, length);
+
+            // a first code (of the dc table) that isn't in the table.
+            memcpy(damaged, image, size);
+            damaged[scan] = 0xE0;
+            passed = passed && !readsBack(damaged, size, message, length);
+            Cover broken = {"", damaged, cover.size};
+            memcpy(damaged, cover.data, cover.size);
+            damaged[coverScan] = 0xE0;
+            passed = passed
+                     && embedMessage(&broken, message, 10, &options, &refused, &refusedSize) == STEGO_BADIMAGE;
+        }
+    }
+
+    // a dc table that says it has more codes than the segment holds,
+    // and one that has 3 codes of 1 bit.
+    if (passed)
+    {
+        Cover broken = {"", damaged, cover.size};
+        size_t table = findSegment(cover.data, cover.size, 0xC4);
+        memcpy(damaged, cover.data, cover.size);
+        damaged[table + 8] = 13;
+        passed = table > 0 && embedMessage(&broken, message, 10, &options, &refused, &refusedSize) == STEGO_BADIMAGE;
+        damaged[table + 5] = 3;
+        damaged[table + 8] = 9;
+        passed = passed && embedMessage(&broken, message, 10, &options, &refused, &refusedSize) == STEGO_BADIMAGE;
+    }
+    failed += !report("jpg coefficients damaged", passed);
+
+    free(cover.data);
+    free(message);
+    free(image);
+    free(again);
+    free(damaged);
+    free(refused);
+    return failed;
+}
+
+
+// this function rewrites bytes of the message stored in the image the
+// way the updates say (see stego_plan_update()), like writemessage
+// --record does: the patches and then the header, all worked out from
+// the image as it was. out is allocated (the caller frees it) and
+// outSize set to its size.
+// returns 1 if it could and 0 if it couldn't.
+static int applyUpdates(const BYTE* image, size_t size, const stego_update* updates, const BYTE* const* bytes,
+                        int count, BYTE** out, size_t* outSize)
+{
+    *outSize = updates[0].outputSize;
+    *out = malloc(size > *outSize ? size : *outSize);
+    BYTE* header = malloc(updates[0].headerLength);
+    int applied = *out != NULL && header != NULL;
+    if (applied)
+        memcpy(*out, image, size);
+
+    for (int i = 0; i < count && applied; i++)
+    {
+        BYTE* patch = malloc(updates[i].patchLength > 0 ? updates[i].patchLength : 1);
+        applied = patch != NULL
+                  && stego_embed_update(image, size, &updates[i], bytes[i], header, patch) == STEGO_OK;
+        if (applied)
+            memcpy(*out + updates[i].patchOffset, patch, updates[i].patchLength);
+        free(patch);
+    }
+    if (applied)
+        memcpy(*out + updates[0].headerOffset, header, updates[0].headerLength);
+
+    free(header);
+    return applied;
+}
+
+
+// this function stores a record (and the table of contents that says
+// where it is) in the container of the image, without storing the
+// rest of the container again. out is allocated (the caller frees it)
+// and outSize set to its size.
+// returns 1 if it could and 0 if it couldn't.
+static int updateRecord(const BYTE* image, size_t size, stego_toc* toc, const char* name, const BYTE* bytes,
+                        size_t length, BYTE** out, size_t* outSize)
+{
+    int index;
+    BYTE tocBytes[STEGO_TOCSIZE];
+    stego_update updates[2];
+    const BYTE* updateBytes[2] = {bytes, tocBytes};
+    *out = NULL;
+    if (stego_put_record(toc, name, bytes, length, &index) != STEGO_OK)
+        return 0;
+
+    stego_write_toc(toc, tocBytes);
+    return stego_plan_update(image, size, toc->length, toc->records[index].offset, length, &updates[0]) == STEGO_OK
+           && stego_plan_update(image, size, toc->length, 0, STEGO_TOCSIZE, &updates[1]) == STEGO_OK
+           && applyUpdates(image, size, updates, updateBytes, 2, out, outSize);
+}
+
+
+// returns 1 if the container in the image has the record with the
+// name and it reads back as the length bytes (at most 300) given, and
+// 0 if it doesn't.
+static int hasRecord(const BYTE* image, size_t size, const char* name, const BYTE* bytes, size_t length)
+{
+    stego_toc toc;
+    BYTE record[300];
+    if (stego_read_toc(image, size, &toc) != STEGO_OK)
+        return 0;
+
+    int index = stego_find_record(&toc, name);
+    return index >= 0 && toc.records[index].length == length
+           && stego_extract_record(image, size, &toc, index, record) == STEGO_OK
+           && memcmp(record, bytes, length) == 0;
+}
+
+
+// this function stores a container of records in a bmp, reads them
+// back, replaces one and adds one (rewriting only their bytes and the
+// table of contents), and checks that a damaged table of contents, a
+// record that is not in the container and a damaged record are
+// refused.
+// returns the number of checks that failed.
+static int checkContainer(void)
+{
+    int failed = 0;
+    Cover cover;
+    if (makeBMP(&cover, 64, 64, 24, SEED) == 0)
+        return !report("container", 0);
+
+    BYTE records[3][300];
+    for (int i = 0; i < 3; i++)
+        fillText(records[i], 300, SEED + i);
+
+    stego_toc toc;
+    stego_new_toc(&toc);
+    int a, b;
+    stego_put_record(&toc, "a", records[0], 300, &a);
+    stego_put_record(&toc, "b", records[1], 200, &b);
+    BYTE* container = calloc(toc.length, 1);
+    BYTE* image = NULL;
+    BYTE* replaced = NULL;
+    BYTE* added = NULL;
+    BYTE* damaged = NULL;
+    size_t size, replacedSize, addedSize, damagedSize;
+    stego_options options = {1, STEGO_COLORCHANNELS, NULL, 0, NULL, 0, 1};
+    int passed = container != NULL;
+    if (passed)
+    {
+        stego_write_toc(&toc, container);
+        memcpy(container + toc.records[a].offset, records[0], 300);
+        memcpy(container + toc.records[b].offset, records[1], 200);
+        passed = embedMessage(&cover, container, toc.length, &options, &image, &size) == STEGO_OK
+                 && hasRecord(image, size, "a", records[0], 300) && hasRecord(image, size, "b", records[1], 200)
+                 && !hasRecord(image, size, "c", records[2], 0);
+    }
+    failed += !report("container", passed);
+
+    // "a" gets shorter and "c" goes after "b", which makes the container
+    // longer.
+    passed = passed && updateRecord(image, size, &toc, "a", records[2], 100, &replaced, &replacedSize)
+             && hasRecord(replaced, replacedSize, "a", records[2], 100)
+             && hasRecord(replaced, replacedSize, "b", records[1], 200)
+             && updateRecord(replaced, replacedSize, &toc, "c", records[0] + 10, 250, &added, &addedSize)
+             && hasRecord(added, addedSize, "a", records[2], 100) && hasRecord(added, addedSize, "b", records[1], 200)
+             && hasRecord(added, addedSize, "c", records[0] + 10, 250);
+    failed += !report("container update", passed);
+
+    // a byte of a name (the checksum doesn't match), a container that is
+    // shorter than the table says, and records that don't end in it.
+    BYTE tocBytes[STEGO_TOCSIZE];
+    stego_toc parsed;
+    if (passed)
+    {
+        stego_write_toc(&toc, tocBytes);
+        passed = stego_parse_toc(tocBytes, toc.length, &parsed) == STEGO_OK
+                 && stego_parse_toc(tocBytes, toc.length - 1, &parsed) == STEGO_BADMESSAGE;
+        tocBytes[16] ^= 1;
+        passed = passed && stego_parse_toc(tocBytes, toc.length, &parsed) == STEGO_BADMESSAGE;
+
+        stego_toc outside = toc;
+        outside.records[b].offset = toc.length - 10;
+        stego_write_toc(&outside, tocBytes);
+        passed = passed && stego_parse_toc(tocBytes, toc.length, &parsed) == STEGO_BADMESSAGE;
+        outside.records[b].offset = toc.length + 1;
+        outside.records[b].length = 0;
+        stego_write_toc(&outside, tocBytes);
+        passed = passed && stego_parse_toc(tocBytes, toc.length, &parsed) == STEGO_BADMESSAGE;
+    }
+
+    // the same damaged table of contents in the image, and a record
+    // whose bytes changed without it.
+    stego_update update;
+    if (passed)
+    {
+        stego_write_toc(&toc, tocBytes);
+        tocBytes[16] ^= 1;
+        const BYTE* bytes = tocBytes;
+        passed = stego_plan_update(added, addedSize, toc.length, 0, STEGO_TOCSIZE, &update) == STEGO_OK
+                 && applyUpdates(added, addedSize, &update, &bytes, 1, &damaged, &damagedSize)
+                 && stego_read_toc(damaged, damagedSize, &parsed) == STEGO_BADMESSAGE;
+        free(damaged);
+        damaged = NULL;
+
+        BYTE record[300];
+        memcpy(record, records[1], 200);
+        record[123] ^= 1;
+        bytes = record;
+        passed = passed
+                 && stego_plan_update(added, addedSize, toc.length, toc.records[b].offset, 200, &update) == STEGO_OK
+                 && applyUpdates(added, addedSize, &update, &bytes, 1, &damaged, &damagedSize)
+                 && stego_read_toc(damaged, damagedSize, &parsed) == STEGO_OK
+                 && stego_extract_record(damaged, damagedSize, &parsed, b, record) == STEGO_BADMESSAGE
+                 && hasRecord(damaged, damagedSize, "a", records[2], 100);
+    }
+    failed += !report("container damaged", passed);
+
+    free(cover.data);
+    free(container);
+    free(image);
+    free(replaced);
+    free(added);
+    free(damaged);
+    return failed;
+}
+
+
+int main(void)
+{
+    int failed = 0;
+    printf("kernel: %s\n", chachaKernelName());
+
+    // RFC 8439 2.4.2: the "sunscreen" message.
+    BYTE key[CHACHAKEYSIZE];
+    BYTE nonce[CHACHANONCESIZE];
+    parseHex("000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f", key);
+    parseHex("000000000000004a00000000", nonce);
+    BYTE text[] = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, "
+                  "sunscreen would be it.";
+    size_t textLength = sizeof(text) - 1;
+    chacha20Xor(key, nonce, 1, text, textLength);
+    failed += !check("chacha20 rfc8439 2.4.2", text, textLength,
+                     "6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0bf91b65c5524733ab8f593dabcd62b357"
+                     "1639d624e65152ab8f530c359f0861d807ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab77937365a"
+                     "f90bbf74a35be6b40b8eedf2785e42874d");
+
+    // 1000 bytes (15 blocks and a part of one) at once, and the same in
+    // two calls that meet at a block.
+    BYTE message[LONGLENGTH];
+    BYTE digest[SHA256SIZE];
+    for (int i = 0; i < LONGLENGTH; i++)
+        message[i] = i;
+    chacha20Xor(key, nonce, 1, message, LONGLENGTH);
+    hashInPieces(message, LONGLENGTH, LONGLENGTH, digest);
+    failed += !check("chacha20 1000 bytes", digest, SHA256SIZE,
+                     "adb5b13ccb493743d6391b747aa0999ccedee46af076a89674397e73333b7f45");
+
+    for (int i = 0; i < LONGLENGTH; i++)
+        message[i] = i;
+    chacha20Xor(key, nonce, 1, message, 5 * CHACHABLOCKSIZE);
+    chacha20Xor(key, nonce, 6, message + 5 * CHACHABLOCKSIZE, LONGLENGTH - 5 * CHACHABLOCKSIZE);
+    hashInPieces(message, LONGLENGTH, LONGLENGTH, digest);
+    failed += !check("chacha20 in two calls", digest, SHA256SIZE,
+                     "adb5b13ccb493743d6391b747aa0999ccedee46af076a89674397e73333b7f45");
+
+    // RFC 8439 2.5.2, given all at once and in pieces.
+    BYTE polyKey[32];
+    BYTE tag[POLY1305TAGSIZE];
+    parseHex("85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b", polyKey);
+    const BYTE* forum = (const BYTE*) "Cryptographic Forum Research Group";
+    size_t forumLength = strlen((const char*) forum);
+    const char* polyTag = "a8061dc1305136c6c22b8baf0c0127a9";
+
+    Poly1305 poly;
+    poly1305Start(&poly, polyKey);
+    poly1305Add(&poly, forum, forumLength);
+    poly1305Finish(&poly, tag);
+    failed += !check("poly1305 rfc8439 2.5.2", tag, POLY1305TAGSIZE, polyTag);
+
+    poly1305Start(&poly, polyKey);
+    poly1305Add(&poly, forum, 1);
+    poly1305Add(&poly, forum + 1, 20);
+    poly1305Add(&poly, forum + 21, forumLength - 21);
+    poly1305Finish(&poly, tag);
+    failed += !check("poly1305 in pieces", tag, POLY1305TAGSIZE, polyTag);
+
+    // FIPS 180-2: "abc", the empty message, the 448-bit message and a
+    // million a's (given 1000 at a time).
+    hashInPieces((const BYTE*) "abc", 3, 3, digest);
+    failed += !check("sha256 abc", digest, SHA256SIZE,
+                     "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    hashInPieces(NULL, 0, 1, digest);
+    failed += !check("sha256 empty", digest, SHA256SIZE,
+                     "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    const char* twoBlocks = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    hashInPieces((const BYTE*) twoBlocks, strlen(twoBlocks), 7, digest);
+    failed += !check("sha256 448 bits", digest, SHA256SIZE,
+                     "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+    SHA256 hash;
+    memset(message, 'a', LONGLENGTH);
+    sha256Start(&hash);
+    for (int i = 0; i < 1000; i++)
+        sha256Add(&hash, message, LONGLENGTH);
+    sha256Finish(&hash, digest);
+    failed += !check("sha256 million a", digest, SHA256SIZE,
+                     "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+
+    // PBKDF2 with SHA-256: RFC 7914 11.1 (two blocks of key) and
+    // "password", "salt" and 4096 iterations.
+    BYTE derived[64];
+    pbkdf2SHA256((const BYTE*) "passwd", 6, (const BYTE*) "salt", 4, 1, derived, 64);
+    failed += !check("pbkdf2 rfc7914 11.1", derived, 64,
+                     "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc49ca9cccf179b645991664b39d77ef317c71"
+                     "b845b1e30bd509112041d3a19783");
+    pbkdf2SHA256((const BYTE*) "password", 8, (const BYTE*) "salt", 4, 4096, derived, 32);
+    failed += !check("pbkdf2 sha256 4096", derived, 32,
+                     "c5e478d59288c841aa530db6845c4c8d962893a001ce4e11a4963873aa98134a");
+
+    failed += checkPasskeys();
+    failed += checkOldMessages();
+    failed += checkOptions();
+    failed += checkRecordSpace();
+    failed += checkCompression();
+    failed += checkInflate();
+    failed += checkPNGPixels();
+    failed += checkJPGCoefficients();
+    failed += checkContainer();
+    return failed;
+}
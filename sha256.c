@@ -0,0 +1,221 @@
+// this file has SHA-256 (FIPS 180-4) and PBKDF2 with HMAC-SHA-256
+// (RFC 8018), which turns a passkey into an encryption key.
+//
+// PBKDF2 runs HMAC thousands of times on tiny inputs, so the inner and
+// outer HMAC states are worked out once and copied for every round
+// instead of hashing the padded passkey again every time.
+
+#include <string.h>
+
+#include "helpers.h"
+#include "sha256.h"
+
+
+static const uint32_t roundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+
+static uint32_t rotateRight(uint32_t value, int count)
+{
+    return value >> count | value << (32 - count);
+}
+
+
+// this function mixes one 64 byte block into the state.
+static void compressBlock(uint32_t* state, const BYTE* block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t) block[4 * i] << 24 | block[4 * i + 1] << 16 | block[4 * i + 2] << 8 | block[4 * i + 3];
+
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ w[i - 15] >> 3;
+        uint32_t s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ w[i - 2] >> 10;
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t s1 = rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25);
+        uint32_t choice = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + choice + roundConstants[i] + w[i];
+        uint32_t s0 = rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22);
+        uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + majority;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+
+// this function starts a new hash.
+void sha256Start(SHA256* hash)
+{
+    static const uint32_t initialState[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                             0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(hash->state, initialState, sizeof(initialState));
+    hash->length = 0;
+    hash->blockLength = 0;
+}
+
+
+// this function adds length bytes of data to the hash.
+void sha256Add(SHA256* hash, const BYTE* data, size_t length)
+{
+    hash->length += length;
+
+    // fill up a block that was started before.
+    if (hash->blockLength > 0)
+    {
+        size_t count = SHA256BLOCKSIZE - hash->blockLength;
+        if (count > length)
+            count = length;
+
+        memcpy(hash->block + hash->blockLength, data, count);
+        hash->blockLength += count;
+        data += count;
+        length -= count;
+
+        if (hash->blockLength < SHA256BLOCKSIZE)
+            return;
+
+        compressBlock(hash->state, hash->block);
+        hash->blockLength = 0;
+    }
+
+    // whole blocks are hashed straight from the data.
+    for (; length >= SHA256BLOCKSIZE; data += SHA256BLOCKSIZE, length -= SHA256BLOCKSIZE)
+        compressBlock(hash->state, data);
+
+    memcpy(hash->block, data, length);
+    hash->blockLength = length;
+}
+
+
+// this function pads the data, finishes the hash and stores the 32
+// byte result in digest.
+void sha256Finish(SHA256* hash, BYTE* digest)
+{
+    uint64_t bitLength = hash->length * BYTESIZE;
+
+    // a 1 bit, zeros up to 8 bytes before the end of a block and the
+    // length in bits.
+    hash->block[hash->blockLength++] = 0x80;
+    if (hash->blockLength > SHA256BLOCKSIZE - 8)
+    {
+        memset(hash->block + hash->blockLength, 0, SHA256BLOCKSIZE - hash->blockLength);
+        compressBlock(hash->state, hash->block);
+        hash->blockLength = 0;
+    }
+
+    memset(hash->block + hash->blockLength, 0, SHA256BLOCKSIZE - 8 - hash->blockLength);
+    for (int i = 0; i < 8; i++)
+        hash->block[SHA256BLOCKSIZE - 1 - i] = bitLength >> (8 * i);
+    compressBlock(hash->state, hash->block);
+
+    for (int i = 0; i < 8; i++)
+    {
+        digest[4 * i] = hash->state[i] >> 24;
+        digest[4 * i + 1] = hash->state[i] >> 16;
+        digest[4 * i + 2] = hash->state[i] >> 8;
+        digest[4 * i + 3] = hash->state[i];
+    }
+}
+
+
+// this function works out PBKDF2 with HMAC-SHA-256: keyLength bytes
+// of key from the password and salt, hashing iterations times.
+void pbkdf2SHA256(const BYTE* password, size_t passwordLength, const BYTE* salt, size_t saltLength,
+                  uint32_t iterations, BYTE* key, size_t keyLength)
+{
+    // a password longer than a block is hashed first (as HMAC does).
+    BYTE hashedPassword[SHA256SIZE];
+    if (passwordLength > SHA256BLOCKSIZE)
+    {
+        SHA256 hash;
+        sha256Start(&hash);
+        sha256Add(&hash, password, passwordLength);
+        sha256Finish(&hash, hashedPassword);
+        password = hashedPassword;
+        passwordLength = SHA256SIZE;
+    }
+
+    // the states after hashing the inner and outer padded password,
+    // which every HMAC below starts from.
+    BYTE innerPad[SHA256BLOCKSIZE], outerPad[SHA256BLOCKSIZE];
+    memset(innerPad, 0x36, SHA256BLOCKSIZE);
+    memset(outerPad, 0x5c, SHA256BLOCKSIZE);
+    for (size_t i = 0; i < passwordLength; i++)
+    {
+        innerPad[i] ^= password[i];
+        outerPad[i] ^= password[i];
+    }
+
+    SHA256 inner, outer;
+    sha256Start(&inner);
+    sha256Add(&inner, innerPad, SHA256BLOCKSIZE);
+    sha256Start(&outer);
+    sha256Add(&outer, outerPad, SHA256BLOCKSIZE);
+
+    for (uint32_t blockNumber = 1; keyLength > 0; blockNumber++)
+    {
+        // U1 = HMAC(password, salt || blockNumber)
+        BYTE counter[4] = {blockNumber >> 24, blockNumber >> 16, blockNumber >> 8, blockNumber};
+        BYTE u[SHA256SIZE], result[SHA256SIZE];
+
+        SHA256 hash = inner;
+        sha256Add(&hash, salt, saltLength);
+        sha256Add(&hash, counter, sizeof(counter));
+        sha256Finish(&hash, u);
+        hash = outer;
+        sha256Add(&hash, u, SHA256SIZE);
+        sha256Finish(&hash, u);
+        memcpy(result, u, SHA256SIZE);
+
+        // Un = HMAC(password, Un-1), all of them xored together.
+        for (uint32_t i = 1; i < iterations; i++)
+        {
+            hash = inner;
+            sha256Add(&hash, u, SHA256SIZE);
+            sha256Finish(&hash, u);
+            hash = outer;
+            sha256Add(&hash, u, SHA256SIZE);
+            sha256Finish(&hash, u);
+
+            for (int j = 0; j < SHA256SIZE; j++)
+                result[j] ^= u[j];
+        }
+
+        size_t count = keyLength < SHA256SIZE ? keyLength : SHA256SIZE;
+        memcpy(key, result, count);
+        key += count;
+        keyLength -= count;
+    }
+}
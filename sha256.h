@@ -0,0 +1,34 @@
+// header file for SHA-256 and the key derivation built on it
+
+#ifndef SHA256_H_
+#define SHA256_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "helpers.h"
+
+// sizes of a SHA-256 hash and of the blocks it works on.
+#define SHA256SIZE 32
+#define SHA256BLOCKSIZE 64
+
+// the state of a hash that is being worked out, so that the data can
+// be given in pieces.
+typedef struct
+{
+    uint32_t state[8];
+    uint64_t length;
+    BYTE block[SHA256BLOCKSIZE];
+    size_t blockLength;
+} SHA256;
+
+
+// function declarations
+void sha256Start(SHA256* hash);
+void sha256Add(SHA256* hash, const BYTE* data, size_t length);
+void sha256Finish(SHA256* hash, BYTE* digest);
+
+void pbkdf2SHA256(const BYTE* password, size_t passwordLength, const BYTE* salt, size_t saltLength,
+                  uint32_t iterations, BYTE* key, size_t keyLength);
+
+#endif
@@ -0,0 +1,84 @@
+// this file is the sharding stage of libstego: it works out how a
+// message is split across several images (see stego_split() and
+// stego_checksum() in stego.h).
+//
+// every image gets a part of the message in proportion to how much it
+// can hold, so no image is filled up while another one is nearly empty
+// and the shards take about the same time to embed and extract. a
+// shard is a piece of the message as it is stored (after it is
+// encrypted), with its own header that says which piece it is (see
+// STEGO_SHARDED in stego.h). the pieces are in the order of the shards,
+// so the message is the shards put back together by their numbers.
+
+#include "cipher.h"
+#include "helpers.h"
+#include "pngchunks.h"
+#include "stego.h"
+
+
+// this function splits a message of messageLength bytes into count
+// shards for images that can hold capacities[i] bytes each (what
+// stego_capacity() returns with a stego_shard in the options, so the
+// header of the shard is left out already). fills in shardLengths (count
+// lengths that add up to messageLength) and a new random id of
+// STEGO_SHARDIDSIZE bytes for the message.
+// returns STEGO_OK, STEGO_BADOPTIONS (no images), STEGO_NOSPACE (the
+// message doesn't fit in all the images together) or STEGO_NORANDOM.
+int stego_split(const size_t* capacities, uint32_t count, size_t messageLength, size_t* shardLengths,
+                uint8_t* id)
+{
+    if (count == 0)
+        return STEGO_BADOPTIONS;
+
+    // the images together must hold the whole message
+    size_t left = messageLength;
+    for (uint32_t i = 0; i < count && left > 0; i++)
+        left -= capacities[i] < left ? capacities[i] : left;
+    if (left > 0)
+        return STEGO_NOSPACE;
+
+    // every image gets its part of the message rounded down (never more
+    // than it holds)
+    double weights = 0;
+    for (uint32_t i = 0; i < count; i++)
+        weights += capacities[i] < messageLength ? capacities[i] : messageLength;
+
+    size_t assigned = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        size_t capacity = capacities[i] < messageLength ? capacities[i] : messageLength;
+        size_t length = weights > 0 ? (size_t) ((double) messageLength * capacity / weights) : 0;
+        if (length > capacity)
+            length = capacity;
+
+        shardLengths[i] = length;
+        assigned += length;
+    }
+
+    // and the bytes that are left over by rounding go to the first
+    // images that still have room
+    for (uint32_t i = 0; i < count && assigned < messageLength; i++)
+    {
+        size_t room = capacities[i] - shardLengths[i];
+        size_t left = messageLength - assigned;
+        size_t length = room < left ? room : left;
+
+        shardLengths[i] += length;
+        assigned += length;
+    }
+
+    if (!randomBytes(id, STEGO_SHARDIDSIZE))
+        return STEGO_NORANDOM;
+
+    return STEGO_OK;
+}
+
+
+// this function works out the checksum of a shard (the CRC-32 of its
+// bytes, the same as the one of a png chunk), which is stored in its
+// header so that a damaged shard is noticed before the message is put
+// back together.
+uint32_t stego_checksum(const uint8_t* shard, size_t length)
+{
+    return pngCRC(shard, length);
+}
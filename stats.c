@@ -0,0 +1,97 @@
+// this file has the timers and counters that writemessage and
+// readmessage print as a single line of JSON on stderr when they are
+// given --stats, for example:
+// {"program":"writemessage","code":0,"seconds":0.0213,"phases":{"load":0.0000,"plan":0.0000,"copy":0.0061,"embed":0.0142},"bytesRead":0,"readCalls":0,"bytesWritten":0,"writeCalls":0,"bytesCopied":18000054,"copyCalls":1,"bytesMapped":36000108,"patchBytes":2400128,"coverBytesModified":1199987}
+//
+// the phases are timed with the monotonic clock. bytesCopied and
+// copyCalls are the copies done inside the kernel (copy_file_range()
+// and sendfile()), bytesMapped is the size of the files that were
+// mapped instead of read. patchBytes is the number of bytes of the
+// output image that were produced by libstego and coverBytesModified
+// the number of those that are different from the input image.
+//
+// nothing is timed or counted without --stats, the only cost is
+// checking that stats is NULL.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+Stats* stats = NULL;
+
+static Stats programStats;
+
+// held while a phase is added, phases can end on several threads.
+static pthread_mutex_t phaseLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// returns the time of the monotonic clock in seconds.
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+
+// this function turns the statistics on (for --stats).
+void enableStats(void)
+{
+    stats = &programStats;
+    stats->start = now();
+}
+
+
+// this function is called when a phase starts. its result is given to
+// phaseEnd() when the phase ends.
+double phaseStart(void)
+{
+    return stats != NULL ? now() : 0;
+}
+
+
+// this function adds the time since start to the phase with the given
+// name (a string that stays around, like a literal).
+void phaseEnd(const char* name, double start)
+{
+    if (stats == NULL)
+        return;
+
+    double seconds = now() - start;
+    pthread_mutex_lock(&phaseLock);
+    int i = 0;
+    while (i < stats->phaseCount && strcmp(stats->phaseNames[i], name) != 0)
+        i++;
+
+    if (i < stats->phaseCount)
+        stats->phaseSeconds[i] += seconds;
+    else if (stats->phaseCount < MAXPHASES)
+    {
+        stats->phaseNames[stats->phaseCount] = name;
+        stats->phaseSeconds[stats->phaseCount++] = seconds;
+    }
+    pthread_mutex_unlock(&phaseLock);
+}
+
+
+// this function prints the statistics as a single line of JSON on
+// stderr.
+void printStats(const char* program, int exitCode)
+{
+    if (stats == NULL)
+        return;
+
+    fprintf(stderr, "{\"program\":\"%s\",\"code\":%d,\"seconds\":%.6f,\"phases\":{", program, exitCode,
+            now() - stats->start);
+    for (int i = 0; i < stats->phaseCount; i++)
+        fprintf(stderr, "%s\"%s\":%.6f", i == 0 ? "" : ",", stats->phaseNames[i], stats->phaseSeconds[i]);
+
+    fprintf(stderr, "},\"bytesRead\":%llu,\"readCalls\":%llu,\"bytesWritten\":%llu,\"writeCalls\":%llu,"
+            "\"bytesCopied\":%llu,\"copyCalls\":%llu,\"bytesMapped\":%llu,\"patchBytes\":%llu,"
+            "\"coverBytesModified\":%llu}\n",
+            stats->bytesRead, stats->readCalls, stats->bytesWritten, stats->writeCalls, stats->bytesCopied,
+            stats->copyCalls, stats->bytesMapped, stats->patchBytes, stats->coverBytesModified);
+}
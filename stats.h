@@ -0,0 +1,47 @@
+// header file for the timers and counters that writemessage and
+// readmessage print with --stats
+
+#ifndef STATS_H_
+#define STATS_H_
+
+// the most phases a program can time.
+#define MAXPHASES 16
+
+// how long every phase took and how much I/O was done. phases with
+// the same name are added up, also when they run on several threads at
+// the same time (the images of writemessage --shards for example).
+typedef struct
+{
+    double start;
+    const char* phaseNames[MAXPHASES];
+    double phaseSeconds[MAXPHASES];
+    int phaseCount;
+
+    unsigned long long bytesRead;
+    unsigned long long readCalls;
+    unsigned long long bytesWritten;
+    unsigned long long writeCalls;
+    unsigned long long bytesCopied;
+    unsigned long long copyCalls;
+    unsigned long long bytesMapped;
+    unsigned long long patchBytes;
+    unsigned long long coverBytesModified;
+} Stats;
+
+// the statistics of the program, NULL unless --stats was given. all
+// the functions and COUNT() do nothing then.
+extern Stats* stats;
+
+// adds amount to one of the counters above. it can be used by several
+// threads at the same time.
+#define COUNT(counter, amount) \
+    do { if (stats != NULL) __atomic_fetch_add(&stats->counter, (amount), __ATOMIC_RELAXED); } while (0)
+
+
+// function declarations
+void enableStats(void);
+double phaseStart(void);
+void phaseEnd(const char* name, double start);
+void printStats(const char* program, int exitCode);
+
+#endif
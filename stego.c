@@ -0,0 +1,1798 @@
+// this file is libstego: the functions that do the actual
+// steganography for writemessage.c, readmessage.c and batchmessage.c,
+// storing a message in an image and reading it back according to the
+// type of the image.
+//
+// every message is stored with a header in front of it that says how
+// long it is (see stego.h). the header of an encrypted message is
+// STEGO_CRYPTOSIZE bytes longer, and the one of a shard of a message
+// split across several images STEGO_SHARDSIZE bytes longer (see
+// shards.c). a message that was compressed (see compression.c) only
+// has STEGO_COMPRESSED set in its header, and so does a container of
+// records (see container.c) STEGO_CONTAINER. some bytes of a message
+// that is stored already can be read (stego_extract_range()) or
+// rewritten (stego_plan_update()) without going through the rest of
+// it.
+//
+// BMP: the header and the message are stored in the LSBs of the rows
+//      of the pixel array. the header always takes 1 bit of each of
+//      the first color samples (128, or 512 for an encrypted message),
+//      so it can be read without knowing how the message was stored.
+//      the message takes 1 - 4 bits of every color sample after it, or
+//      only of the samples of some channels, as the header says. the
+//      padding at the end of every row, the alpha bytes (unless they
+//      are asked for) and anything after the last row are never
+//      touched. the rows are used in the order they are in the file,
+//      so bottom-up and top-down images are handled the same way.
+//      messages stored before rows were used (without STEGO_ROWS)
+//      start in the first bytes of the pixel array and can use the
+//      padding too, they can still be read.
+// JPG and PNG: the header and the message are stored right after the
+//      end of the image (the 0xFFD9 marker or the IEND chunk).
+// PNG pixels: when asked for (stego_options.pixels), the header and
+//      the message are stored in the LSBs of the samples of the png
+//      the same way as in the rows of a bmp, and the image is
+//      compressed again (see pngpixels.c).
+// JPG coefficients: when asked for, the header and the message take
+//      the lowest bit of the quantized AC coefficients of the jpg that
+//      are not 0, 1 or -1, and the scan is huffman coded again (see
+//      jpgcoefficients.c). it always takes 1 bit in the color
+//      channels, like a message after a jpg or png.
+// either way the message then survives anything that keeps the pixels
+// (or coefficients), but the output image can't be patched like the
+// others, it is made a piece at a time by stego_embed_stream().
+//
+// messages stored by older versions have no header. in a bmp they end
+// with the special end of text byte 0000 0000 and in a jpg or png they
+// go up to the end of the file. they can still be read.
+//
+// everything works on images that are already in memory and writes
+// into buffers the caller gives, nothing is allocated here (except by
+// pngpixels.c and jpgcoefficients.c for the pixels of a png and the
+// coefficients of a jpg). go through
+// writemessage.c and readmessage.c first.
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bmpinfo.h"
+#include "helpers.h"
+#include "jpgcoefficients.h"
+#include "jpgmarkers.h"
+#include "lsbkernels.h"
+#include "pngchunks.h"
+#include "pngpixels.h"
+#include "stego.h"
+
+// number of characters that are read from the pixel array at a time.
+#define TEXTBLOCKSIZE 4096
+
+// the longest a header can be.
+#define MAXHEADERSIZE (STEGO_HEADERSIZE + STEGO_CRYPTOSIZE + STEGO_SHARDSIZE)
+
+// the flags that say something about the message itself, they can be
+// set wherever it is stored.
+#define MESSAGEFLAGS (STEGO_ENCRYPTED | STEGO_SHARDED | STEGO_COMPRESSED | STEGO_CONTAINER)
+
+// the flags this version knows about.
+#define KNOWNFLAGS (MESSAGEFLAGS | STEGO_ROWS | STEGO_PIXELS)
+
+// the result of readBMPHeader() and readStreamHeader() when there is
+// no header.
+#define NOHEADER 1
+
+
+// where and how the message is stored in the pixel array of a bmp.
+// the header takes the first headerCover bytes. when useChannels is 0
+// every byte after the header is used, otherwise only the selected
+// bytes are. when rows is 1 the header is stored in the colors bytes
+// (the color samples of every row) instead of in every byte.
+typedef struct
+{
+    size_t pixelArrayOffset;
+    size_t pixelBytes;
+    size_t headerCover;
+    int depth;
+    int useChannels;
+    int rows;
+    ChannelSelection selection;
+    ChannelSelection colors;
+} BMPCover;
+
+// the pixels of a png or the coefficients of a jpg that are being read
+// (or written) a piece at a time, for a message stored in them.
+typedef struct
+{
+    int type;
+    PNGPixels png;
+    JPGCoefficients jpg;
+} ImageStream;
+
+
+// this function checks if the image is a bmp, jpg or png by looking at
+// its first 2 bytes (the "signature" bytes that are different for
+// every file type).
+// returns STEGO_BMP, STEGO_JPG, STEGO_PNG or STEGO_UNSUPPORTED.
+int stego_type(const uint8_t* image, size_t size)
+{
+    if (size < SIGNATUREBYTESIZE)
+        return STEGO_UNSUPPORTED;
+
+    // combine the two 8-bit numbers into a single 16-bit number.
+    int signatureBytes = image[0] << 8 | image[1];
+
+    if (signatureBytes == BMPSIGNATUREBYTES)
+        return STEGO_BMP;
+    else if (signatureBytes == JPGSIGNATUREBYTES)
+        return STEGO_JPG;
+    else if (signatureBytes == PNGSIGNATUREBYTES)
+        return STEGO_PNG;
+    else
+        return STEGO_UNSUPPORTED;
+}
+
+
+// this function reads the position of the start of the pixel array
+// from the header of a bmp image. returns size if the header is
+// missing or the position is outside the image.
+static size_t pixelArrayOffsetOf(const uint8_t* image, size_t size)
+{
+    if (size < BITMAPHEADERSIZE)
+        return size;
+
+    size_t offset = (size_t) image[10] | (size_t) image[11] << 8 |
+                    (size_t) image[12] << 16 | (size_t) image[13] << 24;
+    return offset < size ? offset : size;
+}
+
+
+// returns the number of channels that are selected.
+static int channelCount(int channels)
+{
+    return __builtin_popcount(channels);
+}
+
+
+// returns the number of selected bytes in the first length bytes of a
+// row.
+static size_t selectedInRow(const ChannelSelection* selection, size_t length)
+{
+    if (length > selection->rowBytes)
+        length = selection->rowBytes;
+
+    size_t pixels = length / selection->bytesPerPixel;
+    int rest = length % selection->bytesPerPixel;
+    return pixels * channelCount(selection->channels) + channelCount(selection->channels & ((1 << rest) - 1));
+}
+
+
+// returns the number of selected bytes in the first length bytes of
+// the pixel array.
+static size_t selectedBefore(const ChannelSelection* selection, size_t length)
+{
+    size_t rows = length / selection->stride;
+    return rows * selectedInRow(selection, selection->rowBytes) + selectedInRow(selection, length % selection->stride);
+}
+
+
+// returns the position in the pixel array of the selected byte with
+// the given number (counting from 0).
+static size_t positionOfSelected(const ChannelSelection* selection, size_t number)
+{
+    size_t perRow = selectedInRow(selection, selection->rowBytes);
+    int perPixel = channelCount(selection->channels);
+
+    size_t row = number / perRow;
+    size_t inRow = number % perRow;
+    size_t pixel = inRow / perPixel;
+    int skip = inRow % perPixel;
+
+    // find the channel the selected byte is in.
+    int channel = 0;
+    while (!(selection->channels >> channel & 1) || skip-- > 0)
+        channel++;
+
+    return row * selection->stride + pixel * selection->bytesPerPixel + channel;
+}
+
+
+// returns the number of bytes of the header of a message with the
+// given flags.
+static size_t headerSizeOf(int flags)
+{
+    return STEGO_HEADERSIZE + (flags & STEGO_ENCRYPTED ? STEGO_CRYPTOSIZE : 0)
+           + (flags & STEGO_SHARDED ? STEGO_SHARDSIZE : 0);
+}
+
+
+// this function reads how the rows of a bmp image of the given size
+// are laid out and fills in colors with its color samples: every byte
+// of the pixels, except the alpha byte of 32-bit pixels. pixels of
+// more than 4 bytes (48 and 64 bits) have no channels to choose from,
+// all their bytes are used. only the first available bytes of the
+// image are looked at.
+// returns 1 if the headers make sense and 0 if they don't.
+static int rowsOf(const uint8_t* image, size_t available, size_t size, BMPInfo* info, ChannelSelection* colors)
+{
+    if (readBMPInfo(image, available, info) == 0 || info->pixelArrayOffset >= size)
+        return 0;
+
+    colors->rowBytes = info->rowBytes;
+    colors->stride = info->stride;
+    colors->bytesPerPixel = info->bytesPerPixel > 4 ? 1 : info->bytesPerPixel;
+    colors->channels = colors->bytesPerPixel == 4 ? STEGO_COLORCHANNELS : (1 << colors->bytesPerPixel) - 1;
+    return 1;
+}
+
+
+// returns STEGO_ROWS if a message can be stored in the rows of the bmp
+// image (its headers make sense and its pixels are not compressed) and
+// 0 if it can't. only a message stored before rows were used is in the
+// whole pixel array.
+static int rowsFlagOf(const uint8_t* image, size_t available, size_t size)
+{
+    BMPInfo info;
+    ChannelSelection colors;
+    return rowsOf(image, available, size, &info, &colors) ? STEGO_ROWS : 0;
+}
+
+
+// this function works out how a message is stored in the rows of a
+// bmp image (see coverOf()).
+// returns STEGO_OK or STEGO_BADOPTIONS.
+static int rowCoverOf(const uint8_t* image, size_t available, size_t size, int flags, int channels,
+                      BMPCover* cover)
+{
+    BMPInfo info;
+    if (!rowsOf(image, available, size, &info, &cover->colors))
+        return STEGO_BADOPTIONS;
+
+    // only the rows are used, not whatever comes after the last one.
+    cover->pixelArrayOffset = info.pixelArrayOffset;
+    cover->pixelBytes = size - info.pixelArrayOffset;
+    if (cover->pixelBytes / info.stride >= (size_t) info.height)
+        cover->pixelBytes = info.stride * info.height;
+
+    cover->rows = 1;
+    cover->useChannels = 1;
+    cover->selection = cover->colors;
+    cover->headerCover = positionOfSelected(&cover->colors, headerSizeOf(flags) * BYTESIZE - 1) + 1;
+
+    // channels only mean something for pixels of 2 - 4 bytes.
+    if (info.bytesPerPixel >= 2 && info.bytesPerPixel <= 4)
+    {
+        cover->selection.channels = channels & ((1 << info.bytesPerPixel) - 1);
+        if (cover->selection.channels == 0)
+            return STEGO_BADOPTIONS;
+    }
+
+    return STEGO_OK;
+}
+
+
+// this function works out how a message with the given header flags,
+// bit depth and channels is stored in the pixel array of a bmp image
+// of the given size. only the first available bytes of the image (the
+// headers) are looked at.
+// returns STEGO_OK or STEGO_BADOPTIONS.
+static int coverOf(const uint8_t* image, size_t available, size_t size, int flags, int depth, int channels,
+                   BMPCover* cover)
+{
+    if (depth < 1 || depth > STEGO_MAXDEPTH || (channels & STEGO_ALLCHANNELS) == 0)
+        return STEGO_BADOPTIONS;
+
+    cover->depth = depth;
+    if (flags & STEGO_ROWS)
+        return rowCoverOf(image, available, size, flags, channels, cover);
+
+    // a message stored before rows were used.
+    cover->pixelArrayOffset = available < BITMAPHEADERSIZE ? size : pixelArrayOffsetOf(image, size);
+    cover->pixelBytes = size - cover->pixelArrayOffset;
+    cover->headerCover = headerSizeOf(flags) * BYTESIZE;
+    cover->rows = 0;
+    cover->useChannels = 0;
+
+    // channels only mean something for pixels of 2 - 4 bytes. if all
+    // of them are selected every byte is used (padding too).
+    BMPInfo info;
+    if (readBMPInfo(image, available, &info) == 0 || info.bytesPerPixel < 2 || info.bytesPerPixel > 4)
+        return STEGO_OK;
+
+    int allChannels = (1 << info.bytesPerPixel) - 1;
+    if ((channels & allChannels) == 0)
+        return STEGO_BADOPTIONS;
+
+    if ((channels & allChannels) != allChannels)
+    {
+        cover->useChannels = 1;
+        cover->selection.rowBytes = info.rowBytes;
+        cover->selection.stride = info.stride;
+        cover->selection.bytesPerPixel = info.bytesPerPixel;
+        cover->selection.channels = channels & allChannels;
+    }
+
+    return STEGO_OK;
+}
+
+
+// returns the number of message bytes that fit in the pixel array
+// after the header.
+static size_t capacityOf(const BMPCover* cover)
+{
+    if (cover->pixelBytes <= cover->headerCover)
+        return 0;
+
+    size_t coverBytes = cover->pixelBytes - cover->headerCover;
+    if (cover->useChannels)
+        coverBytes = selectedBefore(&cover->selection, cover->pixelBytes)
+                     - selectedBefore(&cover->selection, cover->headerCover);
+
+    return coverBytes / BYTESIZE * cover->depth + coverBytes % BYTESIZE * cover->depth / BYTESIZE;
+}
+
+
+// returns the number of pixel array bytes after the header that a
+// message of the given length (that fits) is stored in.
+static size_t spanOf(const BMPCover* cover, size_t messageLength)
+{
+    size_t coverBytes = coverBytesFor(cover->depth, messageLength);
+    if (!cover->useChannels || coverBytes == 0)
+        return coverBytes;
+
+    size_t first = selectedBefore(&cover->selection, cover->headerCover);
+    return positionOfSelected(&cover->selection, first + coverBytes - 1) + 1 - cover->headerCover;
+}
+
+
+// this function finds the payload bytes [first, end) of a part when
+// a message of the given length is split into parts. the parts start
+// on multiples of depth payload bytes, which is exactly 8 cover bytes
+// (or selected bytes), so no part shares a cover byte with another.
+static void partOf(size_t length, int depth, int part, int parts, size_t* first, size_t* end)
+{
+    size_t groups = length / depth;
+    *first = groups * part / parts * depth;
+    *end = part == parts - 1 ? length : groups * (part + 1) / parts * depth;
+}
+
+
+// returns the position in the pixel array of the cover byte that the
+// payload byte with the given number (a multiple of depth) starts in.
+static size_t coverPositionOf(const BMPCover* cover, size_t payloadByte)
+{
+    size_t coverBytes = payloadByte * BYTESIZE / cover->depth;
+    if (!cover->useChannels)
+        return cover->headerCover + coverBytes;
+
+    size_t first = selectedBefore(&cover->selection, cover->headerCover);
+    return positionOfSelected(&cover->selection, first + coverBytes);
+}
+
+
+// this function stores count payload bytes, starting at the payload
+// byte first (a multiple of depth), where the cover says. pixels is
+// where the pixel array has its byte base (0, or the start of a row
+// when the pixels are a patch that starts there).
+static void embedGroups(BYTE* pixels, size_t base, const BMPCover* cover, size_t first, const BYTE* payload,
+                        size_t count)
+{
+    size_t position = coverPositionOf(cover, first) - base;
+    if (cover->useChannels)
+        embedBitsInChannels(pixels, &cover->selection, position, cover->depth, payload, count);
+    else
+        embedBitsInLSB(pixels + position, cover->depth, payload, count);
+}
+
+
+// this function reads count payload bytes, starting at the payload
+// byte first (a multiple of depth), from where the cover says.
+static void extractGroups(const BYTE* pixels, const BMPCover* cover, size_t first, BYTE* payload, size_t count)
+{
+    size_t position = coverPositionOf(cover, first);
+    if (cover->useChannels)
+        extractBitsFromChannels(pixels, &cover->selection, position, cover->depth, payload, count);
+    else
+        extractBitsFromLSB(pixels + position, cover->depth, payload, count);
+}
+
+
+// this function stores the header (of headerSize bytes) in the LSBs
+// of the pixel array of a bmp, where the cover says.
+static void embedHeader(BYTE* pixels, const BMPCover* cover, const BYTE* header, size_t headerSize)
+{
+    if (cover->rows)
+        embedBitsInChannels(pixels, &cover->colors, 0, 1, header, headerSize);
+    else
+        embedBytesInLSB(pixels, header, headerSize);
+}
+
+
+// this function reads count bytes of a header, starting at its byte
+// first, from the LSBs of the pixel array of a bmp: from its color
+// samples if colors is not NULL, otherwise from its first bytes.
+static void extractHeader(const BYTE* pixels, const ChannelSelection* colors, size_t first, BYTE* bytes,
+                          size_t count)
+{
+    if (colors != NULL)
+        extractBitsFromChannels(pixels, colors, positionOfSelected(colors, first * BYTESIZE), 1, bytes, count);
+    else
+        extractBytesFromLSB(pixels + first * BYTESIZE, bytes, count);
+}
+
+
+// this function finds the position where the appended message starts
+// in a jpg or png image (right after the end of the image).
+static long long endOfImage(const uint8_t* image, size_t size, int type)
+{
+    if (type == STEGO_JPG)
+        return findJPGEnd(image, size);
+    else
+        return findPNGEnd(image, size);
+}
+
+
+// this function fills in the header for a message of the given length
+// stored as the layout says. returns the number of bytes of the header.
+static size_t writeHeader(BYTE* header, uint64_t length, const stego_layout* layout)
+{
+    memcpy(header, STEGO_MAGIC, STEGO_MAGICSIZE);
+    header[4] = STEGO_VERSION;
+    header[5] = layout->flags;
+    header[6] = layout->depth;
+    header[7] = layout->channels;
+
+    for (int i = 0; i < 8; i++)
+        header[8 + i] = length >> (8 * i);
+
+    if (layout->flags & STEGO_ENCRYPTED)
+    {
+        BYTE* crypto = header + STEGO_HEADERSIZE;
+        memcpy(crypto, layout->crypto.salt, STEGO_SALTSIZE);
+        memcpy(crypto + 16, layout->crypto.nonce, STEGO_NONCESIZE);
+        memcpy(crypto + 28, layout->crypto.tag, STEGO_TAGSIZE);
+        for (int i = 0; i < 4; i++)
+            crypto[44 + i] = layout->crypto.iterations >> (8 * i);
+    }
+
+    if (layout->flags & STEGO_SHARDED)
+    {
+        BYTE* shard = header + headerSizeOf(layout->flags) - STEGO_SHARDSIZE;
+        memcpy(shard, layout->shard.id, STEGO_SHARDIDSIZE);
+        for (int i = 0; i < 4; i++)
+        {
+            shard[8 + i] = layout->shard.index >> (8 * i);
+            shard[12 + i] = layout->shard.count >> (8 * i);
+            shard[16 + i] = layout->shard.checksum >> (8 * i);
+        }
+    }
+
+    return headerSizeOf(layout->flags);
+}
+
+
+// this function reads a header. returns 1 if it is a header and 0 if
+// it is not (the message was stored by an older version).
+static int parseHeader(const BYTE* bytes, stego_header* header)
+{
+    if (memcmp(bytes, STEGO_MAGIC, STEGO_MAGICSIZE) != 0)
+        return 0;
+
+    header->version = bytes[4];
+    header->flags = bytes[5];
+    header->length = 0;
+    for (int i = 0; i < 8; i++)
+        header->length |= (uint64_t) bytes[8 + i] << (8 * i);
+
+    // headers from before the bit depth and channels were stored have
+    // 0 in their place.
+    header->depth = bytes[6] == 0 ? 1 : bytes[6];
+    header->channels = bytes[7] == 0 ? STEGO_ALLCHANNELS : bytes[7];
+    return 1;
+}
+
+
+// this function reads the bytes that follow the header of an encrypted
+// message (STEGO_CRYPTOSIZE of them) and then of a shard
+// (STEGO_SHARDSIZE of them).
+// returns 1 if they make sense and 0 if they don't.
+static int parseRestOfHeader(const BYTE* bytes, stego_header* header)
+{
+    if (header->flags & STEGO_ENCRYPTED)
+    {
+        memcpy(header->crypto.salt, bytes, STEGO_SALTSIZE);
+        memcpy(header->crypto.nonce, bytes + 16, STEGO_NONCESIZE);
+        memcpy(header->crypto.tag, bytes + 28, STEGO_TAGSIZE);
+        header->crypto.iterations = 0;
+        for (int i = 0; i < 4; i++)
+            header->crypto.iterations |= (uint32_t) bytes[44 + i] << (8 * i);
+        bytes += STEGO_CRYPTOSIZE;
+    }
+
+    if (header->flags & STEGO_SHARDED)
+    {
+        memcpy(header->shard.id, bytes, STEGO_SHARDIDSIZE);
+        header->shard.index = header->shard.count = header->shard.checksum = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            header->shard.index |= (uint32_t) bytes[8 + i] << (8 * i);
+            header->shard.count |= (uint32_t) bytes[12 + i] << (8 * i);
+            header->shard.checksum |= (uint32_t) bytes[16 + i] << (8 * i);
+        }
+        return header->shard.index < header->shard.count;
+    }
+
+    return 1;
+}
+
+
+// this function starts reading the pixels of the png or the
+// coefficients of the jpg (see startPNGPixels() and
+// startJPGCoefficients()). endStream() must be called afterwards.
+static int startStream(ImageStream* stream, const uint8_t* image, size_t size, const stego_output* output)
+{
+    stream->type = stego_type(image, size);
+    if (stream->type == STEGO_JPG)
+        return startJPGCoefficients(&stream->jpg, image, size, output);
+
+    return startPNGPixels(&stream->png, image, size, output);
+}
+
+
+// this function stores payload bytes at the cursor of the stream, in
+// the channels with the given depth for a png.
+static int embedInStream(ImageStream* stream, int channels, int depth, const BYTE* payload, size_t count)
+{
+    if (stream->type == STEGO_JPG)
+        return embedInJPGCoefficients(&stream->jpg, payload, count);
+
+    return embedInPNGPixels(&stream->png, channels, depth, payload, count);
+}
+
+
+// this function reads payload bytes at the cursor of the stream.
+static int extractFromStream(ImageStream* stream, int channels, int depth, BYTE* payload, size_t count)
+{
+    if (stream->type == STEGO_JPG)
+        return extractFromJPGCoefficients(&stream->jpg, payload, count);
+
+    return extractFromPNGPixels(&stream->png, channels, depth, payload, count);
+}
+
+
+// this function writes the rest of the output image.
+static int finishStream(ImageStream* stream)
+{
+    if (stream->type == STEGO_JPG)
+        return finishJPGCoefficients(&stream->jpg);
+
+    return finishPNGPixels(&stream->png);
+}
+
+
+// this function frees everything startStream() allocated.
+static void endStream(ImageStream* stream)
+{
+    if (stream->type == STEGO_JPG)
+        endJPGCoefficients(&stream->jpg);
+    else
+        endPNGPixels(&stream->png);
+}
+
+
+// this function counts the message bytes that fit in the coefficients
+// of the jpg after a header of headerSize bytes, which means huffman
+// decoding the scan. it stops once limit bytes fit (SIZE_MAX decodes
+// the whole scan).
+// returns STEGO_OK, STEGO_NOPIXELS or STEGO_BADIMAGE.
+static int jpgCapacityOf(const uint8_t* image, size_t size, size_t headerSize, size_t limit, size_t* capacity)
+{
+    JPGCoefficients jpg;
+    uint64_t count = 0;
+    uint64_t limitBits = limit == SIZE_MAX ? UINT64_MAX : ((uint64_t) headerSize + limit) * BYTESIZE;
+    int result = startJPGCoefficients(&jpg, image, size, NULL);
+    if (result == STEGO_OK)
+        result = countJPGCoefficients(&jpg, limitBits, &count);
+    endJPGCoefficients(&jpg);
+
+    *capacity = count > headerSize * BYTESIZE ? (count - headerSize * BYTESIZE) / BYTESIZE : 0;
+    return result;
+}
+
+
+// this function works out how the output image is made from the input
+// image when a message of the given length is stored in it (see
+// stego_layout in stego.h). options can be NULL for 1 bit per byte in
+// all channels.
+// returns STEGO_OK, STEGO_UNSUPPORTED (also for a bmp with compressed
+// pixels), STEGO_NOSPACE, STEGO_BADOPTIONS (also for a depth other than
+// 1 or channels other than STEGO_COLORCHANNELS in a jpg, or in a png
+// unless the message goes in its pixels), STEGO_NOPIXELS or
+// STEGO_BADIMAGE (for the coefficients of a jpg).
+int stego_plan(const uint8_t* in, size_t size, size_t messageLength, const stego_options* options,
+               stego_layout* layout)
+{
+    int type = stego_type(in, size);
+    if (type == STEGO_UNSUPPORTED)
+        return STEGO_UNSUPPORTED;
+
+    layout->depth = options != NULL ? options->depth : 1;
+    layout->channels = options != NULL ? options->channels : STEGO_COLORCHANNELS;
+    layout->flags = 0;
+    if (options != NULL && options->crypto != NULL)
+    {
+        layout->flags |= STEGO_ENCRYPTED;
+        layout->crypto = *options->crypto;
+    }
+    if (options != NULL && options->shard != NULL)
+    {
+        layout->flags |= STEGO_SHARDED;
+        layout->shard = *options->shard;
+    }
+    if (options != NULL && options->compressed)
+        layout->flags |= STEGO_COMPRESSED;
+    if (options != NULL && options->container)
+        layout->flags |= STEGO_CONTAINER;
+
+    // only a bmp and the pixels of a png have bytes to store a message
+    // in with another depth or in other channels, the rest always
+    // store it with 1 bit in the color channels. asking them for
+    // anything else is an error rather than being ignored.
+    int pngPixels = type == STEGO_PNG && options != NULL && options->pixels;
+    if (type != STEGO_BMP && !pngPixels && (layout->depth != 1 || layout->channels != STEGO_COLORCHANNELS))
+        return STEGO_BADOPTIONS;
+
+    // a bmp whose headers don't make sense (or whose pixels are
+    // compressed) has no rows to store a message in.
+    if (type == STEGO_BMP)
+    {
+        layout->flags |= rowsFlagOf(in, size, size);
+        if (!(layout->flags & STEGO_ROWS))
+            return STEGO_UNSUPPORTED;
+    }
+
+    size_t headerSize = headerSizeOf(layout->flags);
+
+    if (type == STEGO_BMP)
+    {
+        // the header takes 8 color samples for each of its bytes and
+        // the message takes the ones after it. the image keeps its
+        // size.
+        BMPCover cover;
+        int result = coverOf(in, size, size, layout->flags, layout->depth, layout->channels, &cover);
+        if (result != STEGO_OK)
+            return result;
+
+        if (cover.pixelBytes < cover.headerCover || messageLength > capacityOf(&cover))
+            return STEGO_NOSPACE;
+
+        layout->keepLength = size;
+        layout->patchOffset = cover.pixelArrayOffset;
+        layout->patchLength = cover.headerCover + spanOf(&cover, messageLength);
+        layout->outputSize = size;
+        return STEGO_OK;
+    }
+
+    if (pngPixels)
+    {
+        // the header and the message go in the samples of the png, the
+        // whole image is written again by stego_embed_stream().
+        PNGInfo info;
+        if (!readPNGInfo(in, size, &info) || !canHoldPixels(&info))
+            return STEGO_NOPIXELS;
+        if (layout->depth < 1 || layout->depth > STEGO_MAXDEPTH || sampleMaskOf(&info, layout->channels) == 0)
+            return STEGO_BADOPTIONS;
+
+        layout->flags |= STEGO_PIXELS;
+        if (messageLength > pixelCapacityOf(&info, headerSize, layout->channels, layout->depth))
+            return STEGO_NOSPACE;
+
+        layout->keepLength = 0;
+        layout->patchOffset = 0;
+        layout->patchLength = 0;
+        layout->outputSize = 0;
+        return STEGO_OK;
+    }
+
+    if (type == STEGO_JPG && options != NULL && options->pixels)
+    {
+        // the header and the message take a bit of the coefficients
+        // that can hold one, so they have to be counted.
+        layout->flags |= STEGO_PIXELS;
+
+        size_t capacity;
+        int result = jpgCapacityOf(in, size, headerSize, messageLength, &capacity);
+        if (result != STEGO_OK)
+            return result;
+        if (messageLength > capacity)
+            return STEGO_NOSPACE;
+
+        layout->keepLength = 0;
+        layout->patchOffset = 0;
+        layout->patchLength = 0;
+        layout->outputSize = 0;
+        return STEGO_OK;
+    }
+
+    // jpg and png: everything up to the end of the image is kept and
+    // the header and the message are appended after it.
+    long long end = endOfImage(in, size, type);
+    if (end < 0)
+        return STEGO_UNSUPPORTED;
+
+    layout->keepLength = end;
+    layout->patchOffset = end;
+    layout->patchLength = headerSize + messageLength;
+    layout->outputSize = end + headerSize + messageLength;
+    return STEGO_OK;
+}
+
+
+// this function produces the patchLength bytes of the output image that
+// start at patchOffset (see stego_plan()). patch may point into the
+// output image itself, or even at the same bytes of the input image
+// when the image is edited in place.
+// returns STEGO_OK, STEGO_UNSUPPORTED or STEGO_BADOPTIONS.
+int stego_embed_patch(const uint8_t* in, size_t size, const stego_layout* layout,
+                      const uint8_t* message, size_t messageLength, uint8_t* patch)
+{
+    return stego_embed_patch_part(in, size, layout, message, messageLength, patch, 0, 1);
+}
+
+
+// this function does the same as stego_embed_patch(), but only for
+// one part (numbered 0 to parts - 1) of the patch. the parts don't
+// share any bytes, so they can be produced at the same time by
+// different threads (the message must not overlap the patch then).
+// returns STEGO_OK, STEGO_UNSUPPORTED or STEGO_BADOPTIONS (for a
+// message in the pixels of a png or jpg, which has no patch).
+int stego_embed_patch_part(const uint8_t* in, size_t size, const stego_layout* layout,
+                           const uint8_t* message, size_t messageLength, uint8_t* patch,
+                           int part, int parts)
+{
+    int type = stego_type(in, size);
+    if (type == STEGO_UNSUPPORTED)
+        return STEGO_UNSUPPORTED;
+    if (layout->flags & STEGO_PIXELS)
+        return STEGO_BADOPTIONS;
+
+    BYTE header[MAXHEADERSIZE];
+    size_t headerSize = writeHeader(header, messageLength, layout);
+
+    if (type == STEGO_BMP)
+    {
+        BMPCover cover;
+        int result = coverOf(in, size, size, layout->flags, layout->depth, layout->channels, &cover);
+        if (result != STEGO_OK)
+            return result;
+
+        // the cover bytes of this part: the first part also has the
+        // header and the last one goes up to the end of the patch.
+        size_t first, end;
+        partOf(messageLength, cover.depth, part, parts, &first, &end);
+        size_t from = part == 0 ? 0 : coverPositionOf(&cover, first);
+        size_t to = part == parts - 1 ? layout->patchLength : coverPositionOf(&cover, end);
+        if (from > to)
+            from = to;
+
+        // start with the original pixels and edit their LSBs.
+        if (patch != in + layout->patchOffset)
+            memmove(patch + from, in + layout->patchOffset + from, to - from);
+
+        if (part == 0)
+            embedHeader(patch, &cover, header, headerSize);
+        if (end == first)
+            return STEGO_OK;
+
+        embedGroups(patch, 0, &cover, first, message + first, end - first);
+        return STEGO_OK;
+    }
+
+    // the message is moved first in case it is in the way of the header.
+    size_t first, end;
+    partOf(messageLength, 1, part, parts, &first, &end);
+    memmove(patch + headerSize + first, message + first, end - first);
+    if (part == 0)
+        memcpy(patch, header, headerSize);
+
+    return STEGO_OK;
+}
+
+
+// returns the number of cover bytes of the message (the ones after
+// the header, only the selected ones when channels are used) that come
+// before the given position of the pixel array.
+static size_t coverBytesBefore(const BMPCover* cover, size_t position)
+{
+    if (position <= cover->headerCover)
+        return 0;
+    if (!cover->useChannels)
+        return position - cover->headerCover;
+
+    return selectedBefore(&cover->selection, position) - selectedBefore(&cover->selection, cover->headerCover);
+}
+
+
+// this function copies the bytes that a block of the pixel array (it
+// has the bytes [from, to)) shares with a region of it (the bytes
+// [start, end)) from the block into the region, or back into the block
+// when back is 1.
+static void shareBytes(BYTE* block, size_t from, size_t to, BYTE* region, size_t start, size_t end, int back)
+{
+    size_t first = from > start ? from : start;
+    size_t last = to < end ? to : end;
+    if (first >= last)
+        return;
+
+    if (back)
+        memcpy(block + first - from, region + first - start, last - first);
+    else
+        memcpy(region + first - start, block + first - from, last - first);
+}
+
+
+// this function stores count payload bytes, starting at the payload
+// byte first (a multiple of depth), in a block of the pixel array (it
+// has the bytes [from, to)) that may only have some of the cover bytes
+// they go in, or not the start of the row they are in (the channel
+// kernels count positions from there). they are stored in a copy of
+// the rows they are in, and the bytes the block has are copied back.
+// returns STEGO_OK or STEGO_NOMEMORY.
+static int embedGroupsInCopy(BYTE* block, size_t from, size_t to, const BMPCover* cover, size_t first,
+                             const BYTE* payload, size_t count)
+{
+    size_t start = coverPositionOf(cover, first);
+    if (cover->useChannels)
+        start -= start % cover->selection.stride;
+    size_t end = cover->headerCover + spanOf(cover, first + count);
+
+    BYTE* region = calloc(end - start, 1);
+    if (region == NULL)
+        return STEGO_NOMEMORY;
+
+    shareBytes(block, from, to, region, start, end, 0);
+    embedGroups(region, start, cover, first, payload, count);
+    shareBytes(block, from, to, region, start, end, 1);
+    free(region);
+    return STEGO_OK;
+}
+
+
+// this function does the same as stego_embed_patch() for a bmp, but
+// only for the blockLength bytes of the image that start at
+// blockOffset, which block has (read from the input image, they are
+// edited where they are). only the first headLength bytes of the image
+// (its headers, up to the pixel array) are needed, so a huge image can
+// be streamed through in blocks that never are all in memory at once,
+// and the blocks can be edited at the same time by different threads.
+// blocks can start anywhere, the groups of cover bytes a block only
+// has some of are stored in the bytes it has (through a copy of the
+// rows they are in, which is allocated, see embedGroupsInCopy()).
+// returns STEGO_OK, STEGO_UNSUPPORTED (not a bmp), STEGO_BADOPTIONS or
+// STEGO_NOMEMORY (the copy could not be allocated).
+int stego_embed_block(const uint8_t* head, size_t headLength, size_t size, const stego_layout* layout,
+                      const uint8_t* message, size_t messageLength, uint8_t* block, size_t blockOffset,
+                      size_t blockLength)
+{
+    if (stego_type(head, headLength) != STEGO_BMP)
+        return STEGO_UNSUPPORTED;
+    if (layout->flags & STEGO_PIXELS)
+        return STEGO_BADOPTIONS;
+
+    BMPCover cover;
+    int result = coverOf(head, headLength, size, layout->flags, layout->depth, layout->channels, &cover);
+    if (result != STEGO_OK)
+        return result;
+
+    // the part of the pixel array the block has, and where it is in
+    // the block.
+    size_t blockEnd = blockOffset + blockLength;
+    size_t patchEnd = layout->patchOffset + layout->patchLength;
+    if (blockEnd <= cover.pixelArrayOffset || blockOffset >= patchEnd)
+        return STEGO_OK;
+    size_t from = (blockOffset > cover.pixelArrayOffset ? blockOffset : cover.pixelArrayOffset)
+                  - cover.pixelArrayOffset;
+    size_t to = (blockEnd < patchEnd ? blockEnd : patchEnd) - cover.pixelArrayOffset;
+    BYTE* pixels = block + cover.pixelArrayOffset + from - blockOffset;
+
+    if (from < cover.headerCover)
+    {
+        BYTE header[MAXHEADERSIZE];
+        size_t headerSize = writeHeader(header, messageLength, layout);
+        BYTE* region = calloc(cover.headerCover, 1);
+        if (region == NULL)
+            return STEGO_NOMEMORY;
+
+        shareBytes(pixels, from, to, region, 0, cover.headerCover, 0);
+        embedHeader(region, &cover, header, headerSize);
+        shareBytes(pixels, from, to, region, 0, cover.headerCover, 1);
+        free(region);
+    }
+
+    // the groups of 8 cover bytes the block touches: the ones before
+    // the first row that starts in it and the one it ends in are only
+    // partly in it (or need the start of their row), the ones in
+    // between are stored right in it.
+    size_t groupCount = (messageLength + cover.depth - 1) / cover.depth;
+    size_t aligned = from;
+    if (cover.useChannels)
+        aligned = (from + cover.selection.stride - 1) / cover.selection.stride * cover.selection.stride;
+
+    size_t firstGroup = coverBytesBefore(&cover, from) / BYTESIZE;
+    size_t endGroup = (coverBytesBefore(&cover, to) + BYTESIZE - 1) / BYTESIZE;
+    if (endGroup > groupCount)
+        endGroup = groupCount;
+    size_t innerFirst = (coverBytesBefore(&cover, aligned) + BYTESIZE - 1) / BYTESIZE;
+    size_t innerEnd = coverBytesBefore(&cover, to) / BYTESIZE;
+    if (innerFirst > endGroup)
+        innerFirst = endGroup;
+    if (innerEnd > endGroup)
+        innerEnd = endGroup;
+    if (innerEnd < innerFirst)
+        innerEnd = innerFirst;
+
+    size_t ranges[3][2] = {{firstGroup, innerFirst}, {innerFirst, innerEnd}, {innerEnd, endGroup}};
+    for (int i = 0; i < 3 && result == STEGO_OK; i++)
+    {
+        if (ranges[i][0] >= ranges[i][1])
+            continue;
+
+        size_t first = ranges[i][0] * cover.depth;
+        size_t end = ranges[i][1] * cover.depth < messageLength ? ranges[i][1] * cover.depth : messageLength;
+        if (i == 1)
+            embedGroups(pixels + aligned - from, aligned, &cover, first, message + first, end - first);
+        else
+            result = embedGroupsInCopy(pixels, from, to, &cover, first, message + first, end - first);
+    }
+
+    return result;
+}
+
+
+// this function stores the message in the pixels of the png image or
+// the coefficients of the jpg image as the layout says (stego_plan()
+// set STEGO_PIXELS) and sends the whole output image to output a piece
+// at a time.
+// returns STEGO_OK, STEGO_BADOPTIONS, STEGO_NOPIXELS, STEGO_BADIMAGE,
+// STEGO_NOMEMORY or STEGO_WRITEFAILED.
+int stego_embed_stream(const uint8_t* in, size_t size, const stego_layout* layout, const uint8_t* message,
+                       size_t messageLength, const stego_output* output)
+{
+    int type = stego_type(in, size);
+    if (!(layout->flags & STEGO_PIXELS) || (type != STEGO_PNG && type != STEGO_JPG))
+        return STEGO_BADOPTIONS;
+
+    BYTE header[MAXHEADERSIZE];
+    size_t headerSize = writeHeader(header, messageLength, layout);
+
+    // like in a bmp, the header takes 1 bit of each of the first color
+    // samples (or coefficients) and the message the ones after it.
+    ImageStream stream;
+    int result = startStream(&stream, in, size, output);
+    if (result == STEGO_OK)
+        result = embedInStream(&stream, STEGO_COLORCHANNELS, 1, header, headerSize);
+    if (result == STEGO_OK)
+        result = embedInStream(&stream, layout->channels, layout->depth, message, messageLength);
+    if (result == STEGO_OK)
+        result = finishStream(&stream);
+
+    endStream(&stream);
+    return result;
+}
+
+
+// where stego_embed() writes a png or jpg made by stego_embed_stream().
+typedef struct
+{
+    BYTE* out;
+    size_t capacity;
+    size_t length;
+} BufferOutput;
+
+
+// this function adds bytes of the output image to the buffer (only
+// counting them once it is full).
+static int writeToBuffer(void* context, const uint8_t* bytes, size_t length)
+{
+    BufferOutput* buffer = context;
+    if (buffer->length <= buffer->capacity && length <= buffer->capacity - buffer->length)
+        memcpy(buffer->out + buffer->length, bytes, length);
+
+    buffer->length += length;
+    return 1;
+}
+
+
+// this function stores the message in the input image and writes the
+// complete output image to out (which may be the same buffer as in,
+// except for a message in the pixels of a png or jpg).
+// the length of the output image is stored in outLength.
+// returns STEGO_OK, STEGO_UNSUPPORTED, STEGO_NOSPACE, STEGO_BADOPTIONS
+// or STEGO_SMALLBUFFER (outLength is then set to the size needed), or
+// for the pixels of a png or jpg what stego_embed_stream() returns.
+int stego_embed(const uint8_t* in, size_t size, const uint8_t* message, size_t messageLength,
+                const stego_options* options, uint8_t* out, size_t outCapacity, size_t* outLength)
+{
+    stego_layout layout;
+    int result = stego_plan(in, size, messageLength, options, &layout);
+    if (result != STEGO_OK)
+        return result;
+
+    if (layout.flags & STEGO_PIXELS)
+    {
+        if (out == in)
+            return STEGO_BADOPTIONS;
+
+        BufferOutput buffer = {out, outCapacity, 0};
+        stego_output output = {writeToBuffer, NULL, &buffer, 1};
+        result = stego_embed_stream(in, size, &layout, message, messageLength, &output);
+        *outLength = buffer.length;
+        return result == STEGO_OK && buffer.length > outCapacity ? STEGO_SMALLBUFFER : result;
+    }
+
+    *outLength = layout.outputSize;
+    if (outCapacity < layout.outputSize)
+        return STEGO_SMALLBUFFER;
+
+    if (out != in)
+        memcpy(out, in, layout.keepLength);
+
+    return stego_embed_patch(in, size, &layout, message, messageLength, out + layout.patchOffset);
+}
+
+
+// this function returns the number of message bytes that fit in an
+// image of the given size with the given options (NULL for 1 bit per
+// byte in the color channels, not encrypted). only the first
+// headLength bytes of the image
+// are needed (a few dozen are enough for the headers of a bmp or png),
+// so the pixels don't have to be read. a jpg or png has no limit, for
+// them STEGO_NOLIMIT is returned, unless the message goes in the pixels
+// of the png, or the coefficients of the jpg (which have to be counted,
+// so the whole jpg is needed, headLength has to be size). returns 0 if
+// the image is not supported or the options are invalid.
+size_t stego_capacity(const uint8_t* head, size_t headLength, size_t size, const stego_options* options)
+{
+    int type = stego_type(head, headLength);
+    if (type == STEGO_UNSUPPORTED)
+        return 0;
+
+    BMPCover cover;
+    int depth = options != NULL ? options->depth : 1;
+    int channels = options != NULL ? options->channels : STEGO_COLORCHANNELS;
+    int flags = options != NULL && options->crypto != NULL ? STEGO_ENCRYPTED : 0;
+    if (options != NULL && options->shard != NULL)
+        flags |= STEGO_SHARDED;
+
+    if (type == STEGO_PNG && options != NULL && options->pixels)
+    {
+        PNGInfo info;
+        if (!readPNGInfo(head, headLength, &info) || !canHoldPixels(&info))
+            return 0;
+        return pixelCapacityOf(&info, headerSizeOf(flags), channels, depth);
+    }
+
+    if (type == STEGO_JPG && options != NULL && options->pixels)
+    {
+        size_t capacity;
+        if (headLength < size || jpgCapacityOf(head, size, headerSizeOf(flags), SIZE_MAX, &capacity) != STEGO_OK)
+            return 0;
+        return capacity;
+    }
+
+    if (type != STEGO_BMP)
+        return STEGO_NOLIMIT;
+
+    flags |= rowsFlagOf(head, headLength, size);
+    if (!(flags & STEGO_ROWS) || coverOf(head, headLength, size, flags, depth, channels, &cover) != STEGO_OK)
+        return 0;
+
+    return capacityOf(&cover);
+}
+
+
+// returns the number of bytes of the pixel array of a bmp that a header
+// of headerSize bytes is stored in (in the colors bytes if colors is
+// not NULL, otherwise in the first bytes).
+static size_t headerCoverOf(const ChannelSelection* colors, size_t headerSize)
+{
+    return colors != NULL ? positionOfSelected(colors, headerSize * BYTESIZE - 1) + 1 : headerSize * BYTESIZE;
+}
+
+
+// this function reads the header of a message stored in the rows of a
+// bmp image (when rows is 1) or in the first bytes of its pixel array
+// (when rows is 0), and checks that it makes sense. only the first
+// available bytes of the image (of size bytes) need to be there.
+// returns STEGO_OK, STEGO_NOMESSAGE, STEGO_SMALLBUFFER (the header is
+// not in the available bytes) or NOHEADER if there is no header.
+static int readBMPHeader(const uint8_t* image, size_t available, size_t size, int rows, stego_header* header,
+                         size_t* start)
+{
+    BMPInfo info;
+    ChannelSelection colors;
+    if (available < BITMAPHEADERSIZE && available < size)
+        return STEGO_SMALLBUFFER;
+    if (rows && !rowsOf(image, available, size, &info, &colors))
+        return NOHEADER;
+
+    size_t offset = rows ? info.pixelArrayOffset : pixelArrayOffsetOf(image, size);
+    size_t needed = headerCoverOf(rows ? &colors : NULL, STEGO_HEADERSIZE);
+    if (size - offset < needed)
+        return NOHEADER;
+    if (available < offset || available - offset < needed)
+        return STEGO_SMALLBUFFER;
+
+    BYTE bytes[MAXHEADERSIZE];
+    extractHeader(image + offset, rows ? &colors : NULL, 0, bytes, STEGO_HEADERSIZE);
+    if (!parseHeader(bytes, header))
+        return NOHEADER;
+
+    // in a 24-bit image without padding the first color samples are
+    // the first bytes, so an older message is found here too.
+    if (rows && !(header->flags & STEGO_ROWS))
+        return NOHEADER;
+
+    BMPCover cover;
+    if ((header->flags & ~KNOWNFLAGS) != 0 || (header->flags & STEGO_ROWS) != (rows ? STEGO_ROWS : 0)
+        || coverOf(image, available, size, header->flags, header->depth, header->channels, &cover) != STEGO_OK
+        || cover.pixelBytes < cover.headerCover)
+        return STEGO_NOMESSAGE;
+    if (available - offset < headerCoverOf(rows ? &colors : NULL, headerSizeOf(header->flags)))
+        return STEGO_SMALLBUFFER;
+
+    // the rest of the header of an encrypted message or a shard.
+    extractHeader(image + offset, rows ? &colors : NULL, STEGO_HEADERSIZE, bytes,
+                  headerSizeOf(header->flags) - STEGO_HEADERSIZE);
+    if (!parseRestOfHeader(bytes, header))
+        return STEGO_NOMESSAGE;
+
+    *start = offset;
+    return header->length <= capacityOf(&cover) ? STEGO_OK : STEGO_NOMESSAGE;
+}
+
+
+// this function reads the header of a message stored in the pixels of
+// a png image or the coefficients of a jpg image, and checks that it
+// makes sense.
+// returns STEGO_OK, STEGO_NOMESSAGE, STEGO_NOMEMORY or NOHEADER if there
+// is no header.
+static int readStreamHeader(const uint8_t* image, size_t size, stego_header* header)
+{
+    ImageStream stream;
+    BYTE bytes[MAXHEADERSIZE];
+    int found = 0;
+
+    int result = startStream(&stream, image, size, NULL);
+    if (result == STEGO_OK)
+        result = extractFromStream(&stream, STEGO_COLORCHANNELS, 1, bytes, STEGO_HEADERSIZE);
+    if (result == STEGO_OK)
+        found = parseHeader(bytes, header) && (header->flags & STEGO_PIXELS);
+
+    // the rest of the header of an encrypted message or a shard.
+    if (found)
+        result = extractFromStream(&stream, STEGO_COLORCHANNELS, 1, bytes + STEGO_HEADERSIZE,
+                                   headerSizeOf(header->flags) - STEGO_HEADERSIZE);
+
+    // the most a jpg can hold without counting its coefficients: every
+    // one of them takes at least 3 bits of the scan.
+    size_t capacity = 0;
+    if (found && stream.type == STEGO_JPG)
+        capacity = (stream.jpg.scanEnd - stream.jpg.scanStart) / 3;
+    else if (found)
+        capacity = pixelCapacityOf(&stream.png.info, headerSizeOf(header->flags), header->channels, header->depth);
+
+    endStream(&stream);
+    if (result == STEGO_NOMEMORY)
+        return result;
+    if (!found)
+        return NOHEADER;
+
+    if (result != STEGO_OK || (header->flags & ~(MESSAGEFLAGS | STEGO_PIXELS)) != 0
+        || header->depth > STEGO_MAXDEPTH
+        || (stream.type == STEGO_PNG && sampleMaskOf(&stream.png.info, header->channels) == 0)
+        || !parseRestOfHeader(bytes + STEGO_HEADERSIZE, header))
+        return STEGO_NOMESSAGE;
+
+    return header->length <= capacity ? STEGO_OK : STEGO_NOMESSAGE;
+}
+
+
+// this function finds the message stored in the image and reads its
+// header. start is set to the position where the message starts (in
+// a bmp, the position of the pixel array, and 0 for a message in the
+// pixels of a png or the coefficients of a jpg).
+// returns STEGO_OK, STEGO_UNSUPPORTED, STEGO_NOMESSAGE or
+// STEGO_NOMEMORY.
+static int findMessage(const uint8_t* image, size_t size, stego_header* header, size_t* start)
+{
+    int type = stego_type(image, size);
+    if (type == STEGO_UNSUPPORTED)
+        return STEGO_UNSUPPORTED;
+
+    size_t available;
+
+    if (type == STEGO_BMP)
+    {
+        // a message in the rows, then one stored before rows were used.
+        for (int rows = 1; rows >= 0; rows--)
+        {
+            int result = readBMPHeader(image, size, size, rows, header, start);
+            if (result != NOHEADER)
+                return result;
+        }
+
+        // an older message without a header, it can be as long as the
+        // pixel array.
+        size_t pixelArrayOffset = pixelArrayOffsetOf(image, size);
+        *start = pixelArrayOffset;
+        header->version = 0;
+        header->flags = 0;
+        header->depth = 1;
+        header->channels = STEGO_ALLCHANNELS;
+        header->length = (size - pixelArrayOffset) / BYTESIZE;
+        return STEGO_OK;
+    }
+
+    long long end = endOfImage(image, size, type);
+    if (end < 0)
+        return STEGO_NOMESSAGE;
+
+    available = size - end;
+    if (available >= STEGO_HEADERSIZE && parseHeader(image + end, header))
+    {
+        size_t headerSize = headerSizeOf(header->flags);
+        if ((header->flags & ~MESSAGEFLAGS) != 0 || available < headerSize
+            || !parseRestOfHeader(image + end + STEGO_HEADERSIZE, header))
+            return STEGO_NOMESSAGE;
+
+        *start = end + headerSize;
+        available -= headerSize;
+        return header->length <= available ? STEGO_OK : STEGO_NOMESSAGE;
+    }
+
+    // a message in the pixels of a png or the coefficients of a jpg.
+    int result = readStreamHeader(image, size, header);
+    *start = 0;
+    if (result != NOHEADER)
+        return result;
+
+    // older versions of writemessage wrote the jpg end of image bytes
+    // a second time before the text, skip them if they are there.
+    if (type == STEGO_JPG && available >= 2 && image[end] == 0xFF && image[end + 1] == 0xD9)
+        end += 2;
+
+    header->version = 0;
+    header->flags = 0;
+    header->depth = 1;
+    header->channels = STEGO_ALLCHANNELS;
+    header->length = size - end;
+    *start = end;
+    return STEGO_OK;
+}
+
+
+// this function reads the header of the message stored in the image.
+// returns STEGO_OK, STEGO_UNSUPPORTED or STEGO_NOMESSAGE.
+int stego_read_header(const uint8_t* image, size_t size, stego_header* header)
+{
+    size_t start;
+    return findMessage(image, size, header, &start);
+}
+
+
+// the last bytes of a jpg and of a png that has nothing after its end:
+// the end of image marker, and the IEND chunk (with no data) and its
+// CRC.
+static const BYTE jpgEnd[] = {0xFF, 0xD9};
+static const BYTE pngEnd[] = {0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xAE, 0x42, 0x60, 0x82};
+
+
+// this function tells if a message is stored in an image of size bytes
+// from its first headLength bytes (head) and its last tailLength bytes
+// (tail) only, without the bytes in between, and reads its header:
+//  - in a bmp the header is in the first bytes of the pixel array, the
+//    head must have them (a few KB are always enough).
+//  - after a jpg or png the header is right after the end of the image
+//    and the message goes up to the end of the file, so it is found in
+//    the tail if the whole message is in it. a tail that ends with the
+//    end of the image has no message after it.
+// a message in the pixels of a png or the coefficients of a jpg can't
+// be told this way (it takes decoding the image), nor can one in a bmp
+// stored by an older version (it has no header).
+// returns STEGO_OK, STEGO_UNSUPPORTED, STEGO_NOMESSAGE or
+// STEGO_SMALLBUFFER if it can't be told from the head and the tail (the
+// whole image has to be read with stego_read_header() then).
+int stego_probe(const uint8_t* head, size_t headLength, const uint8_t* tail, size_t tailLength, size_t size,
+                stego_header* header)
+{
+    int type = stego_type(head, headLength);
+    if (type == STEGO_UNSUPPORTED)
+        return STEGO_UNSUPPORTED;
+
+    if (type == STEGO_BMP)
+    {
+        size_t start;
+        for (int rows = 1; rows >= 0; rows--)
+        {
+            int result = readBMPHeader(head, headLength, size, rows, header, &start);
+            if (result != NOHEADER)
+                return result;
+        }
+
+        return STEGO_NOMESSAGE;
+    }
+
+    // a header in the tail that is right after the end of the image and
+    // says the message goes exactly up to the end of the file.
+    const BYTE* end = type == STEGO_JPG ? jpgEnd : pngEnd;
+    size_t endLength = type == STEGO_JPG ? sizeof(jpgEnd) : sizeof(pngEnd);
+    const BYTE* found = tail;
+    while ((found = memmem(found, tail + tailLength - found, STEGO_MAGIC, STEGO_MAGICSIZE)) != NULL)
+    {
+        size_t position = found - tail;
+        size_t left = tailLength - position;
+        found++;
+        if (position < endLength || memcmp(tail + position - endLength, end, endLength) != 0
+            || left < STEGO_HEADERSIZE || !parseHeader(tail + position, header))
+            continue;
+
+        size_t headerSize = headerSizeOf(header->flags);
+        if ((header->flags & ~MESSAGEFLAGS) == 0 && left >= headerSize && header->length == left - headerSize
+            && parseRestOfHeader(tail + position + STEGO_HEADERSIZE, header))
+            return STEGO_OK;
+    }
+
+    if (tailLength >= endLength && memcmp(tail + tailLength - endLength, end, endLength) == 0)
+        return STEGO_NOMESSAGE;
+
+    return STEGO_SMALLBUFFER;
+}
+
+
+// this function returns the length of the message stored in the image
+// (for a message stored by an older version, the length of the longest
+// message it could be), so that the caller knows how big the message
+// buffer has to be.
+size_t stego_extract_bound(const uint8_t* image, size_t size)
+{
+    stego_header header;
+    size_t start;
+    if (findMessage(image, size, &header, &start) != STEGO_OK)
+        return 0;
+
+    return header.length;
+}
+
+
+// this function reads a message stored by an older version in the
+// LSBs of the pixel array of a bmp image, up to the end of text byte.
+static int extractOldFromBMP(const uint8_t* pixels, size_t charsLeft, uint8_t* message, size_t capacity,
+                             size_t* messageLength)
+{
+    size_t length = 0;
+
+    // the characters are read a block at a time straight into the
+    // message buffer, and each block is searched for the end of text
+    // byte.
+    while (charsLeft > 0)
+    {
+        size_t chars = charsLeft < TEXTBLOCKSIZE ? charsLeft : TEXTBLOCKSIZE;
+        if (chars > capacity - length)
+            chars = capacity - length;
+
+        // the buffer is full, the message fits only if the next
+        // character is the end of text byte.
+        if (chars == 0)
+        {
+            BYTE ch;
+            extractBytesFromLSB(pixels, &ch, 1);
+            *messageLength = length;
+            return ch == 0 ? STEGO_OK : STEGO_SMALLBUFFER;
+        }
+
+        extractBytesFromLSB(pixels, message + length, chars);
+
+        BYTE* endOfText = memchr(message + length, 0, chars);
+        if (endOfText != NULL)
+        {
+            *messageLength = endOfText - message;
+            return STEGO_OK;
+        }
+
+        length += chars;
+        pixels += chars * BYTESIZE;
+        charsLeft -= chars;
+    }
+
+    *messageLength = length;
+    return STEGO_NOMESSAGE;
+}
+
+
+// this function reads a message stored in the pixels of a png image
+// or the coefficients of a jpg image with the given header into the
+// message buffer.
+// returns STEGO_OK, STEGO_NOMESSAGE or STEGO_NOMEMORY.
+static int extractFromPixels(const uint8_t* image, size_t size, const stego_header* header, uint8_t* message)
+{
+    ImageStream stream;
+    BYTE bytes[MAXHEADERSIZE];
+    int result = startStream(&stream, image, size, NULL);
+    if (result == STEGO_OK)
+        result = extractFromStream(&stream, STEGO_COLORCHANNELS, 1, bytes, headerSizeOf(header->flags));
+    if (result == STEGO_OK)
+        result = extractFromStream(&stream, header->channels, header->depth, message, header->length);
+
+    endStream(&stream);
+    return result == STEGO_OK || result == STEGO_NOMEMORY ? result : STEGO_NOMESSAGE;
+}
+
+
+// this function reads the message stored in the image into the message
+// buffer (which has space for capacity bytes) and stores its length in
+// messageLength. only the bytes of the image that hold the message are
+// read.
+// returns STEGO_OK, STEGO_UNSUPPORTED, STEGO_NOMESSAGE,
+// STEGO_SMALLBUFFER or STEGO_NOMEMORY.
+int stego_extract(const uint8_t* image, size_t size, uint8_t* message, size_t capacity,
+                  size_t* messageLength)
+{
+    return stego_extract_part(image, size, message, capacity, messageLength, 0, 1);
+}
+
+
+// this function does the same as stego_extract(), but only reads one
+// part (numbered 0 to parts - 1) of the message into the buffer. the
+// parts don't share any bytes, so they can be read at the same time by
+// different threads. a message stored by an older version in a bmp
+// can't be split (its length is not known), and neither can one in the
+// pixels of a png or the coefficients of a jpg (they are decoded in
+// order), so they are read by part 0.
+// returns STEGO_OK, STEGO_UNSUPPORTED, STEGO_NOMESSAGE,
+// STEGO_SMALLBUFFER or STEGO_NOMEMORY.
+int stego_extract_part(const uint8_t* image, size_t size, uint8_t* message, size_t capacity,
+                       size_t* messageLength, int part, int parts)
+{
+    *messageLength = 0;
+
+    stego_header header;
+    size_t start;
+    int result = findMessage(image, size, &header, &start);
+    if (result != STEGO_OK)
+        return result;
+
+    int isBMP = stego_type(image, size) == STEGO_BMP;
+    if (header.version == 0 && isBMP)
+    {
+        if (part != 0)
+            return STEGO_OK;
+        return extractOldFromBMP(image + start, header.length, message, capacity, messageLength);
+    }
+
+    *messageLength = header.length;
+    if (header.length > capacity)
+        return STEGO_SMALLBUFFER;
+
+    if (header.flags & STEGO_PIXELS)
+        return part == 0 ? extractFromPixels(image, size, &header, message) : STEGO_OK;
+
+    if (!isBMP)
+    {
+        size_t first, end;
+        partOf(header.length, 1, part, parts, &first, &end);
+        memcpy(message + first, image + start + first, end - first);
+        return STEGO_OK;
+    }
+
+    // the header said how the message is stored (findMessage() checked
+    // that it makes sense).
+    BMPCover cover;
+    coverOf(image, size, size, header.flags, header.depth, header.channels, &cover);
+
+    size_t first, end;
+    partOf(header.length, cover.depth, part, parts, &first, &end);
+    if (end == first)
+        return STEGO_OK;
+
+    extractGroups(image + start, &cover, first, message + first, end - first);
+    return STEGO_OK;
+}
+
+
+// this function skips count bytes (a multiple of depth) of a message
+// in the pixels of a png or the coefficients of a jpg. they are
+// decoded like all the others, there is no way to find them without.
+// returns STEGO_OK, STEGO_NOSPACE, STEGO_BADIMAGE or STEGO_NOMEMORY.
+static int skipInStream(ImageStream* stream, int channels, int depth, size_t count)
+{
+    BYTE skipped[TEXTBLOCKSIZE];
+    size_t block = TEXTBLOCKSIZE / depth * depth;
+    int result = STEGO_OK;
+    for (size_t left = count; left > 0 && result == STEGO_OK;)
+    {
+        size_t bytes = left < block ? left : block;
+        result = extractFromStream(stream, channels, depth, skipped, bytes);
+        left -= bytes;
+    }
+
+    return result;
+}
+
+
+// this function reads count bytes of a message in the pixels of a png
+// or the coefficients of a jpg, starting at its byte offset. the
+// payload bytes are only read in groups of depth (8 samples) at a
+// time, so a range that starts in the middle of a group reads the
+// group first.
+// returns STEGO_OK, STEGO_NOMESSAGE or STEGO_NOMEMORY.
+static int extractRangeFromPixels(const uint8_t* image, size_t size, const stego_header* header, size_t offset,
+                                  BYTE* bytes, size_t count)
+{
+    ImageStream stream;
+    BYTE skipped[MAXHEADERSIZE];
+    size_t skip = offset % header->depth;
+    int result = startStream(&stream, image, size, NULL);
+    if (result == STEGO_OK)
+        result = extractFromStream(&stream, STEGO_COLORCHANNELS, 1, skipped, headerSizeOf(header->flags));
+    if (result == STEGO_OK)
+        result = skipInStream(&stream, header->channels, header->depth, offset - skip);
+
+    if (result == STEGO_OK && skip != 0)
+    {
+        BYTE group[STEGO_MAXDEPTH];
+        size_t groupLength = header->length - (offset - skip) < (size_t) header->depth
+                                 ? header->length - (offset - skip) : (size_t) header->depth;
+        size_t head = groupLength - skip < count ? groupLength - skip : count;
+        result = extractFromStream(&stream, header->channels, header->depth, group, groupLength);
+        memcpy(bytes, group + skip, head);
+        bytes += head;
+        count -= head;
+    }
+    if (result == STEGO_OK)
+        result = extractFromStream(&stream, header->channels, header->depth, bytes, count);
+
+    endStream(&stream);
+    return result == STEGO_OK || result == STEGO_NOMEMORY ? result : STEGO_NOMESSAGE;
+}
+
+
+// this function reads count bytes of the message stored in the image,
+// starting at its byte offset, into bytes. in a bmp and after the end
+// of a png or jpg only the cover bytes of the range are read, so a
+// small piece of a long message (a record of a container) costs the
+// same as a short message. a message in the pixels of a png or the
+// coefficients of a jpg is decoded up to the range (but not after it).
+// returns STEGO_OK, STEGO_UNSUPPORTED, STEGO_NOMESSAGE (also for a
+// message stored by an older version), STEGO_BADOPTIONS (the range
+// goes past the end of the message) or STEGO_NOMEMORY.
+int stego_extract_range(const uint8_t* image, size_t size, size_t offset, uint8_t* bytes, size_t count)
+{
+    stego_header header;
+    size_t start;
+    int result = findMessage(image, size, &header, &start);
+    if (result != STEGO_OK)
+        return result;
+    if (header.version == 0)
+        return STEGO_NOMESSAGE;
+    if (offset > header.length || count > header.length - offset)
+        return STEGO_BADOPTIONS;
+    if (count == 0)
+        return STEGO_OK;
+
+    if (header.flags & STEGO_PIXELS)
+        return extractRangeFromPixels(image, size, &header, offset, bytes, count);
+
+    if (stego_type(image, size) != STEGO_BMP)
+    {
+        memcpy(bytes, image + start + offset, count);
+        return STEGO_OK;
+    }
+
+    BMPCover cover;
+    coverOf(image, size, size, header.flags, header.depth, header.channels, &cover);
+
+    // the group the range starts in (if it doesn't start on one) and
+    // then the groups after it.
+    size_t skip = offset % cover.depth;
+    if (skip != 0)
+    {
+        BYTE group[STEGO_MAXDEPTH];
+        size_t head = cover.depth - skip < count ? cover.depth - skip : count;
+        extractGroups(image + start, &cover, offset - skip, group, skip + head);
+        memcpy(bytes, group + skip, head);
+        offset += head;
+        bytes += head;
+        count -= head;
+    }
+    if (count > 0)
+        extractGroups(image + start, &cover, offset, bytes, count);
+
+    return STEGO_OK;
+}
+
+
+// this function works out how count bytes of the message stored in
+// the image, starting at its byte offset, are rewritten in place when
+// the message becomes messageLength bytes long (see stego_update in
+// stego.h). the other bytes of the message stay where they are, so
+// only the cover bytes of the range and of the header change (in a
+// bmp, the whole groups of depth bytes the range touches). the header
+// keeps everything else it says (depth, channels, flags).
+// returns STEGO_OK, STEGO_UNSUPPORTED, STEGO_NOMESSAGE (also for a
+// message stored by an older version), STEGO_BADOPTIONS (the range
+// goes past messageLength, or the message is in the pixels of a png or
+// the coefficients of a jpg, which can't be patched) or STEGO_NOSPACE.
+int stego_plan_update(const uint8_t* image, size_t size, size_t messageLength, size_t offset, size_t count,
+                      stego_update* update)
+{
+    stego_header header;
+    size_t start;
+    int result = findMessage(image, size, &header, &start);
+    if (result != STEGO_OK)
+        return result;
+    if (header.version == 0)
+        return STEGO_NOMESSAGE;
+    if ((header.flags & STEGO_PIXELS) || offset > messageLength || count > messageLength - offset)
+        return STEGO_BADOPTIONS;
+
+    update->messageLength = messageLength;
+    update->offset = offset;
+    update->count = count;
+
+    if (stego_type(image, size) == STEGO_BMP)
+    {
+        BMPCover cover;
+        coverOf(image, size, size, header.flags, header.depth, header.channels, &cover);
+        size_t capacity = capacityOf(&cover);
+        if (messageLength > capacity)
+            return STEGO_NOSPACE;
+
+        // the groups the range touches, from the start of the row the
+        // first one is in (the channel kernels count positions from the
+        // start of a row).
+        size_t first = offset / cover.depth * cover.depth;
+        size_t end = (offset + count + cover.depth - 1) / cover.depth * cover.depth;
+        if (end > capacity)
+            end = capacity;
+
+        size_t from = count > 0 ? coverPositionOf(&cover, first) : cover.headerCover;
+        if (cover.useChannels)
+            from -= from % cover.selection.stride;
+
+        update->headerOffset = start;
+        update->headerLength = cover.headerCover;
+        update->patchOffset = start + from;
+        update->patchLength = count > 0 ? cover.headerCover + spanOf(&cover, end) - from : 0;
+        update->outputSize = size;
+        return STEGO_OK;
+    }
+
+    // jpg and png: the message is appended, so it can grow or shrink
+    // with the image.
+    update->headerOffset = start - headerSizeOf(header.flags);
+    update->headerLength = headerSizeOf(header.flags);
+    update->patchOffset = start + offset;
+    update->patchLength = count;
+    update->outputSize = start + messageLength;
+    return STEGO_OK;
+}
+
+
+// this function produces the bytes of the image that change when the
+// bytes of the message are rewritten as the update says (see
+// stego_plan_update()): the headerLength bytes of the header and the
+// patchLength bytes of the patch. bytes has the count new bytes of the
+// message.
+// returns STEGO_OK, STEGO_UNSUPPORTED, STEGO_NOMESSAGE or
+// STEGO_BADOPTIONS.
+int stego_embed_update(const uint8_t* image, size_t size, const stego_update* update, const uint8_t* bytes,
+                       uint8_t* header, uint8_t* patch)
+{
+    stego_header found;
+    size_t start;
+    int result = findMessage(image, size, &found, &start);
+    if (result != STEGO_OK)
+        return result;
+    if (found.version == 0)
+        return STEGO_NOMESSAGE;
+    if (found.flags & STEGO_PIXELS)
+        return STEGO_BADOPTIONS;
+
+    // the header says the same as before, only the length is new.
+    stego_layout layout;
+    layout.flags = found.flags;
+    layout.depth = found.depth;
+    layout.channels = found.channels;
+    layout.crypto = found.crypto;
+    layout.shard = found.shard;
+    BYTE headerBytes[MAXHEADERSIZE];
+    size_t headerSize = writeHeader(headerBytes, update->messageLength, &layout);
+
+    if (stego_type(image, size) != STEGO_BMP)
+    {
+        memcpy(header, headerBytes, headerSize);
+        memcpy(patch, bytes, update->count);
+        return STEGO_OK;
+    }
+
+    BMPCover cover;
+    coverOf(image, size, size, found.flags, found.depth, found.channels, &cover);
+    memcpy(header, image + update->headerOffset, update->headerLength);
+    embedHeader(header, &cover, headerBytes, headerSize);
+
+    // start with the original pixels and edit their LSBs. a group that
+    // is only partly in the range keeps the other bytes it holds, so
+    // it is read first.
+    memcpy(patch, image + update->patchOffset, update->patchLength);
+    size_t base = update->patchOffset - start;
+    size_t capacity = capacityOf(&cover);
+    size_t offset = update->offset;
+    size_t count = update->count;
+    while (count > 0)
+    {
+        size_t skip = offset % cover.depth;
+        size_t length = skip == 0 ? count / cover.depth * cover.depth : 0;
+        if (length > 0)
+            embedGroups(patch, base, &cover, offset, bytes, length);
+        else
+        {
+            BYTE group[STEGO_MAXDEPTH];
+            size_t first = offset - skip;
+            size_t groupLength = capacity - first < (size_t) cover.depth ? capacity - first : (size_t) cover.depth;
+            length = groupLength - skip < count ? groupLength - skip : count;
+            extractGroups(image + start, &cover, first, group, groupLength);
+            memcpy(group + skip, bytes, length);
+            embedGroups(patch, base, &cover, first, group, groupLength);
+        }
+
+        offset += length;
+        bytes += length;
+        count -= length;
+    }
+
+    return STEGO_OK;
+}
+
+
+// returns a message describing a result of the functions above.
+const char* stego_error(int result)
+{
+    switch (result)
+    {
+        case STEGO_OK:
+            return "Success.";
+        case STEGO_UNSUPPORTED:
+            return "Unsupported file type.\nSupported file types are BMP (uncompressed), JPG, PNG.";
+        case STEGO_NOSPACE:
+            return "The message does not fit in the image.";
+        case STEGO_SMALLBUFFER:
+            return "The buffer is too small.";
+        case STEGO_NOMESSAGE:
+            return "No message was found.";
+        case STEGO_BADOPTIONS:
+            return "Invalid bit depth or channels for this image.";
+        case STEGO_BADKEY:
+            return "Wrong passkey, or the message was changed.";
+        case STEGO_NORANDOM:
+            return "Could not get random bytes for the encryption.";
+        case STEGO_NOPIXELS:
+            return "The message can't be stored in the pixels of this image.\n"
+                   "Only 8 and 16 bit gray and RGB(A) pngs without interlacing and baseline jpgs can hold one.";
+        case STEGO_BADIMAGE:
+            return "The image is damaged.";
+        case STEGO_NOMEMORY:
+            return "Out of memory.";
+        case STEGO_WRITEFAILED:
+            return "Could not write the output image.";
+        case STEGO_BADMESSAGE:
+            return "The message is damaged.";
+        case STEGO_NORECORDS:
+            return "The message is not a container of records.";
+        case STEGO_TOCFULL:
+            return "The container has no room for another record.";
+        default:
+            return "Unknown error.";
+    }
+}
@@ -0,0 +1,375 @@
+// header file for libstego, the library that does the steganography
+// for writemessage, readmessage, batchmessage, probeimage, scanimages
+// and stegod.
+//
+// every function works on images that are already in memory (mapped
+// or read by the caller) and writes into buffers the caller owns.
+// none of them allocate memory, except for a message in the pixels of
+// a png, which is read and written a few rows at a time (the rows and
+// the blocks being compressed are allocated, see pngpixels.c), or in
+// the coefficients of a jpg (the output buffer is allocated, see
+// jpgcoefficients.c), and stego_embed_block(), which stores the groups
+// of cover bytes a block only has part of in a copy of the rows around
+// them (it is allocated). they return STEGO_NOMEMORY if the memory
+// can't be allocated.
+
+#ifndef STEGO_H_
+#define STEGO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the image types that are supported, returned by stego_type().
+#define STEGO_BMP 1
+#define STEGO_JPG 2
+#define STEGO_PNG 3
+
+// results returned by the functions below. everything except
+// STEGO_OK is an error.
+#define STEGO_OK 0
+#define STEGO_UNSUPPORTED -1
+#define STEGO_NOSPACE -2
+#define STEGO_SMALLBUFFER -3
+#define STEGO_NOMESSAGE -4
+#define STEGO_BADOPTIONS -5
+#define STEGO_BADKEY -6
+#define STEGO_NORANDOM -7
+#define STEGO_NOPIXELS -8
+#define STEGO_BADIMAGE -9
+#define STEGO_NOMEMORY -10
+#define STEGO_WRITEFAILED -11
+#define STEGO_BADMESSAGE -12
+#define STEGO_NORECORDS -13
+#define STEGO_TOCFULL -14
+
+// the channels of a pixel, for stego_options. a bmp stores the bytes
+// of a pixel in the order blue, green, red (and alpha), a png in the
+// order red, green, blue (and alpha). the gray samples of a png are in
+// all three color channels.
+#define STEGO_BLUE 1
+#define STEGO_GREEN 2
+#define STEGO_RED 4
+#define STEGO_ALPHA 8
+#define STEGO_COLORCHANNELS 7
+#define STEGO_ALLCHANNELS 15
+
+// what stego_capacity() returns for an image that any message fits in.
+#define STEGO_NOLIMIT SIZE_MAX
+
+// the most bits of a cover byte a message can take.
+#define STEGO_MAXDEPTH 4
+
+// every message starts with a header of STEGO_HEADERSIZE bytes:
+//  - bytes 0 - 3: STEGO_MAGIC, to tell it apart from a message that
+//    was stored by an older version (with no header).
+//  - byte 4: the version of the format (STEGO_VERSION). version 1
+//    encrypted a message that was given a passkey with a shift of its
+//    bytes, version 2 encrypts it with ChaCha20 (STEGO_ENCRYPTED) and
+//    stores every other message as it is.
+//  - byte 5: flags, STEGO_ENCRYPTED, STEGO_ROWS, STEGO_PIXELS,
+//    STEGO_SHARDED, STEGO_COMPRESSED and STEGO_CONTAINER or 0.
+//  - byte 6: the bit depth the message is stored with.
+//  - byte 7: the channels the message is stored in.
+//  - bytes 8 - 15: the length of the message as a little endian
+//    64-bit number.
+// the message comes right after the header, so it can have any bytes
+// in it (including 0) and can be read without searching for its end.
+#define STEGO_HEADERSIZE 16
+#define STEGO_MAGIC "\x89STG"
+#define STEGO_MAGICSIZE 4
+#define STEGO_VERSION 2
+
+// the last version that encrypted messages with a shift (see
+// decryptOldMessage() in helpers.c).
+#define STEGO_SHIFTVERSION 1
+
+// the flags of the header. STEGO_ROWS is set for a message in a bmp
+// that is stored in the pixels of the rows only (see stego.c), it is
+// set by stego_plan() for every bmp it can read the headers of.
+// STEGO_PIXELS is set for a message in the pixels of a png or the DCT
+// coefficients of a jpg. STEGO_SHARDED is set for a shard of a message
+// that is split across several images (see stego_split()).
+// STEGO_COMPRESSED is set for a message that was compressed with
+// stego_compress() (before it was encrypted or split).
+// STEGO_CONTAINER is set for a message that is a container of named
+// records (see container.c).
+#define STEGO_ENCRYPTED 1
+#define STEGO_ROWS 2
+#define STEGO_PIXELS 4
+#define STEGO_SHARDED 8
+#define STEGO_COMPRESSED 16
+#define STEGO_CONTAINER 32
+
+// an encrypted message has STEGO_CRYPTOSIZE more bytes of header:
+//  - bytes 16 - 31: the salt the key was derived from the passkey with.
+//  - bytes 32 - 43: the nonce the message was encrypted with.
+//  - bytes 44 - 59: the Poly1305 tag of the encrypted message.
+//  - bytes 60 - 63: the number of PBKDF2 iterations as a little endian
+//    32-bit number.
+// the message is encrypted with ChaCha20 and the key is derived from
+// the passkey with PBKDF2-HMAC-SHA256 (see cipher.c).
+#define STEGO_CRYPTOSIZE 48
+#define STEGO_SALTSIZE 16
+#define STEGO_NONCESIZE 12
+#define STEGO_TAGSIZE 16
+#define STEGO_KDFITERATIONS 100000
+
+typedef struct
+{
+    uint8_t salt[STEGO_SALTSIZE];
+    uint8_t nonce[STEGO_NONCESIZE];
+    uint8_t tag[STEGO_TAGSIZE];
+    uint32_t iterations;
+} stego_crypto;
+
+// a shard has STEGO_SHARDSIZE more bytes of header (after the ones of
+// an encrypted message):
+//  - bytes 0 - 7: the id of the message, the same random bytes in
+//    every shard of it.
+//  - bytes 8 - 11: the number of the shard (from 0).
+//  - bytes 12 - 15: the number of shards the message is split into.
+//  - bytes 16 - 19: the CRC-32 of the shard as it is stored (see
+//    stego_checksum()).
+// the numbers are little endian. an encrypted message is encrypted
+// before it is split, so every shard has the same crypto.
+#define STEGO_SHARDSIZE 20
+#define STEGO_SHARDIDSIZE 8
+
+typedef struct
+{
+    uint8_t id[STEGO_SHARDIDSIZE];
+    uint32_t index;
+    uint32_t count;
+    uint32_t checksum;
+} stego_shard;
+
+// a compressed message starts with the length of the message it
+// decompresses to, as a little endian 64-bit number (STEGO_COMPRESSIONSIZE
+// bytes), and then the message follows in blocks of 4 MB (the last one
+// can be shorter). every block is a little endian 32-bit number, its
+// length, and then that many bytes of LZ4 (see lz4.c), or the block as
+// it is if the top bit of its length is set. this is not the LZ4 frame
+// format, only the blocks are LZ4.
+#define STEGO_COMPRESSIONSIZE 8
+
+// a container starts with a table of contents of STEGO_TOCSIZE bytes:
+//  - bytes 0 - 3: the number of slots for records (STEGO_RECORDSLOTS).
+//  - bytes 4 - 7: the CRC-32 of bytes 8 - 527 (see stego_checksum()).
+//  - bytes 8 - 15: the length of the container (the end of the last
+//    record, or more if records were replaced by shorter ones).
+//  - bytes 16 - 527: the slots, STEGO_SLOTSIZE bytes each: the name of
+//    the record (up to STEGO_NAMESIZE - 1 bytes, the rest 0, all 0 for
+//    a slot that is not used), then the offset of the record in the
+//    container and its length as little endian 64-bit numbers, and the
+//    CRC-32 of the record as a little endian 32-bit number.
+// the records follow in any order. the table is a multiple of every
+// depth, so it never shares a cover byte with a record and either of
+// them can be written on its own (see stego_plan_update()).
+#define STEGO_TOCSIZE 528
+#define STEGO_RECORDSLOTS 8
+#define STEGO_SLOTSIZE 64
+#define STEGO_NAMESIZE 44
+
+typedef struct
+{
+    char name[STEGO_NAMESIZE];
+    uint64_t offset;
+    uint64_t length;
+    uint32_t checksum;
+} stego_record;
+
+typedef struct
+{
+    uint64_t length;
+    stego_record records[STEGO_RECORDSLOTS];
+} stego_toc;
+
+// how a message is stored (a jpg, and a png unless the message goes in
+// its pixels, can only store it with depth 1 in STEGO_COLORCHANNELS,
+// stego_plan() returns STEGO_BADOPTIONS for anything else):
+//  - depth: the number of low bits (1 - 4) of every pixel byte (or
+//    16-bit sample) that are used. more bits fit a bigger message in
+//    the same image.
+//  - channels: the channels that are used (STEGO_RED | STEGO_GREEN for
+//    example). the bytes of the other channels, the padding at the
+//    end of every row and anything after the pixel array are left as
+//    they are. STEGO_COLORCHANNELS leaves out alpha.
+//  - crypto: for a message that was encrypted with stego_encrypt(),
+//    what is needed to decrypt it (stored with the header). NULL for a
+//    message that is not encrypted.
+//  - pixels: 1 to store the message of a png in the LSBs of its pixels
+//    (see stego_embed_stream()) instead of after the end of the image,
+//    so that it survives the image being compressed again. only 8 and
+//    16 bit gray and rgb(a) images without interlacing can do this. a
+//    baseline jpg stores it in the lowest bit of its quantized AC
+//    coefficients that are not 0, 1 or -1 instead (1 bit each).
+//  - shard: for a shard of a message that is split across several
+//    images, which one it is (stored with the header). NULL for a
+//    whole message.
+//  - compressed: 1 for a message that was compressed with
+//    stego_compress().
+//  - container: 1 for a message that is a container of records (see
+//    stego_write_toc()).
+// a NULL stego_options means depth 1 in the color channels, not
+// encrypted, appended to a png.
+typedef struct
+{
+    int depth;
+    int channels;
+    const stego_crypto* crypto;
+    int pixels;
+    const stego_shard* shard;
+    int compressed;
+    int container;
+} stego_options;
+
+// what the header of a stored message says. version is 0 for a message
+// stored by an older version (in a bmp it ends with a 0 byte, in a jpg
+// or png it goes up to the end of the file). crypto is only filled in
+// when flags has STEGO_ENCRYPTED and shard when it has STEGO_SHARDED
+// (length is the length of the shard then).
+typedef struct
+{
+    int version;
+    int flags;
+    int depth;
+    int channels;
+    uint64_t length;
+    stego_crypto crypto;
+    stego_shard shard;
+} stego_header;
+
+// how the output image of an embed is put together from the input
+// image:
+//  - the first keepLength bytes of the input are copied as they are.
+//  - then patchLength bytes starting at patchOffset are overwritten
+//    (or appended) with the bytes stego_embed_patch() produces.
+// the output image is outputSize bytes long. depth, channels, flags,
+// crypto and shard are what the header of the message says.
+//
+// this lets a caller copy the unchanged part of the image however it
+// likes (copy_file_range() for example) and only compute the patch.
+//
+// a message in the pixels of a png or the coefficients of a jpg (flags
+// has STEGO_PIXELS) changes the whole compressed image (or scan), its
+// output image is made by stego_embed_stream() instead and all the
+// sizes are 0.
+typedef struct
+{
+    size_t keepLength;
+    size_t patchOffset;
+    size_t patchLength;
+    size_t outputSize;
+    int depth;
+    int channels;
+    int flags;
+    stego_crypto crypto;
+    stego_shard shard;
+} stego_layout;
+
+// how some bytes of a message that is stored in an image already are
+// rewritten (see stego_plan_update()), without storing the whole
+// message again:
+//  - count bytes of the message starting at its byte offset are
+//    changed and the message becomes messageLength bytes long.
+//  - patchLength bytes of the image starting at patchOffset are
+//    overwritten (or appended) with the bytes stego_embed_update()
+//    produces, and then headerLength bytes starting at headerOffset
+//    with the header that has the new length.
+// the image is outputSize bytes long afterwards. in a bmp the patch
+// starts at the beginning of a row and may take in some of the bytes
+// of the header, so the header must be written after it (and after
+// the patches of any other updates of the same image).
+typedef struct
+{
+    size_t messageLength;
+    size_t offset;
+    size_t count;
+    size_t headerOffset;
+    size_t headerLength;
+    size_t patchOffset;
+    size_t patchLength;
+    size_t outputSize;
+} stego_update;
+
+// where stego_embed_stream() sends the output image:
+//  - write is called with the bytes of the output image in order and
+//    returns 1 if it could write them (0 stops the embed).
+//  - run calls task(taskContext, i, worker) for every i from 0 to
+//    taskCount - 1 and returns when they are all done. it may run them
+//    on up to threads threads at the same time, worker being the
+//    number of the thread (0 to threads - 1). NULL runs them one after
+//    the other (threads is 1 then).
+// the blocks of a png are compressed in parallel this way (the scan of
+// a jpg is coded on a single thread).
+typedef struct
+{
+    int (*write)(void* context, const uint8_t* bytes, size_t length);
+    void (*run)(void* context, long taskCount, void (*task)(void* taskContext, long task, int worker),
+                void* taskContext);
+    void* context;
+    int threads;
+} stego_output;
+
+
+// function declarations
+int stego_type(const uint8_t* image, size_t size);
+
+int stego_plan(const uint8_t* in, size_t size, size_t messageLength, const stego_options* options,
+               stego_layout* layout);
+int stego_embed_patch(const uint8_t* in, size_t size, const stego_layout* layout,
+                      const uint8_t* message, size_t messageLength, uint8_t* patch);
+int stego_embed_patch_part(const uint8_t* in, size_t size, const stego_layout* layout,
+                           const uint8_t* message, size_t messageLength, uint8_t* patch,
+                           int part, int parts);
+int stego_embed_block(const uint8_t* head, size_t headLength, size_t size, const stego_layout* layout,
+                      const uint8_t* message, size_t messageLength, uint8_t* block, size_t blockOffset,
+                      size_t blockLength);
+int stego_embed_stream(const uint8_t* in, size_t size, const stego_layout* layout, const uint8_t* message,
+                       size_t messageLength, const stego_output* output);
+int stego_embed(const uint8_t* in, size_t size, const uint8_t* message, size_t messageLength,
+                const stego_options* options, uint8_t* out, size_t outCapacity, size_t* outLength);
+
+size_t stego_capacity(const uint8_t* head, size_t headLength, size_t size, const stego_options* options);
+
+int stego_read_header(const uint8_t* image, size_t size, stego_header* header);
+int stego_probe(const uint8_t* head, size_t headLength, const uint8_t* tail, size_t tailLength, size_t size,
+                stego_header* header);
+size_t stego_extract_bound(const uint8_t* image, size_t size);
+int stego_extract(const uint8_t* image, size_t size, uint8_t* message, size_t capacity,
+                  size_t* messageLength);
+
+int stego_extract_part(const uint8_t* image, size_t size, uint8_t* message, size_t capacity,
+                       size_t* messageLength, int part, int parts);
+int stego_extract_range(const uint8_t* image, size_t size, size_t offset, uint8_t* bytes, size_t count);
+
+int stego_plan_update(const uint8_t* image, size_t size, size_t messageLength, size_t offset, size_t count,
+                      stego_update* update);
+int stego_embed_update(const uint8_t* image, size_t size, const stego_update* update, const uint8_t* bytes,
+                       uint8_t* header, uint8_t* patch);
+
+int stego_encrypt(uint8_t* message, size_t messageLength, const char* passkey, stego_crypto* crypto);
+int stego_decrypt(uint8_t* message, size_t messageLength, const char* passkey, const stego_crypto* crypto);
+
+int stego_split(const size_t* capacities, uint32_t count, size_t messageLength, size_t* shardLengths,
+                uint8_t* id);
+uint32_t stego_checksum(const uint8_t* shard, size_t length);
+
+size_t stego_compress_bound(size_t messageLength);
+int stego_compress(const uint8_t* message, size_t messageLength, uint8_t* compressed, size_t capacity,
+                   size_t* compressedLength);
+int stego_decompressed_length(const uint8_t* compressed, size_t compressedLength, size_t* messageLength);
+int stego_decompress(const uint8_t* compressed, size_t compressedLength, uint8_t* message, size_t capacity,
+                     size_t* messageLength);
+
+void stego_new_toc(stego_toc* toc);
+int stego_read_toc(const uint8_t* image, size_t size, stego_toc* toc);
+int stego_parse_toc(const uint8_t* bytes, uint64_t messageLength, stego_toc* toc);
+void stego_write_toc(const stego_toc* toc, uint8_t* bytes);
+int stego_find_record(const stego_toc* toc, const char* name);
+int stego_put_record(stego_toc* toc, const char* name, const uint8_t* bytes, size_t length, int* index);
+int stego_extract_record(const uint8_t* image, size_t size, const stego_toc* toc, int index, uint8_t* bytes);
+
+const char* stego_error(int result);
+
+#endif
@@ -0,0 +1,388 @@
+// ---------------------------------------------------------------------------------------------
+// this program is a client of stegod (see stegod.c): it sends a single probe, read or write
+// request to the daemon and prints what came back, so the daemon can be tried out (and its
+// latency measured) without writing a client first.
+//
+//  - probe prints one line of JSON with the type of the image, the header of its message and
+//    how much it can hold.
+//  - read writes the message in the image to the output file, like readmessage prints it
+//    (stegod writes it to the file itself).
+//  - write stores the contents of the payload file in the output image, like writemessage does.
+//  - bench sends count read requests for the same image over one connection and prints how
+//    long they took (the median, the 99th percentile and the slowest one), in one line of JSON.
+//    with -k the requests have the passkey of the message, so that decrypting it is measured
+//    too.
+//
+// the image is sent as a file descriptor of the file, or with --shm as a memfd the image is
+// copied into first (the way a program that has the image in memory would send it).
+// ---------------------------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "helpers.h"
+#include "protocol.h"
+#include "stego.h"
+
+// a payload up to this long is sent in the write request, a longer one
+// as a file descriptor of the payload file.
+#define MAXINLINEPAYLOAD (1 << 16)
+
+
+// this function connects to stegod at the socket path.
+// returns the connection or -1 if it couldn't.
+static int connectTo(const char* path)
+{
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+        return -1;
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    return fd;
+}
+
+
+// this function opens the image for a request, or copies it into a
+// memfd with --shm.
+// returns the file descriptor or -1 if it couldn't.
+static int openImage(const char* path, int shared)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || !shared)
+        return fd;
+
+    int memory = memfd_create("stegoclient", MFD_CLOEXEC);
+    BYTE buffer[1 << 16];
+    ssize_t bytesRead;
+    while (memory >= 0 && (bytesRead = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        if (write(memory, buffer, bytesRead) != bytesRead)
+        {
+            close(memory);
+            memory = -1;
+        }
+    }
+
+    close(fd);
+    return memory;
+}
+
+
+// this function sends a request with its file descriptors, passkey and
+// message, and receives the reply. the bytes after the reply (the
+// message of a read request) are put in a buffer that is allocated for
+// them, and that the caller frees.
+// returns 1 if it could and 0 if the connection broke.
+static int exchange(int connection, stegod_request* request, const int* fds, const char* passkey,
+                    const BYTE* message, stegod_reply* reply, BYTE** bytes)
+{
+    request->magic = STEGOD_MAGIC;
+    request->passkeyLength = passkey != NULL ? strlen(passkey) : 0;
+    *bytes = NULL;
+
+    if (!sendWithFds(connection, request, sizeof(stegod_request), fds, request->fdCount)
+        || !sendAll(connection, passkey, request->passkeyLength)
+        || (message != NULL && !sendAll(connection, message, request->messageLength))
+        || !receiveAll(connection, reply, sizeof(stegod_reply)) || reply->magic != STEGOD_MAGIC)
+        return 0;
+
+    if (reply->inlineLength == 0)
+        return 1;
+
+    *bytes = malloc(reply->inlineLength);
+    if (*bytes != NULL && receiveAll(connection, *bytes, reply->inlineLength))
+        return 1;
+
+    free(*bytes);
+    *bytes = NULL;
+    return 0;
+}
+
+
+// returns the name of an image type.
+static const char* typeName(int type)
+{
+    if (type == STEGO_BMP)
+        return "bmp";
+    if (type == STEGO_JPG)
+        return "jpg";
+    return type == STEGO_PNG ? "png" : "unsupported";
+}
+
+
+// this function sends a probe request and prints the reply as JSON.
+// returns the exit code.
+static int probe(int connection, int image, const char* path, stegod_request* request)
+{
+    stegod_reply reply;
+    BYTE* bytes;
+    request->kind = STEGOD_PROBE;
+    request->fdCount = 1;
+    if (!exchange(connection, request, &image, NULL, NULL, &reply, &bytes))
+    {
+        fprintf(stderr, "The connection to stegod broke.\n");
+        return 6;
+    }
+
+    printf("{\"image\":\"%s\",\"type\":\"%s\",\"result\":\"%s\",\"version\":%u,\"flags\":%u,\"length\":%llu,"
+           "\"capacity\":%llu}\n", path, typeName(reply.type), stego_error(reply.result), reply.version,
+           reply.flags, (unsigned long long) reply.length, (unsigned long long) reply.capacity);
+    return reply.result == STEGO_OK || reply.result == STEGO_NOMESSAGE ? 0 : 3;
+}
+
+
+// this function sends a read request with the output file, which
+// stegod writes the message to (so that it never goes through the
+// socket, however long it is). the output file is removed again if the
+// message could not be read.
+// returns the exit code.
+static int readMessage(int connection, int image, const char* outputPath, char* passkey, stegod_request* request)
+{
+    int fds[2] = {image, open(outputPath, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+    if (fds[STEGOD_OUTPUTFD] < 0)
+    {
+        fprintf(stderr, "Could not create output file.\n");
+        return 4;
+    }
+
+    stegod_reply reply;
+    BYTE* bytes;
+    request->kind = STEGOD_EXTRACT;
+    request->fdCount = 2;
+    int exchanged = exchange(connection, request, fds, passkey, NULL, &reply, &bytes);
+    free(bytes);
+    close(fds[STEGOD_OUTPUTFD]);
+
+    if (!exchanged || reply.result != STEGO_OK)
+    {
+        unlink(outputPath);
+        fprintf(stderr, "%s\n", exchanged ? stego_error(reply.result) : "The connection to stegod broke.");
+        return exchanged ? 3 : 6;
+    }
+
+    printf("Message read successfully.\n");
+    return 0;
+}
+
+
+// this function sends a write request with the payload and the output
+// image (which is removed again if the message could not be stored).
+// returns the exit code.
+static int writeMessage(int connection, int image, const char* outputPath, const char* payloadPath, char* passkey,
+                        stegod_request* request)
+{
+    int fds[STEGOD_MAXFDS] = {image, -1, -1};
+    BYTE* message = NULL;
+    fds[STEGOD_MESSAGEFDINDEX] = open(payloadPath, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fds[STEGOD_MESSAGEFDINDEX] < 0 || fstat(fds[STEGOD_MESSAGEFDINDEX], &info) != 0)
+    {
+        fprintf(stderr, "Could not read payload file.\n");
+        return 4;
+    }
+
+    // a short payload goes in the request, a long one as a file
+    // descriptor.
+    request->kind = STEGOD_EMBED;
+    request->fdCount = 2;
+    if (info.st_size <= MAXINLINEPAYLOAD && (message = malloc(info.st_size + 1)) != NULL
+        && read(fds[STEGOD_MESSAGEFDINDEX], message, info.st_size) == info.st_size)
+        request->messageLength = info.st_size;
+    else
+    {
+        free(message);
+        message = NULL;
+        request->flags |= STEGOD_MESSAGEFD;
+        request->fdCount = 3;
+    }
+
+    fds[STEGOD_OUTPUTFD] = open(outputPath, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fds[STEGOD_OUTPUTFD] < 0)
+    {
+        fprintf(stderr, "Could not create output image.\n");
+        free(message);
+        close(fds[STEGOD_MESSAGEFDINDEX]);
+        return 2;
+    }
+
+    stegod_reply reply;
+    BYTE* bytes;
+    int exchanged = exchange(connection, request, fds, passkey, message, &reply, &bytes);
+    free(message);
+    free(bytes);
+    close(fds[STEGOD_OUTPUTFD]);
+    close(fds[STEGOD_MESSAGEFDINDEX]);
+
+    if (!exchanged || reply.result != STEGO_OK)
+    {
+        unlink(outputPath);
+        fprintf(stderr, "%s\n", exchanged ? stego_error(reply.result) : "The connection to stegod broke.");
+        printf("Could not store message.\n");
+        return exchanged ? 5 : 6;
+    }
+
+    printf("Message successfully stored.\n");
+    return 0;
+}
+
+
+// compares two durations, for qsort().
+static int compareSeconds(const void* a, const void* b)
+{
+    double difference = *(const double*) a - *(const double*) b;
+    return (difference > 0) - (difference < 0);
+}
+
+
+// this function sends count read requests for the image (with the
+// passkey, if there is one) over the connection and prints how long
+// they took. a message that is too long to come back in the reply is
+// written to a memfd instead.
+// returns the exit code.
+static int bench(int connection, int image, const char* path, long count, char* passkey, stegod_request* request)
+{
+    double* seconds = malloc(sizeof(double) * count);
+    if (seconds == NULL)
+        return 4;
+
+    int fds[2] = {image, -1};
+    request->kind = STEGOD_EXTRACT;
+    request->fdCount = 1;
+    unsigned long long bytesRead = 0;
+    int code = 0;
+    for (long i = 0; i < count && code == 0; i++)
+    {
+        struct timespec start, end;
+        stegod_reply reply;
+        BYTE* bytes;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int exchanged = exchange(connection, request, fds, passkey, NULL, &reply, &bytes);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        free(bytes);
+
+        // the first reply says if the message is too long for it, the
+        // requests are then sent again with a memfd for it.
+        if (exchanged && reply.result == STEGO_SMALLBUFFER && request->fdCount == 1
+            && (fds[STEGOD_OUTPUTFD] = memfd_create("stegoclient", MFD_CLOEXEC)) >= 0)
+        {
+            request->fdCount = 2;
+            i--;
+            continue;
+        }
+
+        if (!exchanged || reply.result != STEGO_OK)
+        {
+            fprintf(stderr, "%s\n", exchanged ? stego_error(reply.result) : "The connection to stegod broke.");
+            code = exchanged ? 3 : 6;
+        }
+        seconds[i] = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        bytesRead += reply.length;
+    }
+
+    if (code == 0)
+    {
+        qsort(seconds, count, sizeof(double), compareSeconds);
+        printf("{\"image\":\"%s\",\"requests\":%ld,\"bytes\":%llu,\"p50Seconds\":%.6f,\"p99Seconds\":%.6f,"
+               "\"maxSeconds\":%.6f}\n", path, count, bytesRead / count, seconds[count / 2],
+               seconds[count * 99 / 100], seconds[count - 1]);
+    }
+    if (fds[STEGOD_OUTPUTFD] >= 0)
+        close(fds[STEGOD_OUTPUTFD]);
+    free(seconds);
+    return code;
+}
+
+
+int main(int argc, char* argv[])
+{
+    // --shm sends the image as a memfd. for write, -b and -c give the
+    // number of bits and the channels (see writemessage), -p stores the
+    // message in the pixels of a png or the coefficients of a jpg and
+    // -z compresses it. for bench, -k gives the passkey.
+    static const struct option longOptions[] = {{"shm", no_argument, NULL, 'm'}, {NULL, 0, NULL, 0}};
+    stegod_request request = {0};
+    int shared = 0;
+    char* passkey = NULL;
+    int option;
+    while ((option = getopt_long(argc, argv, "b:c:k:pz", longOptions, NULL)) != -1)
+    {
+        if (option == 'm')
+            shared = 1;
+        else if (option == 'k')
+            passkey = optarg;
+        else if (option == 'b')
+            request.depth = atoi(optarg);
+        else if (option == 'c')
+            request.channels = atoi(optarg);
+        else if (option == 'p')
+            request.flags |= STEGOD_PIXELS;
+        else if (option == 'z')
+            request.flags |= STEGOD_COMPRESS;
+        else
+            argc = 0;
+    }
+    argc -= optind;
+    argv += optind;
+
+    int valid = argc >= 3
+                && ((strcmp(argv[1], "probe") == 0 && argc == 3)
+                    || (strcmp(argv[1], "read") == 0 && (argc == 4 || argc == 5))
+                    || (strcmp(argv[1], "write") == 0 && (argc == 5 || argc == 6))
+                    || (strcmp(argv[1], "bench") == 0 && argc == 4 && atol(argv[3]) > 0));
+    if (!valid)
+    {
+        printf("Incorrect usage.\nCorrect usage: ./stegoclient (optional)--shm <socketpath> probe <image>\n"
+               "or: ./stegoclient (optional)--shm <socketpath> read <steganographyimage> <outputfile> (optional)<passkey>\n"
+               "or: ./stegoclient (optional)--shm (optional)-b <bits> (optional)-c <channels> (optional)-p (optional)-z <socketpath> write <inputimage> <outputimage> <payloadfile> (optional)<passkey>\n"
+               "or: ./stegoclient (optional)--shm (optional)-k <passkey> <socketpath> bench <steganographyimage> <count>\n");
+        return -1;
+    }
+
+    int image = openImage(argv[2], shared);
+    if (image < 0)
+    {
+        printf("Could not open image.\n");
+        return 1;
+    }
+
+    int connection = connectTo(argv[0]);
+    if (connection < 0)
+    {
+        printf("Could not connect to stegod at: %s\n", argv[0]);
+        close(image);
+        return 6;
+    }
+
+    int code;
+    if (strcmp(argv[1], "probe") == 0)
+        code = probe(connection, image, argv[2], &request);
+    else if (strcmp(argv[1], "read") == 0)
+        code = readMessage(connection, image, argv[3], argc == 5 ? argv[4] : NULL, &request);
+    else if (strcmp(argv[1], "write") == 0)
+        code = writeMessage(connection, image, argv[3], argv[4], argc == 6 ? argv[5] : NULL, &request);
+    else
+        code = bench(connection, image, argv[2], atol(argv[3]), passkey, &request);
+
+    close(connection);
+    close(image);
+    return code;
+}
@@ -0,0 +1,637 @@
+// ---------------------------------------------------------------------------------------------
+// this program is a daemon that keeps libstego running, so that a program that needs a
+// message stored or read every now and then (a web server for example) doesn't have to start a
+// readmessage or writemessage process every time. it listens on a unix socket and takes probe,
+// extract and embed requests (see protocol.h, and stegoclient.c for a client).
+//
+// the image of a request is never sent through the socket: the client sends a file descriptor
+// of it with the request (SCM_RIGHTS), the file itself or a memfd that it filled (a region of
+// shared memory), and the daemon maps it. the output image of an embed request is written to
+// another file descriptor the client sends, and so is the message of an extract request if the
+// client wants it there and not in the reply. a message longer than a few MB never goes through
+// the socket either way (see STEGOD_MAXINLINELENGTH in protocol.h).
+//
+// the listening socket and every connection are watched with epoll. a worker only takes a
+// connection when a request has come in on it (or the listening socket when clients are
+// connecting), serves that one request and hands the connection back, so idle connections (a
+// pool a web server keeps open) never hold a worker, and a client that stops halfway through a
+// request only holds one for a few seconds. every worker has an arena of memory that is
+// allocated when the daemon starts (-m, in MB) for the passkeys and messages, so that a request
+// doesn't allocate anything unless its message is bigger than the arena. the daemon stops on
+// SIGINT or SIGTERM, once the requests that are being served are done.
+// ---------------------------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "helpers.h"
+#include "mappedio.h"
+#include "protocol.h"
+#include "stats.h"
+#include "stego.h"
+#include "threadpool.h"
+
+// the size of the arena of every worker, unless -m gives another one.
+#define ARENASIZE (4 << 20)
+
+// the longest passkey a request can have in it.
+#define MAXPASSKEYLENGTH 4096
+
+// how often (in milliseconds) a worker waiting for the next request
+// checks if the daemon is stopping.
+#define IDLEPOLLTIME 500
+
+// how long (in milliseconds) a receive or send on a connection can
+// wait, so that a client that sends half a request (or doesn't read
+// its reply) only holds a worker that long.
+#define CONNECTIONTIMEOUT 5000
+
+
+// the memory a worker keeps for its requests. it grows when a request
+// needs more, and shrinks back to the size it started with after it.
+typedef struct
+{
+    BYTE* data;
+    size_t capacity;
+} Arena;
+
+// everything the workers share.
+typedef struct
+{
+    int listener;
+    int events;
+    Arena* arenas;
+    size_t arenaSize;
+} Daemon;
+
+// a request that is being served: the file descriptors that came with
+// it, the image mapped, and where its passkey and message are (offsets
+// into the arena, as it can move when it grows).
+typedef struct
+{
+    stegod_request request;
+    int fds[STEGOD_MAXFDS];
+    int fdCount;
+    FILE* imageFile;
+    MappedFile image;
+    char* passkey;
+    size_t messageOffset;
+} Request;
+
+
+// set by the signal handler when the daemon should stop. the socket is
+// shut down then, so no more clients connect, and the workers see it
+// the next time their wait times out. it is read by other threads than
+// the one the handler runs on, so it is only used atomically (see
+// isStopping()).
+static int stopping = 0;
+static int listener = -1;
+
+
+// the handler of SIGINT and SIGTERM.
+static void stop(int signal)
+{
+    (void) signal;
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+    shutdown(listener, SHUT_RDWR);
+}
+
+
+// returns 1 once the daemon should stop.
+static int isStopping(void)
+{
+    return __atomic_load_n(&stopping, __ATOMIC_RELAXED);
+}
+
+
+// this function makes sure the arena has space for at least size
+// bytes, keeping the bytes in it.
+// returns 1 on success and 0 if there is not enough memory.
+static int reserveArena(Arena* arena, size_t size)
+{
+    if (arena->capacity >= size)
+        return 1;
+
+    size_t capacity = arena->capacity * 2 > size ? arena->capacity * 2 : size;
+    BYTE* data = realloc(arena->data, capacity);
+    if (data == NULL)
+        return 0;
+
+    arena->data = data;
+    arena->capacity = capacity;
+    return 1;
+}
+
+
+// this function brings the file of a file descriptor that came with a
+// request into memory (mapped, or read for a pipe).
+// returns the file the map was made from (it is closed after the map
+// is unmapped, the bytes that are not changed are copied from it) or
+// NULL if it couldn't.
+static FILE* loadFd(int fd, MappedFile* map)
+{
+    FILE* file = fdopen(dup(fd), "rb");
+    if (file != NULL && loadFile(file, map) == 0)
+    {
+        fclose(file);
+        file = NULL;
+    }
+
+    return file;
+}
+
+
+// this function writes bytes to a file descriptor that came with a
+// request, in place of what the file had.
+// returns 1 if it could and 0 if it couldn't.
+static int writeFd(int fd, const BYTE* bytes, size_t length)
+{
+    if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0)
+        return 0;
+
+    FILE* file = fdopen(dup(fd), "wb");
+    if (file == NULL)
+        return 0;
+
+    int written = fwrite(bytes, 1, length, file) == length;
+    COUNT(writeCalls, 1);
+    COUNT(bytesWritten, length);
+    return fclose(file) == 0 && written;
+}
+
+
+// this function reads the header of the message in the image, and how
+// much can be stored in it with the depth and channels of the request.
+static void probeImage(Request* request, stegod_reply* reply)
+{
+    stego_options options = {request->request.depth, request->request.channels, NULL,
+                             (request->request.flags & STEGOD_PIXELS) != 0, NULL, 0, 0};
+    stego_header header = {0};
+    reply->result = stego_read_header(request->image.data, request->image.size, &header);
+    reply->version = header.version;
+    reply->flags = header.flags;
+    reply->length = header.length;
+    reply->capacity = stego_capacity(request->image.data, request->image.size, request->image.size, &options);
+}
+
+
+// this function reads the message in the image into the arena (after
+// the passkey), decrypting and decompressing it, the same as
+// readmessage does. the message is then at message in the arena.
+// returns STEGO_OK or an error of libstego.
+static int extractMessage(Request* request, Arena* arena, size_t* message, size_t* length)
+{
+    const MappedFile* image = &request->image;
+    stego_header header = {0};
+    int result = stego_read_header(image->data, image->size, &header);
+
+    // a shard or a container can't be read as a single message.
+    if (result == STEGO_OK && (header.flags & (STEGO_SHARDED | STEGO_CONTAINER)))
+        return STEGO_NOMESSAGE;
+    if (result != STEGO_OK && result != STEGO_NOMESSAGE)
+        return result;
+
+    size_t capacity = stego_extract_bound(image->data, image->size);
+    if (!reserveArena(arena, request->messageOffset + capacity))
+        return STEGO_NOMEMORY;
+
+    BYTE* bytes = arena->data + request->messageOffset;
+    result = stego_extract(image->data, image->size, bytes, capacity, length);
+    if (result != STEGO_OK)
+        return result;
+
+    // an encrypted message is only given back if the passkey is right.
+    if (header.flags & STEGO_ENCRYPTED)
+        result = request->passkey == NULL ? STEGO_BADKEY
+                                          : stego_decrypt(bytes, *length, request->passkey, &header.crypto);
+    else if (request->passkey != NULL)
+        decryptOldMessage(bytes, *length, request->passkey, header.version);
+
+    // an image without a header only holds a message of an older
+    // version if it looks like one.
+    if (result == STEGO_OK && header.version == 0
+        && !isOldMessage(bytes, *length, stego_type(image->data, image->size) == STEGO_BMP))
+        result = STEGO_NOMESSAGE;
+
+    // a compressed message is decompressed into the arena after it.
+    *message = request->messageOffset;
+    if (result == STEGO_OK && (header.flags & STEGO_COMPRESSED))
+    {
+        size_t decompressedLength = 0;
+        result = stego_decompressed_length(bytes, *length, &decompressedLength);
+        if (result == STEGO_OK && !reserveArena(arena, request->messageOffset + *length + decompressedLength))
+            result = STEGO_NOMEMORY;
+        if (result == STEGO_OK)
+        {
+            *message = request->messageOffset + *length;
+            result = stego_decompress(arena->data + request->messageOffset, *length, arena->data + *message,
+                                      decompressedLength, length);
+        }
+    }
+
+    return result;
+}
+
+
+// this function stores the message of the request in the image,
+// compressed and encrypted if the request says so, and writes the
+// output image to the output file descriptor, the same as writemessage
+// does.
+// returns STEGO_OK or an error of libstego.
+static int embedMessage(Request* request, Arena* arena, stegod_reply* reply)
+{
+    if (request->fdCount <= STEGOD_OUTPUTFD)
+        return STEGO_BADOPTIONS;
+
+    // the message is in the arena after the passkey, or in a file of
+    // its own.
+    MappedFile messageFile = {NULL, 0, -1, 0};
+    FILE* messageStream = NULL;
+    BYTE* message = arena->data + request->messageOffset;
+    size_t length = request->request.messageLength;
+    if (request->request.flags & STEGOD_MESSAGEFD)
+    {
+        if (request->fdCount <= STEGOD_MESSAGEFDINDEX
+            || (messageStream = loadFd(request->fds[STEGOD_MESSAGEFDINDEX], &messageFile)) == NULL)
+            return STEGO_BADOPTIONS;
+        message = messageFile.data;
+        length = messageFile.size;
+    }
+
+    stego_crypto crypto;
+    stego_options options = {request->request.depth, request->request.channels, NULL,
+                             (request->request.flags & STEGOD_PIXELS) != 0, NULL, 0, 0};
+    int result = STEGO_OK;
+
+    // the compressed message goes into the arena after the message, and
+    // is stored in place of it if it got smaller.
+    if (request->request.flags & STEGOD_COMPRESS)
+    {
+        size_t bound = stego_compress_bound(length);
+        size_t offset = request->messageOffset + (messageFile.data == NULL ? length : 0);
+        size_t compressedLength = 0;
+        if (!reserveArena(arena, offset + bound))
+            result = STEGO_NOMEMORY;
+        else
+        {
+            if (messageFile.data == NULL)
+                message = arena->data + request->messageOffset;
+            result = stego_compress(message, length, arena->data + offset, bound, &compressedLength);
+        }
+
+        if (result == STEGO_OK && compressedLength < length)
+        {
+            message = arena->data + offset;
+            length = compressedLength;
+            options.compressed = 1;
+        }
+    }
+
+    if (result == STEGO_OK && request->passkey != NULL)
+    {
+        result = stego_encrypt(message, length, request->passkey, &crypto);
+        options.crypto = &crypto;
+    }
+
+    stego_layout layout;
+    if (result == STEGO_OK)
+        result = stego_plan(request->image.data, request->image.size, length, &options, &layout);
+
+    // the output image is written over whatever the output file had.
+    int out = request->fds[STEGOD_OUTPUTFD];
+    FILE* file = NULL;
+    if (result == STEGO_OK
+        && (ftruncate(out, 0) != 0 || lseek(out, 0, SEEK_SET) != 0 || (file = fdopen(dup(out), "w+")) == NULL))
+        result = STEGO_BADOPTIONS;
+    if (result == STEGO_OK && !writeEmbeddedImage(&request->image, &layout, message, length, file, 1))
+        result = STEGO_NOSPACE;
+    if (file != NULL && fclose(file) != 0 && result == STEGO_OK)
+        result = STEGO_BADOPTIONS;
+
+    if (result == STEGO_OK)
+        reply->length = layout.outputSize;
+    if (messageStream != NULL)
+    {
+        unmapFile(&messageFile);
+        fclose(messageStream);
+    }
+    return result;
+}
+
+
+// this function receives one request on the connection, serves it and
+// sends the reply.
+// returns 1 if the connection can take another request and 0 if it
+// should be closed (the client went away or sent something that is not
+// a request).
+static int serveRequest(int connection, Arena* arena, size_t arenaSize)
+{
+    Request request = {{0}, {-1, -1, -1}, 0, NULL, {NULL, 0, -1, 0}, NULL, 0};
+    stegod_request* header = &request.request;
+    if (!receiveWithFds(connection, header, sizeof(stegod_request), request.fds, &request.fdCount))
+        return 0;
+
+    // the passkey and the message that come after the request are read
+    // into the arena (the passkey with a NUL character after it, and
+    // the message after space for the reply, see below).
+    size_t inlineLength = header->kind == STEGOD_EMBED && !(header->flags & STEGOD_MESSAGEFD)
+                              ? header->messageLength : 0;
+    int valid = header->magic == STEGOD_MAGIC && header->fdCount == (uint32_t) request.fdCount
+                && header->passkeyLength <= MAXPASSKEYLENGTH && inlineLength <= STEGOD_MAXINLINELENGTH;
+    request.messageOffset = header->passkeyLength + 1 + sizeof(stegod_reply);
+    if (!valid || !reserveArena(arena, request.messageOffset + inlineLength)
+        || !receiveAll(connection, arena->data, header->passkeyLength)
+        || !receiveAll(connection, arena->data + request.messageOffset, inlineLength))
+    {
+        for (int i = 0; i < request.fdCount; i++)
+            close(request.fds[i]);
+        return 0;
+    }
+    arena->data[header->passkeyLength] = '\0';
+    if (header->passkeyLength > 0)
+        request.passkey = (char*) arena->data;
+
+    // a depth or channels of 0 are the ones writemessage uses.
+    if (header->depth == 0)
+        header->depth = 1;
+    if (header->channels == 0)
+        header->channels = STEGO_COLORCHANNELS;
+
+    double start = phaseStart();
+    stegod_reply reply = {STEGOD_MAGIC, STEGO_OK, STEGO_UNSUPPORTED, 0, 0, 0, 0, 0, 0};
+    size_t message = 0;
+    size_t length = 0;
+    if (request.fdCount <= STEGOD_IMAGEFD
+        || (request.imageFile = loadFd(request.fds[STEGOD_IMAGEFD], &request.image)) == NULL)
+        reply.result = STEGO_BADOPTIONS;
+    else if ((reply.type = stego_type(request.image.data, request.image.size)) == STEGO_UNSUPPORTED)
+        reply.result = STEGO_UNSUPPORTED;
+    else if (header->kind == STEGOD_PROBE)
+        probeImage(&request, &reply);
+    else if (header->kind == STEGOD_EXTRACT)
+    {
+        reply.result = extractMessage(&request, arena, &message, &length);
+        reply.length = length;
+
+        // the message goes into the output file descriptor if there is
+        // one, and after the reply if there isn't and it is not too long
+        // for it.
+        if (reply.result == STEGO_OK && request.fdCount > STEGOD_OUTPUTFD)
+            reply.result = writeFd(request.fds[STEGOD_OUTPUTFD], arena->data + message, length) ? STEGO_OK
+                                                                                                 : STEGO_BADOPTIONS;
+        else if (reply.result == STEGO_OK && length > STEGOD_MAXINLINELENGTH)
+            reply.result = STEGO_SMALLBUFFER;
+        else if (reply.result == STEGO_OK)
+            reply.inlineLength = length;
+    }
+    else if (header->kind == STEGOD_EMBED)
+        reply.result = embedMessage(&request, arena, &reply);
+    else
+        reply.result = STEGO_BADOPTIONS;
+    phaseEnd(header->kind == STEGOD_PROBE ? "probe" : header->kind == STEGOD_EXTRACT ? "extract" : "embed", start);
+
+    if (request.imageFile != NULL)
+    {
+        unmapFile(&request.image);
+        fclose(request.imageFile);
+    }
+    for (int i = 0; i < request.fdCount; i++)
+        close(request.fds[i]);
+
+    // the reply goes in front of the message (the passkey and the
+    // compressed message there are not needed anymore), so they are sent
+    // together.
+    int sent;
+    if (reply.inlineLength > 0)
+    {
+        memcpy(arena->data + message - sizeof(reply), &reply, sizeof(reply));
+        sent = sendAll(connection, arena->data + message - sizeof(reply), sizeof(reply) + reply.inlineLength);
+    }
+    else
+        sent = sendAll(connection, &reply, sizeof(reply));
+
+    // an arena that grew a lot for a big message is made small again,
+    // so a single big request doesn't keep its memory forever.
+    if (arena->capacity > 4 * arenaSize)
+    {
+        BYTE* data = realloc(arena->data, arenaSize);
+        if (data != NULL)
+        {
+            arena->data = data;
+            arena->capacity = arenaSize;
+        }
+    }
+
+    return sent;
+}
+
+
+// this function (re)arms the file descriptor in the epoll instance, for
+// one event: the worker that gets it is the only one that has it until
+// it arms it again.
+// returns 1 if it could and 0 if it couldn't.
+static int watch(int events, int fd, int operation)
+{
+    struct epoll_event event = {EPOLLIN | EPOLLONESHOT, {.fd = fd}};
+    return epoll_ctl(events, operation, fd, &event) == 0;
+}
+
+
+// this function accepts the clients that are connecting and adds their
+// connections to the epoll instance.
+static void acceptConnections(Daemon* daemon)
+{
+    struct timeval timeout = {CONNECTIONTIMEOUT / 1000, CONNECTIONTIMEOUT % 1000 * 1000};
+    int connection;
+    while ((connection = accept4(daemon->listener, NULL, NULL, SOCK_CLOEXEC)) >= 0)
+    {
+        if (setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0
+            || setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0
+            || !watch(daemon->events, connection, EPOLL_CTL_ADD))
+            close(connection);
+    }
+
+    // out of file descriptors for example, so wait a little before
+    // trying again.
+    if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED && !isStopping())
+        usleep(10000);
+    if (!isStopping())
+        watch(daemon->events, daemon->listener, EPOLL_CTL_MOD);
+}
+
+
+// this function is what every worker runs until the daemon stops: it
+// waits for a connection that has a request on it (or for clients that
+// are connecting), serves the request and hands the connection back.
+static void serveConnections(void* context, long task, int worker)
+{
+    (void) task;
+    Daemon* daemon = context;
+    Arena* arena = &daemon->arenas[worker];
+
+    // the wait times out every now and then, so that the daemon can
+    // stop even if nothing comes in.
+    while (!isStopping())
+    {
+        struct epoll_event event;
+        if (epoll_wait(daemon->events, &event, 1, IDLEPOLLTIME) != 1)
+            continue;
+
+        int fd = event.data.fd;
+        if (fd == daemon->listener)
+            acceptConnections(daemon);
+        else if (!serveRequest(fd, arena, daemon->arenaSize) || !watch(daemon->events, fd, EPOLL_CTL_MOD))
+        {
+            epoll_ctl(daemon->events, EPOLL_CTL_DEL, fd, NULL);
+            close(fd);
+        }
+    }
+}
+
+
+// this function creates the socket at path and starts listening on it.
+// a socket that is left over from a daemon that didn't stop properly
+// is removed, but not one that another daemon is listening on.
+// returns the socket or -1 if it couldn't.
+static int listenOn(const char* path)
+{
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+        return -1;
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return -1;
+
+    if (bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0 && errno == EADDRINUSE)
+    {
+        struct stat info;
+        int other = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int listening = other >= 0 && connect(other, (struct sockaddr*) &address, sizeof(address)) == 0;
+        if (other >= 0)
+            close(other);
+
+        if (listening || lstat(path, &info) != 0 || !S_ISSOCK(info.st_mode) || unlink(path) != 0
+            || bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, SOMAXCONN) != 0)
+    {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+// this function does everything, main() only prints the statistics
+// afterwards. returns the exit code.
+static int runDaemon(int argc, char* argv[])
+{
+    // -j gives the number of workers (as many as there are cores
+    // otherwise), -m the size of the arena of every worker in MB.
+    // --stats prints how long the requests took altogether and how
+    // much I/O was done when the daemon stops (see stats.c).
+    static const struct option longOptions[] = {{"stats", no_argument, NULL, 's'}, {NULL, 0, NULL, 0}};
+    int threadCount = numberOfCores();
+    size_t arenaSize = ARENASIZE;
+    int option;
+    while ((option = getopt_long(argc, argv, "j:m:", longOptions, NULL)) != -1)
+    {
+        if (option == 's')
+            enableStats();
+        else if (option == 'j')
+            threadCount = atoi(optarg);
+        else if (option == 'm')
+            arenaSize = (size_t) atol(optarg) << 20;
+        else
+            argc = 0;
+    }
+
+    if (argc - optind != 1 || threadCount < 1 || arenaSize == 0)
+    {
+        fprintf(stderr, "Incorrect usage.\nCorrect usage: ./stegod (optional)-j <workers> (optional)-m <arenamegabytes> (optional)--stats <socketpath>\n");
+        return -1;
+    }
+    char* path = argv[optind];
+
+    // the arenas are touched once, so that the first requests don't
+    // wait for the memory to be mapped in.
+    Daemon daemon = {-1, -1, calloc(threadCount, sizeof(Arena)), arenaSize};
+    for (int i = 0; daemon.arenas != NULL && i < threadCount; i++)
+    {
+        daemon.arenas[i] = (Arena) {malloc(arenaSize), arenaSize};
+        if (daemon.arenas[i].data == NULL)
+        {
+            fprintf(stderr, "Something went wrong...\n");
+            return 4;
+        }
+        memset(daemon.arenas[i].data, 0, arenaSize);
+    }
+    if (daemon.arenas == NULL)
+    {
+        fprintf(stderr, "Something went wrong...\n");
+        return 4;
+    }
+
+    listener = daemon.listener = listenOn(path);
+    if (daemon.listener < 0)
+    {
+        fprintf(stderr, "Could not listen on: %s\n", path);
+        return 1;
+    }
+
+    daemon.events = epoll_create1(EPOLL_CLOEXEC);
+    if (daemon.events < 0 || !watch(daemon.events, daemon.listener, EPOLL_CTL_ADD))
+    {
+        fprintf(stderr, "Something went wrong...\n");
+        close(daemon.listener);
+        unlink(path);
+        return 4;
+    }
+
+    struct sigaction action = {0};
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    fprintf(stderr, "Listening on %s with %d workers.\n", path, threadCount);
+    runTasks(threadCount, threadCount, serveConnections, &daemon);
+
+    close(daemon.events);
+    close(daemon.listener);
+    unlink(path);
+    for (int i = 0; i < threadCount; i++)
+        free(daemon.arenas[i].data);
+    free(daemon.arenas);
+    fprintf(stderr, "Stopped.\n");
+    return 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+    int code = runDaemon(argc, argv);
+    printStats("stegod", code);
+    return code;
+}
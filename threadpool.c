@@ -0,0 +1,177 @@
+// this file has a small work stealing thread pool.
+//
+// the tasks are numbered 0 to taskCount - 1 and every thread starts
+// with an equal range of them. a thread takes tasks from the front of
+// its own range, and once its range is empty it steals the back half
+// of the range of another thread. so threads that get quick tasks
+// keep themselves busy by taking work from the ones that got slow
+// tasks, without a single shared queue that every thread fights over.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "threadpool.h"
+
+
+// the range of tasks [next, end) that a thread still has to run.
+// the lock protects the range from other threads stealing it.
+typedef struct
+{
+    pthread_mutex_t lock;
+    long next;
+    long end;
+} TaskRange;
+
+// everything the threads share.
+typedef struct
+{
+    TaskRange* ranges;
+    int threadCount;
+    TaskFunction function;
+    void* context;
+} Pool;
+
+// what every thread is given when it is started.
+typedef struct
+{
+    Pool* pool;
+    int worker;
+} Worker;
+
+
+// returns the number of cores that are online (at least 1).
+int numberOfCores(void)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int) cores : 1;
+}
+
+
+// this function takes the next task from the front of a range.
+// returns the task or -1 if the range is empty.
+static long takeTask(TaskRange* range)
+{
+    long task = -1;
+
+    pthread_mutex_lock(&range->lock);
+    if (range->next < range->end)
+        task = range->next++;
+    pthread_mutex_unlock(&range->lock);
+
+    return task;
+}
+
+
+// this function steals the back half of the range of another thread
+// and makes it the range of the given worker.
+// returns 1 if something was stolen and 0 if every range was empty.
+static int stealTasks(Pool* pool, int worker)
+{
+    for (int i = 1; i < pool->threadCount; i++)
+    {
+        TaskRange* victim = &pool->ranges[(worker + i) % pool->threadCount];
+
+        pthread_mutex_lock(&victim->lock);
+        long left = victim->end - victim->next;
+        long stolenStart = victim->end - (left + 1) / 2;
+        long stolenEnd = victim->end;
+        if (left > 0)
+            victim->end = stolenStart;
+        pthread_mutex_unlock(&victim->lock);
+
+        if (left > 0)
+        {
+            TaskRange* own = &pool->ranges[worker];
+            pthread_mutex_lock(&own->lock);
+            own->next = stolenStart;
+            own->end = stolenEnd;
+            pthread_mutex_unlock(&own->lock);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+// the function every thread runs: run its own tasks, then steal.
+static void* runWorker(void* argument)
+{
+    Worker* self = argument;
+    Pool* pool = self->pool;
+
+    do
+    {
+        long task;
+        while ((task = takeTask(&pool->ranges[self->worker])) >= 0)
+            pool->function(pool->context, task, self->worker);
+    } while (stealTasks(pool, self->worker) == 1);
+
+    return NULL;
+}
+
+
+// this function runs function(context, task, worker) for every task
+// from 0 to taskCount - 1 on threadCount threads and returns once all
+// of them are done. the calling thread is used as worker 0.
+// returns 0 on success and -1 if the threads could not be created
+// (in that case the tasks are run on the calling thread only).
+int runTasks(long taskCount, int threadCount, TaskFunction function, void* context)
+{
+    if (threadCount < 1)
+        threadCount = 1;
+    if (threadCount > taskCount)
+        threadCount = taskCount > 0 ? (int) taskCount : 1;
+
+    Pool pool = {NULL, threadCount, function, context};
+    pool.ranges = malloc(sizeof(TaskRange) * threadCount);
+    Worker* workers = malloc(sizeof(Worker) * threadCount);
+    pthread_t* threads = malloc(sizeof(pthread_t) * threadCount);
+
+    if (pool.ranges == NULL || workers == NULL || threads == NULL)
+    {
+        free(pool.ranges);
+        free(workers);
+        free(threads);
+        for (long task = 0; task < taskCount; task++)
+            function(context, task, 0);
+        return -1;
+    }
+
+    // split the tasks into equal ranges.
+    for (int i = 0; i < threadCount; i++)
+    {
+        pthread_mutex_init(&pool.ranges[i].lock, NULL);
+        pool.ranges[i].next = taskCount * i / threadCount;
+        pool.ranges[i].end = taskCount * (i + 1) / threadCount;
+        workers[i].pool = &pool;
+        workers[i].worker = i;
+    }
+
+    // threads that could not be created simply leave their range to be
+    // stolen by the others.
+    int result = 0;
+    int started = 1;
+    for (int i = 1; i < threadCount; i++, started++)
+    {
+        if (pthread_create(&threads[i], NULL, runWorker, &workers[i]) != 0)
+        {
+            result = -1;
+            break;
+        }
+    }
+
+    runWorker(&workers[0]);
+
+    for (int i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    for (int i = 0; i < threadCount; i++)
+        pthread_mutex_destroy(&pool.ranges[i].lock);
+
+    free(pool.ranges);
+    free(workers);
+    free(threads);
+    return result;
+}
@@ -0,0 +1,17 @@
+// header file for the work stealing thread pool
+
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+// the function that runs a single task. task is the number of the
+// task (0 to taskCount - 1) and worker is the number of the thread
+// running it (0 to threadCount - 1), so that per-thread data can be
+// kept in an array indexed by worker.
+typedef void (*TaskFunction)(void* context, long task, int worker);
+
+
+// function declarations
+int numberOfCores(void);
+int runTasks(long taskCount, int threadCount, TaskFunction function, void* context);
+
+#endif
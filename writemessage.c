@@ -10,244 +10,837 @@
 // the image. Hence the data is just stored after a special sequence of bytes that JPG and PNG
 // use to signify the end of image. PNG and JPG parsers stop reading after this EOF sequence of
 // bytes have been reached so the message is not visible while viewing the image normally.
+// with -p a message is stored in the pixels of a PNG after all: its rows are uncompressed and
+// compressed again a few at a time (see pngpixels.c), so the message survives the image being
+// saved again by another program. a baseline JPG stores it in the lowest bits of its DCT
+// coefficients instead, which are huffman decoded and coded again a block at a time without
+// ever being turned into pixels (see jpgcoefficients.c).
+// with --shards a message is split across several images, each of them holding a shard of it
+// with its own header (see shards.c), so a message that doesn't fit in one image can still be
+// stored and no single image holds all of it. with -z the message is compressed first (see
+// compression.c), so it takes fewer bytes of the image.
+// with --in-place the message is written into the input image itself: only the bytes that
+// change are written (see mappedio.c), a few KB instead of the whole image.
+// with --record the message is a named record of a container that can hold several of them
+// (see container.c). a record is added to (or replaced in) the container that is stored in the
+// image already by writing only its bytes and the table of contents, the other records are
+// never stored again.
 //
 // BMP format stores the pixel data without compressing it in raw. Hence it is easy to edit
 // the pixel data without corrupting the image.
 // ---------------------------------------------------------------------------------------------
-// go through helpers.c if you want to know how the user defined functions work.
+// go through stego.c, mappedio.c and helpers.c if you want to know how the user defined
+// functions work.
 
-#include <ctype.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "helpers.h"
+#include "mappedio.h"
+#include "stats.h"
+#include "stego.h"
+#include "threadpool.h"
 
 
-// argc is the number of command line arguments given.
-// argv is an array of strings containing all the arguments.
-int main(int argc, char* argv[])
+// this function turns the letters r, g, b and a into the channels
+// they stand for. returns 0 if there is any other letter.
+static int channelsOf(char* letters)
 {
-    // if the number of arguments is not 3, i.e, ONLY an input image
-    // AND ONLY an output image path is not provided, exit the program
-    // with an error code -1.
-    if (argc != 3 && argc != 4)
+    int channels = 0;
+    for (char* letter = letters; *letter != '\0'; letter++)
     {
-        printf("Incorrect usage.\nCorrect usage: ./writemessage <inputimagepath> <outputimagepath> (optional)<passkey>\n");
-        return -1;
+        if (*letter == 'r')
+            channels |= STEGO_RED;
+        else if (*letter == 'g')
+            channels |= STEGO_GREEN;
+        else if (*letter == 'b')
+            channels |= STEGO_BLUE;
+        else if (*letter == 'a')
+            channels |= STEGO_ALPHA;
+        else
+            return 0;
     }
 
-    // store the input image and output image paths and passkey
-    // in their own separate strings.
-    char* inputImagePath = argv[1];
-    char* outputImagePath = argv[2];
-    char* passkey = NULL;
-    if (argc == 4)
-        passkey = argv[3];
+    return channels;
+}
 
-    // open the input image, if the input image path is
-    // not valid exit with error code 1.
-    FILE* inimage = fopen(inputImagePath, "rb");
-    if (inimage == NULL)
+
+// this function reads the text to be secretly stored, either typed in
+// or read from the payload file (the payload file is mapped into
+// memory, stdin is read in large blocks).
+// returns 1 if it could and 0 if it couldn't.
+static int readPayload(char* payloadPath, MappedFile* payload)
+{
+    *payload = (MappedFile) {NULL, 0, -1, 0};
+    if (payloadPath == NULL)
     {
-        printf("Invalid input image path.\n");
-        return 1;
+        char* hiddenText = get_string("Enter the text:\n");
+        payload->data = (BYTE*) hiddenText;
+        payload->size = hiddenText != NULL ? strlen(hiddenText) : 0;
+    }
+    else
+    {
+        FILE* payloadFile = strcmp(payloadPath, "-") == 0 ? stdin : fopen(payloadPath, "rb");
+        if (payloadFile != NULL && loadFile(payloadFile, payload) == 0)
+            payload->data = NULL;
+        if (payloadFile != NULL && payloadFile != stdin)
+            fclose(payloadFile);
     }
 
-    // open the output image (or create it if it doesn't exist yet),
-    // if the input image path is not valid exit with error code 2.
-    FILE* outimage = fopen(outputImagePath, "w");
+    return payload->data != NULL;
+}
+
+
+// this function compresses the text (for -z) and puts it in place of
+// the text if it got smaller, options then say that it is compressed.
+// noisy text is left as it is.
+// returns 1 if it could and 0 if there is not enough memory.
+static int compressPayload(MappedFile* payload, stego_options* options)
+{
+    double start = phaseStart();
+    size_t capacity = stego_compress_bound(payload->size);
+    BYTE* compressed = malloc(capacity);
+    size_t length = 0;
+    if (compressed == NULL || stego_compress(payload->data, payload->size, compressed, capacity, &length) != STEGO_OK)
+    {
+        free(compressed);
+        return 0;
+    }
+
+    if (length < payload->size)
+    {
+        unmapFile(payload);
+        *payload = (MappedFile) {compressed, length, -1, 0};
+        options->compressed = 1;
+    }
+    else
+        free(compressed);
+    phaseEnd("compress", start);
+
+    return 1;
+}
+
+
+// a cover image of writemessage --shards, the shard of the message that
+// goes in it and how storing it went (code is the exit code it gives,
+// 0 while nothing went wrong).
+typedef struct
+{
+    char* inputPath;
+    char outputPath[FILENAME_MAX];
+    FILE* inimage;
+    MappedFile image;
+    size_t capacity;
+    size_t offset;
+    size_t length;
+    stego_shard shard;
+    stego_layout layout;
+    int code;
+    int result;
+} ShardCover;
+
+// everything the shards share.
+typedef struct
+{
+    ShardCover* covers;
+    uint32_t count;
+    const stego_options* options;
+    BYTE* message;
+    int threadsPerShard;
+} ShardSet;
+
+
+// this function loads a cover image and works out how much of the
+// message fits in it.
+static void loadShardCover(void* context, long task, int worker)
+{
+    (void) worker;
+    ShardSet* set = context;
+    ShardCover* cover = &set->covers[task];
+
+    cover->inimage = fopen(cover->inputPath, "rb");
+    if (cover->inimage == NULL || loadFile(cover->inimage, &cover->image) == 0)
+    {
+        cover->code = 1;
+        return;
+    }
+
+    if (stego_type(cover->image.data, cover->image.size) == STEGO_UNSUPPORTED)
+    {
+        cover->code = 3;
+        return;
+    }
+
+    // the capacity is the same for every shard, only the header of the
+    // shard has to be left out of it.
+    stego_shard shard = {{0}, 0, 0, 0};
+    stego_options options = *set->options;
+    options.shard = &shard;
+    cover->capacity = stego_capacity(cover->image.data, cover->image.size, cover->image.size, &options);
+}
+
+
+// this function works out where the shard of a cover image goes in it,
+// so that no output image is created if any of the shards doesn't fit.
+static void planShard(void* context, long task, int worker)
+{
+    (void) worker;
+    ShardSet* set = context;
+    ShardCover* cover = &set->covers[task];
+
+    cover->shard.index = task;
+    cover->shard.count = set->count;
+    cover->shard.checksum = stego_checksum(set->message + cover->offset, cover->length);
+
+    stego_options options = *set->options;
+    options.shard = &cover->shard;
+    cover->result = stego_plan(cover->image.data, cover->image.size, cover->length, &options, &cover->layout);
+    if (cover->result != STEGO_OK)
+        cover->code = 5;
+}
+
+
+// this function writes the output image of a cover image with its
+// shard stored in it.
+static void writeShard(void* context, long task, int worker)
+{
+    (void) worker;
+    ShardSet* set = context;
+    ShardCover* cover = &set->covers[task];
+
+    FILE* outimage = fopen(cover->outputPath, "w+");
     if (outimage == NULL)
     {
-        printf("Could not create output image.\n");
-        return 2;
+        cover->code = 2;
+        return;
     }
 
-    // check if the file type is supported (only BMP, PNG or JPEG).
-    // if file type unsupported, exit with error code 3.
-    int fileType = checkFileType(inimage, outimage);
-    if (fileType == UNSUPPORTEDTYPE)
+    if (writeEmbeddedImage(&cover->image, &cover->layout, set->message + cover->offset, cover->length, outimage,
+                           set->threadsPerShard) == 0)
+        cover->code = 5;
+    fclose(outimage);
+}
+
+
+// this function returns the first cover image that failed (the covers
+// are checked in the order they were given so the error is always the
+// same), or NULL if none of them did.
+static ShardCover* firstFailed(ShardSet* set)
+{
+    for (uint32_t i = 0; i < set->count; i++)
     {
-        printf("Unsupported file type.\nSupported file types are BMP, JPG, PNG.\n");
-        return 3;
+        if (set->covers[i].code != 0)
+            return &set->covers[i];
     }
 
-    // input the text to be secretly stored in the output image.
-    char* hiddenText = get_string("Enter the text:\n");
-    if (hiddenText == NULL)
+    return NULL;
+}
+
+
+// this function does what writeMessage() does for --shards: the message
+// is split across all the cover images, every one of them gets a shard
+// of it in proportion to how much it can hold (see stego_split()), and
+// the output images go in the output directory with the same names as
+// the cover images. the covers are loaded and the shards are stored on
+// threadCount threads, a shard at a time per thread, a large bmp can
+// still be split into parts when there are more threads than shards.
+// a compressed or encrypted message is compressed and encrypted once,
+// before it is split.
+// returns the exit code.
+static int writeShards(char* directory, int coverCount, char* coverPaths[], char* payloadPath, int compress,
+                       char* passkey, stego_options* options, int threadCount)
+{
+    ShardSet set = {NULL, coverCount, options, NULL, 1};
+    set.covers = calloc(coverCount, sizeof(ShardCover));
+    if (set.covers == NULL)
     {
-        // the get_string() function can give back a NULL value
-        // if there is not enough space to store the text string
-        // in that case exit with error code 4.
-        printf("Something went wrong...\n");
+        fprintf(stderr, "Something went wrong...\n");
         return 4;
     }
-    // store the length of the text string in textlen.
-    int textlen = strlen(hiddenText);
 
-    // encrypt the inputted text using the provided passkey
-    if (argc == 4)
+    // the output images are named after the cover images, so two
+    // cover images with the same name would overwrite each other.
+    // exit with error code 2 then.
+    for (int i = 0; i < coverCount; i++)
+    {
+        ShardCover* cover = &set.covers[i];
+        cover->inputPath = coverPaths[i];
+        char* name = strrchr(coverPaths[i], '/');
+        name = name != NULL ? name + 1 : coverPaths[i];
+        size_t length = snprintf(cover->outputPath, FILENAME_MAX, "%s/%s", directory, name);
+        if (length >= FILENAME_MAX || *name == '\0')
+        {
+            fprintf(stderr, "Could not create output image: %s\n", cover->outputPath);
+            free(set.covers);
+            return 2;
+        }
+
+        for (int j = 0; j < i; j++)
+        {
+            if (strcmp(set.covers[j].outputPath, cover->outputPath) == 0)
+            {
+                fprintf(stderr, "%s and %s have the same name.\n", set.covers[j].inputPath, cover->inputPath);
+                free(set.covers);
+                return 2;
+            }
+        }
+    }
+
+    // load the cover images and work out how much fits in each.
+    double start = phaseStart();
+    runTasks(coverCount, threadCount, loadShardCover, &set);
+    phaseEnd("load", start);
+
+    int code = 0;
+    ShardCover* failed = firstFailed(&set);
+    if (failed != NULL)
     {
-        encrypt(hiddenText, passkey);
+        // exit with error code 1 if a cover image can't be opened and
+        // 3 if its type is not supported.
+        if (failed->code == 1)
+            fprintf(stderr, "Invalid input image path: %s\n", failed->inputPath);
+        else
+            fprintf(stderr, "%s\n", stego_error(STEGO_UNSUPPORTED));
+        code = failed->code;
     }
 
-    // variable to keep track if the message has been stored.
-    // 0 -> false (message not stored).
-    // 1 -> true (message stored).
-    int messageStored = 0;
+    // the text to be secretly stored, compressed and encrypted as a
+    // whole.
+    MappedFile payload = {NULL, 0, -1, 0};
+    stego_crypto crypto;
+    if (code == 0)
+    {
+        start = phaseStart();
+        if (readPayload(payloadPath, &payload) == 0)
+        {
+            fprintf(stderr, "Something went wrong...\n");
+            code = 4;
+        }
+        phaseEnd("payload", start);
+    }
 
-    // execute operations according to file type.
+    if (code == 0 && compress && compressPayload(&payload, options) == 0)
+    {
+        fprintf(stderr, "Something went wrong...\n");
+        code = 4;
+    }
 
-    // operations to be done if image type is BMP:
-    if (fileType == BMP)
+    if (code == 0 && passkey != NULL)
     {
-        // copyHeaderForBMP() copies the header to the output image and
-        // returns the value of where the pixel array, i.e, all the RGB
-        // values of the image starts.
-        int pixelArrayOffset = copyHeaderForBMP(inimage, outimage);
+        start = phaseStart();
+        int result = stego_encrypt(payload.data, payload.size, passkey, &crypto);
+        phaseEnd("encrypt", start);
+        if (result != STEGO_OK)
+        {
+            fprintf(stderr, "%s\n", stego_error(result));
+            code = 5;
+        }
+        options->crypto = &crypto;
+    }
 
-        // copy all data from input to output image till the pixel array starts.
-        // i.e, copy all the metadata into the output image.
-        readNWriteFor(pixelArrayOffset - BITMAPHEADERSIZE, inimage, outimage);
+    // split the message and work out where every shard goes.
+    if (code == 0)
+    {
+        start = phaseStart();
+        size_t* capacities = malloc(sizeof(size_t) * coverCount);
+        size_t* lengths = malloc(sizeof(size_t) * coverCount);
+        stego_shard shard;
+        int result = STEGO_NOMEMORY;
+        if (capacities != NULL && lengths != NULL)
+        {
+            for (int i = 0; i < coverCount; i++)
+                capacities[i] = set.covers[i].capacity;
+            result = stego_split(capacities, coverCount, payload.size, lengths, shard.id);
+        }
 
-        // a buffer (memory to store temporary data) to store one 8 BYTEs of data.
-        BYTE buffer[BYTESIZE];
+        size_t offset = 0;
+        for (int i = 0; i < coverCount && result == STEGO_OK; i++)
+        {
+            memcpy(set.covers[i].shard.id, shard.id, STEGO_SHARDIDSIZE);
+            set.covers[i].offset = offset;
+            set.covers[i].length = lengths[i];
+            offset += lengths[i];
+        }
+        free(capacities);
+        free(lengths);
 
-        // index to keep track of how much (or how many characters) of the
-        // inputted text string has been stored in the image.
-        int index = 0;
+        set.message = payload.data;
+        if (result == STEGO_OK)
+            runTasks(coverCount, threadCount, planShard, &set);
+        phaseEnd("plan", start);
 
-        // keep reading data into buffer from the input image until the end of
-        // file (or until the message is being stored).
-        while (fread(buffer, 1, BYTESIZE, inimage) != 0)
+        failed = firstFailed(&set);
+        if (result != STEGO_OK || failed != NULL)
         {
-            // if the index has reached the end of the inputted text
-            // i.e index is equal to the text length then store a
-            // special sequence of bytes (0000 0000) to indicate that
-            // it is the end of the secret string.
-            // this is needed so that the program knows when the complete
-            // text has been read while reading it.
-            if (index >= textlen)
+            fprintf(stderr, "%s\n", stego_error(result != STEGO_OK ? result : failed->result));
+            code = 5;
+        }
+    }
+
+    // write the output images, the threads that are left over go to
+    // the parts of the shards.
+    if (code == 0)
+    {
+        set.threadsPerShard = threadCount / coverCount > 1 ? threadCount / coverCount : 1;
+        runTasks(coverCount, threadCount, writeShard, &set);
+
+        failed = firstFailed(&set);
+        if (failed != NULL && failed->code == 2)
+            fprintf(stderr, "Could not create output image: %s\n", failed->outputPath);
+        code = failed != NULL ? failed->code : 0;
+    }
+
+    // Close all opened files and free all the data allocated for the
+    // hidden text to prevent memory leaks.
+    start = phaseStart();
+    for (int i = 0; i < coverCount; i++)
+    {
+        if (set.covers[i].inimage != NULL)
+        {
+            if (set.covers[i].code != 1)
+                unmapFile(&set.covers[i].image);
+            fclose(set.covers[i].inimage);
+        }
+    }
+    unmapFile(&payload);
+    free(set.covers);
+    phaseEnd("close", start);
+
+    if (code == 5)
+        fprintf(stderr, "Could not store message.\n");
+    else if (code == 0)
+        fprintf(stderr, "Message successfully stored in %d shards.\n", coverCount);
+    return code;
+}
+
+
+// this function writes the output image (or the input image itself
+// for inPlace) of writemessage --record: the payload becomes the record
+// with the given name of the container stored in the image. if the
+// image holds a container already, the record and the table of contents
+// are written over the bytes they take (see patchMessageBytes()) in a
+// copy of the image, so the other records stay as they are, unless the
+// container is in the pixels of a png or jpg, which is stored again
+// with the new record. an image without a container gets a new one
+// stored the way the options say.
+// returns the exit code.
+static int writeRecord(MappedFile* image, char* inputPath, char* outputPath, char* name, MappedFile* payload,
+                       stego_options* options, int inPlace, int sync, int threadCount)
+{
+    double start = phaseStart();
+    stego_toc toc;
+    stego_header header = {0};
+    int result = stego_read_toc(image->data, image->size, &toc);
+    if (result == STEGO_NORECORDS || result == STEGO_NOMESSAGE)
+        stego_new_toc(&toc);
+    else if (result != STEGO_OK)
+    {
+        fprintf(stderr, "%s\n", stego_error(result));
+        return 5;
+    }
+    int found = result == STEGO_OK;
+    if (found)
+        stego_read_header(image->data, image->size, &header);
+
+    int index;
+    result = stego_put_record(&toc, name, payload->data, payload->size, &index);
+    if (result == STEGO_BADOPTIONS)
+        fprintf(stderr, "Record names are 1 - %d characters long.\n", STEGO_NAMESIZE - 1);
+    else if (result != STEGO_OK)
+        fprintf(stderr, "%s\n", stego_error(result));
+    if (result != STEGO_OK)
+        return 5;
+
+    BYTE tocBytes[STEGO_TOCSIZE];
+    stego_write_toc(&toc, tocBytes);
+    size_t offset = toc.records[index].offset;
+
+    // the record and then the table of contents, so that the table is
+    // written after any bytes of it the patch of the record takes in.
+    stego_update updates[2];
+    int patchable = found && image->isMapped && !(header.flags & STEGO_PIXELS);
+    if (patchable)
+    {
+        result = stego_plan_update(image->data, image->size, toc.length, offset, payload->size, &updates[0]);
+        if (result == STEGO_OK)
+            result = stego_plan_update(image->data, image->size, toc.length, 0, STEGO_TOCSIZE, &updates[1]);
+        phaseEnd("plan", start);
+        if (result != STEGO_OK)
+        {
+            fprintf(stderr, "%s\n", stego_error(result));
+            return 5;
+        }
+
+        const BYTE* bytes[2] = {payload->data, tocBytes};
+        int stored;
+        if (inPlace && !sync)
+        {
+            int fd = open(inputPath, O_WRONLY);
+            if (fd < 0)
             {
-                editBufferToStoreChar(buffer, 0);
-                // set messageStored to true (1).
-                messageStored = 1;
+                fprintf(stderr, "Could not open image for writing.\n");
+                return 2;
             }
 
-            // if message has not been stored, i.e,
-            // messageStored -> false (0), then continue to add
-            // characters from the input text to the image.
-            if (messageStored == 0)
+            stored = patchMessageBytes(image, updates, bytes, 2, fd);
+            stored = close(fd) == 0 && stored;
+        }
+        else
+        {
+            OutputFile out;
+            if (openOutputFile(outputPath, sync || inPlace, &out) == 0)
             {
-                // put the character of the text at the current index in ch.
-                int ch = hiddenText[index];
-
-                // edits the buffer (8 bits of data read from the input image)
-                // to store the current character from the string.
-                editBufferToStoreChar(buffer, ch);
-                index++;
+                fprintf(stderr, "Could not create output image.\n");
+                return 2;
             }
 
-            // write the modified data (buffer) from the input image into
-            // the output image.
-            fwrite(buffer, 1, BYTESIZE, outimage);
+            stored = cloneFile(image->fd, fileno(out.file), image->size)
+                     && patchMessageBytes(image, updates, bytes, 2, fileno(out.file));
+            stored = closeOutputFile(&out, stored);
         }
-        // end of operations for bmp file.
+
+        return stored ? 0 : 5;
+    }
+
+    // the whole container is put together and stored: the one that is
+    // stored already (it never gets shorter), the new record and the
+    // table of contents.
+    BYTE* container = calloc(toc.length, 1);
+    if (container == NULL)
+    {
+        fprintf(stderr, "Something went wrong...\n");
+        return 4;
+    }
+    size_t length;
+    if (found)
+        result = stego_extract(image->data, image->size, container, toc.length, &length);
+    memcpy(container, tocBytes, STEGO_TOCSIZE);
+    memcpy(container + offset, payload->data, payload->size);
+
+    // the container keeps the depth and channels it had.
+    stego_layout layout;
+    options->container = 1;
+    if (found)
+    {
+        options->depth = header.depth;
+        options->channels = header.channels;
+        options->pixels = (header.flags & STEGO_PIXELS) != 0;
+    }
+    if (result == STEGO_OK)
+        result = stego_plan(image->data, image->size, toc.length, options, &layout);
+    phaseEnd("plan", start);
+    if (result != STEGO_OK)
+    {
+        fprintf(stderr, "%s\n", stego_error(result));
+        free(container);
+        return 5;
+    }
+
+    OutputFile out;
+    if (openOutputFile(outputPath, sync || inPlace, &out) == 0)
+    {
+        fprintf(stderr, "Could not create output image.\n");
+        free(container);
+        return 2;
     }
-    // operations to be done if image type is JPG:
-    else if (fileType == JPG)
+    int stored = writeEmbeddedImage(image, &layout, container, toc.length, out.file, threadCount);
+    stored = closeOutputFile(&out, stored);
+    free(container);
+
+    return stored ? 0 : 5;
+}
+
+
+// this function does everything, main() only prints the statistics
+// afterwards. returns the exit code.
+// argc is the number of command line arguments given.
+// argv is an array of strings containing all the arguments.
+static int writeMessage(int argc, char* argv[])
+{
+    // the message is typed in, unless a payload file is given with
+    // -i (- for stdin), which can have any bytes in it.
+    // in a bmp the message takes 1 bit of every color sample (alpha
+    // is left alone), unless -b gives the number of bits (1 - 4) and
+    // -c the channels to use (some of the letters r, g, b and a).
+    // -p stores the message in the pixels of a png the same way, or
+    // in the DCT coefficients of a jpg (1 bit each, -b and -c can't be
+    // given then, nor when the message is appended to a jpg or png).
+    // -z compresses the message first (LZ4, see compression.c), so
+    // that it takes fewer bytes of the image. it is left as it is if
+    // it doesn't get smaller.
+    // a large bmp is split into parts that are done by as many threads
+    // as there are cores, unless -j gives the number of threads.
+    // --stats prints how long every phase took and how much I/O was
+    // done (see stats.c).
+    // --shards splits the message across all the input images that are
+    // given and writes the output images to the given directory (see
+    // writeShards()). the passkey is given with -k then (it can be
+    // given that way without --shards too).
+    // --in-place stores the message in the input image itself (there
+    // is no output image path then), only the bytes that change are
+    // written. --clone makes the output image a clone of the input
+    // image first (a reflink where the filesystem can, see cloneFile())
+    // and only writes the message into it. --sync writes the output
+    // image to a temporary file and renames it over the output image
+    // once it is on the disk, so a crash never leaves it half written.
+    // --record stores the message as the record with the given name of
+    // the container in the image (see writeRecord()), it can't be
+    // compressed or encrypted then (every record is read on its own).
+    // -b, -c and -p only matter for an image that has no container
+    // yet.
+    static const struct option longOptions[] = {{"stats", no_argument, NULL, 's'},
+                                                {"shards", required_argument, NULL, 'S'},
+                                                {"in-place", no_argument, NULL, 'I'},
+                                                {"clone", no_argument, NULL, 'C'},
+                                                {"sync", no_argument, NULL, 'Y'},
+                                                {"record", required_argument, NULL, 'R'},
+                                                {NULL, 0, NULL, 0}};
+    char* payloadPath = NULL;
+    char* shardDirectory = NULL;
+    char* passkey = NULL;
+    char* recordName = NULL;
+    int compress = 0;
+    int inPlace = 0;
+    int clone = 0;
+    int sync = 0;
+    stego_options options = {1, STEGO_COLORCHANNELS, NULL, 0, NULL, 0, 0};
+    int threadCount = numberOfCores();
+    int option;
+    while ((option = getopt_long(argc, argv, "i:b:c:j:k:pz", longOptions, NULL)) != -1)
     {
-        // copies all the data from the input image to output image
-        // up to (but not including) the end of file sequence.
-        readNWriteFor(-1, inimage, outimage);
+        if (option == 's')
+            enableStats();
+        else if (option == 'S')
+            shardDirectory = optarg;
+        else if (option == 'I')
+            inPlace = 1;
+        else if (option == 'C')
+            clone = 1;
+        else if (option == 'Y')
+            sync = 1;
+        else if (option == 'R')
+            recordName = optarg;
+        else if (option == 'k')
+            passkey = optarg;
+        else if (option == 'i')
+            payloadPath = optarg;
+        else if (option == 'j')
+            threadCount = atoi(optarg);
+        else if (option == 'b')
+            options.depth = atoi(optarg);
+        else if (option == 'c')
+            options.channels = channelsOf(optarg);
+        else if (option == 'p')
+            options.pixels = 1;
+        else if (option == 'z')
+            compress = 1;
+        else
+            argc = 0;
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
 
-        // The two bytes in a JPG file that signify the end of file.
-        BYTE EOFSequence[] = {0xFF, 0xD9};
+    if (shardDirectory != NULL && argc >= 2 && !inPlace && !clone && !sync)
+        return writeShards(shardDirectory, argc - 1, argv + 1, payloadPath, compress, passkey, &options,
+                           threadCount);
 
-        // write the end of file sequence into the output image.
-        fwrite(EOFSequence, 2, 1, outimage);
+    // if the number of arguments is not 3, i.e, ONLY an input image
+    // AND ONLY an output image path is not provided (or only the image
+    // for --in-place), exit the program with an error code -1.
+    int paths = inPlace ? 1 : 2;
+    if (shardDirectory != NULL || (inPlace && clone)
+        || (argc != 1 + paths && (argc != 2 + paths || passkey != NULL))
+        || (recordName != NULL && (compress || passkey != NULL || argc != 1 + paths)))
+    {
+        fprintf(stderr, "Incorrect usage.\nCorrect usage: ./writemessage (optional)-i <payloadfile> (optional)-b <bits> (optional)-c <channels> (optional)-p (optional)-z (optional)-j <threads> (optional)--clone (optional)--sync (optional)--stats <inputimagepath> <outputimagepath> (optional)<passkey>\n"
+                        "or: ./writemessage --in-place (optional)--sync (same options) <imagepath> (optional)<passkey>\n"
+                        "or: ./writemessage --shards <outputdirectory> (optional)-k <passkey> (same options) <inputimagepath>...\n"
+                        "or: ./writemessage --record <name> (same options, without -z) <inputimagepath> <outputimagepath> (or --in-place <imagepath>)\n");
+        return -1;
+    }
 
-        // write the inputted text into the output image after
-        // the end of file bytes.
-        fwrite(hiddenText, textlen, 1, outimage);
+    // store the input image and output image paths and passkey
+    // in their own separate strings.
+    char* inputImagePath = argv[1];
+    char* outputImagePath = inPlace ? argv[1] : argv[2];
+    if (argc == 2 + paths)
+        passkey = argv[1 + paths];
 
-        // message has been stored.
-        messageStored = 1;
+    // open the input image, if the input image path is
+    // not valid exit with error code 1.
+    double start = phaseStart();
+    FILE* inimage = fopen(inputImagePath, "rb");
+    if (inimage == NULL)
+    {
+        fprintf(stderr, "Invalid input image path.\n");
+        return 1;
+    }
 
-        // end of operations for jpg file.
+    // bring the input image into memory (it is mapped if it is a
+    // regular file).
+    MappedFile image;
+    if (loadFile(inimage, &image) == 0)
+    {
+        fprintf(stderr, "Invalid input image path.\n");
+        return 1;
     }
-    // operations to be done if image type is PNG:
-    else if (fileType == PNG)
+    phaseEnd("load", start);
+
+    // check if the file type is supported (only BMP, PNG or JPEG).
+    // if file type unsupported, exit with error code 3.
+    if (stego_type(image.data, image.size) == STEGO_UNSUPPORTED)
     {
-        // a buffer to store ONE BYTE.
-        BYTE buffer[1];
+        fprintf(stderr, "%s\n", stego_error(STEGO_UNSUPPORTED));
+        return 3;
+    }
 
-        // this is the sequence of bytes that signify the end of file in
-        // a PNG file.
-        int EOFSequence[] = {0x49, 0x45, 0x4E, 0x44, 0xAE, 0x42, 0x60, 0x82};
+    // the text to be secretly stored in the output image.
+    MappedFile payload;
+    start = phaseStart();
+    if (readPayload(payloadPath, &payload) == 0)
+    {
+        // the text can't be read if there is not enough space to
+        // store it or the payload file can't be opened, in that case
+        // exit with error code 4.
+        fprintf(stderr, "Something went wrong...\n");
+        return 4;
+    }
+    phaseEnd("payload", start);
 
-        // number of bytes in the EOF sequence is 8.
-        int EOFSequenceLen = 8;
+    // with --record the text is a record of the container in the image.
+    if (recordName != NULL)
+    {
+        int code = writeRecord(&image, inputImagePath, outputImagePath, recordName, &payload, &options, inPlace,
+                               sync, threadCount);
+        start = phaseStart();
+        unmapFile(&image);
+        unmapFile(&payload);
+        fclose(inimage);
+        phaseEnd("close", start);
+
+        if (code == 5)
+            fprintf(stderr, "Could not store message.\n");
+        else if (code == 0)
+            fprintf(stderr, "Record %s successfully stored.\n", recordName);
+        return code;
+    }
 
-        // index to keep track of the byte in the EOF sequence that has been
-        // found in the file.
-        int index = 0;
+    // compress the text first if it is asked for. the header says that
+    // it is compressed, so readmessage decompresses it again.
+    if (compress && compressPayload(&payload, &options) == 0)
+    {
+        fprintf(stderr, "Something went wrong...\n");
+        return 4;
+    }
 
-        // keep reading the input file until there is nothing to read
-        // (until the EOF sequence is reached).
-        while (fread(buffer, 1, 1, inimage) != 0)
+    // encrypt the inputted text using the provided passkey. what is
+    // needed to decrypt it again (except the passkey) is stored in the
+    // header of the message. if it can't be encrypted exit with error
+    // code 5.
+    stego_crypto crypto;
+    if (passkey != NULL)
+    {
+        start = phaseStart();
+        int result = stego_encrypt(payload.data, payload.size, passkey, &crypto);
+        phaseEnd("encrypt", start);
+        if (result != STEGO_OK)
         {
-            // write whatever byte was read into the output image.
-            fwrite(buffer, 1, 1, outimage);
-
-            // if the current byte is following the EOF sequence
-            // increment the index to check for the next byte in the
-            // sequence in the next iteration.
-            if (buffer[0] == EOFSequence[index])
-                index++;
-            // if the current byte doesn't follow the EOF sequence set
-            // the index back to the first byte of the EOF sequence.
-            else
-                index = 0;
-
-            // if the index has reached the end of the EOF sequence, then
-            // exit the loop to store the text.
-            if (index >= EOFSequenceLen)
-                break;
+            fprintf(stderr, "%s\nCould not store message.\n", stego_error(result));
+            return 5;
         }
+        options.crypto = &crypto;
+    }
+
+    // work out where the text goes in the output image. this only
+    // needs the headers of the image, so if the text doesn't fit the
+    // output image is never created.
+    stego_layout layout;
+    start = phaseStart();
+    int result = stego_plan(image.data, image.size, payload.size, &options, &layout);
+    phaseEnd("plan", start);
+    if (result != STEGO_OK)
+    {
+        fprintf(stderr, "%s\nCould not store message.\n", stego_error(result));
+        return 5;
+    }
 
-        // check if the EOF sequence has indeed been read.
-        if (index >= 8)
+    // with --in-place only the bytes of the message are written into
+    // the input image, unless the whole image changes (the message
+    // goes in the pixels of a png or jpg) or --sync asks for the image
+    // to be replaced at once. if the input image can't be opened for
+    // writing exit with error code 2.
+    int messageStored;
+    int patchable = image.isMapped && !(layout.flags & STEGO_PIXELS);
+    if (inPlace && !sync && patchable)
+    {
+        int fd = open(inputImagePath, O_WRONLY);
+        if (fd < 0)
         {
-            // write the inputted text into the output image after
-            // the end of file bytes.
-            fwrite(hiddenText, textlen, 1, outimage);
+            fprintf(stderr, "Could not open image for writing.\n");
+            return 2;
+        }
 
-            // message has been stored.
-            messageStored = 1;
+        messageStored = patchEmbeddedImage(&image, &layout, payload.data, payload.size, fd, threadCount);
+        messageStored = close(fd) == 0 && messageStored;
+    }
+    else
+    {
+        // open the output image (or create it if it doesn't exist
+        // yet), if the output image path is not valid exit with error
+        // code 2. the output is opened for reading too so that it can
+        // be mapped into memory. with --sync (and for --in-place) a
+        // temporary file is written and renamed over it at the end.
+        OutputFile out;
+        if (openOutputFile(outputImagePath, sync || inPlace, &out) == 0)
+        {
+            fprintf(stderr, "Could not create output image.\n");
+            return 2;
         }
-        // end of operations for png file.
+
+        // write the output image (the copy and embed phases are timed
+        // inside). with --clone (and for --in-place) it starts as a
+        // clone of the input image that only the message is written
+        // into.
+        if ((clone || inPlace) && patchable)
+            messageStored = cloneFile(image.fd, fileno(out.file), image.size)
+                            && patchEmbeddedImage(&image, &layout, payload.data, payload.size, fileno(out.file),
+                                                  threadCount);
+        else
+            messageStored = writeEmbeddedImage(&image, &layout, payload.data, payload.size, out.file, threadCount);
+        messageStored = closeOutputFile(&out, messageStored);
     }
 
     // Close all opened files and free all the data allocated for the
-    // hidden text string to prevent memory leaks.
+    // hidden text to prevent memory leaks.
+    start = phaseStart();
+    unmapFile(&image);
+    unmapFile(&payload);
     fclose(inimage);
-    fclose(outimage);
-    free(hiddenText);
+    phaseEnd("close", start);
 
     // print the appropriate message after all operations have finished.
     if (messageStored == 0)
     {
         // exit with error code 5 if message was not stored.
-        printf("Could not store message.\n");
+        fprintf(stderr, "Could not store message.\n");
         return 5;
     }
     else
     {
         // exit with code 0 (signifying success) if message was stored.
-        printf("Message successfully stored.\n");
+        fprintf(stderr, "Message successfully stored.\n");
         return 0;
     }
 }
 
 
+int main(int argc, char* argv[])
+{
+    int code = writeMessage(argc, argv);
+    printStats("writemessage", code);
+    return code;
+}